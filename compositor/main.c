@@ -64,6 +64,7 @@
 #include "compositor-x11.h"
 #include "compositor-wayland.h"
 #include "windowed-output-api.h"
+#include "presentation-time-server-protocol.h"
 
 #define WINDOW_TITLE "Weston Compositor"
 
@@ -79,6 +80,7 @@ struct wet_compositor {
 	struct wet_output_config *parsed_options;
 	struct wl_listener pending_output_listener;
 	bool drm_use_current_mode;
+	struct weston_headless_output_timing headless_timing;
 };
 
 static FILE *weston_logfile = NULL;
@@ -585,6 +587,12 @@ usage(int error_code)
 		"\tnormal 90 180 270 flipped flipped-90 flipped-180 flipped-270\n"
 		"  --use-pixman\t\tUse the pixman (CPU) renderer (default: no rendering)\n"
 		"  --no-outputs\t\tDo not create any virtual outputs\n"
+		"  --refresh-rate=HZ\tThe refresh rate of the outputs, 60 by default\n"
+		"  --min-refresh-rate=HZ\tEmulate variable refresh down to HZ\n"
+		"  --frame-jitter=USEC\tDelay frame completions by up to USEC\n"
+		"  --presentation-flags=F\tComma separated presentation flags:\n"
+		"\tvsync hw-clock hw-completion\n"
+		"  --unthrottled\t\tComplete frames as soon as they are repainted\n"
 		"\n");
 #endif
 
@@ -884,6 +892,10 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
 	int repaint_msec;
+	int occluded_frame_msec;
+	int adaptive_repaint;
+	int latency_log_interval;
+	int renderer_threads;
 	int vt_switching;
 
 	s = weston_config_get_section(config, "keyboard", NULL, NULL);
@@ -922,6 +934,46 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_bool(s, "adaptive-repaint-window",
+				       &adaptive_repaint, 0);
+	ec->adaptive_repaint = adaptive_repaint;
+	if (ec->adaptive_repaint)
+		weston_log("Output repaint window adapts to the repaint "
+			   "time.\n");
+
+	weston_config_section_get_int(s, "latency-log-interval",
+				      &latency_log_interval, 0);
+	if (latency_log_interval < 0 ||
+	    latency_log_interval > INT32_MAX / 1000) {
+		weston_log("Invalid latency-log-interval value in config: "
+			   "%d\n", latency_log_interval);
+	} else if (latency_log_interval > 0 &&
+		   weston_compositor_set_latency_log_interval(ec,
+				(uint32_t) latency_log_interval * 1000) < 0) {
+		weston_log("Failed to set up the latency log timer.\n");
+	}
+
+	weston_config_section_get_int(s, "occluded-frame-interval",
+				      &occluded_frame_msec, 0);
+	if (occluded_frame_msec < 0 || occluded_frame_msec > 60000) {
+		weston_log("Invalid occluded-frame-interval value in config: "
+			   "%d\n", occluded_frame_msec);
+	} else {
+		ec->occluded_frame_msec = occluded_frame_msec;
+	}
+	if (ec->occluded_frame_msec)
+		weston_log("Frame callbacks of occluded surfaces are sent "
+			   "every %u ms at most.\n", ec->occluded_frame_msec);
+
+	weston_config_section_get_int(s, "renderer-threads",
+				      &renderer_threads, 1);
+	if (renderer_threads < 1 || renderer_threads > 64) {
+		weston_log("Invalid renderer-threads value in config: %d\n",
+			   renderer_threads);
+	} else {
+		ec->renderer_threads = renderer_threads;
+	}
+
 	return 0;
 }
 
@@ -1216,6 +1268,7 @@ load_drm_backend(struct weston_compositor *c,
 	struct weston_drm_backend_config config = {{ 0, }};
 	struct weston_config_section *section;
 	struct wet_compositor *wet = to_wet_compositor(c);
+	int pixman_direct;
 	int ret = 0;
 
 	wet->drm_use_current_mode = false;
@@ -1235,6 +1288,9 @@ load_drm_backend(struct weston_compositor *c,
 					 NULL);
 	weston_config_section_get_uint(section, "pageflip-timeout",
 	                               &config.pageflip_timeout, 0);
+	weston_config_section_get_bool(section, "pixman-direct",
+				       &pixman_direct, 0);
+	config.pixman_direct = pixman_direct;
 
 	config.base.struct_version = WESTON_DRM_BACKEND_CONFIG_VERSION;
 	config.base.struct_size = sizeof(struct weston_drm_backend_config);
@@ -1251,6 +1307,146 @@ load_drm_backend(struct weston_compositor *c,
 	return ret;
 }
 
+/* A refresh rate in Hz, with decimals, into mHz */
+static int
+parse_refresh_rate(const char *str, int32_t *refresh)
+{
+	char *end;
+	double hz;
+
+	errno = 0;
+	hz = strtod(str, &end);
+	if (errno != 0 || end == str || *end != '\0' ||
+	    hz < 0.0 || hz > 1000000.0)
+		return -1;
+
+	*refresh = hz * 1000.0 + 0.5;
+
+	return 0;
+}
+
+/* A comma separated list of presentation feedback flags */
+static int
+parse_presentation_flags(const char *str, uint32_t *flags)
+{
+	static const struct {
+		const char *name;
+		uint32_t flag;
+	} names[] = {
+		{ "vsync", WP_PRESENTATION_FEEDBACK_KIND_VSYNC },
+		{ "hw-clock", WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK },
+		{ "hw-completion", WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION },
+	};
+	char *copy, *name, *saveptr;
+	unsigned int i;
+	int ret = 0;
+
+	copy = strdup(str);
+	if (!copy)
+		return -1;
+
+	*flags = 0;
+	for (name = strtok_r(copy, ",", &saveptr); name;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		for (i = 0; i < ARRAY_LENGTH(names); i++) {
+			if (strcmp(name, names[i].name) == 0)
+				break;
+		}
+
+		if (i == ARRAY_LENGTH(names)) {
+			ret = -1;
+			break;
+		}
+		*flags |= names[i].flag;
+	}
+
+	free(copy);
+
+	return ret;
+}
+
+static int
+parse_headless_timing(struct weston_headless_output_timing *timing,
+		      const char *refresh_rate, const char *min_refresh_rate,
+		      const char *presentation_flags)
+{
+	if (refresh_rate &&
+	    parse_refresh_rate(refresh_rate, &timing->refresh) < 0) {
+		weston_log("Invalid refresh rate \"%s\"\n", refresh_rate);
+		return -1;
+	}
+
+	if (min_refresh_rate &&
+	    parse_refresh_rate(min_refresh_rate, &timing->min_refresh) < 0) {
+		weston_log("Invalid minimum refresh rate \"%s\"\n",
+			   min_refresh_rate);
+		return -1;
+	}
+
+	if (presentation_flags &&
+	    parse_presentation_flags(presentation_flags,
+				     &timing->presented_flags) < 0) {
+		weston_log("Invalid presentation flags \"%s\"\n",
+			   presentation_flags);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+headless_output_configure_timing(struct weston_output *output)
+{
+	const struct weston_headless_output_api *api =
+		weston_headless_output_get_api(output->compositor);
+	struct wet_compositor *compositor = to_wet_compositor(output->compositor);
+	struct weston_config *wc = wet_get_config(output->compositor);
+	struct weston_config_section *section;
+	struct weston_headless_output_timing timing =
+		compositor->headless_timing;
+	char *refresh_rate, *min_refresh_rate, *presentation_flags;
+	int jitter, unthrottled;
+	int ret;
+
+	section = weston_config_get_section(wc, "output", "name", output->name);
+	if (!section)
+		return 0;
+
+	if (!api) {
+		weston_log("Cannot use weston_headless_output_api.\n");
+		return -1;
+	}
+
+	weston_config_section_get_string(section, "refresh-rate",
+					 &refresh_rate, NULL);
+	weston_config_section_get_string(section, "min-refresh-rate",
+					 &min_refresh_rate, NULL);
+	weston_config_section_get_string(section, "presentation-flags",
+					 &presentation_flags, NULL);
+	weston_config_section_get_int(section, "frame-jitter", &jitter,
+				      timing.jitter_usec);
+	weston_config_section_get_bool(section, "unthrottled", &unthrottled,
+				       timing.unthrottled);
+
+	ret = parse_headless_timing(&timing, refresh_rate, min_refresh_rate,
+				    presentation_flags);
+	free(refresh_rate);
+	free(min_refresh_rate);
+	free(presentation_flags);
+	if (ret < 0)
+		return -1;
+
+	if (jitter < 0) {
+		weston_log("Invalid frame-jitter value in config: %d\n",
+			   jitter);
+		return -1;
+	}
+	timing.jitter_usec = jitter;
+	timing.unthrottled = unthrottled;
+
+	return api->set_timing(output, &timing);
+}
+
 static void
 headless_backend_output_configure(struct wl_listener *listener, void *data)
 {
@@ -1262,6 +1458,10 @@ headless_backend_output_configure(struct wl_listener *listener, void *data)
 		.transform = WL_OUTPUT_TRANSFORM_NORMAL
 	};
 
+	if (headless_output_configure_timing(output) < 0)
+		weston_log("Cannot configure the timing of output \"%s\".\n",
+			   output->name);
+
 	if (wet_configure_windowed_output_from_config(output, &defaults) < 0)
 		weston_log("Cannot configure output \"%s\".\n", output->name);
 }
@@ -1272,9 +1472,13 @@ load_headless_backend(struct weston_compositor *c,
 {
 	const struct weston_windowed_output_api *api;
 	struct weston_headless_backend_config config = {{ 0, }};
+	struct wet_compositor *wet = to_wet_compositor(c);
 	int no_outputs = 0;
 	int ret = 0;
 	char *transform = NULL;
+	char *refresh_rate = NULL, *min_refresh_rate = NULL;
+	char *presentation_flags = NULL;
+	int jitter = 0, unthrottled = 0;
 
 	struct wet_output_config *parsed_options = wet_init_parsed_options(c);
 	if (!parsed_options)
@@ -1286,10 +1490,31 @@ load_headless_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &config.use_pixman },
 		{ WESTON_OPTION_STRING, "transform", 0, &transform },
 		{ WESTON_OPTION_BOOLEAN, "no-outputs", 0, &no_outputs },
+		{ WESTON_OPTION_STRING, "refresh-rate", 0, &refresh_rate },
+		{ WESTON_OPTION_STRING, "min-refresh-rate", 0, &min_refresh_rate },
+		{ WESTON_OPTION_INTEGER, "frame-jitter", 0, &jitter },
+		{ WESTON_OPTION_STRING, "presentation-flags", 0, &presentation_flags },
+		{ WESTON_OPTION_BOOLEAN, "unthrottled", 0, &unthrottled },
 	};
 
 	parse_options(options, ARRAY_LENGTH(options), argc, argv);
 
+	ret = parse_headless_timing(&config.timing, refresh_rate,
+				    min_refresh_rate, presentation_flags);
+	free(refresh_rate);
+	free(min_refresh_rate);
+	free(presentation_flags);
+	if (ret < 0)
+		return -1;
+
+	if (jitter < 0) {
+		weston_log("Invalid frame jitter %d\n", jitter);
+		return -1;
+	}
+	config.timing.jitter_usec = jitter;
+	config.timing.unthrottled = unthrottled;
+	wet->headless_timing = config.timing;
+
 	if (transform) {
 		if (weston_parse_transform(transform, &parsed_options->transform) < 0) {
 			weston_log("Invalid transform \"%s\"\n", transform);
@@ -44,6 +44,7 @@
 #include "weston.h"
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
+#include "shared/pixel-copy.h"
 #include "fullscreen-shell-unstable-v1-client-protocol.h"
 
 struct shared_output {
@@ -76,8 +77,25 @@ struct shared_output {
 
 	int cache_dirty;
 	pixman_image_t *cache_image;
-	uint32_t *tmp_data;
-	size_t tmp_data_size;
+
+	/* struct ss_read_back::link, oldest first */
+	struct wl_list read_backs;
+};
+
+/* The damage of one repaint, read back from the renderer
+ * asynchronously and copied into the cache once all of it is in */
+struct ss_read_back {
+	struct shared_output *output;	/* NULL once it is destroyed */
+	struct wl_list link;
+
+	int32_t width, height;		/* of the cache it is meant for */
+	int do_yflip;
+	pixman_box32_t rects[16];
+	int nrects;
+	uint32_t *data;			/* the rectangles one after another */
+
+	int pending;
+	int failed;
 };
 
 struct ss_seat {
@@ -555,42 +573,6 @@ output_compute_transform(struct weston_output *output,
 static void
 shared_output_destroy(struct shared_output *so);
 
-static int
-shared_output_ensure_tmp_data(struct shared_output *so,
-			      pixman_region32_t *region)
-{
-	pixman_box32_t *ext;
-	size_t size;
-
-	if (!pixman_region32_not_empty(region))
-		return 0;
-
-	ext = pixman_region32_extents(region);
-
-	/* Damage is in output coordinates.
-	 *
-	 * We are multiplying by 4 because the temporary data needs to be able
-	 * to store an 32 bit-per-pixel buffer.
-	 */
-	size = 4 * (ext->x2 - ext->x1) * (ext->y2 - ext->y1)
-		 * so->output->current_scale * so->output->current_scale;
-
-	if (so->tmp_data != NULL && size <= so->tmp_data_size)
-		return 0;
-
-	free(so->tmp_data);
-	so->tmp_data = malloc(size);
-	if (so->tmp_data == NULL) {
-		so->tmp_data_size = 0;
-		errno = ENOMEM;
-		return -1;
-	}
-
-	so->tmp_data_size = size;
-
-	return 0;
-}
-
 static void
 shared_output_update(struct shared_output *so);
 
@@ -788,6 +770,86 @@ struct zwp_fullscreen_shell_mode_feedback_v1_listener mode_feedback_listener = {
 	mode_feedback_ok,
 };
 
+static void
+ss_read_back_destroy(struct ss_read_back *rb)
+{
+	wl_list_remove(&rb->link);
+	free(rb->data);
+	free(rb);
+}
+
+static void
+ss_read_back_apply(struct ss_read_back *rb)
+{
+	struct shared_output *so = rb->output;
+	uint32_t *cache_data, *data;
+	int32_t x, y, width, height, stride;
+	int i;
+
+	if (rb->failed) {
+		/* Read everything again on the next repaint */
+		weston_output_damage(so->output);
+		return;
+	}
+
+	/* The cache was resized since, a later read covers all of it */
+	if (pixman_image_get_width(so->cache_image) != rb->width ||
+	    pixman_image_get_height(so->cache_image) != rb->height)
+		return;
+
+	cache_data = pixman_image_get_data(so->cache_image);
+	stride = rb->width;
+	data = rb->data;
+	for (i = 0; i < rb->nrects; i++) {
+		x = rb->rects[i].x1;
+		y = rb->rects[i].y1;
+		width = rb->rects[i].x2 - x;
+		height = rb->rects[i].y2 - y;
+
+		pixel_copy_rect32(cache_data + y * stride + x, stride * 4,
+				  data, width * 4, width, height,
+				  rb->do_yflip ? PIXEL_COPY_YFLIP : 0);
+		data += width * height;
+	}
+
+	so->cache_dirty = 1;
+}
+
+static void
+ss_read_back_done(int status, void *data)
+{
+	struct ss_read_back *rb = data;
+	struct shared_output *so = rb->output;
+	int applied = 0;
+
+	if (status < 0)
+		rb->failed = 1;
+	if (--rb->pending > 0)
+		return;
+
+	if (so == NULL) {
+		free(rb->data);
+		free(rb);
+		return;
+	}
+
+	/* Reads may complete out of order, apply them in order so an
+	 * older frame never overwrites a newer one. */
+	while (!wl_list_empty(&so->read_backs)) {
+		rb = container_of(so->read_backs.next,
+				  struct ss_read_back, link);
+		if (rb->pending > 0)
+			break;
+
+		ss_read_back_apply(rb);
+		ss_read_back_destroy(rb);
+		applied = 1;
+	}
+
+	if (applied)
+		shared_output_update(so);
+}
+
 static void
 shared_output_repainted(struct wl_listener *listener, void *data)
 {
@@ -795,10 +857,11 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 		container_of(listener, struct shared_output, frame_listener);
 	pixman_region32_t damage;
 	struct ss_shm_buffer *sb;
+	struct ss_read_back *rb;
 	int32_t x, y, width, height, stride;
-	int i, nrects, do_yflip;
-	pixman_box32_t *r;
-	uint32_t *cache_data;
+	uint32_t *pixels;
+	size_t size;
+	int i;
 
 	/* Damage in output coordinates */
 	pixman_region32_init(&damage);
@@ -839,44 +902,70 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 		pixman_region32_init_rect(&damage, 0, 0, width, height);
 	}
 
-	if (shared_output_ensure_tmp_data(so, &damage) < 0) {
+	if (!pixman_region32_not_empty(&damage)) {
+		pixman_region32_fini(&damage);
+		return;
+	}
+
+	rb = zalloc(sizeof *rb);
+	if (rb == NULL) {
+		pixman_region32_fini(&damage);
 		shared_output_destroy(so);
 		return;
 	}
 
-	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	rb->output = so;
+	rb->width = width;
+	rb->height = height;
+	rb->do_yflip = !!(so->output->compositor->capabilities &
+			  WESTON_CAP_CAPTURE_YFLIP);
 
-	cache_data = pixman_image_get_data(so->cache_image);
-	r = pixman_region32_rectangles(&damage, &nrects);
-	for (i = 0; i < nrects; ++i) {
-		x = r[i].x1;
-		y = r[i].y1;
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
-
-		if (do_yflip) {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, so->output->current_mode->height - r[i].y2,
-				width, height);
-
-			pixman_blt(so->tmp_data, cache_data, -width, stride,
-				   32, 32, 0, 1 - height, x, y, width, height);
-		} else {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, y, width, height);
-
-			pixman_blt(so->tmp_data, cache_data, width, stride,
-				   32, 32, 0, 0, x, y, width, height);
-		}
+	/* Each read has a fixed cost, read a few larger boxes rather than
+	 * many small rectangles. */
+	rb->nrects = weston_region_coalesce(&damage, rb->rects,
+					    ARRAY_LENGTH(rb->rects));
+	pixman_region32_fini(&damage);
+
+	size = 0;
+	for (i = 0; i < rb->nrects; i++)
+		size += (rb->rects[i].x2 - rb->rects[i].x1) *
+			(rb->rects[i].y2 - rb->rects[i].y1);
+
+	rb->data = malloc(size * 4);
+	if (rb->data == NULL) {
+		free(rb);
+		shared_output_destroy(so);
+		return;
 	}
 
-	pixman_region32_fini(&damage);
+	wl_list_insert(so->read_backs.prev, &rb->link);
+
+	/* Hold the completion back until every read has been started */
+	rb->pending = 1;
+	pixels = rb->data;
+	for (i = 0; i < rb->nrects; ++i) {
+		x = rb->rects[i].x1;
+		y = rb->rects[i].y1;
+		width = rb->rects[i].x2 - rb->rects[i].x1;
+		height = rb->rects[i].y2 - rb->rects[i].y1;
+
+		if (rb->do_yflip)
+			y = so->output->current_mode->height - rb->rects[i].y2;
+
+		rb->pending++;
+		if (weston_output_read_pixels_async(so->output,
+						    PIXMAN_a8r8g8b8, pixels,
+						    x, y, width, height,
+						    ss_read_back_done,
+						    rb) < 0) {
+			rb->pending--;
+			rb->failed = 1;
+		}
 
-	so->cache_dirty = 1;
+		pixels += width * height;
+	}
 
-	shared_output_update(so);
+	ss_read_back_done(0, rb);
 }
 
 static struct shared_output *
@@ -892,6 +981,7 @@ shared_output_create(struct weston_output *output, int parent_fd)
 		goto err_close;
 
 	wl_list_init(&so->seat_list);
+	wl_list_init(&so->read_backs);
 
 	so->parent.display = wl_display_connect_to_fd(parent_fd);
 	if (!so->parent.display)
@@ -986,9 +1076,21 @@ static void
 shared_output_destroy(struct shared_output *so)
 {
 	struct ss_shm_buffer *buffer, *bnext;
+	struct ss_read_back *rb, *rb_next;
 
 	so->output->disable_planes--;
 
+	/* Reads still in flight free themselves once done */
+	wl_list_for_each_safe(rb, rb_next, &so->read_backs, link) {
+		if (rb->pending == 0) {
+			ss_read_back_destroy(rb);
+			continue;
+		}
+
+		wl_list_remove(&rb->link);
+		rb->output = NULL;
+	}
+
 	wl_list_for_each_safe(buffer, bnext, &so->shm.buffers, link)
 		ss_shm_buffer_destroy(buffer);
 	wl_list_for_each_safe(buffer, bnext, &so->shm.free_buffers, free_link)
@@ -1001,7 +1103,6 @@ shared_output_destroy(struct shared_output *so)
 	wl_list_remove(&so->frame_listener.link);
 
 	pixman_image_unref(so->cache_image);
-	free(so->tmp_data);
 
 	free(so);
 }
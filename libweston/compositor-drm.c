@@ -37,6 +37,7 @@
 #include <linux/vt.h>
 #include <assert.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <dlfcn.h>
 #include <time.h>
 
@@ -63,6 +64,9 @@
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 
+/* Client dmabuf fbs kept around for reuse, see drm_fb_get_from_dmabuf() */
+#define DRM_FB_CACHE_SIZE 32
+
 #ifndef DRM_CAP_TIMESTAMP_MONOTONIC
 #define DRM_CAP_TIMESTAMP_MONOTONIC 0x6
 #endif
@@ -71,6 +75,10 @@
 #define DRM_CLIENT_CAP_UNIVERSAL_PLANES 2
 #endif
 
+#ifndef DRM_CLIENT_CAP_ATOMIC
+#define DRM_CLIENT_CAP_ATOMIC 3
+#endif
+
 #ifndef DRM_CAP_CURSOR_WIDTH
 #define DRM_CAP_CURSOR_WIDTH 0x8
 #endif
@@ -88,6 +96,16 @@
  */
 enum wdrm_plane_property {
 	WDRM_PLANE_TYPE = 0,
+	WDRM_PLANE_SRC_X,
+	WDRM_PLANE_SRC_Y,
+	WDRM_PLANE_SRC_W,
+	WDRM_PLANE_SRC_H,
+	WDRM_PLANE_CRTC_X,
+	WDRM_PLANE_CRTC_Y,
+	WDRM_PLANE_CRTC_W,
+	WDRM_PLANE_CRTC_H,
+	WDRM_PLANE_FB_ID,
+	WDRM_PLANE_CRTC_ID,
 	WDRM_PLANE__COUNT
 };
 
@@ -107,9 +125,19 @@ enum wdrm_plane_type {
 enum wdrm_connector_property {
 	WDRM_CONNECTOR_EDID = 0,
 	WDRM_CONNECTOR_DPMS,
+	WDRM_CONNECTOR_CRTC_ID,
 	WDRM_CONNECTOR__COUNT
 };
 
+/**
+ * List of properties attached to a DRM CRTC
+ */
+enum wdrm_crtc_property {
+	WDRM_CRTC_MODE_ID = 0,
+	WDRM_CRTC_ACTIVE,
+	WDRM_CRTC__COUNT
+};
+
 /**
  * Represents the values of an enum-type KMS property
  */
@@ -175,8 +203,10 @@ struct drm_backend {
 	int cursors_are_broken;
 
 	bool universal_planes;
+	bool atomic_modeset;
 
 	int use_pixman;
+	bool pixman_direct;
 
 	struct udev_input input;
 
@@ -184,11 +214,18 @@ struct drm_backend {
 	int32_t cursor_height;
 
 	uint32_t pageflip_timeout;
+
+	struct {
+		struct wl_list list; /**< drm_fb::cache_link, most recent first */
+		int count;
+		uint32_t hits, misses, evictions;
+	} fb_cache;
 };
 
 struct drm_mode {
 	struct weston_mode base;
 	drmModeModeInfo mode_info;
+	uint32_t blob_id; /**< mode property blob, created on first use */
 };
 
 enum drm_fb_type {
@@ -199,6 +236,22 @@ enum drm_fb_type {
 	BUFFER_CURSOR, /**< internal cursor buffer */
 };
 
+/**
+ * Identity of a client dmabuf, as seen by the fb cache
+ *
+ * The inode of the dmabuf tells buffers apart regardless of the wl_buffer
+ * or file descriptor they were passed with, and cannot be reused while
+ * the cached gbm_bo keeps the dmabuf imported.
+ */
+struct drm_fb_cache_key {
+	dev_t dev;
+	ino_t ino;
+	uint32_t format; /**< KMS format the fb was added with */
+	uint64_t modifier;
+	uint32_t offset, stride;
+	int32_t width, height;
+};
+
 struct drm_fb {
 	enum drm_fb_type type;
 
@@ -216,6 +269,13 @@ struct drm_fb {
 
 	/* Used by dumb fbs */
 	void *map;
+
+	/* Used by client fbs in the backend's fb cache */
+	struct drm_backend *backend;
+	struct drm_fb_cache_key cache_key;
+	struct wl_list cache_link;
+	struct wl_listener buffer_destroy_listener;
+	bool cached;
 };
 
 struct drm_edid {
@@ -225,6 +285,42 @@ struct drm_edid {
 	char serial_number[13];
 };
 
+/**
+ * Where plane assignment put a view
+ */
+enum drm_plane_choice {
+	DRM_PLANE_CHOICE_PRIMARY = 0,
+	DRM_PLANE_CHOICE_CURSOR,
+	DRM_PLANE_CHOICE_SCANOUT,
+	DRM_PLANE_CHOICE_OVERLAY,
+};
+
+/**
+ * A view as seen by plane assignment, and the plane it went to
+ *
+ * Whether a view can go on a plane only depends on the key, so as long as
+ * the keys of all the views of an output stay the same, the assignment of
+ * the previous repaint holds and does not need to be searched or tested
+ * again.
+ */
+struct drm_plane_cache_entry {
+	struct {
+		struct weston_view *view;
+		uint32_t output_mask;
+		uint32_t format; /**< dmabuf or shm format, 0 if unknown */
+		uint64_t modifier;
+		int32_t buffer_width, buffer_height;
+		int32_t buffer_transform, buffer_scale;
+		pixman_box32_t bbox;
+		float alpha;
+		int matrix_type; /**< -1 without a transform */
+		bool scissor;
+	} key;
+
+	enum drm_plane_choice choice;
+	struct drm_plane *plane; /**< for DRM_PLANE_CHOICE_OVERLAY */
+};
+
 /**
  * Pending state holds one or more drm_output_state structures, collected from
  * performing repaint. This pending state is transient, and only lives between
@@ -233,6 +329,14 @@ struct drm_edid {
  */
 struct drm_pending_state {
 	struct drm_backend *backend;
+
+#ifdef HAVE_DRM_ATOMIC
+	/* With atomic modesetting, the state of every output repainted in
+	 * this cycle is added to one request, committed at flush. */
+	drmModeAtomicReq *req;
+#endif
+	uint32_t flags;
+	struct wl_list output_list; /**< drm_output::pending_link */
 };
 
 /**
@@ -295,6 +399,17 @@ struct drm_output {
 
 	/* Holds the properties for the connector */
 	struct drm_property_info props_conn[WDRM_CONNECTOR__COUNT];
+	/* Holds the properties for the CRTC */
+	struct drm_property_info props_crtc[WDRM_CRTC__COUNT];
+
+	/* KMS planes claimed by this output when committing atomically */
+	struct drm_plane *primary_drm_plane;
+	struct drm_plane *cursor_drm_plane;
+	struct wl_list pending_link; /**< drm_pending_state::output_list */
+
+	/* Plane assignment of the last repaint, drm_plane_cache_entry */
+	struct wl_array plane_cache;
+	bool plane_cache_valid;
 
 	enum dpms_enum dpms;
 	struct backlight *backlight;
@@ -597,6 +712,9 @@ drm_property_info_free(struct drm_property_info *info, int num_props)
 static void
 drm_output_set_cursor(struct drm_output *output);
 
+static bool
+drm_output_update_cursor_image(struct drm_output *output);
+
 static void
 drm_output_update_msc(struct drm_output *output, unsigned int seq);
 
@@ -880,8 +998,13 @@ drm_fb_unref(struct drm_fb *fb)
 		return;
 
 	assert(fb->refcnt > 0);
-	if (--fb->refcnt > 0)
+	if (--fb->refcnt > 0) {
+		/* Only the fb cache holds it now, the client may have its
+		 * buffer back. */
+		if (fb->refcnt == 1 && fb->cached)
+			weston_buffer_reference(&fb->buffer_ref, NULL);
 		return;
+	}
 
 	switch (fb->type) {
 	case BUFFER_PIXMAN_DUMB:
@@ -900,6 +1023,151 @@ drm_fb_unref(struct drm_fb *fb)
 	}
 }
 
+static void
+drm_fb_cache_evict(struct drm_backend *b, struct drm_fb *fb)
+{
+	assert(fb->cached);
+
+	wl_list_remove(&fb->cache_link);
+	wl_list_remove(&fb->buffer_destroy_listener.link);
+	fb->cached = false;
+	b->fb_cache.count--;
+
+	/* Still on screen, the buffer is released along with the fb. */
+	drm_fb_unref(fb);
+}
+
+static void
+drm_fb_cache_flush(struct drm_backend *b)
+{
+	struct drm_fb *fb, *next;
+
+	wl_list_for_each_safe(fb, next, &b->fb_cache.list, cache_link)
+		drm_fb_cache_evict(b, fb);
+
+	weston_log("DRM: fb cache: %u hits, %u misses, %u evictions\n",
+		   b->fb_cache.hits, b->fb_cache.misses,
+		   b->fb_cache.evictions);
+}
+
+#ifdef HAVE_GBM_FD_IMPORT
+/* The buffer the fb was last used for is gone, and likely its dmabuf too */
+static void
+drm_fb_handle_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct drm_fb *fb =
+		container_of(listener, struct drm_fb, buffer_destroy_listener);
+
+	drm_fb_cache_evict(fb->backend, fb);
+}
+
+/**
+ * Get a KMS fb for a single-plane client dmabuf
+ *
+ * Importing the dmabuf and adding an fb for it every time a client
+ * attaches it again costs a gbm import, an AddFB2 and later an RmFB per
+ * frame. Instead, fbs are kept in a small cache keyed on the identity and
+ * layout of the dmabuf, so cycling through the same few buffers costs
+ * nothing after the first round. An fb is dropped from the cache along
+ * with the last wl_buffer it was used for, or as the least recently used
+ * one when the cache is full.
+ *
+ * A cached fb still on screen is not handed out again: its buffer
+ * reference belongs to the commit showing it. The dmabuf is then
+ * imported anew, without going through the cache.
+ *
+ * @param dmabuf The client buffer, with one plane at offset 0.
+ * @param buffer The weston_buffer of the dmabuf.
+ * @param b The backend.
+ * @param format The KMS format to add the fb with.
+ * @returns A new reference to the fb, or NULL on failure.
+ */
+static struct drm_fb *
+drm_fb_get_from_dmabuf(struct linux_dmabuf_buffer *dmabuf,
+		       struct weston_buffer *buffer,
+		       struct drm_backend *b, uint32_t format)
+{
+	struct gbm_import_fd_data gbm_dmabuf = {
+		.fd     = dmabuf->attributes.fd[0],
+		.width  = dmabuf->attributes.width,
+		.height = dmabuf->attributes.height,
+		.stride = dmabuf->attributes.stride[0],
+		.format = dmabuf->attributes.format
+	};
+	struct drm_fb_cache_key key;
+	struct drm_fb *fb;
+	struct gbm_bo *bo;
+	struct stat st;
+	bool cacheable;
+
+	/* Zeroed first, so that keys can be compared with memcmp() */
+	memset(&key, 0, sizeof key);
+	cacheable = fstat(dmabuf->attributes.fd[0], &st) == 0;
+	if (cacheable) {
+		key.dev = st.st_dev;
+		key.ino = st.st_ino;
+	}
+	key.format = format;
+	key.modifier = dmabuf->attributes.modifier[0];
+	key.offset = dmabuf->attributes.offset[0];
+	key.stride = dmabuf->attributes.stride[0];
+	key.width = dmabuf->attributes.width;
+	key.height = dmabuf->attributes.height;
+
+	if (cacheable) {
+		wl_list_for_each(fb, &b->fb_cache.list, cache_link) {
+			if (memcmp(&fb->cache_key, &key, sizeof key) != 0)
+				continue;
+
+			/* Only the cache holds it, so it is off screen */
+			if (fb->refcnt > 1) {
+				cacheable = false;
+				break;
+			}
+
+			b->fb_cache.hits++;
+			wl_list_remove(&fb->cache_link);
+			wl_list_insert(&b->fb_cache.list, &fb->cache_link);
+			wl_list_remove(&fb->buffer_destroy_listener.link);
+			wl_signal_add(&buffer->destroy_signal,
+				      &fb->buffer_destroy_listener);
+			return drm_fb_ref(fb);
+		}
+	}
+
+	bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_FD, &gbm_dmabuf,
+			   GBM_BO_USE_SCANOUT);
+	if (!bo)
+		return NULL;
+
+	fb = drm_fb_get_from_bo(bo, b, format, BUFFER_CLIENT);
+	if (!fb) {
+		gbm_bo_destroy(bo);
+		return NULL;
+	}
+
+	b->fb_cache.misses++;
+	if (!cacheable)
+		return fb;
+
+	fb->backend = b;
+	fb->cache_key = key;
+	fb->cached = true;
+	wl_list_insert(&b->fb_cache.list, &drm_fb_ref(fb)->cache_link);
+	fb->buffer_destroy_listener.notify = drm_fb_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &fb->buffer_destroy_listener);
+	b->fb_cache.count++;
+
+	if (b->fb_cache.count > DRM_FB_CACHE_SIZE) {
+		b->fb_cache.evictions++;
+		drm_fb_cache_evict(b, container_of(b->fb_cache.list.prev,
+						   struct drm_fb, cache_link));
+	}
+
+	return fb;
+}
+#endif
+
 static int
 drm_view_transform_supported(struct weston_view *ev)
 {
@@ -926,6 +1194,17 @@ drm_pending_state_alloc(struct drm_backend *backend)
 		return NULL;
 
 	ret->backend = backend;
+	wl_list_init(&ret->output_list);
+
+#ifdef HAVE_DRM_ATOMIC
+	if (backend->atomic_modeset) {
+		ret->req = drmModeAtomicAlloc();
+		if (!ret->req) {
+			free(ret);
+			return NULL;
+		}
+	}
+#endif
 
 	return ret;
 }
@@ -943,9 +1222,231 @@ drm_pending_state_free(struct drm_pending_state *pending_state)
 	if (!pending_state)
 		return;
 
+#ifdef HAVE_DRM_ATOMIC
+	if (pending_state->req)
+		drmModeAtomicFree(pending_state->req);
+#endif
 	free(pending_state);
 }
 
+#ifdef HAVE_DRM_ATOMIC
+static int
+plane_add_prop(drmModeAtomicReq *req, struct drm_plane *plane,
+	       enum wdrm_plane_property prop, uint64_t val)
+{
+	struct drm_property_info *info = &plane->props[prop];
+	int ret;
+
+	if (info->prop_id == 0)
+		return -1;
+
+	ret = drmModeAtomicAddProperty(req, plane->plane_id, info->prop_id,
+				       val);
+	return (ret <= 0) ? -1 : 0;
+}
+
+static int
+crtc_add_prop(drmModeAtomicReq *req, struct drm_output *output,
+	      enum wdrm_crtc_property prop, uint64_t val)
+{
+	struct drm_property_info *info = &output->props_crtc[prop];
+	int ret;
+
+	if (info->prop_id == 0)
+		return -1;
+
+	ret = drmModeAtomicAddProperty(req, output->crtc_id, info->prop_id,
+				       val);
+	return (ret <= 0) ? -1 : 0;
+}
+
+static int
+connector_add_prop(drmModeAtomicReq *req, struct drm_output *output,
+		   enum wdrm_connector_property prop, uint64_t val)
+{
+	struct drm_property_info *info = &output->props_conn[prop];
+	int ret;
+
+	if (info->prop_id == 0)
+		return -1;
+
+	ret = drmModeAtomicAddProperty(req, output->connector_id,
+				       info->prop_id, val);
+	return (ret <= 0) ? -1 : 0;
+}
+
+/**
+ * Add the state of one plane to an atomic request
+ *
+ * Shows fb on the plane, cropped to the plane's source rectangle and
+ * positioned at its destination rectangle on the CRTC. A NULL fb disables
+ * the plane.
+ *
+ * @param req Atomic request
+ * @param plane Plane to add
+ * @param crtc_id CRTC the plane is shown on
+ * @param fb Framebuffer to show, or NULL
+ * @returns 0 on success, -1 on failure
+ */
+static int
+drm_plane_atomic_add(drmModeAtomicReq *req, struct drm_plane *plane,
+		     uint32_t crtc_id, struct drm_fb *fb)
+{
+	int ret = 0;
+
+	if (!fb) {
+		ret |= plane_add_prop(req, plane, WDRM_PLANE_FB_ID, 0);
+		ret |= plane_add_prop(req, plane, WDRM_PLANE_CRTC_ID, 0);
+		return ret;
+	}
+
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_FB_ID, fb->fb_id);
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_CRTC_ID, crtc_id);
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_SRC_X, plane->src_x);
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_SRC_Y, plane->src_y);
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_SRC_W, plane->src_w);
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_SRC_H, plane->src_h);
+	/* CRTC_X and CRTC_Y are signed, a cursor may hang off the top left */
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_CRTC_X,
+			      (int32_t) plane->dest_x);
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_CRTC_Y,
+			      (int32_t) plane->dest_y);
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_CRTC_W, plane->dest_w);
+	ret |= plane_add_prop(req, plane, WDRM_PLANE_CRTC_H, plane->dest_h);
+
+	return ret;
+}
+
+static int
+drm_mode_ensure_blob(struct drm_backend *b, struct drm_mode *mode)
+{
+	int ret;
+
+	if (mode->blob_id)
+		return 0;
+
+	ret = drmModeCreatePropertyBlob(b->drm.fd, &mode->mode_info,
+					sizeof(mode->mode_info),
+					&mode->blob_id);
+	if (ret != 0)
+		weston_log("failed to create mode property blob: %m\n");
+
+	return ret;
+}
+
+/**
+ * Add the state of an output to an atomic request
+ *
+ * Adds the mode if the CRTC needs a modeset, the primary plane showing
+ * primary_fb, the cursor, and the overlay planes pending for the output;
+ * overlays which were shown but have nothing pending are disabled.
+ *
+ * @param output Output to add
+ * @param req Atomic request
+ * @param primary_fb Framebuffer for the primary plane
+ * @param flags Commit flags, DRM_MODE_ATOMIC_ALLOW_MODESET is added if a
+ * modeset is needed
+ * @returns 0 on success, -1 on failure
+ */
+static int
+drm_output_atomic_add(struct drm_output *output, drmModeAtomicReq *req,
+		      struct drm_fb *primary_fb, uint32_t *flags)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct drm_mode *mode;
+	struct drm_plane *p;
+	struct drm_fb *fb;
+	int ret = 0;
+
+	if (output->state_invalid) {
+		mode = container_of(output->base.current_mode,
+				    struct drm_mode, base);
+		if (drm_mode_ensure_blob(b, mode) < 0)
+			return -1;
+
+		ret |= crtc_add_prop(req, output, WDRM_CRTC_MODE_ID,
+				     mode->blob_id);
+		ret |= crtc_add_prop(req, output, WDRM_CRTC_ACTIVE, 1);
+		ret |= connector_add_prop(req, output, WDRM_CONNECTOR_CRTC_ID,
+					  output->crtc_id);
+		*flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	p = output->primary_drm_plane;
+	p->src_x = 0;
+	p->src_y = 0;
+	p->src_w = primary_fb->width << 16;
+	p->src_h = primary_fb->height << 16;
+	p->dest_x = 0;
+	p->dest_y = 0;
+	p->dest_w = primary_fb->width;
+	p->dest_h = primary_fb->height;
+	ret |= drm_plane_atomic_add(req, p, output->crtc_id, primary_fb);
+
+	p = output->cursor_drm_plane;
+	if (p) {
+		fb = NULL;
+		if (output->cursor_view) {
+			fb = output->gbm_cursor_fb[output->current_cursor];
+			p->src_x = 0;
+			p->src_y = 0;
+			p->src_w = b->cursor_width << 16;
+			p->src_h = b->cursor_height << 16;
+			p->dest_x = (output->cursor_plane.x - output->base.x) *
+				output->base.current_scale;
+			p->dest_y = (output->cursor_plane.y - output->base.y) *
+				output->base.current_scale;
+			p->dest_w = b->cursor_width;
+			p->dest_h = b->cursor_height;
+		}
+		ret |= drm_plane_atomic_add(req, p, output->crtc_id, fb);
+	}
+
+	wl_list_for_each(p, &b->plane_list, link) {
+		if (p->type != WDRM_PLANE_TYPE_OVERLAY || p->output != output)
+			continue;
+
+		fb = b->sprites_hidden ? NULL : p->fb_pending;
+		if (!fb && !p->fb_current)
+			continue;
+
+		ret |= drm_plane_atomic_add(req, p, output->crtc_id, fb);
+	}
+
+	return ret ? -1 : 0;
+}
+
+/**
+ * Check whether the kernel would accept the output's state
+ *
+ * Runs a TEST_ONLY commit of the output with primary_fb on the primary
+ * plane and the planes assigned so far, without touching the hardware.
+ *
+ * @param output Output to test
+ * @param primary_fb Framebuffer for the primary plane
+ * @returns 0 if the state would be accepted, -1 otherwise
+ */
+static int
+drm_output_atomic_test(struct drm_output *output, struct drm_fb *primary_fb)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	uint32_t flags = DRM_MODE_ATOMIC_TEST_ONLY;
+	drmModeAtomicReq *req;
+	int ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	ret = drm_output_atomic_add(output, req, primary_fb, &flags);
+	if (ret == 0)
+		ret = drmModeAtomicCommit(b->drm.fd, req, flags, NULL);
+	drmModeAtomicFree(req);
+
+	return ret == 0 ? 0 : -1;
+}
+#endif
+
 static uint32_t
 drm_output_check_scanout_format(struct drm_output *output,
 				struct weston_surface *es, struct gbm_bo *bo)
@@ -976,9 +1477,18 @@ drm_output_check_scanout_format(struct drm_output *output,
 	return 0;
 }
 
+/**
+ * Try to scan a fullscreen view out directly
+ *
+ * @param output Output the view is shown on
+ * @param ev View to place
+ * @param test Whether to check the configuration with a TEST_ONLY commit;
+ * false when an earlier assignment of the same scene already did
+ * @returns The scanout plane, or NULL if the view cannot be scanned out
+ */
 static struct weston_plane *
 drm_output_prepare_scanout_view(struct drm_output *output,
-				struct weston_view *ev)
+				struct weston_view *ev, bool test)
 {
 	struct drm_backend *b = to_drm_backend(output->base.compositor);
 	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
@@ -1042,6 +1552,15 @@ drm_output_prepare_scanout_view(struct drm_output *output,
 
 	drm_fb_set_buffer(output->fb_pending, buffer);
 
+#ifdef HAVE_DRM_ATOMIC
+	if (b->atomic_modeset && test &&
+	    drm_output_atomic_test(output, output->fb_pending) < 0) {
+		drm_fb_unref(output->fb_pending);
+		output->fb_pending = NULL;
+		return NULL;
+	}
+#endif
+
 	return &output->scanout_plane;
 }
 
@@ -1202,6 +1721,32 @@ drm_output_repaint(struct weston_output *output_base,
 	if (!output->fb_pending)
 		return -1;
 
+#ifdef HAVE_DRM_ATOMIC
+	/* The state is only added to the request here, the whole repaint
+	 * cycle is committed at once in drm_repaint_flush(). */
+	if (backend->atomic_modeset) {
+		struct drm_pending_state *pending_state = repaint_data;
+
+		if (!pending_state)
+			goto err_pageflip;
+
+		if (output->cursor_view)
+			drm_output_update_cursor_image(output);
+
+		if (drm_output_atomic_add(output, pending_state->req,
+					  output->fb_pending,
+					  &pending_state->flags) < 0) {
+			weston_log("atomic: couldn't add state for %s\n",
+				   output->base.name);
+			goto err_pageflip;
+		}
+
+		wl_list_insert(&pending_state->output_list,
+			       &output->pending_link);
+		return 0;
+	}
+#endif
+
 	mode = container_of(output->base.current_mode, struct drm_mode, base);
 	if (output->state_invalid || !output->fb_current ||
 	    output->fb_current->stride != output->fb_pending->stride) {
@@ -1300,6 +1845,36 @@ err_pageflip:
 	return -1;
 }
 
+#ifdef HAVE_DRM_ATOMIC
+/**
+ * Commit the current framebuffer of an output again
+ *
+ * The atomic counterpart of flipping to the framebuffer already shown,
+ * which gets us a page flip event to start the repaint loop from.
+ */
+static int
+drm_output_atomic_flip_current(struct drm_output *output)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	drmModeAtomicReq *req;
+	int ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	ret = drm_plane_atomic_add(req, output->primary_drm_plane,
+				   output->crtc_id, output->fb_current);
+	if (ret == 0)
+		ret = drmModeAtomicCommit(b->drm.fd, req,
+					  DRM_MODE_ATOMIC_NONBLOCK |
+					  DRM_MODE_PAGE_FLIP_EVENT, b);
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+#endif
+
 static void
 drm_output_start_repaint_loop(struct weston_output *output_base)
 {
@@ -1365,8 +1940,14 @@ drm_output_start_repaint_loop(struct weston_output *output_base)
 	assert(!output->page_flip_pending);
 	assert(!output->fb_last);
 
-	if (drmModePageFlip(backend->drm.fd, output->crtc_id, fb_id,
-			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
+#ifdef HAVE_DRM_ATOMIC
+	if (backend->atomic_modeset)
+		ret = drm_output_atomic_flip_current(output);
+	else
+#endif
+		ret = drmModePageFlip(backend->drm.fd, output->crtc_id, fb_id,
+				      DRM_MODE_PAGE_FLIP_EVENT, output);
+	if (ret < 0) {
 		weston_log("queueing pageflip failed: %m\n");
 		goto finish_frame;
 	}
@@ -1467,6 +2048,165 @@ page_flip_handler(int fd, unsigned int frame,
 	}
 }
 
+#ifdef HAVE_DRM_ATOMIC
+static void
+atomic_flip_handler(int fd, unsigned int frame, unsigned int sec,
+		    unsigned int usec, unsigned int crtc_id, void *data)
+{
+	struct drm_backend *b = data;
+	struct drm_output *output = drm_output_find_by_crtc(b, crtc_id);
+	struct drm_plane *p;
+
+	/* A commit completes all of its CRTCs at once, so the overlays of
+	 * the output are released here rather than from vblank events. */
+	if (!output || !output->page_flip_pending)
+		return;
+
+	wl_list_for_each(p, &b->plane_list, link) {
+		if (p->type != WDRM_PLANE_TYPE_OVERLAY || p->output != output)
+			continue;
+
+		drm_fb_unref(p->fb_last);
+		p->fb_last = NULL;
+		if (!p->fb_current)
+			p->output = NULL;
+	}
+
+	page_flip_handler(fd, frame, sec, usec, output);
+}
+
+/**
+ * Drop the framebuffers prepared for an output in a repaint cycle
+ *
+ * @param output Output whose pending state is not going to be committed
+ */
+static void
+drm_output_drop_pending(struct drm_output *output)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct drm_plane *p;
+
+	drm_fb_unref(output->fb_pending);
+	output->fb_pending = NULL;
+
+	wl_list_for_each(p, &b->plane_list, link) {
+		if (p->type != WDRM_PLANE_TYPE_OVERLAY || p->output != output)
+			continue;
+
+		drm_fb_unref(p->fb_pending);
+		p->fb_pending = NULL;
+		if (!p->fb_current && !p->fb_last)
+			p->output = NULL;
+	}
+}
+
+/**
+ * Make the pending state of an output current after a commit
+ *
+ * @param output Output which was part of a successful commit
+ */
+static void
+drm_output_commit_done(struct drm_output *output)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct drm_plane *p;
+
+	output->fb_last = output->fb_current;
+	output->fb_current = output->fb_pending;
+	output->fb_pending = NULL;
+
+	wl_list_for_each(p, &b->plane_list, link) {
+		if (p->type != WDRM_PLANE_TYPE_OVERLAY || p->output != output)
+			continue;
+
+		p->fb_last = p->fb_current;
+		p->fb_current = p->fb_pending;
+		p->fb_pending = NULL;
+	}
+
+	if (output->state_invalid) {
+		output->state_invalid = false;
+		output->dpms = WESTON_DPMS_ON;
+	}
+
+	assert(!output->page_flip_pending);
+	output->page_flip_pending = 1;
+
+	if (output->pageflip_timer)
+		wl_event_source_timer_update(output->pageflip_timer,
+		                             b->pageflip_timeout);
+}
+
+/**
+ * Commit a repaint cycle
+ *
+ * All outputs repainted in the cycle, with their planes, go to the kernel
+ * in a single non-blocking commit; each CRTC then completes with its own
+ * page flip event. If the commit fails, the outputs are modeset from
+ * scratch on their next repaint.
+ *
+ * @param pending_state Pending state of the repaint cycle
+ */
+static void
+drm_pending_state_apply(struct drm_pending_state *pending_state)
+{
+	struct drm_backend *b = pending_state->backend;
+	struct drm_output *output, *tmp;
+	uint32_t flags;
+	int ret;
+
+	if (wl_list_empty(&pending_state->output_list))
+		return;
+
+	flags = pending_state->flags | DRM_MODE_ATOMIC_NONBLOCK |
+		DRM_MODE_PAGE_FLIP_EVENT;
+	ret = drmModeAtomicCommit(b->drm.fd, pending_state->req, flags, b);
+	if (ret != 0)
+		weston_log("atomic: couldn't commit new state: %m\n");
+
+	wl_list_for_each_safe(output, tmp, &pending_state->output_list,
+			      pending_link) {
+		wl_list_remove(&output->pending_link);
+
+		if (ret == 0) {
+			drm_output_commit_done(output);
+			continue;
+		}
+
+		output->cursor_view = NULL;
+		output->state_invalid = true;
+		drm_output_drop_pending(output);
+		weston_output_finish_frame(&output->base, NULL,
+					   WP_PRESENTATION_FEEDBACK_INVALID);
+	}
+}
+
+/**
+ * Throw away a repaint cycle which is not going to be committed
+ *
+ * @param pending_state Pending state of the repaint cycle
+ */
+static void
+drm_pending_state_discard(struct drm_pending_state *pending_state)
+{
+	struct drm_backend *b = pending_state->backend;
+	struct drm_output *output, *tmp;
+
+	/* Views may have been assigned to the planes of outputs which did
+	 * not get to repaint. */
+	wl_list_for_each(output, &b->compositor->output_list, base.link)
+		drm_output_drop_pending(output);
+
+	/* These are waiting for a page flip which is never coming. */
+	wl_list_for_each_safe(output, tmp, &pending_state->output_list,
+			      pending_link) {
+		wl_list_remove(&output->pending_link);
+		weston_output_finish_frame(&output->base, NULL,
+					   WP_PRESENTATION_FEEDBACK_INVALID);
+	}
+}
+#endif
+
 /**
  * Begin a new repaint cycle
  *
@@ -1496,6 +2236,11 @@ drm_repaint_flush(struct weston_compositor *compositor, void *repaint_data)
 	struct drm_backend *b = to_drm_backend(compositor);
 	struct drm_pending_state *pending_state = repaint_data;
 
+#ifdef HAVE_DRM_ATOMIC
+	if (b->atomic_modeset && pending_state)
+		drm_pending_state_apply(pending_state);
+#endif
+
 	drm_pending_state_free(pending_state);
 	b->repaint_data = NULL;
 }
@@ -1512,17 +2257,20 @@ drm_repaint_cancel(struct weston_compositor *compositor, void *repaint_data)
 	struct drm_backend *b = to_drm_backend(compositor);
 	struct drm_pending_state *pending_state = repaint_data;
 
+#ifdef HAVE_DRM_ATOMIC
+	if (b->atomic_modeset && pending_state)
+		drm_pending_state_discard(pending_state);
+#endif
+
 	drm_pending_state_free(pending_state);
 	b->repaint_data = NULL;
 }
 
 static uint32_t
 drm_output_check_plane_format(struct drm_plane *p,
-			       struct weston_view *ev, struct gbm_bo *bo)
+			       struct weston_view *ev, uint32_t format)
 {
-	uint32_t i, format;
-
-	format = gbm_bo_get_format(bo);
+	uint32_t i;
 
 	if (format == GBM_FORMAT_ARGB8888) {
 		pixman_region32_t r;
@@ -1542,25 +2290,135 @@ drm_output_check_plane_format(struct drm_plane *p,
 		if (p->formats[i] == format)
 			return format;
 
-	return 0;
+	return 0;
+}
+
+/**
+ * Whether a plane can take a view for an output in this repaint
+ */
+static bool
+drm_plane_is_available(struct drm_plane *p, struct drm_output *output)
+{
+	struct drm_backend *b = p->backend;
+
+	if (p->type != WDRM_PLANE_TYPE_OVERLAY)
+		return false;
+
+	if (!drm_plane_crtc_supported(output, p))
+		return false;
+
+	/* Moving a plane between CRTCs would pull the other CRTC
+	 * into the commit. */
+	if (b->atomic_modeset && p->output && p->output != output)
+		return false;
+
+	return p->fb_pending == NULL;
+}
+
+/**
+ * Set the source and destination rectangles of a plane to show a view
+ *
+ * The caller has called weston_view_update_transform() for the view.
+ */
+static void
+drm_plane_set_view_coords(struct drm_plane *p, struct drm_output *output,
+			  struct weston_view *ev)
+{
+	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	pixman_region32_t dest_rect, src_rect;
+	pixman_box32_t *box, tbox;
+	wl_fixed_t sx1, sy1, sx2, sy2;
+
+	box = pixman_region32_extents(&ev->transform.boundingbox);
+	p->base.x = box->x1;
+	p->base.y = box->y1;
+
+	pixman_region32_init(&dest_rect);
+	pixman_region32_intersect(&dest_rect, &ev->transform.boundingbox,
+				  &output->base.region);
+	pixman_region32_translate(&dest_rect, -output->base.x, -output->base.y);
+	box = pixman_region32_extents(&dest_rect);
+	tbox = weston_transformed_rect(output->base.width,
+				       output->base.height,
+				       output->base.transform,
+				       output->base.current_scale,
+				       *box);
+	p->dest_x = tbox.x1;
+	p->dest_y = tbox.y1;
+	p->dest_w = tbox.x2 - tbox.x1;
+	p->dest_h = tbox.y2 - tbox.y1;
+	pixman_region32_fini(&dest_rect);
+
+	pixman_region32_init(&src_rect);
+	pixman_region32_intersect(&src_rect, &ev->transform.boundingbox,
+				  &output->base.region);
+	box = pixman_region32_extents(&src_rect);
+
+	weston_view_from_global_fixed(ev,
+				      wl_fixed_from_int(box->x1),
+				      wl_fixed_from_int(box->y1),
+				      &sx1, &sy1);
+	weston_view_from_global_fixed(ev,
+				      wl_fixed_from_int(box->x2),
+				      wl_fixed_from_int(box->y2),
+				      &sx2, &sy2);
+
+	if (sx1 < 0)
+		sx1 = 0;
+	if (sy1 < 0)
+		sy1 = 0;
+	if (sx2 > wl_fixed_from_int(ev->surface->width))
+		sx2 = wl_fixed_from_int(ev->surface->width);
+	if (sy2 > wl_fixed_from_int(ev->surface->height))
+		sy2 = wl_fixed_from_int(ev->surface->height);
+
+	tbox.x1 = sx1;
+	tbox.y1 = sy1;
+	tbox.x2 = sx2;
+	tbox.y2 = sy2;
+
+	tbox = weston_transformed_rect(wl_fixed_from_int(ev->surface->width),
+				       wl_fixed_from_int(ev->surface->height),
+				       viewport->buffer.transform,
+				       viewport->buffer.scale,
+				       tbox);
+
+	p->src_x = tbox.x1 << 8;
+	p->src_y = tbox.y1 << 8;
+	p->src_w = (tbox.x2 - tbox.x1) << 8;
+	p->src_h = (tbox.y2 - tbox.y1) << 8;
+	pixman_region32_fini(&src_rect);
 }
 
+/**
+ * Try to put a view on an overlay plane
+ *
+ * Without a plane given, each available plane is tried in turn, with a
+ * TEST_ONLY commit when using atomic modesetting, until one works. With
+ * a plane given, from an earlier assignment of the same scene, only that
+ * plane is used and it is not tested again.
+ *
+ * @param output Output the view is shown on
+ * @param ev View to place
+ * @param cached_plane Plane known to work for the view, or NULL
+ * @returns The plane used, or NULL if the view stays on the primary plane
+ */
 static struct weston_plane *
 drm_output_prepare_overlay_view(struct drm_output *output,
-				struct weston_view *ev)
+				struct weston_view *ev,
+				struct drm_plane *cached_plane)
 {
 	struct weston_compositor *ec = output->base.compositor;
 	struct drm_backend *b = to_drm_backend(ec);
 	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
 	struct wl_resource *buffer_resource;
 	struct drm_plane *p;
 	struct linux_dmabuf_buffer *dmabuf;
 	int found = 0;
-	struct gbm_bo *bo;
-	pixman_region32_t dest_rect, src_rect;
-	pixman_box32_t *box, tbox;
-	uint32_t format;
-	wl_fixed_t sx1, sy1, sx2, sy2;
+	struct gbm_bo *bo = NULL;
+	struct drm_fb *fb = NULL;
+	uint32_t buffer_format, format;
 
 	if (b->sprites_are_broken)
 		return NULL;
@@ -1573,9 +2431,9 @@ drm_output_prepare_overlay_view(struct drm_output *output,
 	if (b->gbm == NULL)
 		return NULL;
 
-	if (ev->surface->buffer_ref.buffer == NULL)
+	if (buffer == NULL)
 		return NULL;
-	buffer_resource = ev->surface->buffer_ref.buffer->resource;
+	buffer_resource = buffer->resource;
 	if (wl_shm_buffer_get(buffer_resource))
 		return NULL;
 
@@ -1589,14 +2447,16 @@ drm_output_prepare_overlay_view(struct drm_output *output,
 	if (ev->alpha != 1.0f)
 		return NULL;
 
-	wl_list_for_each(p, &b->plane_list, link) {
-		if (p->type != WDRM_PLANE_TYPE_OVERLAY)
-			continue;
+	/* The primary plane is tested along with the overlay, and until the
+	 * output has shown a frame there is nothing to test it with. */
+	if (b->atomic_modeset && !output->fb_current && !output->fb_pending)
+		return NULL;
 
-		if (!drm_plane_crtc_supported(output, p))
+	wl_list_for_each(p, &b->plane_list, link) {
+		if (cached_plane && p != cached_plane)
 			continue;
 
-		if (!p->fb_pending) {
+		if (drm_plane_is_available(p, output)) {
 			found = 1;
 			break;
 		}
@@ -1615,13 +2475,6 @@ drm_output_prepare_overlay_view(struct drm_output *output,
 		 * Both require refactoring in the DRM-backend to
 		 * support a mix of gbm_bos and drmfbs.
 		 */
-		struct gbm_import_fd_data gbm_dmabuf = {
-			.fd     = dmabuf->attributes.fd[0],
-			.width  = dmabuf->attributes.width,
-			.height = dmabuf->attributes.height,
-			.stride = dmabuf->attributes.stride[0],
-			.format = dmabuf->attributes.format
-		};
 
                 /* XXX: TODO:
                  *
@@ -1637,98 +2490,72 @@ drm_output_prepare_overlay_view(struct drm_output *output,
 		    dmabuf->attributes.flags)
 			return NULL;
 
-		bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_FD, &gbm_dmabuf,
-				   GBM_BO_USE_SCANOUT);
+		/* Imported only once the fb is needed, through the cache */
+		buffer_format = dmabuf->attributes.format;
 #else
 		return NULL;
 #endif
 	} else {
 		bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_WL_BUFFER,
 				   buffer_resource, GBM_BO_USE_SCANOUT);
-	}
-	if (!bo)
-		return NULL;
-
-	format = drm_output_check_plane_format(p, ev, bo);
-	if (format == 0) {
-		gbm_bo_destroy(bo);
-		return NULL;
-	}
-
-	p->fb_pending = drm_fb_get_from_bo(bo, b, format, BUFFER_CLIENT);
-	if (!p->fb_pending) {
-		gbm_bo_destroy(bo);
-		return NULL;
+		if (!bo)
+			return NULL;
+		buffer_format = gbm_bo_get_format(bo);
 	}
 
-	drm_fb_set_buffer(p->fb_pending, ev->surface->buffer_ref.buffer);
+	wl_list_for_each(p, &b->plane_list, link) {
+		if (cached_plane && p != cached_plane)
+			continue;
 
-	box = pixman_region32_extents(&ev->transform.boundingbox);
-	p->base.x = box->x1;
-	p->base.y = box->y1;
+		if (!drm_plane_is_available(p, output))
+			continue;
 
-	/*
-	 * Calculate the source & dest rects properly based on actual
-	 * position (note the caller has called weston_view_update_transform()
-	 * for us already).
-	 */
-	pixman_region32_init(&dest_rect);
-	pixman_region32_intersect(&dest_rect, &ev->transform.boundingbox,
-				  &output->base.region);
-	pixman_region32_translate(&dest_rect, -output->base.x, -output->base.y);
-	box = pixman_region32_extents(&dest_rect);
-	tbox = weston_transformed_rect(output->base.width,
-				       output->base.height,
-				       output->base.transform,
-				       output->base.current_scale,
-				       *box);
-	p->dest_x = tbox.x1;
-	p->dest_y = tbox.y1;
-	p->dest_w = tbox.x2 - tbox.x1;
-	p->dest_h = tbox.y2 - tbox.y1;
-	pixman_region32_fini(&dest_rect);
+		format = drm_output_check_plane_format(p, ev, buffer_format);
+		if (format == 0)
+			continue;
 
-	pixman_region32_init(&src_rect);
-	pixman_region32_intersect(&src_rect, &ev->transform.boundingbox,
-				  &output->base.region);
-	box = pixman_region32_extents(&src_rect);
+		if (!fb) {
+#ifdef HAVE_GBM_FD_IMPORT
+			if (dmabuf)
+				fb = drm_fb_get_from_dmabuf(dmabuf, buffer,
+							    b, format);
+			else
+#endif
+				fb = drm_fb_get_from_bo(bo, b, format,
+							BUFFER_CLIENT);
+			if (!fb)
+				break;
+			drm_fb_set_buffer(fb, buffer);
+		}
 
-	weston_view_from_global_fixed(ev,
-				      wl_fixed_from_int(box->x1),
-				      wl_fixed_from_int(box->y1),
-				      &sx1, &sy1);
-	weston_view_from_global_fixed(ev,
-				      wl_fixed_from_int(box->x2),
-				      wl_fixed_from_int(box->y2),
-				      &sx2, &sy2);
+		p->fb_pending = fb;
+		drm_plane_set_view_coords(p, output, ev);
 
-	if (sx1 < 0)
-		sx1 = 0;
-	if (sy1 < 0)
-		sy1 = 0;
-	if (sx2 > wl_fixed_from_int(ev->surface->width))
-		sx2 = wl_fixed_from_int(ev->surface->width);
-	if (sy2 > wl_fixed_from_int(ev->surface->height))
-		sy2 = wl_fixed_from_int(ev->surface->height);
+#ifdef HAVE_DRM_ATOMIC
+		if (b->atomic_modeset) {
+			struct drm_output *prev_output = p->output;
 
-	tbox.x1 = sx1;
-	tbox.y1 = sy1;
-	tbox.x2 = sx2;
-	tbox.y2 = sy2;
+			p->output = output;
+			if (!cached_plane &&
+			    drm_output_atomic_test(output, output->fb_pending ?
+						   output->fb_pending :
+						   output->fb_current) < 0) {
+				p->fb_pending = NULL;
+				p->output = prev_output;
+				continue;
+			}
+		}
+#endif
 
-	tbox = weston_transformed_rect(wl_fixed_from_int(ev->surface->width),
-				       wl_fixed_from_int(ev->surface->height),
-				       viewport->buffer.transform,
-				       viewport->buffer.scale,
-				       tbox);
+		return &p->base;
+	}
 
-	p->src_x = tbox.x1 << 8;
-	p->src_y = tbox.y1 << 8;
-	p->src_w = (tbox.x2 - tbox.x1) << 8;
-	p->src_h = (tbox.y2 - tbox.y1) << 8;
-	pixman_region32_fini(&src_rect);
+	if (fb)
+		drm_fb_unref(fb);
+	else if (bo)
+		gbm_bo_destroy(bo);
 
-	return &p->base;
+	return NULL;
 }
 
 static struct weston_plane *
@@ -1821,6 +2648,31 @@ cursor_bo_update(struct drm_backend *b, struct gbm_bo *bo,
 		weston_log("failed update cursor: %m\n");
 }
 
+/**
+ * Copy the cursor surface into the other cursor buffer if it changed
+ *
+ * @param output Output with a cursor view
+ * @returns true if the other cursor buffer became the current one
+ */
+static bool
+drm_output_update_cursor_image(struct drm_output *output)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct gbm_bo *bo;
+
+	if (!pixman_region32_not_empty(&output->cursor_plane.damage))
+		return false;
+
+	pixman_region32_fini(&output->cursor_plane.damage);
+	pixman_region32_init(&output->cursor_plane.damage);
+	output->current_cursor ^= 1;
+	bo = output->gbm_cursor_fb[output->current_cursor]->bo;
+
+	cursor_bo_update(b, bo, output->cursor_view);
+
+	return true;
+}
+
 static void
 drm_output_set_cursor(struct drm_output *output)
 {
@@ -1835,13 +2687,8 @@ drm_output_set_cursor(struct drm_output *output)
 		return;
 	}
 
-	if (pixman_region32_not_empty(&output->cursor_plane.damage)) {
-		pixman_region32_fini(&output->cursor_plane.damage);
-		pixman_region32_init(&output->cursor_plane.damage);
-		output->current_cursor ^= 1;
+	if (drm_output_update_cursor_image(output)) {
 		bo = output->gbm_cursor_fb[output->current_cursor]->bo;
-
-		cursor_bo_update(b, bo, ev);
 		handle = gbm_bo_get_handle(bo).s32;
 		if (drmModeSetCursor(b->drm.fd, output->crtc_id, handle,
 				b->cursor_width, b->cursor_height)) {
@@ -1861,6 +2708,81 @@ drm_output_set_cursor(struct drm_output *output)
 	}
 }
 
+static void
+drm_plane_cache_key_init(struct drm_plane_cache_entry *entry,
+			 struct weston_view *ev)
+{
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct wl_shm_buffer *shmbuf;
+
+	/* Zeroed first, so that keys can be compared with memcmp() */
+	memset(entry, 0, sizeof *entry);
+
+	entry->key.view = ev;
+	entry->key.output_mask = ev->output_mask;
+	entry->key.bbox = *pixman_region32_extents(&ev->transform.boundingbox);
+	entry->key.alpha = ev->alpha;
+	entry->key.matrix_type = ev->transform.enabled ?
+		(int) ev->transform.matrix.type : -1;
+	entry->key.scissor = ev->geometry.scissor_enabled;
+	entry->key.buffer_transform = viewport->buffer.transform;
+	entry->key.buffer_scale = viewport->buffer.scale;
+
+	if (!buffer)
+		return;
+
+	entry->key.buffer_width = buffer->width;
+	entry->key.buffer_height = buffer->height;
+
+	if ((shmbuf = wl_shm_buffer_get(buffer->resource))) {
+		entry->key.format = wl_shm_buffer_get_format(shmbuf);
+	} else if ((dmabuf = linux_dmabuf_buffer_get(buffer->resource))) {
+		entry->key.format = dmabuf->attributes.format;
+		entry->key.modifier = dmabuf->attributes.modifier[0];
+	}
+}
+
+static bool
+drm_plane_cache_matches(struct drm_output *output, struct wl_array *keys)
+{
+	struct drm_plane_cache_entry *cached = output->plane_cache.data;
+	struct drm_plane_cache_entry *entry = keys->data;
+	size_t i, count = keys->size / sizeof *entry;
+
+	if (!output->plane_cache_valid || output->state_invalid ||
+	    output->plane_cache.size != keys->size)
+		return false;
+
+	for (i = 0; i < count; i++) {
+		if (memcmp(&cached[i].key, &entry[i].key, sizeof entry[i].key))
+			return false;
+	}
+
+	return true;
+}
+
+static struct weston_plane *
+drm_output_prepare_cached_view(struct drm_output *output,
+			       struct weston_view *ev,
+			       struct drm_plane_cache_entry *cached)
+{
+	switch (cached->choice) {
+	case DRM_PLANE_CHOICE_PRIMARY:
+		return &output->base.compositor->primary_plane;
+	case DRM_PLANE_CHOICE_CURSOR:
+		return drm_output_prepare_cursor_view(output, ev);
+	case DRM_PLANE_CHOICE_SCANOUT:
+		return drm_output_prepare_scanout_view(output, ev, false);
+	case DRM_PLANE_CHOICE_OVERLAY:
+		return drm_output_prepare_overlay_view(output, ev,
+						       cached->plane);
+	}
+
+	return NULL;
+}
+
 static void
 drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 {
@@ -1869,6 +2791,10 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 	struct weston_view *ev, *next;
 	pixman_region32_t overlap, surface_overlap;
 	struct weston_plane *primary, *next_plane;
+	struct drm_plane_cache_entry *entry, *cached;
+	struct wl_array keys;
+	bool use_cache, keys_complete = true;
+	size_t i;
 
 	/*
 	 * Find a surface for each sprite in the output using some heuristics:
@@ -1882,10 +2808,32 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 	 * the main display surface may not need to update at all, and
 	 * the client buffer can be used directly for the sprite surface
 	 * as we do for flipping full screen surfaces.
+	 *
+	 * With atomic modesetting every candidate is checked with a
+	 * TEST_ONLY commit. As that is costly, the outcome is remembered,
+	 * and as long as the views stay the same, the views are put
+	 * straight back on the planes they were on.
 	 */
 	pixman_region32_init(&overlap);
 	primary = &output_base->compositor->primary_plane;
 
+	wl_array_init(&keys);
+	wl_list_for_each(ev, &output_base->compositor->view_list, link) {
+		if (ev->plane != primary &&
+		    !(ev->output_mask & (1u << output->base.id)))
+			continue;
+
+		entry = wl_array_add(&keys, sizeof *entry);
+		if (!entry) {
+			keys_complete = false;
+			break;
+		}
+		drm_plane_cache_key_init(entry, ev);
+	}
+	use_cache = keys_complete && drm_plane_cache_matches(output, &keys);
+	cached = output->plane_cache.data;
+	i = 0;
+
 	output->cursor_view = NULL;
 	output->cursor_plane.x = INT32_MIN;
 	output->cursor_plane.y = INT32_MIN;
@@ -1910,6 +2858,16 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 		else
 			es->keep_buffer = false;
 
+		/* Planes of all outputs in a repaint cycle are assigned
+		 * before the damage is accumulated; leave the views other
+		 * outputs placed on their own planes alone. */
+		if (ev->plane != primary &&
+		    !(ev->output_mask & (1u << output->base.id)))
+			continue;
+
+		entry = keys_complete ?
+			&((struct drm_plane_cache_entry *) keys.data)[i] : NULL;
+
 		pixman_region32_init(&surface_overlap);
 		pixman_region32_intersect(&surface_overlap, &overlap,
 					  &ev->transform.boundingbox);
@@ -1917,17 +2875,43 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 		next_plane = NULL;
 		if (pixman_region32_not_empty(&surface_overlap))
 			next_plane = primary;
+		if (next_plane == NULL && use_cache) {
+			next_plane = drm_output_prepare_cached_view(output, ev,
+								    &cached[i]);
+			/* The buffer behind the same key changed in a way
+			 * that matters; search again from here on. */
+			if (next_plane == NULL)
+				use_cache = false;
+		}
 		if (next_plane == NULL)
 			next_plane = drm_output_prepare_cursor_view(output, ev);
 		if (next_plane == NULL)
-			next_plane = drm_output_prepare_scanout_view(output, ev);
+			next_plane = drm_output_prepare_scanout_view(output, ev,
+								     true);
 		if (next_plane == NULL)
-			next_plane = drm_output_prepare_overlay_view(output, ev);
+			next_plane = drm_output_prepare_overlay_view(output, ev,
+								     NULL);
 		if (next_plane == NULL)
 			next_plane = primary;
 
 		weston_view_move_to_plane(ev, next_plane);
 
+		if (entry) {
+			if (next_plane == primary) {
+				entry->choice = DRM_PLANE_CHOICE_PRIMARY;
+			} else if (next_plane == &output->cursor_plane) {
+				entry->choice = DRM_PLANE_CHOICE_CURSOR;
+			} else if (next_plane == &output->scanout_plane) {
+				entry->choice = DRM_PLANE_CHOICE_SCANOUT;
+			} else {
+				entry->choice = DRM_PLANE_CHOICE_OVERLAY;
+				entry->plane = container_of(next_plane,
+							    struct drm_plane,
+							    base);
+			}
+		}
+		i++;
+
 		if (next_plane == primary)
 			pixman_region32_union(&overlap, &overlap,
 					      &ev->transform.boundingbox);
@@ -1946,6 +2930,10 @@ drm_assign_planes(struct weston_output *output_base, void *repaint_data)
 		pixman_region32_fini(&surface_overlap);
 	}
 	pixman_region32_fini(&overlap);
+
+	wl_array_release(&output->plane_cache);
+	output->plane_cache = keys;
+	output->plane_cache_valid = keys_complete;
 }
 
 /**
@@ -2038,6 +3026,7 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	assert(!output->fb_last);
 	assert(!output->fb_pending);
 	output->fb_last = output->fb_current = NULL;
+	output->state_invalid = true;
 
 	if (b->use_pixman) {
 		drm_output_fini_pixman(output);
@@ -2067,6 +3056,12 @@ on_drm_input(int fd, uint32_t mask, void *data)
 	evctx.version = 2;
 	evctx.page_flip_handler = page_flip_handler;
 	evctx.vblank_handler = vblank_handler;
+#ifdef HAVE_DRM_ATOMIC
+	if (((struct drm_backend *) data)->atomic_modeset) {
+		evctx.version = 3;
+		evctx.page_flip_handler2 = atomic_flip_handler;
+	}
+#endif
 	drmHandleEvent(fd, &evctx);
 
 	return 1;
@@ -2110,6 +3105,16 @@ init_kms_caps(struct drm_backend *b)
 	weston_log("DRM: %s universal planes\n",
 		   b->universal_planes ? "supports" : "does not support");
 
+#ifdef HAVE_DRM_ATOMIC
+	/* Atomic commits address the primary and cursor planes directly */
+	if (b->universal_planes && !getenv("WESTON_DISABLE_ATOMIC")) {
+		ret = drmSetClientCap(b->drm.fd, DRM_CLIENT_CAP_ATOMIC, 1);
+		b->atomic_modeset = (ret == 0);
+	}
+#endif
+	weston_log("DRM: %s atomic modesetting\n",
+		   b->atomic_modeset ? "supports" : "does not support");
+
 	return 0;
 }
 
@@ -2202,7 +3207,7 @@ init_egl(struct drm_backend *b)
 static int
 init_pixman(struct drm_backend *b)
 {
-	return pixman_renderer_init(b->compositor);
+	return pixman_renderer_init(b->compositor, 0);
 }
 
 /**
@@ -2242,6 +3247,16 @@ drm_plane_create(struct drm_backend *b, const drmModePlane *kplane)
 			.enum_values = plane_type_enums,
 			.num_enum_values = WDRM_PLANE_TYPE__COUNT,
 		},
+		[WDRM_PLANE_SRC_X] = { .name = "SRC_X", },
+		[WDRM_PLANE_SRC_Y] = { .name = "SRC_Y", },
+		[WDRM_PLANE_SRC_W] = { .name = "SRC_W", },
+		[WDRM_PLANE_SRC_H] = { .name = "SRC_H", },
+		[WDRM_PLANE_CRTC_X] = { .name = "CRTC_X", },
+		[WDRM_PLANE_CRTC_Y] = { .name = "CRTC_Y", },
+		[WDRM_PLANE_CRTC_W] = { .name = "CRTC_W", },
+		[WDRM_PLANE_CRTC_H] = { .name = "CRTC_H", },
+		[WDRM_PLANE_FB_ID] = { .name = "FB_ID", },
+		[WDRM_PLANE_CRTC_ID] = { .name = "CRTC_ID", },
 	};
 
 	plane = zalloc(sizeof(*plane) + ((sizeof(uint32_t)) *
@@ -2381,6 +3396,7 @@ drm_output_add_mode(struct drm_output *output, const drmModeModeInfo *info)
 		return NULL;
 
 	mode->base.flags = 0;
+	mode->blob_id = 0;
 	mode->base.width = info->hdisplay;
 	mode->base.height = info->vdisplay;
 
@@ -2472,6 +3488,41 @@ drm_set_dpms(struct weston_output *output_base, enum dpms_enum level)
 		&output->props_conn[WDRM_CONNECTOR_DPMS];
 	int ret;
 
+#ifdef HAVE_DRM_ATOMIC
+	/* Atomic drivers tie DPMS to the CRTC being active: turning it
+	 * back on is a modeset done by the next repaint. */
+	if (b->atomic_modeset) {
+		drmModeAtomicReq *req;
+
+		if (level == WESTON_DPMS_ON) {
+			if (output->dpms != WESTON_DPMS_ON)
+				output->state_invalid = true;
+			return;
+		}
+
+		req = drmModeAtomicAlloc();
+		if (!req)
+			return;
+
+		ret = crtc_add_prop(req, output, WDRM_CRTC_ACTIVE, 0);
+		if (ret == 0)
+			ret = drmModeAtomicCommit(b->drm.fd, req,
+						  DRM_MODE_ATOMIC_ALLOW_MODESET,
+						  NULL);
+		drmModeAtomicFree(req);
+
+		if (ret != 0) {
+			weston_log("DRM: DPMS: failed atomic commit for %s\n",
+				   output->base.name);
+			return;
+		}
+
+		output->state_invalid = true;
+		output->dpms = level;
+		return;
+	}
+#endif
+
 	if (!prop->prop_id)
 		return;
 
@@ -2705,7 +3756,10 @@ drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
 			goto err;
 	}
 
-	if (pixman_renderer_output_create(&output->base) < 0)
+	if (pixman_renderer_output_create(&output->base,
+					  b->pixman_direct ?
+					  PIXMAN_RENDERER_OUTPUT_DIRECT_OPAQUE :
+					  0) < 0)
 		goto err;
 
 	pixman_region32_init_rect(&output->previous_damage,
@@ -3139,6 +4193,30 @@ drm_output_set_seat(struct weston_output *base,
 				     seat ? seat : "");
 }
 
+/**
+ * Find a free KMS plane of the given type for an output
+ *
+ * @param output Output the plane is for
+ * @param type Type of plane
+ * @returns A plane usable on the output's CRTC, or NULL
+ */
+static struct drm_plane *
+drm_output_find_plane(struct drm_output *output, enum wdrm_plane_type type)
+{
+	struct drm_backend *b = to_drm_backend(output->base.compositor);
+	struct drm_plane *p;
+
+	wl_list_for_each(p, &b->plane_list, link) {
+		if (p->type != type || p->output)
+			continue;
+
+		if (drm_plane_crtc_supported(output, p))
+			return p;
+	}
+
+	return NULL;
+}
+
 static int
 drm_output_enable(struct weston_output *base)
 {
@@ -3183,6 +4261,24 @@ drm_output_enable(struct weston_output *base)
 	    output->connector->connector_type == DRM_MODE_CONNECTOR_eDP)
 		output->base.connection_internal = true;
 
+	if (b->atomic_modeset) {
+		output->primary_drm_plane =
+			drm_output_find_plane(output, WDRM_PLANE_TYPE_PRIMARY);
+		if (!output->primary_drm_plane) {
+			weston_log("Failed to find a primary plane for %s\n",
+				   output->base.name);
+			goto err;
+		}
+		output->primary_drm_plane->output = output;
+
+		output->cursor_drm_plane =
+			drm_output_find_plane(output, WDRM_PLANE_TYPE_CURSOR);
+		if (output->cursor_drm_plane)
+			output->cursor_drm_plane->output = output;
+		else
+			b->cursors_are_broken = 1;
+	}
+
 	weston_plane_init(&output->cursor_plane, b->compositor,
 			  INT32_MIN, INT32_MIN);
 	weston_plane_init(&output->scanout_plane, b->compositor, 0, 0);
@@ -3191,6 +4287,9 @@ drm_output_enable(struct weston_output *base)
 	weston_compositor_stack_plane(b->compositor, &output->scanout_plane,
 				      &b->compositor->primary_plane);
 
+	wl_array_init(&output->plane_cache);
+	output->plane_cache_valid = false;
+
 	weston_log("Output %s, (connector %d, crtc %d)\n",
 		   output->base.name, output->connector_id, output->crtc_id);
 	wl_list_for_each(m, &output->base.mode_list, link)
@@ -3216,6 +4315,7 @@ drm_output_deinit(struct weston_output *base)
 {
 	struct drm_output *output = to_drm_output(base);
 	struct drm_backend *b = to_drm_backend(base->compositor);
+	struct drm_plane *p;
 
 	/* output->fb_last and output->fb_pending must not be set here;
 	 * destroy_pending/disable_pending exist to guarantee exactly this. */
@@ -3232,8 +4332,27 @@ drm_output_deinit(struct weston_output *base)
 	weston_plane_release(&output->scanout_plane);
 	weston_plane_release(&output->cursor_plane);
 
+	wl_array_release(&output->plane_cache);
+	wl_array_init(&output->plane_cache);
+	output->plane_cache_valid = false;
+
 	/* Turn off hardware cursor */
 	drmModeSetCursor(b->drm.fd, output->crtc_id, 0, 0, 0);
+
+	/* Release the planes claimed by the output, and the overlays last
+	 * committed on its CRTC. */
+	wl_list_for_each(p, &b->plane_list, link) {
+		if (!b->atomic_modeset || p->output != output)
+			continue;
+
+		assert(!p->fb_last);
+		assert(!p->fb_pending);
+		drm_fb_unref(p->fb_current);
+		p->fb_current = NULL;
+		p->output = NULL;
+	}
+	output->primary_drm_plane = NULL;
+	output->cursor_drm_plane = NULL;
 }
 
 static void
@@ -3256,6 +4375,11 @@ drm_output_destroy(struct weston_output *base)
 	wl_list_for_each_safe(drm_mode, next, &output->base.mode_list,
 			      base.link) {
 		wl_list_remove(&drm_mode->base.link);
+#ifdef HAVE_DRM_ATOMIC
+		if (drm_mode->blob_id)
+			drmModeDestroyPropertyBlob(b->drm.fd,
+						   drm_mode->blob_id);
+#endif
 		free(drm_mode);
 	}
 
@@ -3273,6 +4397,7 @@ drm_output_destroy(struct weston_output *base)
 	weston_output_destroy(&output->base);
 
 	drm_property_info_free(output->props_conn, WDRM_CONNECTOR__COUNT);
+	drm_property_info_free(output->props_crtc, WDRM_CRTC__COUNT);
 
 	drmModeFreeConnector(output->connector);
 
@@ -3332,6 +4457,11 @@ create_output_for_connector(struct drm_backend *b,
 	static const struct drm_property_info connector_props[] = {
 		[WDRM_CONNECTOR_EDID] = { .name = "EDID" },
 		[WDRM_CONNECTOR_DPMS] = { .name = "DPMS" },
+		[WDRM_CONNECTOR_CRTC_ID] = { .name = "CRTC_ID" },
+	};
+	static const struct drm_property_info crtc_props[] = {
+		[WDRM_CRTC_MODE_ID] = { .name = "MODE_ID" },
+		[WDRM_CRTC_ACTIVE] = { .name = "ACTIVE" },
 	};
 
 	i = find_crtc_for_connector(b, resources, connector);
@@ -3373,6 +4503,16 @@ create_output_for_connector(struct drm_backend *b,
 	find_and_parse_output_edid(b, output, props);
 	drmModeFreeObjectProperties(props);
 
+	props = drmModeObjectGetProperties(b->drm.fd, output->crtc_id,
+					   DRM_MODE_OBJECT_CRTC);
+	if (!props) {
+		weston_log("failed to get crtc properties\n");
+		goto err;
+	}
+	drm_property_info_populate(b, crtc_props, output->props_crtc,
+				   WDRM_CRTC__COUNT, props);
+	drmModeFreeObjectProperties(props);
+
 	weston_output_init(&output->base, b->compositor);
 
 	wl_list_init(&output->base.mode_list);
@@ -3579,6 +4719,8 @@ drm_destroy(struct weston_compositor *ec)
 
 	weston_compositor_shutdown(ec);
 
+	drm_fb_cache_flush(b);
+
 	if (b->gbm)
 		gbm_device_destroy(b->gbm);
 
@@ -3788,6 +4930,7 @@ planes_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 	       void *data)
 {
 	struct drm_backend *b = data;
+	struct weston_output *base;
 
 	switch (key) {
 	case KEY_C:
@@ -3802,6 +4945,10 @@ planes_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 	default:
 		break;
 	}
+
+	/* The cached plane assignments were made under the old settings. */
+	wl_list_for_each(base, &b->compositor->output_list, link)
+		to_drm_output(base)->plane_cache_valid = false;
 }
 
 #ifdef BUILD_VAAPI_RECORDER
@@ -3992,19 +5139,9 @@ drm_backend_create(struct weston_compositor *compositor,
 
 	b->drm.fd = -1;
 
-	/*
-	 * KMS support for hardware planes cannot properly synchronize
-	 * without nuclear page flip. Without nuclear/atomic, hw plane
-	 * and cursor plane updates would either tear or cause extra
-	 * waits for vblanks which means dropping the compositor framerate
-	 * to a fraction. For cursors, it's not so bad, so they are
-	 * enabled.
-	 *
-	 * These can be enabled again when nuclear/atomic support lands.
-	 */
-	b->sprites_are_broken = 1;
 	b->compositor = compositor;
 	b->use_pixman = config->use_pixman;
+	b->pixman_direct = config->pixman_direct;
 	b->pageflip_timeout = config->pageflip_timeout;
 
 	if (parse_gbm_format(config->gbm_format, GBM_FORMAT_XRGB8888, &b->gbm_format) < 0)
@@ -4042,6 +5179,19 @@ drm_backend_create(struct weston_compositor *compositor,
 		goto err_udev_dev;
 	}
 
+	/*
+	 * KMS support for hardware planes cannot properly synchronize
+	 * without nuclear page flip. Without nuclear/atomic, hw plane
+	 * and cursor plane updates would either tear or cause extra
+	 * waits for vblanks which means dropping the compositor framerate
+	 * to a fraction. For cursors, it's not so bad, so they are
+	 * enabled.
+	 *
+	 * With atomic modesetting, overlays are committed together with
+	 * the primary plane and validated with TEST_ONLY commits.
+	 */
+	b->sprites_are_broken = !b->atomic_modeset;
+
 	if (b->use_pixman) {
 		if (init_pixman(b) < 0) {
 			weston_log("failed to initialize pixman renderer\n");
@@ -4063,6 +5213,7 @@ drm_backend_create(struct weston_compositor *compositor,
 	weston_setup_vt_switch_bindings(compositor);
 
 	wl_list_init(&b->plane_list);
+	wl_list_init(&b->fb_cache.list);
 	create_sprites(b);
 
 	if (udev_input_init(&b->input,
@@ -35,7 +35,7 @@
 extern "C" {
 #endif
 
-#define WESTON_DRM_BACKEND_CONFIG_VERSION 3
+#define WESTON_DRM_BACKEND_CONFIG_VERSION 4
 
 struct libinput_device;
 
@@ -139,6 +139,11 @@ struct weston_drm_backend_config {
 	 *
 	 * It is exprimed in milliseconds, 0 means disabled. */
 	uint32_t pageflip_timeout;
+
+	/** Whether the pixman renderer may composite straight into the dumb
+	 * buffers for repaints that do not blend, skipping the copy from
+	 * its shadow image. */
+	bool pixman_direct;
 };
 
 #ifdef  __cplusplus
@@ -31,12 +31,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "compositor.h"
 #include "compositor-headless.h"
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "pixman-renderer.h"
+#include "linux-dmabuf.h"
 #include "presentation-time-server-protocol.h"
 #include "windowed-output-api.h"
 
@@ -46,13 +51,20 @@ struct headless_backend {
 
 	struct weston_seat fake_seat;
 	bool use_pixman;
+
+	struct weston_headless_output_timing timing;
 };
 
 struct headless_output {
 	struct weston_output base;
 
 	struct weston_mode mode;
-	struct wl_event_source *finish_frame_timer;
+	struct weston_headless_output_timing timing;
+	int finish_frame_fd;
+	struct wl_event_source *finish_frame_source;
+	struct timespec last_vblank;	/* zero until a frame was shown */
+	struct timespec pending_vblank;	/* of the frame being shown */
+	unsigned int jitter_seed;
 	uint32_t *image_buf;
 	pixman_image_t *image;
 };
@@ -70,22 +82,112 @@ to_headless_backend(struct weston_compositor *base)
 }
 
 static void
-headless_output_start_repaint_loop(struct weston_output *output)
+headless_output_start_repaint_loop(struct weston_output *output_base)
 {
+	struct headless_output *output = to_headless_output(output_base);
 	struct timespec ts;
+	int64_t period, cycles;
+
+	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
 
-	weston_compositor_read_presentation_clock(output->compositor, &ts);
-	weston_output_finish_frame(output, &ts, WP_PRESENTATION_FEEDBACK_INVALID);
+	/* A fixed rate display reports the last vblank it went through;
+	 * a variable rate one is waiting for a frame right now. */
+	if (!output->timing.unthrottled && output->timing.min_refresh == 0 &&
+	    !timespec_is_zero(&output->last_vblank)) {
+		period = millihz_to_nsec(output->timing.refresh);
+		cycles = timespec_sub_to_nsec(&ts, &output->last_vblank) /
+			 period;
+		if (cycles > 0) {
+			timespec_add_nsec(&output->last_vblank,
+					  &output->last_vblank,
+					  cycles * period);
+			output->base.msc += cycles;
+		}
+		ts = output->last_vblank;
+	}
+
+	weston_output_finish_frame(&output->base, &ts,
+				   WP_PRESENTATION_FEEDBACK_INVALID);
+}
+
+/** Compute the vblank a frame repainted now is shown at
+ *
+ * A fixed rate display shows it at the first vblank after now. A variable
+ * rate one shows it right away, unless that would exceed the refresh rate,
+ * and refreshes on its own whenever no frame came for a cycle of the
+ * lowest refresh rate.
+ */
+static void
+headless_output_next_vblank(struct headless_output *output,
+			    const struct timespec *now,
+			    struct timespec *vblank)
+{
+	int64_t period = millihz_to_nsec(output->timing.refresh);
+	int64_t since_last, cycles, max_period;
+	struct timespec start;
+
+	if (timespec_is_zero(&output->last_vblank)) {
+		timespec_add_nsec(vblank, now, period);
+		output->base.msc++;
+		return;
+	}
+
+	since_last = timespec_sub_to_nsec(now, &output->last_vblank);
+
+	if (output->timing.min_refresh == 0) {
+		cycles = (since_last > 0 ? since_last / period : 0) + 1;
+		timespec_add_nsec(vblank, &output->last_vblank,
+				  cycles * period);
+		output->base.msc += cycles;
+		return;
+	}
+
+	max_period = millihz_to_nsec(output->timing.min_refresh);
+	cycles = since_last > 0 ? since_last / max_period : 0;
+	timespec_add_nsec(&start, &output->last_vblank, cycles * max_period);
+	timespec_add_nsec(vblank, &start, period);
+	if (timespec_sub_to_nsec(now, vblank) > 0)
+		*vblank = *now;
+	output->base.msc += cycles + 1;
+}
+
+static void
+headless_output_arm_finish_frame(struct headless_output *output,
+				 int64_t nsec)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	/* A zero expiry would disarm the timer. */
+	if (nsec < 1)
+		nsec = 1;
+
+	timespec_from_nsec(&its.it_value, nsec);
+	if (timerfd_settime(output->finish_frame_fd, 0, &its, NULL) < 0)
+		weston_log("headless: failed to arm the frame timer: %m\n");
 }
 
 static int
-finish_frame_handler(void *data)
+finish_frame_handler(int fd, uint32_t mask, void *data)
 {
 	struct headless_output *output = data;
 	struct timespec ts;
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof expirations) < 0 &&
+	    errno != EAGAIN)
+		weston_log("headless: failed to read the frame timer: %m\n");
+
+	if (output->timing.unthrottled) {
+		weston_compositor_read_presentation_clock(output->base.compositor,
+							  &ts);
+		output->base.msc++;
+	} else {
+		ts = output->pending_vblank;
+	}
 
-	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
-	weston_output_finish_frame(&output->base, &ts, 0);
+	output->last_vblank = ts;
+	weston_output_finish_frame(&output->base, &ts,
+				   output->timing.presented_flags);
 
 	return 1;
 }
@@ -97,13 +199,27 @@ headless_output_repaint(struct weston_output *output_base,
 {
 	struct headless_output *output = to_headless_output(output_base);
 	struct weston_compositor *ec = output->base.compositor;
+	struct timespec now;
+	int64_t delay = 0;
 
 	ec->renderer->repaint_output(&output->base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	weston_compositor_read_presentation_clock(ec, &now);
+	if (!output->timing.unthrottled) {
+		headless_output_next_vblank(output, &now,
+					    &output->pending_vblank);
+		delay = timespec_sub_to_nsec(&output->pending_vblank, &now);
+	}
+
+	/* The completion is late, the timestamp is not. */
+	if (output->timing.jitter_usec)
+		delay += (int64_t) (rand_r(&output->jitter_seed) %
+				    (output->timing.jitter_usec + 1)) * 1000;
+
+	headless_output_arm_finish_frame(output, delay);
 
 	return 0;
 }
@@ -117,7 +233,8 @@ headless_output_disable(struct weston_output *base)
 	if (!output->base.enabled)
 		return 0;
 
-	wl_event_source_remove(output->finish_frame_timer);
+	wl_event_source_remove(output->finish_frame_source);
+	close(output->finish_frame_fd);
 
 	if (b->use_pixman) {
 		pixman_renderer_output_destroy(&output->base);
@@ -147,8 +264,21 @@ headless_output_enable(struct weston_output *base)
 	struct wl_event_loop *loop;
 
 	loop = wl_display_get_event_loop(b->compositor->wl_display);
-	output->finish_frame_timer =
-		wl_event_loop_add_timer(loop, finish_frame_handler, output);
+	output->finish_frame_fd = timerfd_create(CLOCK_MONOTONIC,
+						 TFD_CLOEXEC | TFD_NONBLOCK);
+	if (output->finish_frame_fd < 0)
+		return -1;
+	output->finish_frame_source =
+		wl_event_loop_add_fd(loop, output->finish_frame_fd,
+				     WL_EVENT_READABLE, finish_frame_handler,
+				     output);
+	if (!output->finish_frame_source) {
+		close(output->finish_frame_fd);
+		return -1;
+	}
+
+	output->last_vblank.tv_sec = 0;
+	output->last_vblank.tv_nsec = 0;
 
 	if (b->use_pixman) {
 		output->image_buf = malloc(output->base.current_mode->width *
@@ -162,7 +292,7 @@ headless_output_enable(struct weston_output *base)
 							 output->image_buf,
 							 output->base.current_mode->width * 4);
 
-		if (pixman_renderer_output_create(&output->base) < 0)
+		if (pixman_renderer_output_create(&output->base, 0) < 0)
 			goto err_renderer;
 
 		pixman_renderer_output_set_buffer(&output->base,
@@ -175,7 +305,8 @@ err_renderer:
 	pixman_image_unref(output->image);
 	free(output->image_buf);
 err_malloc:
-	wl_event_source_remove(output->finish_frame_timer);
+	wl_event_source_remove(output->finish_frame_source);
+	close(output->finish_frame_fd);
 
 	return -1;
 }
@@ -200,7 +331,8 @@ headless_output_set_size(struct weston_output *base,
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 	output->mode.width = output_width;
 	output->mode.height = output_height;
-	output->mode.refresh = 60000;
+	output->mode.refresh =
+		output->timing.unthrottled ? 0 : output->timing.refresh;
 	wl_list_init(&output->base.mode_list);
 	wl_list_insert(&output->base.mode_list, &output->mode.link);
 
@@ -222,10 +354,40 @@ headless_output_set_size(struct weston_output *base,
 	return 0;
 }
 
+static int
+headless_output_set_timing(struct weston_output *base,
+			   const struct weston_headless_output_timing *timing)
+{
+	struct headless_output *output = to_headless_output(base);
+
+	if (output->base.enabled)
+		return -1;
+
+	if (timing->refresh < 0 || timing->min_refresh < 0 ||
+	    timing->min_refresh > (timing->refresh ? timing->refresh : 60000)) {
+		weston_log("Invalid refresh rates for output %s\n",
+			   output->base.name);
+		return -1;
+	}
+
+	output->timing = *timing;
+	if (output->timing.refresh == 0)
+		output->timing.refresh = 60000;
+	if (output->timing.min_refresh == output->timing.refresh)
+		output->timing.min_refresh = 0;
+
+	if (output->base.current_mode)
+		output->mode.refresh = output->timing.unthrottled ?
+			0 : output->timing.refresh;
+
+	return 0;
+}
+
 static int
 headless_output_create(struct weston_compositor *compositor,
 		       const char *name)
 {
+	struct headless_backend *b = to_headless_backend(compositor);
 	struct headless_output *output;
 
 	/* name can't be NULL. */
@@ -240,6 +402,10 @@ headless_output_create(struct weston_compositor *compositor,
 	output->base.disable = headless_output_disable;
 	output->base.enable = headless_output_enable;
 
+	/* Checked at backend creation */
+	headless_output_set_timing(&output->base, &b->timing);
+	output->jitter_seed = 1;
+
 	weston_output_init(&output->base, compositor);
 	weston_compositor_add_pending_output(&output->base, compositor);
 
@@ -266,6 +432,10 @@ static const struct weston_windowed_output_api api = {
 	headless_output_create,
 };
 
+static const struct weston_headless_output_api headless_api = {
+	headless_output_set_timing,
+};
+
 static struct headless_backend *
 headless_backend_create(struct weston_compositor *compositor,
 			struct weston_headless_backend_config *config)
@@ -284,14 +454,29 @@ headless_backend_create(struct weston_compositor *compositor,
 	b->base.destroy = headless_destroy;
 	b->base.restore = headless_restore;
 
+	b->timing = config->timing;
+	if (b->timing.refresh < 0 || b->timing.min_refresh < 0 ||
+	    b->timing.min_refresh > (b->timing.refresh ?
+				     b->timing.refresh : 60000)) {
+		weston_log("Invalid refresh rates in the backend config\n");
+		goto err_free;
+	}
+
 	b->use_pixman = config->use_pixman;
 	if (b->use_pixman) {
-		pixman_renderer_init(compositor);
+		pixman_renderer_init(compositor,
+				     PIXMAN_RENDERER_DMABUF_IMPORT);
 	}
 
 	if (!b->use_pixman && noop_renderer_init(compositor) < 0)
 		goto err_input;
 
+	if (compositor->renderer->import_dmabuf) {
+		if (linux_dmabuf_setup(compositor) < 0)
+			weston_log("Error: initializing dmabuf "
+				   "support failed.\n");
+	}
+
 	compositor->backend = &b->base;
 
 	ret = weston_plugin_api_register(compositor, WESTON_WINDOWED_OUTPUT_API_NAME,
@@ -302,6 +487,14 @@ headless_backend_create(struct weston_compositor *compositor,
 		goto err_input;
 	}
 
+	ret = weston_plugin_api_register(compositor,
+					 WESTON_HEADLESS_OUTPUT_API_NAME,
+					 &headless_api, sizeof(headless_api));
+	if (ret < 0) {
+		weston_log("Failed to register headless output API.\n");
+		goto err_input;
+	}
+
 	return b;
 
 err_input:
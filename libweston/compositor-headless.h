@@ -31,16 +31,69 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "compositor.h"
+#include "plugin-registry.h"
 
-#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 2
+#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 3
+
+/** How a headless output emulates the display it stands for */
+struct weston_headless_output_timing {
+	/** The refresh rate in mHz. 0 means 60 Hz. */
+	int32_t refresh;
+
+	/** The lowest refresh rate in mHz of a variable refresh rate
+	 * display. Frames are then shown as soon as they are repainted,
+	 * but no more often than at the refresh rate, and the display
+	 * refreshes on its own when none came for this long. 0 means a
+	 * fixed refresh rate. */
+	int32_t min_refresh;
+
+	/** Deliver each frame completion up to this many microseconds
+	 * late, at random. The presentation timestamps stay on time. */
+	uint32_t jitter_usec;
+
+	/** Flags to report in presentation feedback, from
+	 * enum wp_presentation_feedback_kind */
+	uint32_t presented_flags;
+
+	/** Complete frames as soon as they are repainted, advertising no
+	 * refresh rate, to repaint as fast as possible. */
+	bool unthrottled;
+};
+
+#define WESTON_HEADLESS_OUTPUT_API_NAME "weston_headless_output_api_v1"
+
+struct weston_headless_output_api {
+	/** The timing the output presents frames with, instead of the one
+	 * from the backend config. Must be called before the output is
+	 * enabled.
+	 *
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int (*set_timing)(struct weston_output *output,
+			  const struct weston_headless_output_timing *timing);
+};
+
+static inline const struct weston_headless_output_api *
+weston_headless_output_get_api(struct weston_compositor *compositor)
+{
+	const void *api;
+	api = weston_plugin_api_get(compositor, WESTON_HEADLESS_OUTPUT_API_NAME,
+				    sizeof(struct weston_headless_output_api));
+
+	return (const struct weston_headless_output_api *)api;
+}
 
 struct weston_headless_backend_config {
 	struct weston_backend_config base;
 
 	/** Whether to use the pixman renderer instead of the OpenGL ES renderer. */
 	int use_pixman;
+
+	/** The timing of new outputs */
+	struct weston_headless_output_timing timing;
 };
 
 #ifdef  __cplusplus
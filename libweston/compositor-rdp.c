@@ -77,6 +77,7 @@
 #include <winpr/input.h>
 
 #include "shared/helpers.h"
+#include "shared/pixel-copy.h"
 #include "compositor.h"
 #include "compositor-rdp.h"
 #include "pixman-renderer.h"
@@ -84,6 +85,7 @@
 #define MAX_FREERDP_FDS 32
 #define DEFAULT_AXIS_STEP_DISTANCE 10
 #define RDP_MODE_FREQ 60 * 1000
+#define RDP_MAX_DAMAGE_BOXES 16
 
 #if FREERDP_VERSION_MAJOR >= 2 && defined(PIXEL_FORMAT_BGRA32) && !defined(PIXEL_FORMAT_B8G8R8A8)
 	/* The RDP API is truly wonderful: the pixel format definition changed
@@ -163,7 +165,7 @@ static void
 rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
 {
 	int width, height, nrects, i;
-	pixman_box32_t *region, *rects;
+	pixman_box32_t *region, rects[RDP_MAX_DAMAGE_BOXES];
 	uint32_t *ptr;
 	RFX_RECT *rfxRect;
 	rdpUpdate *update = peer->update;
@@ -193,7 +195,7 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 	ptr = pixman_image_get_data(image) + damage->extents.x1 +
 				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
 
-	rects = pixman_region32_rectangles(damage, &nrects);
+	nrects = weston_region_coalesce(damage, rects, ARRAY_LENGTH(rects));
 	context->rfx_rects = realloc(context->rfx_rects, nrects * sizeof *rfxRect);
 
 	for (i = 0; i < nrects; i++) {
@@ -262,14 +264,12 @@ static void
 pixman_image_flipped_subrect(const pixman_box32_t *rect, pixman_image_t *img, BYTE *dest)
 {
 	int stride = pixman_image_get_stride(img);
-	int h;
-	int toCopy = (rect->x2 - rect->x1) * 4;
-	int height = (rect->y2 - rect->y1);
+	int width = rect->x2 - rect->x1;
 	const BYTE *src = (const BYTE *)pixman_image_get_data(img);
-	src += ((rect->y2-1) * stride) + (rect->x1 * 4);
+	src += (rect->y1 * stride) + (rect->x1 * 4);
 
-	for (h = 0; h < height; h++, src -= stride, dest += toCopy)
-		   memcpy(dest, src, toCopy);
+	pixel_copy_rect32(dest, width * 4, src, stride, width,
+			  rect->y2 - rect->y1, PIXEL_COPY_YFLIP);
 }
 
 static void
@@ -278,11 +278,12 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	rdpUpdate *update = peer->update;
 	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
 	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
-	pixman_box32_t *rect, subrect;
+	pixman_box32_t *rect, subrect, boxes[RDP_MAX_DAMAGE_BOXES];
 	int nrects, i;
 	int heightIncrement, remainingHeight, top;
 
-	rect = pixman_region32_rectangles(region, &nrects);
+	nrects = weston_region_coalesce(region, boxes, ARRAY_LENGTH(boxes));
+	rect = boxes;
 	if (!nrects)
 		return;
 
@@ -445,7 +446,7 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 	output->current_mode->flags |= WL_OUTPUT_MODE_CURRENT;
 
 	pixman_renderer_output_destroy(output);
-	pixman_renderer_output_create(output);
+	pixman_renderer_output_create(output, 0);
 
 	new_shadow_buffer = pixman_image_create_bits(PIXMAN_x8r8g8b8, target_mode->width,
 			target_mode->height, 0, target_mode->width * 4);
@@ -530,7 +531,7 @@ rdp_output_enable(struct weston_output *base)
 		return -1;
 	}
 
-	if (pixman_renderer_output_create(&output->base) < 0) {
+	if (pixman_renderer_output_create(&output->base, 0) < 0) {
 		pixman_image_unref(output->shadow_surface);
 		return -1;
 	}
@@ -1308,7 +1309,7 @@ rdp_backend_create(struct weston_compositor *compositor,
 	if (weston_compositor_set_presentation_clock_software(compositor) < 0)
 		goto err_compositor;
 
-	if (pixman_renderer_init(compositor) < 0)
+	if (pixman_renderer_init(compositor, 0) < 0)
 		goto err_compositor;
 
 	if (rdp_backend_create_output(compositor) < 0)
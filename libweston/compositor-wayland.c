@@ -755,7 +755,7 @@ cleanup_window:
 static int
 wayland_output_init_pixman_renderer(struct wayland_output *output)
 {
-	return pixman_renderer_output_create(&output->base);
+	return pixman_renderer_output_create(&output->base, 0);
 }
 
 static void
@@ -2537,7 +2537,7 @@ wayland_backend_create(struct weston_compositor *compositor,
 	}
 
 	if (b->use_pixman) {
-		if (pixman_renderer_init(compositor) < 0) {
+		if (pixman_renderer_init(compositor, 0) < 0) {
 			weston_log("Failed to initialize pixman renderer\n");
 			goto err_display;
 		}
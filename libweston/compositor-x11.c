@@ -915,7 +915,7 @@ x11_output_enable(struct weston_output *base)
 			weston_log("Failed to initialize SHM for the X11 output\n");
 			goto err;
 		}
-		if (pixman_renderer_output_create(&output->base) < 0) {
+		if (pixman_renderer_output_create(&output->base, 0) < 0) {
 			weston_log("Failed to create pixman renderer for output\n");
 			x11_output_deinit_shm(b, output);
 			goto err;
@@ -1697,7 +1697,7 @@ x11_backend_create(struct weston_compositor *compositor,
 
 	b->use_pixman = config->use_pixman;
 	if (b->use_pixman) {
-		if (pixman_renderer_init(compositor) < 0) {
+		if (pixman_renderer_init(compositor, 0) < 0) {
 			weston_log("Failed to initialize pixman renderer for X11 backend\n");
 			goto err_xdisplay;
 		}
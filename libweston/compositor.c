@@ -41,6 +41,7 @@
 #include <sys/socket.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <math.h>
 #include <linux/input.h>
@@ -52,6 +53,7 @@
 #include <errno.h>
 
 #include "timeline.h"
+#include "latency.h"
 
 #include "compositor.h"
 #include "viewporter-server-protocol.h"
@@ -66,6 +68,11 @@
 
 #define DEFAULT_REPAINT_WINDOW 7 /* milliseconds */
 
+/* Adaptive repaint window: margin kept on top of the measured repaint
+ * cost, and how much the estimate grows when a vblank was missed. */
+#define ADAPTIVE_REPAINT_SLACK_NSEC 1000000
+#define ADAPTIVE_REPAINT_MISS_NSEC 1000000
+
 static void
 weston_output_update_matrix(struct weston_output *output);
 
@@ -76,6 +83,16 @@ weston_output_transform_scale_init(struct weston_output *output,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor);
 
+static void
+pick_grid_view_update(struct weston_view *view);
+
+/* Something changed that may affect which view is under a point. */
+static void
+weston_compositor_invalidate_pick(struct weston_compositor *compositor)
+{
+	compositor->pick_generation++;
+}
+
 static void weston_mode_switch_finish(struct weston_output *output,
 				      int mode_changed,
 				      int scale_changed)
@@ -899,8 +916,8 @@ weston_view_move_to_plane(struct weston_view *view,
  * A repaint is scheduled for this view.
  *
  * The region of all opaque views covering this view is stored in
- * weston_view::clip and updated by view_accumulate_damage() during
- * weston_output_repaint(). Specifically, that region matches the
+ * weston_view::clip and updated by view_accumulate_damage() once per
+ * repaint cycle. Specifically, that region matches the
  * scenegraph as it was last painted.
  */
 WL_EXPORT void
@@ -1240,6 +1257,7 @@ weston_view_update_transform(struct weston_view *view)
 		weston_view_update_transform(parent);
 
 	view->transform.dirty = 0;
+	view->transform.generation++;
 
 	weston_view_damage_below(view);
 
@@ -1282,6 +1300,9 @@ weston_view_update_transform(struct weston_view *view)
 
 	weston_view_assign_output(view);
 
+	pick_grid_view_update(view);
+	weston_compositor_invalidate_pick(view->surface->compositor);
+
 	wl_signal_emit(&view->surface->compositor->transform_signal,
 		       view->surface);
 }
@@ -1302,6 +1323,7 @@ weston_view_geometry_dirty(struct weston_view *view)
 		return;
 
 	view->transform.dirty = 1;
+	weston_compositor_invalidate_pick(view->surface->compositor);
 
 	wl_list_for_each(child, &view->geometry.child_list,
 			 geometry.parent_link)
@@ -1704,38 +1726,349 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-WL_EXPORT struct weston_view *
-weston_compositor_pick_view(struct weston_compositor *compositor,
-			    wl_fixed_t x, wl_fixed_t y,
-			    wl_fixed_t *vx, wl_fixed_t *vy)
+/* The pick grid is a spatial index over weston_compositor::view_list for
+ * weston_compositor_pick_view(). Global space is divided into square cells,
+ * and cells are hashed into a fixed array of buckets by wrapping their
+ * coordinates. Each bucket holds the views whose bounding box overlaps any
+ * of the cells mapped to it, sorted in stacking order, so a pick only has to
+ * look at the views in a single bucket.
+ *
+ * Moving a view only touches the buckets it leaves and enters. Any change in
+ * stacking order found by weston_compositor_build_view_list() rebuilds the
+ * whole grid.
+ */
+#define PICK_GRID_CELL_SHIFT	8	/* 256x256 pixel cells */
+#define PICK_GRID_SIZE		64	/* buckets per axis, power of two */
+
+struct pick_grid_bucket {
+	struct weston_view **views;	/* sorted by weston_view::pick.order */
+	unsigned int count;
+	unsigned int alloc;
+};
+
+struct weston_pick_grid {
+	uint32_t generation;
+	unsigned int view_count;
+	/* false if an allocation failed, falls back to the linear scan */
+	bool valid;
+	struct pick_grid_bucket buckets[PICK_GRID_SIZE * PICK_GRID_SIZE];
+};
+
+static struct weston_pick_grid *
+pick_grid_create(void)
+{
+	struct weston_pick_grid *grid;
+
+	grid = zalloc(sizeof *grid);
+	if (!grid)
+		return NULL;
+
+	/* Views start out with generation 0, i.e. not indexed. */
+	grid->generation = 1;
+	grid->valid = true;
+
+	return grid;
+}
+
+static void
+pick_grid_destroy(struct weston_pick_grid *grid)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(grid->buckets); i++)
+		free(grid->buckets[i].views);
+
+	free(grid);
+}
+
+static uint32_t
+pick_grid_cell(int32_t coord)
+{
+	/* Bias to unsigned so negative coordinates map to cells too. */
+	return (uint32_t)((int64_t)coord - INT32_MIN) >> PICK_GRID_CELL_SHIFT;
+}
+
+static struct pick_grid_bucket *
+pick_grid_get_bucket(struct weston_pick_grid *grid, uint32_t cx, uint32_t cy)
+{
+	cx &= PICK_GRID_SIZE - 1;
+	cy &= PICK_GRID_SIZE - 1;
+
+	return &grid->buckets[cy * PICK_GRID_SIZE + cx];
+}
+
+/* Returns the index of the first view in the bucket that is not above
+ * the given stacking order. */
+static unsigned int
+pick_grid_bucket_search(struct pick_grid_bucket *bucket, uint32_t order)
+{
+	unsigned int lo = 0, hi = bucket->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (bucket->views[mid]->pick.order < order)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int
+pick_grid_bucket_insert(struct pick_grid_bucket *bucket,
+			struct weston_view *view)
+{
+	struct weston_view **views;
+	unsigned int alloc, i;
+
+	if (bucket->count == bucket->alloc) {
+		alloc = bucket->alloc ? bucket->alloc * 2 : 8;
+		views = realloc(bucket->views, alloc * sizeof *views);
+		if (!views)
+			return -1;
+
+		bucket->views = views;
+		bucket->alloc = alloc;
+	}
+
+	/* Appending is the common case while rebuilding. */
+	if (bucket->count == 0 ||
+	    bucket->views[bucket->count - 1]->pick.order < view->pick.order)
+		i = bucket->count;
+	else
+		i = pick_grid_bucket_search(bucket, view->pick.order);
+
+	memmove(&bucket->views[i + 1], &bucket->views[i],
+		(bucket->count - i) * sizeof bucket->views[0]);
+	bucket->views[i] = view;
+	bucket->count++;
+
+	return 0;
+}
+
+static void
+pick_grid_bucket_remove(struct pick_grid_bucket *bucket,
+			struct weston_view *view)
+{
+	unsigned int i;
+
+	i = pick_grid_bucket_search(bucket, view->pick.order);
+	if (i == bucket->count || bucket->views[i] != view)
+		return;
+
+	bucket->count--;
+	memmove(&bucket->views[i], &bucket->views[i + 1],
+		(bucket->count - i) * sizeof bucket->views[0]);
+}
+
+/* Returns the cells covered by the view's current bounding box. */
+static pixman_box32_t
+pick_grid_view_cells(struct weston_view *view)
+{
+	pixman_box32_t *box = pixman_region32_extents(&view->transform.boundingbox);
+	pixman_box32_t cells = { 0, 0, 0, 0 };
+
+	if (box->x1 >= box->x2 || box->y1 >= box->y2)
+		return cells;
+
+	cells.x1 = pick_grid_cell(box->x1);
+	cells.y1 = pick_grid_cell(box->y1);
+	cells.x2 = pick_grid_cell(box->x2 - 1) + 1;
+	cells.y2 = pick_grid_cell(box->y2 - 1) + 1;
+
+	return cells;
+}
+
+static int
+pick_grid_view_apply(struct weston_pick_grid *grid, struct weston_view *view,
+		     bool insert)
+{
+	const pixman_box32_t *cells = &view->pick.cells;
+	struct pick_grid_bucket *bucket;
+	int32_t nx, ny, i, j;
+
+	/* A view spanning more cells than there are buckets along an axis
+	 * covers every bucket along that axis exactly once. */
+	nx = MIN(cells->x2 - cells->x1, PICK_GRID_SIZE);
+	ny = MIN(cells->y2 - cells->y1, PICK_GRID_SIZE);
+
+	for (j = 0; j < ny; j++) {
+		for (i = 0; i < nx; i++) {
+			bucket = pick_grid_get_bucket(grid, cells->x1 + i,
+						      cells->y1 + j);
+			if (!insert)
+				pick_grid_bucket_remove(bucket, view);
+			else if (pick_grid_bucket_insert(bucket, view) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+pick_grid_rebuild(struct weston_compositor *compositor)
+{
+	struct weston_pick_grid *grid = compositor->pick_grid;
+	struct weston_view *view;
+	uint32_t order = 0;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(grid->buckets); i++)
+		grid->buckets[i].count = 0;
+
+	/* Forget all views indexed so far, including those no longer
+	 * in the view list. */
+	grid->generation++;
+	if (grid->generation == 0)
+		grid->generation = 1;
+	grid->view_count = 0;
+	grid->valid = true;
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		view->pick.generation = grid->generation;
+		view->pick.order = order++;
+		view->pick.cells = pick_grid_view_cells(view);
+		grid->view_count++;
+
+		if (pick_grid_view_apply(grid, view, true) < 0) {
+			weston_log("Out of memory, disabling pick grid "
+				   "until the next view list change.\n");
+			grid->valid = false;
+			return;
+		}
+	}
+}
+
+/* Called after the view list has been rebuilt. Keeps the grid if the
+ * indexed views still appear in the same relative order, otherwise
+ * reindexes everything. Returns true if the view list changed. */
+static bool
+pick_grid_update(struct weston_compositor *compositor)
 {
+	struct weston_pick_grid *grid = compositor->pick_grid;
 	struct weston_view *view;
+	unsigned int count = 0;
+	uint32_t order = 0;
+
+	if (!grid->valid)
+		goto rebuild;
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (view->pick.generation != grid->generation)
+			goto rebuild;
+		if (count > 0 && view->pick.order <= order)
+			goto rebuild;
+
+		order = view->pick.order;
+		count++;
+	}
+
+	if (count == grid->view_count)
+		return false;
+
+rebuild:
+	pick_grid_rebuild(compositor);
+
+	return true;
+}
+
+/* Called whenever the bounding box of the view may have changed. */
+static void
+pick_grid_view_update(struct weston_view *view)
+{
+	struct weston_pick_grid *grid = view->surface->compositor->pick_grid;
+	pixman_box32_t cells;
+
+	if (!grid->valid || view->pick.generation != grid->generation)
+		return;
+
+	cells = pick_grid_view_cells(view);
+	if (cells.x1 == view->pick.cells.x1 &&
+	    cells.y1 == view->pick.cells.y1 &&
+	    cells.x2 == view->pick.cells.x2 &&
+	    cells.y2 == view->pick.cells.y2)
+		return;
+
+	pick_grid_view_apply(grid, view, false);
+	view->pick.cells = cells;
+	if (pick_grid_view_apply(grid, view, true) < 0)
+		grid->valid = false;
+}
+
+/* Called when the view leaves the view list. */
+static void
+pick_grid_view_remove(struct weston_view *view)
+{
+	struct weston_pick_grid *grid = view->surface->compositor->pick_grid;
+
+	if (view->pick.generation != grid->generation)
+		return;
+
+	if (grid->valid)
+		pick_grid_view_apply(grid, view, false);
+
+	view->pick.generation = 0;
+	grid->view_count--;
+}
+
+static bool
+view_pick(struct weston_view *view, wl_fixed_t x, wl_fixed_t y,
+	  wl_fixed_t *vx, wl_fixed_t *vy)
+{
 	wl_fixed_t view_x, view_y;
 	int view_ix, view_iy;
-	int ix = wl_fixed_to_int(x);
-	int iy = wl_fixed_to_int(y);
 
-	wl_list_for_each(view, &compositor->view_list, link) {
-		if (!pixman_region32_contains_point(
-				&view->transform.boundingbox, ix, iy, NULL))
-			continue;
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    wl_fixed_to_int(x),
+					    wl_fixed_to_int(y), NULL))
+		return false;
 
-		weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
-		view_ix = wl_fixed_to_int(view_x);
-		view_iy = wl_fixed_to_int(view_y);
+	weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
+	view_ix = wl_fixed_to_int(view_x);
+	view_iy = wl_fixed_to_int(view_y);
 
-		if (!pixman_region32_contains_point(&view->surface->input,
-						    view_ix, view_iy, NULL))
-			continue;
+	if (!pixman_region32_contains_point(&view->surface->input,
+					    view_ix, view_iy, NULL))
+		return false;
 
-		if (view->geometry.scissor_enabled &&
-		    !pixman_region32_contains_point(&view->geometry.scissor,
-						    view_ix, view_iy, NULL))
-			continue;
+	if (view->geometry.scissor_enabled &&
+	    !pixman_region32_contains_point(&view->geometry.scissor,
+					    view_ix, view_iy, NULL))
+		return false;
 
-		*vx = view_x;
-		*vy = view_y;
-		return view;
+	*vx = view_x;
+	*vy = view_y;
+
+	return true;
+}
+
+WL_EXPORT struct weston_view *
+weston_compositor_pick_view(struct weston_compositor *compositor,
+			    wl_fixed_t x, wl_fixed_t y,
+			    wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	struct weston_pick_grid *grid = compositor->pick_grid;
+	struct pick_grid_bucket *bucket;
+	struct weston_view *view;
+	unsigned int i;
+
+	if (grid->valid) {
+		bucket = pick_grid_get_bucket(grid,
+					      pick_grid_cell(wl_fixed_to_int(x)),
+					      pick_grid_cell(wl_fixed_to_int(y)));
+
+		for (i = 0; i < bucket->count; i++) {
+			view = bucket->views[i];
+			if (view_pick(view, x, y, vx, vy))
+				return view;
+		}
+	} else {
+		wl_list_for_each(view, &compositor->view_list, link) {
+			if (view_pick(view, x, y, vx, vy))
+				return view;
+		}
 	}
 
 	*vx = wl_fixed_from_int(-1000000);
@@ -1743,16 +2076,47 @@ weston_compositor_pick_view(struct weston_compositor *compositor,
 	return NULL;
 }
 
+/** Re-evaluate the pointer focus of a seat, if it may have changed
+ *
+ * \param seat The seat to repick.
+ * \return true if the focus was re-evaluated, false if nothing that could
+ * change the result happened since the last repick.
+ */
+static bool
+seat_repick_if_needed(struct weston_seat *seat)
+{
+	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+
+	if (!pointer)
+		return false;
+
+	if (pointer->pick_generation == seat->compositor->pick_generation)
+		return false;
+
+	weston_seat_repick(seat);
+
+	return true;
+}
+
 static void
-weston_compositor_repick(struct weston_compositor *compositor)
+weston_compositor_repick(struct weston_compositor *compositor,
+			 struct weston_output *output)
 {
 	struct weston_seat *seat;
+	bool repicked = false;
 
 	if (!compositor->session_active)
 		return;
 
-	wl_list_for_each(seat, &compositor->seat_list, link)
-		weston_seat_repick(seat);
+	wl_list_for_each(seat, &compositor->seat_list, link) {
+		if (seat_repick_if_needed(seat))
+			repicked = true;
+	}
+
+	if (repicked)
+		TL_POINT("core_repick", TLP_OUTPUT(output), TLP_END);
+	else
+		TL_POINT("core_repick_skipped", TLP_OUTPUT(output), TLP_END);
 }
 
 WL_EXPORT void
@@ -1768,8 +2132,11 @@ weston_view_unmap(struct weston_view *view)
 	view->plane = NULL;
 	view->is_mapped = false;
 	weston_layer_entry_remove(&view->layer_link);
+	pick_grid_view_remove(view);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
+	/* Views of sub-surfaces go away with the parent view. */
+	view->surface->compositor->view_list_needs_rebuild = true;
 	view->output_mask = 0;
 	weston_surface_assign_output(view->surface);
 
@@ -1824,6 +2191,7 @@ weston_view_destroy(struct weston_view *view)
 		weston_compositor_build_view_list(view->surface->compositor);
 	}
 
+	pick_grid_view_remove(view);
 	wl_list_remove(&view->link);
 	weston_layer_entry_remove(&view->layer_link);
 
@@ -2021,12 +2389,43 @@ surface_flush_damage(struct weston_surface *surface)
 	pixman_region32_clear(&surface->damage);
 }
 
+/* A view is occluded when the opaque views above it on its own plane
+ * and the planes above cover all of it. Occluded views are not drawn,
+ * and their damage does not need to be accumulated: whatever uncovers
+ * them damages the area below.
+ */
+static bool
+view_is_occluded(struct weston_view *view, pixman_region32_t *opaque)
+{
+	pixman_region32_t visible;
+	bool occluded;
+
+	if (!pixman_region32_not_empty(opaque) &&
+	    !pixman_region32_not_empty(&view->plane->clip))
+		return false;
+
+	pixman_region32_init(&visible);
+	pixman_region32_subtract(&visible, &view->transform.boundingbox,
+				 opaque);
+	pixman_region32_subtract(&visible, &visible, &view->plane->clip);
+	occluded = !pixman_region32_not_empty(&visible);
+	pixman_region32_fini(&visible);
+
+	return occluded;
+}
+
 static void
 view_accumulate_damage(struct weston_view *view,
 		       pixman_region32_t *opaque)
 {
 	pixman_region32_t damage;
 
+	view->occluded = view_is_occluded(view, opaque);
+
+	if (view->occluded ||
+	    !pixman_region32_not_empty(&view->surface->damage))
+		goto out;
+
 	pixman_region32_init(&damage);
 	if (view->transform.enabled) {
 		pixman_box32_t *extents;
@@ -2045,10 +2444,21 @@ view_accumulate_damage(struct weston_view *view,
 	pixman_region32_union(&view->plane->damage,
 			      &view->plane->damage, &damage);
 	pixman_region32_fini(&damage);
+
+out:
 	pixman_region32_copy(&view->clip, opaque);
 	pixman_region32_union(opaque, opaque, &view->transform.opaque);
 }
 
+/* Collect the damage of all views into their planes and flush the
+ * surface damage to the renderer.
+ *
+ * This is done once per repaint cycle, after the planes of all outputs
+ * in the cycle have been assigned. The plane damage is in global
+ * coordinates and each output picks up its own part of it in
+ * weston_output_repaint(); what is left stays in the planes until the
+ * outputs it belongs to get repainted.
+ */
 static void
 compositor_accumulate_damage(struct weston_compositor *ec)
 {
@@ -2211,13 +2621,27 @@ view_list_add(struct weston_compositor *compositor,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor)
 {
-	struct weston_view *view;
+	struct weston_view *view, *next;
 	struct weston_layer *layer;
 
+	/* Nothing changed the stacking since the last rebuild, so the
+	 * list is still valid; only bring the transforms up to date. */
+	if (!compositor->view_list_needs_rebuild) {
+		wl_list_for_each(view, &compositor->view_list, link)
+			weston_view_update_transform(view);
+		return;
+	}
+
+	compositor->view_list_needs_rebuild = false;
+
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_stash_subsurface_views(view->surface);
 
+	/* Views that do not make it into the new list must not keep
+	 * links into it. */
+	wl_list_for_each_safe(view, next, &compositor->view_list, link)
+		wl_list_init(&view->link);
 	wl_list_init(&compositor->view_list);
 	wl_list_for_each(layer, &compositor->layer_list, link) {
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link) {
@@ -2228,6 +2652,9 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_free_unused_subsurface_views(view->surface);
+
+	if (pick_grid_update(compositor))
+		weston_compositor_invalidate_pick(compositor);
 }
 
 static void
@@ -2255,24 +2682,102 @@ weston_output_take_feedback_list(struct weston_output *output,
 	wl_list_init(&surface->feedback_list);
 }
 
+static bool
+surface_is_occluded(struct weston_surface *surface)
+{
+	struct weston_view *view;
+
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (!wl_list_empty(&view->link) && !view->occluded)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+compositor_arm_frame_throttle(struct weston_compositor *ec,
+			      uint32_t msecs, uint32_t deadline)
+{
+	int32_t delay;
+
+	if (ec->frame_throttle_armed &&
+	    (int32_t)(deadline - ec->frame_throttle_deadline) >= 0)
+		return;
+
+	ec->frame_throttle_armed = true;
+	ec->frame_throttle_deadline = deadline;
+
+	delay = deadline - msecs;
+	wl_event_source_timer_update(ec->frame_throttle_timer, MAX(delay, 1));
+}
+
+/* Returns true if the pending frame callbacks of the surface are to be
+ * held back at time msecs, and makes sure they get sent when the
+ * interval ends even if nothing is repainted by then.
+ */
+static bool
+weston_surface_throttle_frame(struct weston_surface *surface, uint32_t msecs)
+{
+	struct weston_compositor *ec = surface->compositor;
+	uint32_t deadline;
+
+	if (ec->occluded_frame_msec == 0 || !surface_is_occluded(surface))
+		return false;
+
+	deadline = surface->frame_done_msec + ec->occluded_frame_msec;
+	if ((int32_t)(msecs - deadline) >= 0)
+		return false;
+
+	compositor_arm_frame_throttle(ec, msecs, deadline);
+
+	return true;
+}
+
 static int
-weston_output_repaint(struct weston_output *output, void *repaint_data)
+frame_throttle_timer_handler(void *data)
 {
-	struct weston_compositor *ec = output->compositor;
-	struct weston_view *ev;
-	struct weston_animation *animation, *next;
+	struct weston_compositor *ec = data;
 	struct weston_frame_callback *cb, *cnext;
-	struct wl_list frame_callback_list;
-	pixman_region32_t output_damage;
-	int r;
+	struct weston_surface *surface;
+	struct weston_view *ev;
+	struct timespec now;
+	uint32_t msecs;
 
-	if (output->destroying)
-		return 0;
+	ec->frame_throttle_armed = false;
 
-	TL_POINT("core_repaint_begin", TLP_OUTPUT(output), TLP_END);
+	weston_compositor_read_presentation_clock(ec, &now);
+	msecs = timespec_to_msec(&now);
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_view_list(ec);
+	/* Surfaces that are not occluded anymore get their callbacks from
+	 * the repaint of their output. */
+	wl_list_for_each(ev, &ec->view_list, link) {
+		surface = ev->surface;
+
+		if (!surface->output ||
+		    wl_list_empty(&surface->frame_callback_list) ||
+		    !surface_is_occluded(surface) ||
+		    weston_surface_throttle_frame(surface, msecs))
+			continue;
+
+		wl_list_for_each_safe(cb, cnext,
+				      &surface->frame_callback_list, link) {
+			wl_callback_send_done(cb->resource, msecs);
+			wl_resource_destroy(cb->resource);
+		}
+		surface->frame_done_msec = msecs;
+	}
+
+	return 0;
+}
+
+static void
+weston_output_assign_planes(struct weston_output *output, void *repaint_data)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_view *ev;
+
+	TL_POINT("core_repaint_begin", TLP_OUTPUT(output), TLP_END);
 
 	if (output->assign_planes && !output->disable_planes) {
 		output->assign_planes(output, repaint_data);
@@ -2282,22 +2787,49 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 			ev->psf_flags = 0;
 		}
 	}
+}
+
+static int
+weston_output_repaint(struct weston_output *output, void *repaint_data)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_view *ev;
+	struct weston_animation *animation, *next;
+	struct weston_frame_callback *cb, *cnext;
+	struct wl_list frame_callback_list;
+	pixman_region32_t output_damage;
+	struct timespec now;
+	int r;
+
+	weston_compositor_read_presentation_clock(ec, &now);
 
 	wl_list_init(&frame_callback_list);
 	wl_list_for_each(ev, &ec->view_list, link) {
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
-		if (ev->surface->output == output) {
+		if (ev->surface->output != output)
+			continue;
+
+		if (!timespec_is_zero(&ev->surface->commit_time)) {
+			weston_latency_record(output,
+					      WESTON_LATENCY_COMMIT_TO_REPAINT,
+					      &ev->surface->commit_time, &now);
+			ev->surface->commit_time.tv_sec = 0;
+			ev->surface->commit_time.tv_nsec = 0;
+		}
+
+		if (!wl_list_empty(&ev->surface->frame_callback_list) &&
+		    !weston_surface_throttle_frame(ev->surface,
+						   output->frame_time)) {
 			wl_list_insert_list(&frame_callback_list,
 					    &ev->surface->frame_callback_list);
 			wl_list_init(&ev->surface->frame_callback_list);
-
-			weston_output_take_feedback_list(output, ev->surface);
+			ev->surface->frame_done_msec = output->frame_time;
 		}
-	}
 
-	compositor_accumulate_damage(ec);
+		weston_output_take_feedback_list(output, ev->surface);
+	}
 
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
@@ -2316,7 +2848,7 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 	if (r == 0)
 		output->repaint_status = REPAINT_AWAITING_COMPLETION;
 
-	weston_compositor_repick(ec);
+	weston_compositor_repick(ec, output);
 
 	wl_list_for_each_safe(cb, cnext, &frame_callback_list, link) {
 		wl_callback_send_done(cb->resource, output->frame_time);
@@ -2328,6 +2860,9 @@ weston_output_repaint(struct weston_output *output, void *repaint_data)
 		animation->frame(animation, output, output->frame_time);
 	}
 
+	weston_compositor_read_presentation_clock(ec, &now);
+	weston_latency_repaint_posted(output, &now);
+
 	TL_POINT("core_repaint_posted", TLP_OUTPUT(output), TLP_END);
 
 	return r;
@@ -2340,48 +2875,37 @@ weston_output_schedule_repaint_reset(struct weston_output *output)
 	TL_POINT("core_repaint_exit_loop", TLP_OUTPUT(output), TLP_END);
 }
 
-static int
-weston_output_maybe_repaint(struct weston_output *output, struct timespec *now,
-			    void *repaint_data)
+static bool
+weston_output_repaint_is_due(struct weston_output *output,
+			     const struct timespec *now)
 {
 	struct weston_compositor *compositor = output->compositor;
-	int ret = 0;
-	int64_t msec_to_repaint;
 
 	/* We're not ready yet; come back to make a decision later. */
 	if (output->repaint_status != REPAINT_SCHEDULED)
-		return ret;
+		return false;
 
-	msec_to_repaint = timespec_sub_to_msec(&output->next_repaint, now);
-	if (msec_to_repaint > 1)
-		return ret;
+	/* The repaint timer has nanosecond resolution, an output that is
+	 * not due yet gets its own wakeup. */
+	if (timespec_sub_to_nsec(&output->next_repaint, now) > 0)
+		return false;
 
 	/* If we're sleeping, drop the repaint machinery entirely; we will
 	 * explicitly repaint all outputs when we come back. */
 	if (compositor->state == WESTON_COMPOSITOR_SLEEPING ||
 	    compositor->state == WESTON_COMPOSITOR_OFFSCREEN)
-		goto err;
+		goto drop;
 
 	/* We don't actually need to repaint this output; drop it from
 	 * repaint until something causes damage. */
-	if (!output->repaint_needed)
-		goto err;
-
-	/* If repaint fails, we aren't going to get weston_output_finish_frame
-	 * to trigger a new repaint, so drop it from repaint and hope
-	 * something schedules a successful repaint later. As repainting may
-	 * take some time, re-read our clock as a courtesy to the next
-	 * output. */
-	ret = weston_output_repaint(output, repaint_data);
-	weston_compositor_read_presentation_clock(compositor, now);
-	if (ret != 0)
-		goto err;
+	if (!output->repaint_needed || output->destroying)
+		goto drop;
 
-	return ret;
+	return true;
 
-err:
+drop:
 	weston_output_schedule_repaint_reset(output);
-	return ret;
+	return false;
 }
 
 static void
@@ -2390,20 +2914,21 @@ output_repaint_timer_arm(struct weston_compositor *compositor)
 	struct weston_output *output;
 	bool any_should_repaint = false;
 	struct timespec now;
-	int64_t msec_to_next = INT64_MAX;
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+	int64_t nsec_to_next = INT64_MAX;
 
 	weston_compositor_read_presentation_clock(compositor, &now);
 
 	wl_list_for_each(output, &compositor->output_list, link) {
-		int64_t msec_to_this;
+		int64_t nsec_to_this;
 
 		if (output->repaint_status != REPAINT_SCHEDULED)
 			continue;
 
-		msec_to_this = timespec_sub_to_msec(&output->next_repaint,
+		nsec_to_this = timespec_sub_to_nsec(&output->next_repaint,
 						    &now);
-		if (!any_should_repaint || msec_to_this < msec_to_next)
-			msec_to_next = msec_to_this;
+		if (!any_should_repaint || nsec_to_this < nsec_to_next)
+			nsec_to_next = nsec_to_this;
 
 		any_should_repaint = true;
 	}
@@ -2411,36 +2936,118 @@ output_repaint_timer_arm(struct weston_compositor *compositor)
 	if (!any_should_repaint)
 		return;
 
-	/* Even if we should repaint immediately, add the minimum 1 ms delay.
+	/* Even if we should repaint immediately, go through the timer.
 	 * This is a workaround to allow coalescing multiple output repaints
 	 * particularly from weston_output_finish_frame()
 	 * into the same call, which would not happen if we called
-	 * output_repaint_timer_handler() directly.
+	 * output_repaint_timer_handler() directly. A zero expiry would
+	 * disarm the timer.
 	 */
-	if (msec_to_next < 1)
-		msec_to_next = 1;
+	if (nsec_to_next < 1)
+		nsec_to_next = 1;
+
+	timespec_from_nsec(&its.it_value, nsec_to_next);
+	if (timerfd_settime(compositor->repaint_timer_fd, 0, &its, NULL) < 0)
+		weston_log("failed to arm the repaint timer: %m\n");
+}
 
-	wl_event_source_timer_update(compositor->repaint_timer, msec_to_next);
+static void
+weston_output_update_repaint_cost(struct weston_output *output,
+				  const struct timespec *begin,
+				  const struct timespec *end)
+{
+	const struct timespec *start = begin;
+	int64_t cost;
+
+	/* Count from the deadline if the timer fired late, the wakeup
+	 * latency is part of the cost. */
+	if (timespec_sub_to_nsec(&output->next_repaint, begin) < 0)
+		start = &output->next_repaint;
+	cost = timespec_sub_to_nsec(end, start);
+
+	/* Rise at once, decay slowly, so one quick frame does not make the
+	 * next slow one miss its vblank. */
+	if (cost >= output->repaint_cost_nsec)
+		output->repaint_cost_nsec = cost;
+	else
+		output->repaint_cost_nsec -=
+			(output->repaint_cost_nsec - cost) / 16;
+}
+
+/* How long before the target vblank the output is to be repainted. */
+static int64_t
+weston_output_repaint_window_nsec(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t max_nsec = compositor->repaint_msec * 1000000LL;
+
+	if (!compositor->adaptive_repaint || max_nsec <= 0 ||
+	    output->repaint_cost_nsec == 0)
+		return max_nsec;
+
+	return MIN(output->repaint_cost_nsec + ADAPTIVE_REPAINT_SLACK_NSEC,
+		   max_nsec);
 }
 
 static int
-output_repaint_timer_handler(void *data)
+output_repaint_timer_handler(int fd, uint32_t mask, void *data)
 {
 	struct weston_compositor *compositor = data;
 	struct weston_output *output;
-	struct timespec now;
+	struct timespec now, end;
 	void *repaint_data = NULL;
-	int ret;
+	uint64_t expirations;
+	bool any_due = false;
+	int ret = 0;
+
+	/* Acknowledge the expiry; the timer is re-armed at the end. */
+	if (read(fd, &expirations, sizeof expirations) < 0 &&
+	    errno != EAGAIN)
+		weston_log("failed to read the repaint timer: %m\n");
 
 	weston_compositor_read_presentation_clock(compositor, &now);
 
+	/* The repaint of an output starts here, with the work shared by
+	 * all outputs due in this cycle. */
+	wl_list_for_each(output, &compositor->output_list, link) {
+		output->repaint_due = weston_output_repaint_is_due(output, &now);
+		if (output->repaint_due) {
+			weston_latency_repaint_begin(output, &now);
+			any_due = true;
+		}
+	}
+
 	if (compositor->backend->repaint_begin)
 		repaint_data = compositor->backend->repaint_begin(compositor);
 
+	/* Everything that does not depend on the output being repainted is
+	 * done once for the whole batch: rebuilding the view list, and,
+	 * once all planes are assigned, accumulating the damage. */
+	if (any_due) {
+		weston_compositor_build_view_list(compositor);
+
+		wl_list_for_each(output, &compositor->output_list, link) {
+			if (output->repaint_due)
+				weston_output_assign_planes(output,
+							    repaint_data);
+		}
+
+		compositor_accumulate_damage(compositor);
+	}
+
+	/* If repaint fails, we aren't going to get
+	 * weston_output_finish_frame to trigger a new repaint, so drop it
+	 * from repaint and hope something schedules a successful repaint
+	 * later. */
 	wl_list_for_each(output, &compositor->output_list, link) {
-		ret = weston_output_maybe_repaint(output, &now, repaint_data);
-		if (ret)
+		if (!output->repaint_due)
+			continue;
+
+		ret = weston_output_repaint(output, repaint_data);
+		if (ret) {
+			weston_output_schedule_repaint_reset(output);
 			break;
+		}
 	}
 
 	if (ret == 0) {
@@ -2453,6 +3060,18 @@ output_repaint_timer_handler(void *data)
 						        repaint_data);
 	}
 
+	if (ret == 0 && any_due) {
+		weston_compositor_read_presentation_clock(compositor, &end);
+		wl_list_for_each(output, &compositor->output_list, link) {
+			if (output->repaint_due)
+				weston_output_update_repaint_cost(output,
+								  &now, &end);
+		}
+	}
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		output->repaint_due = false;
+
 	output_repaint_timer_arm(compositor);
 
 	return 0;
@@ -2465,7 +3084,7 @@ weston_output_finish_frame(struct weston_output *output,
 {
 	struct weston_compositor *compositor = output->compositor;
 	int32_t refresh_nsec;
-	struct timespec now;
+	struct timespec now, target;
 	int64_t msec_rel;
 
 	TL_POINT("core_repaint_finished", TLP_OUTPUT(output),
@@ -2476,6 +3095,14 @@ weston_output_finish_frame(struct weston_output *output,
 
 	weston_compositor_read_presentation_clock(compositor, &now);
 
+	weston_latency_presented(output,
+				 presented_flags & WP_PRESENTATION_FEEDBACK_INVALID ?
+				 NULL : stamp);
+
+	target = output->target_vblank;
+	output->target_vblank.tv_sec = 0;
+	output->target_vblank.tv_nsec = 0;
+
 	/* If we haven't been supplied any timestamp at all, we don't have a
 	 * timebase to work against, so any delay just wastes time. Push a
 	 * repaint as soon as possible so we can get on with it. */
@@ -2484,7 +3111,10 @@ weston_output_finish_frame(struct weston_output *output,
 		goto out;
 	}
 
-	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	/* A refresh rate of 0 is an output without a fixed rate, that takes
+	 * a new frame as soon as it is done with the last one. */
+	refresh_nsec = output->current_mode->refresh ?
+		millihz_to_nsec(output->current_mode->refresh) : 0;
 	weston_presentation_feedback_present_list(&output->feedback_list,
 						  output, refresh_nsec, stamp,
 						  output->msc,
@@ -2492,9 +3122,22 @@ weston_output_finish_frame(struct weston_output *output,
 
 	output->frame_time = timespec_to_msec(stamp);
 
-	timespec_add_nsec(&output->next_repaint, stamp, refresh_nsec);
-	timespec_add_msec(&output->next_repaint, &output->next_repaint,
-			  -compositor->repaint_msec);
+	if (refresh_nsec == 0) {
+		output->next_repaint = now;
+		goto out;
+	}
+
+	/* A frame that was presented more than half a refresh cycle after
+	 * the vblank it was repainted for missed it; make the adaptive
+	 * repaint window longer. */
+	if (!timespec_is_zero(&target) &&
+	    !(presented_flags & WP_PRESENTATION_FEEDBACK_INVALID) &&
+	    timespec_sub_to_nsec(stamp, &target) > refresh_nsec / 2)
+		output->repaint_cost_nsec += ADAPTIVE_REPAINT_MISS_NSEC;
+
+	timespec_add_nsec(&output->target_vblank, stamp, refresh_nsec);
+	timespec_add_nsec(&output->next_repaint, &output->target_vblank,
+			  -weston_output_repaint_window_nsec(output));
 	msec_rel = timespec_sub_to_msec(&output->next_repaint, &now);
 
 	if (msec_rel < -1000 || msec_rel > 1000) {
@@ -2506,6 +3149,8 @@ weston_output_finish_frame(struct weston_output *output,
 		warned = true;
 
 		output->next_repaint = now;
+		output->target_vblank.tv_sec = 0;
+		output->target_vblank.tv_nsec = 0;
 	}
 
 	/* Called from restart_repaint_loop and restart happens already after
@@ -2518,6 +3163,9 @@ weston_output_finish_frame(struct weston_output *output,
 			timespec_add_nsec(&output->next_repaint,
 					  &output->next_repaint,
 					  refresh_nsec);
+			timespec_add_nsec(&output->target_vblank,
+					  &output->target_vblank,
+					  refresh_nsec);
 		}
 	}
 
@@ -2542,11 +3190,18 @@ weston_layer_entry_insert(struct weston_layer_entry *list,
 {
 	wl_list_insert(&list->link, &entry->link);
 	entry->layer = list->layer;
+	entry->layer->compositor->view_list_needs_rebuild = true;
+	weston_compositor_invalidate_pick(entry->layer->compositor);
 }
 
 WL_EXPORT void
 weston_layer_entry_remove(struct weston_layer_entry *entry)
 {
+	if (entry->layer) {
+		entry->layer->compositor->view_list_needs_rebuild = true;
+		weston_compositor_invalidate_pick(entry->layer->compositor);
+	}
+
 	wl_list_remove(&entry->link);
 	wl_list_init(&entry->link);
 	entry->layer = NULL;
@@ -2583,6 +3238,8 @@ weston_layer_set_position(struct weston_layer *layer,
 {
 	struct weston_layer *below;
 
+	layer->compositor->view_list_needs_rebuild = true;
+	weston_compositor_invalidate_pick(layer->compositor);
 	wl_list_remove(&layer->link);
 
 	/* layer_list is ordered from top to bottom, the last layer being the
@@ -2606,6 +3263,8 @@ weston_layer_set_position(struct weston_layer *layer,
 WL_EXPORT void
 weston_layer_unset_position(struct weston_layer *layer)
 {
+	layer->compositor->view_list_needs_rebuild = true;
+	weston_compositor_invalidate_pick(layer->compositor);
 	wl_list_remove(&layer->link);
 	wl_list_init(&layer->link);
 }
@@ -2661,6 +3320,74 @@ weston_output_schedule_repaint(struct weston_output *output)
 	TL_POINT("core_repaint_enter_loop", TLP_OUTPUT(output), TLP_END);
 }
 
+struct read_pixels_idle {
+	weston_read_pixels_done_func_t done;
+	void *data;
+	int status;
+};
+
+static void
+read_pixels_idle_done(void *data)
+{
+	struct read_pixels_idle *idle = data;
+
+	idle->done(idle->status, idle->data);
+	free(idle);
+}
+
+/** Read back pixels of an output without blocking on the renderer
+ *
+ * \param output The output to read from, with the arguments up to
+ * height as for weston_renderer::read_pixels().
+ * \param done Called from the event loop once pixels holds the result.
+ * \param data Passed to done.
+ * \return 0 if done is going to be called, -1 otherwise.
+ *
+ * Call this from the frame signal of the output, like read_pixels().
+ * pixels has to stay valid until done is called, which happens even if
+ * the output goes away in the meantime, with an error status then.
+ *
+ * Renderers without weston_renderer::read_pixels_async(), or failing
+ * to start an asynchronous read, read the pixels at once. done is
+ * still deferred to the event loop so callers see the same ordering
+ * either way.
+ */
+WL_EXPORT int
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format, void *pixels,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data)
+{
+	struct weston_renderer *renderer = output->compositor->renderer;
+	struct wl_event_loop *loop;
+	struct read_pixels_idle *idle;
+
+	if (renderer->read_pixels_async &&
+	    renderer->read_pixels_async(output, format, pixels,
+					x, y, width, height,
+					done, data) == 0)
+		return 0;
+
+	idle = zalloc(sizeof *idle);
+	if (idle == NULL)
+		return -1;
+
+	idle->done = done;
+	idle->data = data;
+	idle->status = renderer->read_pixels(output, format, pixels,
+					     x, y, width, height);
+
+	loop = wl_display_get_event_loop(output->compositor->wl_display);
+	if (!wl_event_loop_add_idle(loop, read_pixels_idle_done, idle)) {
+		free(idle);
+		return -1;
+	}
+
+	return 0;
+}
+
 WL_EXPORT void
 weston_compositor_schedule_repaint(struct weston_compositor *compositor)
 {
@@ -2830,8 +3557,10 @@ weston_surface_commit_subsurface_order(struct weston_surface *surface)
 		wl_list_remove(&sub->parent_link);
 		wl_list_insert(&surface->subsurface_list, &sub->parent_link);
 
-		if (sub->reordered)
+		if (sub->reordered) {
+			surface->compositor->view_list_needs_rebuild = true;
 			weston_surface_damage_subsurfaces(sub);
+		}
 	}
 }
 
@@ -3038,6 +3767,7 @@ weston_surface_commit_state(struct weston_surface *surface,
 {
 	struct weston_view *view;
 	pixman_region32_t opaque;
+	pixman_region32_t input;
 
 	/* wl_surface.set_buffer_transform */
 	/* wl_surface.set_buffer_scale */
@@ -3046,8 +3776,12 @@ weston_surface_commit_state(struct weston_surface *surface,
 	surface->buffer_viewport = state->buffer_viewport;
 
 	/* wl_surface.attach */
-	if (state->newly_attached)
+	if (state->newly_attached) {
 		weston_surface_attach(surface, state->buffer);
+		if (timespec_is_zero(&surface->commit_time))
+			weston_compositor_read_presentation_clock(
+				surface->compositor, &surface->commit_time);
+	}
 	weston_surface_state_set_buffer(state, NULL);
 
 	weston_surface_build_buffer_matrix(surface,
@@ -3095,9 +3829,17 @@ weston_surface_commit_state(struct weston_surface *surface,
 	pixman_region32_fini(&opaque);
 
 	/* wl_surface.set_input_region */
-	pixman_region32_intersect_rect(&surface->input, &state->input,
+	pixman_region32_init(&input);
+	pixman_region32_intersect_rect(&input, &state->input,
 				       0, 0, surface->width, surface->height);
 
+	if (!pixman_region32_equal(&input, &surface->input)) {
+		pixman_region32_copy(&surface->input, &input);
+		weston_compositor_invalidate_pick(surface->compositor);
+	}
+
+	pixman_region32_fini(&input);
+
 	/* wl_surface.frame */
 	wl_list_insert_list(&surface->frame_callback_list,
 			    &state->frame_callback_list);
@@ -3498,6 +4240,7 @@ subsurface_committed(struct weston_surface *surface, int32_t dx, int32_t dy)
 
 	if (!weston_surface_is_mapped(surface)) {
 		surface->is_mapped = true;
+		surface->compositor->view_list_needs_rebuild = true;
 
 		/* Cannot call weston_view_update_transform(),
 		 * because that would call it also for the parent surface,
@@ -3835,6 +4578,7 @@ subsurface_set_desync(struct wl_client *client, struct wl_resource *resource)
 static void
 weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 {
+	sub->surface->compositor->view_list_needs_rebuild = true;
 	wl_list_remove(&sub->parent_link);
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
@@ -3898,6 +4642,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_signal_add(&parent->destroy_signal,
 		      &sub->parent_destroy_listener);
 
+	parent->compositor->view_list_needs_rebuild = true;
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
@@ -4696,6 +5441,8 @@ weston_output_init(struct weston_output *output,
 	/* Backends must set output->name */
 	assert(output->name);
 
+	output->latency = NULL;
+
 	wl_list_init(&output->link);
 	output->enabled = false;
 
@@ -4911,6 +5658,7 @@ weston_output_destroy(struct weston_output *output)
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
 	wl_list_remove(&output->link);
+	weston_latency_output_destroy(output);
 	free(output->name);
 }
 
@@ -5207,6 +5955,15 @@ weston_environment_get_fd(const char *env)
 	return fd;
 }
 
+static void
+latency_key_binding_handler(struct weston_keyboard *keyboard, uint32_t time,
+			    uint32_t key, void *data)
+{
+	struct weston_compositor *compositor = data;
+
+	weston_latency_log(compositor);
+}
+
 static void
 timeline_key_binding_handler(struct weston_keyboard *keyboard, uint32_t time,
 			     uint32_t key, void *data)
@@ -5262,6 +6019,10 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	ec->output_id_pool = 0;
 	ec->repaint_msec = DEFAULT_REPAINT_WINDOW;
 
+	/* weston_pointer::pick_generation 0 means never picked. */
+	ec->pick_generation = 1;
+	ec->view_list_needs_rebuild = true;
+
 	ec->activate_serial = 1;
 
 	if (!wl_global_create(ec->wl_display, &wl_compositor_interface, 4,
@@ -5283,6 +6044,10 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	if (weston_input_init(ec) != 0)
 		goto fail;
 
+	ec->pick_grid = pick_grid_create();
+	if (!ec->pick_grid)
+		goto fail;
+
 	wl_list_init(&ec->view_list);
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
@@ -5307,8 +6072,20 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	loop = wl_display_get_event_loop(ec->wl_display);
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
+	if (!ec->idle_source)
+		goto fail_primary_plane;
+	ec->repaint_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					      TFD_CLOEXEC | TFD_NONBLOCK);
+	if (ec->repaint_timer_fd < 0)
+		goto fail_idle_source;
 	ec->repaint_timer =
-		wl_event_loop_add_timer(loop, output_repaint_timer_handler,
+		wl_event_loop_add_fd(loop, ec->repaint_timer_fd,
+				     WL_EVENT_READABLE,
+				     output_repaint_timer_handler, ec);
+	if (!ec->repaint_timer)
+		goto fail_repaint_timer_fd;
+	ec->frame_throttle_timer =
+		wl_event_loop_add_timer(loop, frame_throttle_timer_handler,
 					ec);
 
 	weston_layer_init(&ec->fade_layer, ec);
@@ -5320,9 +6097,18 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	weston_compositor_add_debug_binding(ec, KEY_T,
 					    timeline_key_binding_handler, ec);
+	weston_compositor_add_debug_binding(ec, KEY_L,
+					    latency_key_binding_handler, ec);
 
 	return ec;
 
+fail_repaint_timer_fd:
+	close(ec->repaint_timer_fd);
+fail_idle_source:
+	wl_event_source_remove(ec->idle_source);
+fail_primary_plane:
+	weston_plane_release(&ec->primary_plane);
+	pick_grid_destroy(ec->pick_grid);
 fail:
 	free(ec);
 	return NULL;
@@ -5334,6 +6120,9 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	struct weston_output *output, *next;
 
 	wl_event_source_remove(ec->idle_source);
+	wl_event_source_remove(ec->frame_throttle_timer);
+	if (ec->latency_log_timer)
+		wl_event_source_remove(ec->latency_log_timer);
 
 	/* Destroy all outputs associated with this compositor */
 	wl_list_for_each_safe(output, next, &ec->output_list, link)
@@ -5354,6 +6143,9 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	weston_binding_list_destroy_all(&ec->debug_binding_list);
 
 	weston_plane_release(&ec->primary_plane);
+
+	wl_event_source_remove(ec->repaint_timer);
+	close(ec->repaint_timer_fd);
 }
 
 WL_EXPORT void
@@ -5566,6 +6358,8 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 
 	weston_plugin_api_destroy_list(compositor);
 
+	pick_grid_destroy(compositor->pick_grid);
+
 	free(compositor);
 }
 
@@ -73,6 +73,7 @@ struct weston_pointer;
 struct linux_dmabuf_buffer;
 struct weston_recorder;
 struct weston_pointer_constraint;
+struct weston_pick_grid;
 
 enum weston_keyboard_modifier {
 	MODIFIER_CTRL = (1 << 0),
@@ -187,6 +188,21 @@ struct weston_output {
 	 *  next repaint should be run */
 	struct timespec next_repaint;
 
+	/** True while the output is part of the repaint batch being run
+	 *  by the repaint timer */
+	bool repaint_due;
+
+	/** Estimated time from the repaint deadline until the frame has been
+	 *  flushed to the backend, 0 if not known yet; used to place
+	 *  next_repaint when the repaint window is adaptive */
+	int64_t repaint_cost_nsec;
+
+	/** The vblank the next repaint aims at, zero if unknown */
+	struct timespec target_vblank;
+
+	/** Latency histograms, see latency.c */
+	struct weston_output_latency *latency;
+
 	struct weston_output_zoom zoom;
 	int dirty;
 	struct wl_signal frame_signal;
@@ -388,6 +404,9 @@ struct weston_pointer {
 	uint32_t button_count;
 
 	struct wl_listener output_destroy_listener;
+
+	/* weston_compositor::pick_generation at the last repick, or 0 */
+	uint64_t pick_generation;
 };
 
 
@@ -719,6 +738,10 @@ struct weston_plane {
 	struct wl_list link;
 };
 
+/** Called with 0 once the pixels are in place, or -1 if reading them
+ * failed, see weston_output_read_pixels_async() */
+typedef void (*weston_read_pixels_done_func_t)(int status, void *data);
+
 struct weston_renderer {
 	int (*read_pixels)(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
@@ -754,6 +777,29 @@ struct weston_renderer {
 	bool (*query_dmabuf_modifiers)(struct weston_compositor *ec,
 				int format, uint64_t **modifiers,
 				int *num_modifiers);
+
+	/** Copy the whole output into a dmabuf without going through the CPU
+	 *
+	 * The buffer has been imported with import_dmabuf(). On success,
+	 * fence_fd is set to a sync file signalled when the copy is done,
+	 * or -1 if it is done already. Returns -1 if the renderer cannot
+	 * copy into the buffer, see weston_screenshooter_shoot().
+	 */
+	int (*capture_dmabuf)(struct weston_output *output,
+			      struct linux_dmabuf_buffer *buffer,
+			      int *fence_fd);
+
+	/** Like read_pixels(), without waiting for the GPU to finish
+	 *
+	 * Returns -1 if the read could not be started, in which case done
+	 * is not called. See weston_output_read_pixels_async().
+	 */
+	int (*read_pixels_async)(struct weston_output *output,
+				 pixman_format_code_t format, void *pixels,
+				 uint32_t x, uint32_t y,
+				 uint32_t width, uint32_t height,
+				 weston_read_pixels_done_func_t done,
+				 void *data);
 };
 
 enum weston_capability {
@@ -888,6 +934,12 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;	/* struct weston_layer::link */
 	struct wl_list view_list;	/* struct weston_view::link */
+	/* Set when layers or sub-surface stacking change view_list */
+	bool view_list_needs_rebuild;
+	struct weston_pick_grid *pick_grid; /* spatial index of view_list */
+	/* Bumped whenever the result of weston_compositor_pick_view() may
+	 * have changed, see weston_seat_repick(). */
+	uint64_t pick_generation;
 	struct wl_list plane_list;
 	struct wl_list key_binding_list;
 	struct wl_list modifier_binding_list;
@@ -901,6 +953,7 @@ struct weston_compositor {
 	uint32_t idle_inhibit;
 	int idle_time;			/* timeout, s */
 	struct wl_event_source *repaint_timer;
+	int repaint_timer_fd;
 
 	const struct weston_pointer_grab_interface *default_pointer_grab;
 
@@ -931,6 +984,21 @@ struct weston_compositor {
 
 	clockid_t presentation_clock;
 	int32_t repaint_msec;
+	bool adaptive_repaint;	/* shorten the window to the repaint cost */
+
+	/* Minimum interval between frame callbacks of surfaces whose views
+	 * are all occluded, 0 to send them on every repaint. */
+	uint32_t occluded_frame_msec;
+	struct wl_event_source *frame_throttle_timer;
+	bool frame_throttle_armed;
+	uint32_t frame_throttle_deadline;
+
+	struct wl_event_source *latency_log_timer;
+	uint32_t latency_log_msec;
+
+	/* Threads the pixman renderer composites an output with, including
+	 * the compositor thread; 0 and 1 both mean no worker threads. */
+	uint32_t renderer_threads;
 
 	unsigned int activate_serial;
 
@@ -1041,6 +1109,8 @@ struct weston_view {
 	unsigned int click_to_activate_serial;
 
 	pixman_region32_t clip;          /* See weston_view_damage_below() */
+	bool occluded;                   /* fully covered by opaque views,
+					  * updated along with clip */
 	float alpha;                     /* part of geometry, see below */
 
 	void *renderer_state;
@@ -1072,6 +1142,10 @@ struct weston_view {
 	struct {
 		int dirty;
 
+		/* Incremented on every update, for renderers to tell when
+		 * data derived from the transformation is stale. */
+		uint32_t generation;
+
 		/* Approximations in global coordinates:
 		 * - boundingbox is guaranteed to include the whole view in
 		 *   the smallest possible single rectangle.
@@ -1108,6 +1182,16 @@ struct weston_view {
 	uint32_t psf_flags;
 
 	bool is_mapped;
+
+	/* Bookkeeping of weston_compositor::pick_grid, private to
+	 * compositor.c. The view is indexed if generation matches the
+	 * grid's generation.
+	 */
+	struct {
+		uint32_t generation;
+		uint32_t order;		/* stacking order, top is lowest */
+		pixman_box32_t cells;	/* grid cells covered by the view */
+	} pick;
 };
 
 struct weston_surface_state {
@@ -1211,6 +1295,8 @@ struct weston_surface {
 	uint32_t output_mask;
 
 	struct wl_list frame_callback_list;
+	uint32_t frame_done_msec; /* when frame callbacks were last sent */
+	struct timespec commit_time; /* first new buffer not yet repainted */
 	struct wl_list feedback_list;
 
 	struct weston_buffer_reference buffer_ref;
@@ -1446,6 +1532,13 @@ weston_output_finish_frame(struct weston_output *output,
 			   uint32_t presented_flags);
 void
 weston_output_schedule_repaint(struct weston_output *output);
+int
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format, void *pixels,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data);
 void
 weston_output_damage(struct weston_output *output);
 void
@@ -1696,6 +1789,9 @@ void
 weston_compositor_read_presentation_clock(
 			const struct weston_compositor *compositor,
 			struct timespec *ts);
+int
+weston_compositor_set_latency_log_interval(struct weston_compositor *compositor,
+					   uint32_t msec);
 
 bool
 weston_compositor_import_dmabuf(struct weston_compositor *compositor,
@@ -1891,6 +1987,10 @@ weston_transformed_region(int width, int height,
 			  int32_t scale,
 			  pixman_region32_t *src, pixman_region32_t *dest);
 
+int
+weston_region_coalesce(pixman_region32_t *region,
+		       pixman_box32_t *boxes, int max_boxes);
+
 void *
 weston_load_module(const char *name, const char *entrypoint);
 
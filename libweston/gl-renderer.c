@@ -32,6 +32,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
@@ -51,7 +52,7 @@
 #include "timeline.h"
 
 #include "gl-renderer.h"
-#include "vertex-clipping.h"
+#include "vertex-cache.h"
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-unstable-v1-server-protocol.h"
 
@@ -71,6 +72,8 @@ struct gl_shader {
 };
 
 #define BUFFER_DAMAGE_COUNT 2
+#define UPLOAD_PBO_COUNT 3
+#define UPLOAD_MAX_BOXES 16
 
 enum gl_border_status {
 	BORDER_STATUS_CLEAN = 0,
@@ -101,6 +104,9 @@ struct gl_output_state {
 
 	/* struct timeline_render_point::link */
 	struct wl_list timeline_render_point_list;
+
+	/* struct gl_read_back::link, oldest first */
+	struct wl_list read_back_list;
 };
 
 enum buffer_type {
@@ -133,6 +139,10 @@ struct dmabuf_image {
 	enum import_type import_type;
 	GLenum target;
 	struct gl_shader *shader;
+
+	/* For weston_renderer::capture_dmabuf, created on first use */
+	GLuint capture_texture;
+	GLuint capture_fbo;
 };
 
 struct yuv_plane_descriptor {
@@ -158,6 +168,10 @@ struct gl_surface_state {
 	int num_textures;
 	bool needs_full_upload;
 	pixman_region32_t texture_damage;
+	/* An SHM upload was skipped while no view needed the texture; the
+	 * core may have released its buffer reference since, so the next
+	 * draw does it from buffer_ref. */
+	bool upload_deferred;
 
 	/* These are only used by SHM surfaces to detect when we need
 	 * to do a full upload to specify a new internal texture
@@ -202,6 +216,11 @@ struct gl_renderer {
 	struct wl_array vertices;
 	struct wl_array vtxcnt;
 
+	/* Triangles and draw calls of the output being repainted */
+	struct wl_array batch_vertices;
+	struct wl_array batches;
+	GLuint vertex_buffer;
+
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
 	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
@@ -210,6 +229,19 @@ struct gl_renderer {
 
 	int has_unpack_subimage;
 
+	/* wl_shm uploads through pixel buffer objects */
+	int has_pbo_upload;
+	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+	GLuint upload_pbos[UPLOAD_PBO_COUNT];
+	int upload_pbo_index;
+
+	/* Copies of the outputs into dmabufs */
+	PFNGLBLITFRAMEBUFFERNVPROC blit_framebuffer;
+
+	/* Asynchronous read-back through pixel buffer objects */
+	GLenum read_back_usage;
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	PFNEGLQUERYWAYLANDBUFFERWL query_buffer;
@@ -252,6 +284,25 @@ struct gl_renderer {
 	PFNEGLDUPNATIVEFENCEFDANDROIDPROC dup_native_fence_fd;
 };
 
+struct gl_view_state {
+	struct weston_view *view;
+	struct vertex_cache cache[2]; /* opaque and blended part */
+
+	struct wl_listener view_destroy_listener;
+	struct wl_listener renderer_destroy_listener;
+};
+
+/* A run of triangles in gl_renderer::batch_vertices drawn with the
+ * same state */
+struct gl_batch {
+	struct weston_view *view;
+	struct gl_shader *shader;
+	GLint filter;
+	bool blend;
+	int first;
+	int count;
+};
+
 enum timeline_render_point_type {
 	TIMELINE_RENDER_POINT_TYPE_BEGIN,
 	TIMELINE_RENDER_POINT_TYPE_END
@@ -266,6 +317,21 @@ struct timeline_render_point {
 	struct wl_event_source *event_source;
 };
 
+/* A glReadPixels() into a pixel buffer object, copied out to the
+ * caller once the fence behind it signals */
+struct gl_read_back {
+	struct wl_list link; /* gl_output_state::read_back_list */
+
+	struct weston_output *output;
+	GLuint pbo;
+	GLsizeiptr size;
+	int fd;
+	struct wl_event_source *event_source;
+	void *pixels;
+	weston_read_pixels_done_func_t done;
+	void *data;
+};
+
 static PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = NULL;
 
 static inline const char *
@@ -296,6 +362,12 @@ get_surface_state(struct weston_surface *surface)
 	return (struct gl_surface_state *)surface->renderer_state;
 }
 
+static struct gl_view_state *
+get_view_state(struct weston_view *view);
+
+static void
+gl_renderer_flush_damage(struct weston_surface *surface);
+
 static inline struct gl_renderer *
 get_renderer(struct weston_compositor *ec)
 {
@@ -472,6 +544,11 @@ dmabuf_image_destroy(struct dmabuf_image *image)
 {
 	int i;
 
+	if (image->capture_fbo) {
+		glDeleteFramebuffers(1, &image->capture_fbo);
+		glDeleteTextures(1, &image->capture_texture);
+	}
+
 	for (i = 0; i < image->num_images; ++i)
 		egl_image_unref(image->images[i]);
 
@@ -518,300 +595,149 @@ gl_renderer_print_egl_error_state(void)
 		egl_error_string(code), (long)code);
 }
 
-#define max(a, b) (((a) > (b)) ? (a) : (b))
-#define min(a, b) (((a) > (b)) ? (b) : (a))
-
-/*
- * Compute the boundary vertices of the intersection of the global coordinate
- * aligned rectangle 'rect', and an arbitrary quadrilateral produced from
- * 'surf_rect' when transformed from surface coordinates into global coordinates.
- * The vertices are written to 'ex' and 'ey', and the return value is the
- * number of vertices. Vertices are produced in clockwise winding order.
- * Guarantees to produce either zero vertices, or 3-8 vertices with non-zero
- * polygon area.
- */
-static int
-calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
-		pixman_box32_t *surf_rect, GLfloat *ex, GLfloat *ey)
+static void
+triangle_debug(struct gl_renderer *gr, int first, int count)
 {
-
-	struct clip_context ctx;
-	int i, n;
-	GLfloat min_x, max_x, min_y, max_y;
-	struct polygon8 surf = {
-		{ surf_rect->x1, surf_rect->x2, surf_rect->x2, surf_rect->x1 },
-		{ surf_rect->y1, surf_rect->y1, surf_rect->y2, surf_rect->y2 },
-		4
+	static int color_idx = 0;
+	static const GLfloat color[][4] = {
+			{ 1.0, 0.0, 0.0, 1.0 },
+			{ 0.0, 1.0, 0.0, 1.0 },
+			{ 0.0, 0.0, 1.0, 1.0 },
+			{ 1.0, 1.0, 1.0, 1.0 },
 	};
+	int i;
 
-	ctx.clip.x1 = rect->x1;
-	ctx.clip.y1 = rect->y1;
-	ctx.clip.x2 = rect->x2;
-	ctx.clip.y2 = rect->y2;
-
-	/* transform surface to screen space: */
-	for (i = 0; i < surf.n; i++)
-		weston_view_to_global_float(ev, surf.x[i], surf.y[i],
-					    &surf.x[i], &surf.y[i]);
-
-	/* find bounding box: */
-	min_x = max_x = surf.x[0];
-	min_y = max_y = surf.y[0];
-
-	for (i = 1; i < surf.n; i++) {
-		min_x = min(min_x, surf.x[i]);
-		max_x = max(max_x, surf.x[i]);
-		min_y = min(min_y, surf.y[i]);
-		max_y = max(max_y, surf.y[i]);
-	}
-
-	/* First, simple bounding box check to discard early transformed
-	 * surface rects that do not intersect with the clip region:
-	 */
-	if ((min_x >= ctx.clip.x2) || (max_x <= ctx.clip.x1) ||
-	    (min_y >= ctx.clip.y2) || (max_y <= ctx.clip.y1))
-		return 0;
-
-	/* Simple case, bounding box edges are parallel to surface edges,
-	 * there will be only four edges.  We just need to clip the surface
-	 * vertices to the clip rect bounds:
-	 */
-	if (!ev->transform.enabled)
-		return clip_simple(&ctx, &surf, ex, ey);
-
-	/* Transformed case: use a general polygon clipping algorithm to
-	 * clip the surface rectangle with each side of 'rect'.
-	 * The algorithm is Sutherland-Hodgman, as explained in
-	 * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
-	 * but without looking at any of that code.
-	 */
-	n = clip_transformed(&ctx, &surf, ex, ey);
-
-	if (n < 3)
-		return 0;
-
-	return n;
+	glUseProgram(gr->solid_shader.program);
+	glUniform4fv(gr->solid_shader.color_uniform, 1,
+			color[color_idx++ % ARRAY_LENGTH(color)]);
+	for (i = 0; i < count; i += 3)
+		glDrawArrays(GL_LINE_LOOP, first + i, 3);
+	glUseProgram(gr->current_shader->program);
 }
 
 static bool
-merge_down(pixman_box32_t *a, pixman_box32_t *b, pixman_box32_t *merge)
+batch_can_merge(struct gl_batch *batch, struct weston_view *ev,
+		struct gl_shader *shader, GLint filter, bool blend)
 {
-	if (a->x1 == b->x1 && a->x2 == b->x2 && a->y1 == b->y2) {
-		merge->x1 = a->x1;
-		merge->x2 = a->x2;
-		merge->y1 = b->y1;
-		merge->y2 = a->y2;
-		return true;
-	}
-	return false;
-}
-
-static int
-compress_bands(pixman_box32_t *inrects, int nrects,
-		   pixman_box32_t **outrects)
-{
-	bool merged = false;
-	pixman_box32_t *out, merge_rect;
-	int i, j, nout;
+	struct gl_surface_state *a = get_surface_state(batch->view->surface);
+	struct gl_surface_state *b = get_surface_state(ev->surface);
 
-	if (!nrects) {
-		*outrects = NULL;
-		return 0;
-	}
-
-	/* nrects is an upper bound - we're not too worried about
-	 * allocating a little extra
-	 */
-	out = malloc(sizeof(pixman_box32_t) * nrects);
-	out[0] = inrects[0];
-	nout = 1;
-	for (i = 1; i < nrects; i++) {
-		for (j = 0; j < nout; j++) {
-			merged = merge_down(&inrects[i], &out[j], &merge_rect);
-			if (merged) {
-				out[j] = merge_rect;
-				break;
-			}
-		}
-		if (!merged) {
-			out[nout] = inrects[i];
-			nout++;
-		}
-	}
-	*outrects = out;
-	return nout;
-}
-
-static int
-texture_region(struct weston_view *ev, pixman_region32_t *region,
-		pixman_region32_t *surf_region)
-{
-	struct gl_surface_state *gs = get_surface_state(ev->surface);
-	struct weston_compositor *ec = ev->surface->compositor;
-	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v, inv_width, inv_height;
-	unsigned int *vtxcnt, nvtx = 0;
-	pixman_box32_t *rects, *surf_rects;
-	pixman_box32_t *raw_rects;
-	int i, j, k, nrects, nsurf, raw_nrects;
-	bool used_band_compression;
-	raw_rects = pixman_region32_rectangles(region, &raw_nrects);
-	surf_rects = pixman_region32_rectangles(surf_region, &nsurf);
-
-	if (raw_nrects < 4) {
-		used_band_compression = false;
-		nrects = raw_nrects;
-		rects = raw_rects;
-	} else {
-		nrects = compress_bands(raw_rects, raw_nrects, &rects);
-		used_band_compression = true;
-	}
-	/* worst case we can have 8 vertices per rect (ie. clipped into
-	 * an octagon):
-	 */
-	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
-	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
-
-	inv_width = 1.0 / gs->pitch;
-        inv_height = 1.0 / gs->height;
-
-	for (i = 0; i < nrects; i++) {
-		pixman_box32_t *rect = &rects[i];
-		for (j = 0; j < nsurf; j++) {
-			pixman_box32_t *surf_rect = &surf_rects[j];
-			GLfloat sx, sy, bx, by;
-			GLfloat ex[8], ey[8];          /* edge points in screen space */
-			int n;
-
-			/* The transformed surface, after clipping to the clip region,
-			 * can have as many as eight sides, emitted as a triangle-fan.
-			 * The first vertex in the triangle fan can be chosen arbitrarily,
-			 * since the area is guaranteed to be convex.
-			 *
-			 * If a corner of the transformed surface falls outside of the
-			 * clip region, instead of emitting one vertex for the corner
-			 * of the surface, up to two are emitted for two corresponding
-			 * intersection point(s) between the surface and the clip region.
-			 *
-			 * To do this, we first calculate the (up to eight) points that
-			 * form the intersection of the clip rect and the transformed
-			 * surface.
-			 */
-			n = calculate_edges(ev, rect, surf_rect, ex, ey);
-			if (n < 3)
-				continue;
-
-			/* emit edge points: */
-			for (k = 0; k < n; k++) {
-				weston_view_from_global_float(ev, ex[k], ey[k],
-							      &sx, &sy);
-				/* position: */
-				*(v++) = ex[k];
-				*(v++) = ey[k];
-				/* texcoord: */
-				weston_surface_to_buffer_float(ev->surface,
-							       sx, sy,
-							       &bx, &by);
-				*(v++) = bx * inv_width;
-				if (gs->y_inverted) {
-					*(v++) = by * inv_height;
-				} else {
-					*(v++) = (gs->height - by) * inv_height;
-				}
-			}
+	if (batch->shader != shader || batch->filter != filter ||
+	    batch->blend != blend || batch->view->alpha != ev->alpha)
+		return false;
 
-			vtxcnt[nvtx++] = n;
-		}
-	}
+	if (a == b)
+		return true;
 
-	if (used_band_compression)
-		free(rects);
-	return nvtx;
+	/* Solid color surfaces only differ in their color. */
+	return a->num_textures == 0 && b->num_textures == 0 &&
+	       memcmp(a->color, b->color, sizeof a->color) == 0;
 }
 
+/* Turns the fans left in gl_renderer::vertices by texture_region() into
+ * a triangle list at 'v'. */
 static void
-triangle_fan_debug(struct weston_view *view, int first, int count)
+fans_to_triangles(struct gl_renderer *gr, int nfans, GLfloat *v)
 {
-	struct weston_compositor *compositor = view->surface->compositor;
-	struct gl_renderer *gr = get_renderer(compositor);
-	int i;
-	GLushort *buffer;
-	GLushort *index;
-	int nelems;
-	static int color_idx = 0;
-	static const GLfloat color[][4] = {
-			{ 1.0, 0.0, 0.0, 1.0 },
-			{ 0.0, 1.0, 0.0, 1.0 },
-			{ 0.0, 0.0, 1.0, 1.0 },
-			{ 1.0, 1.0, 1.0, 1.0 },
-	};
-
-	nelems = (count - 1 + count - 2) * 2;
-
-	buffer = malloc(sizeof(GLushort) * nelems);
-	index = buffer;
-
-	for (i = 1; i < count; i++) {
-		*index++ = first;
-		*index++ = first + i;
-	}
-
-	for (i = 2; i < count; i++) {
-		*index++ = first + i - 1;
-		*index++ = first + i;
+	GLfloat *fan = gr->vertices.data;
+	unsigned int *vtxcnt = gr->vtxcnt.data;
+	int i, k;
+
+	for (i = 0; i < nfans; i++) {
+		for (k = 1; k < (int) vtxcnt[i] - 1; k++) {
+			memcpy(v, &fan[0], 4 * sizeof *v);
+			memcpy(v + 4, &fan[k * 4], 8 * sizeof *v);
+			v += 12;
+		}
+		fan += vtxcnt[i] * 4;
 	}
 
-	glUseProgram(gr->solid_shader.program);
-	glUniform4fv(gr->solid_shader.color_uniform, 1,
-			color[color_idx++ % ARRAY_LENGTH(color)]);
-	glDrawElements(GL_LINES, nelems, GL_UNSIGNED_SHORT, buffer);
-	glUseProgram(gr->current_shader->program);
-	free(buffer);
+	gr->vertices.size = 0;
+	gr->vtxcnt.size = 0;
 }
 
 static void
-repaint_region(struct weston_view *ev, pixman_region32_t *region,
-		pixman_region32_t *surf_region)
+batch_region(struct weston_view *ev, pixman_region32_t *region,
+	     pixman_region32_t *surf_region, struct gl_shader *shader,
+	     GLint filter, bool blend, struct vertex_cache *cache)
 {
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v;
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct texture_geometry tex = { gs->pitch, gs->height, gs->y_inverted };
+	struct gl_batch *batch = NULL;
 	unsigned int *vtxcnt;
-	int i, first, nfans;
+	GLfloat *v;
+	size_t size;
+	int i, nfans, first, count = 0;
 
-	/* The final region to be painted is the intersection of
-	 * 'region' and 'surf_region'. However, 'region' is in the global
+	first = gr->batch_vertices.size / (4 * sizeof *v);
+
+	/* The final region to be painted is the intersection of 'region'
+	 * and 'surf_region'. However, 'region' is in the global
 	 * coordinates, and 'surf_region' is in the surface-local
 	 * coordinates. texture_region() will iterate over all pairs of
-	 * rectangles from both regions, compute the intersection
-	 * polygon for each pair, and store it as a triangle fan if
-	 * it has a non-zero area (at least 3 vertices, actually).
+	 * rectangles from both regions, compute the intersection polygon
+	 * for each pair, and store it as a triangle fan if it has a
+	 * non-zero area (at least 3 vertices, actually). The fans are
+	 * turned into a triangle list, so that all views with the same
+	 * state can be drawn with a single call.
+	 *
+	 * Transforming the surface rectangles is the expensive part, so
+	 * for cached views the fans are computed once against the whole
+	 * bounding box, and only clipped against 'region' on each repaint.
 	 */
-	nfans = texture_region(ev, region, surf_region);
+	if (cache) {
+		if (!vertex_cache_matches(cache, ev, surf_region, &tex))
+			vertex_cache_update(cache, ev, surf_region, &tex);
+
+		nfans = vertex_cache_clip(cache, region,
+					  &gr->vertices, &gr->vtxcnt);
+	} else {
+		nfans = texture_region(ev, region, surf_region, &tex,
+				       &gr->vertices, &gr->vtxcnt);
+	}
 
-	v = gr->vertices.data;
 	vtxcnt = gr->vtxcnt.data;
+	for (i = 0; i < nfans; i++)
+		count += (vtxcnt[i] - 2) * 3;
+
+	size = count * 4 * sizeof *v;
+	v = wl_array_add(&gr->batch_vertices, size);
+	if (!v) {
+		gr->vertices.size = 0;
+		gr->vtxcnt.size = 0;
+		return;
+	}
 
-	/* position: */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glEnableVertexAttribArray(0);
+	fans_to_triangles(gr, nfans, v);
 
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
-	glEnableVertexAttribArray(1);
+	count = size / (4 * sizeof *v);
+	if (count == 0)
+		return;
 
-	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
-		if (gr->fan_debug)
-			triangle_fan_debug(ev, first, vtxcnt[i]);
-		first += vtxcnt[i];
+	if (gr->batches.size > 0)
+		batch = (struct gl_batch *)
+			((char *) gr->batches.data + gr->batches.size) - 1;
+
+	if (batch && batch->first + batch->count == first &&
+	    batch_can_merge(batch, ev, shader, filter, blend)) {
+		batch->count += count;
+		return;
 	}
 
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(0);
+	batch = wl_array_add(&gr->batches, sizeof *batch);
+	if (!batch) {
+		gr->batch_vertices.size -= size;
+		return;
+	}
 
-	gr->vertices.size = 0;
-	gr->vtxcnt.size = 0;
+	batch->view = ev;
+	batch->shader = shader;
+	batch->filter = filter;
+	batch->blend = blend;
+	batch->first = first;
+	batch->count = count;
 }
 
 static int
@@ -886,6 +812,8 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_view_state *vs = NULL;
+	struct gl_shader *shader;
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
 	/* opaque region in surface coordinates: */
@@ -893,7 +821,6 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
 	GLint filter;
-	int i;
 
 	/* In case of a runtime switch of renderers, we may not have received
 	 * an attach for this surface since the switch. In that case we don't
@@ -909,28 +836,15 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-
-	if (gr->fan_debug) {
-		use_shader(gr, &gr->solid_shader);
-		shader_uniforms(&gr->solid_shader, ev, output);
-	}
-
-	use_shader(gr, gs->shader);
-	shader_uniforms(gs->shader, ev, output);
-
 	if (ev->transform.enabled || output->zoom.active ||
 	    output->current_scale != ev->surface->buffer_viewport.buffer.scale)
 		filter = GL_LINEAR;
 	else
 		filter = GL_NEAREST;
 
-	for (i = 0; i < gs->num_textures; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
-	}
+	/* Clipping transformed views is expensive, keep the result. */
+	if (ev->transform.enabled)
+		vs = get_view_state(ev);
 
 	/* blended region is whole surface minus opaque region: */
 	pixman_region32_init_rect(&surface_blend, 0, 0,
@@ -951,29 +865,23 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		pixman_region32_copy(&surface_opaque, &ev->surface->opaque);
 
 	if (pixman_region32_not_empty(&surface_opaque)) {
-		if (gs->shader == &gr->texture_shader_rgba) {
+		shader = gs->shader;
+		if (shader == &gr->texture_shader_rgba) {
 			/* Special case for RGBA textures with possibly
 			 * bad data in alpha channel: use the shader
 			 * that forces texture alpha = 1.0.
 			 * Xwayland surfaces need this.
 			 */
-			use_shader(gr, &gr->texture_shader_rgbx);
-			shader_uniforms(&gr->texture_shader_rgbx, ev, output);
+			shader = &gr->texture_shader_rgbx;
 		}
 
-		if (ev->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
-
-		repaint_region(ev, &repaint, &surface_opaque);
+		batch_region(ev, &repaint, &surface_opaque, shader, filter,
+			     ev->alpha < 1.0, vs ? &vs->cache[0] : NULL);
 	}
 
-	if (pixman_region32_not_empty(&surface_blend)) {
-		use_shader(gr, gs->shader);
-		glEnable(GL_BLEND);
-		repaint_region(ev, &repaint, &surface_blend);
-	}
+	if (pixman_region32_not_empty(&surface_blend))
+		batch_region(ev, &repaint, &surface_blend, gs->shader, filter,
+			     true, vs ? &vs->cache[1] : NULL);
 
 	pixman_region32_fini(&surface_blend);
 	pixman_region32_fini(&surface_opaque);
@@ -982,15 +890,97 @@ out:
 	pixman_region32_fini(&repaint);
 }
 
+/* Upload the triangles of all views in one vertex buffer and issue one
+ * draw call per batch. */
+static void
+draw_batches(struct weston_output *output)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_surface_state *gs;
+	struct gl_batch *batch;
+	int i;
+
+	if (gr->batches.size == 0)
+		goto out;
+
+	if (!gr->vertex_buffer)
+		glGenBuffers(1, &gr->vertex_buffer);
+
+	glBindBuffer(GL_ARRAY_BUFFER, gr->vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, gr->batch_vertices.size,
+		     gr->batch_vertices.data, GL_STREAM_DRAW);
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof(GLfloat), (void *) 0);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof(GLfloat),
+			      (void *) (2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(1);
+
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	if (gr->fan_debug) {
+		batch = gr->batches.data;
+		use_shader(gr, &gr->solid_shader);
+		shader_uniforms(&gr->solid_shader, batch->view, output);
+	}
+
+	wl_array_for_each(batch, &gr->batches) {
+		gs = get_surface_state(batch->view->surface);
+
+		use_shader(gr, batch->shader);
+		shader_uniforms(batch->shader, batch->view, output);
+
+		for (i = 0; i < gs->num_textures; i++) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(gs->target, gs->textures[i]);
+			glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER,
+					batch->filter);
+			glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER,
+					batch->filter);
+		}
+
+		if (batch->blend)
+			glEnable(GL_BLEND);
+		else
+			glDisable(GL_BLEND);
+
+		glDrawArrays(GL_TRIANGLES, batch->first, batch->count);
+		if (gr->fan_debug)
+			triangle_debug(gr, batch->first, batch->count);
+	}
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+out:
+	gr->batch_vertices.size = 0;
+	gr->batches.size = 0;
+}
+
 static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_view *view;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	wl_list_for_each_reverse(view, &compositor->view_list, link) {
+		if (view->plane != &compositor->primary_plane ||
+		    view->occluded)
+			continue;
+
+		if (get_surface_state(view->surface)->upload_deferred)
+			gl_renderer_flush_damage(view->surface);
+
+		draw_view(view, output, damage);
+	}
+
+	draw_batches(output);
 }
 
 static void
@@ -1388,6 +1378,316 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+/* The context has to be current. */
+static void
+gl_read_back_finish(struct gl_read_back *rb, int status)
+{
+	wl_list_remove(&rb->link);
+	wl_event_source_remove(rb->event_source);
+	close(rb->fd);
+	glDeleteBuffers(1, &rb->pbo);
+
+	rb->done(status, rb->data);
+	free(rb);
+}
+
+static int
+gl_read_back_handler(int fd, uint32_t mask, void *data)
+{
+	struct gl_read_back *rb = data;
+	struct gl_renderer *gr = get_renderer(rb->output->compositor);
+	void *map;
+	int status = -1;
+
+	if (use_output(rb->output) < 0)
+		goto out;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, rb->pbo);
+	map = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER_NV, 0, rb->size,
+				   GL_MAP_READ_BIT_EXT);
+	if (map) {
+		memcpy(rb->pixels, map, rb->size);
+		if (gr->unmap_buffer(GL_PIXEL_PACK_BUFFER_NV))
+			status = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+
+out:
+	gl_read_back_finish(rb, status);
+
+	return 0;
+}
+
+/* Read into a pixel buffer object and return right away. The fence
+ * after the read is watched on the event loop, the buffer is only
+ * mapped once it has signalled, so neither side waits for the other. */
+static int
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      pixman_format_code_t format, void *pixels,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height,
+			      weston_read_pixels_done_func_t done,
+			      void *data)
+{
+	static const EGLint attribs[] = { EGL_NONE };
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct wl_event_loop *loop;
+	struct gl_read_back *rb;
+	EGLSyncKHR sync;
+	GLenum gl_format;
+
+	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	rb = zalloc(sizeof *rb);
+	if (rb == NULL)
+		return -1;
+
+	rb->size = (GLsizeiptr) width * height * 4;
+	glGenBuffers(1, &rb->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, rb->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER_NV, rb->size, NULL,
+		     gr->read_back_usage);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+
+	sync = gr->create_sync(gr->egl_display,
+			       EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+	if (sync == EGL_NO_SYNC_KHR)
+		goto err;
+
+	/* The fence only gets a file descriptor once it is flushed */
+	glFlush();
+	rb->fd = gr->dup_native_fence_fd(gr->egl_display, sync);
+	gr->destroy_sync(gr->egl_display, sync);
+	if (rb->fd == EGL_NO_NATIVE_FENCE_FD_ANDROID)
+		goto err;
+
+	loop = wl_display_get_event_loop(output->compositor->wl_display);
+	rb->event_source = wl_event_loop_add_fd(loop, rb->fd,
+						WL_EVENT_READABLE,
+						gl_read_back_handler, rb);
+	if (rb->event_source == NULL) {
+		close(rb->fd);
+		goto err;
+	}
+
+	rb->output = output;
+	rb->pixels = pixels;
+	rb->done = done;
+	rb->data = data;
+	wl_list_insert(go->read_back_list.prev, &rb->link);
+
+	return 0;
+
+err:
+	glDeleteBuffers(1, &rb->pbo);
+	free(rb);
+
+	return -1;
+}
+
+static int
+gl_renderer_capture_dmabuf(struct weston_output *output,
+			   struct linux_dmabuf_buffer *dmabuf,
+			   int *fence_fd)
+{
+	static const EGLint attribs[] = { EGL_NONE };
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct dmabuf_image *image = linux_dmabuf_buffer_get_user_data(dmabuf);
+	int32_t x, y, width, height, y1, y2;
+	EGLSyncKHR sync;
+	GLenum status;
+
+	*fence_fd = -1;
+
+	/* The buffer has to be renderable as a whole */
+	if (!image || image->import_type != IMPORT_TYPE_DIRECT ||
+	    image->target != GL_TEXTURE_2D)
+		return -1;
+
+	if (use_output(output) < 0)
+		return -1;
+
+	if (!image->capture_fbo) {
+		glGenTextures(1, &image->capture_texture);
+		glBindTexture(GL_TEXTURE_2D, image->capture_texture);
+		gr->image_target_texture_2d(GL_TEXTURE_2D,
+					    image->images[0]->image);
+
+		glGenFramebuffers(1, &image->capture_fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, image->capture_fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				       GL_TEXTURE_2D, image->capture_texture, 0);
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		if (status != GL_FRAMEBUFFER_COMPLETE) {
+			weston_log("dmabuf cannot be rendered to, "
+				   "framebuffer status 0x%x\n", status);
+			glDeleteFramebuffers(1, &image->capture_fbo);
+			glDeleteTextures(1, &image->capture_texture);
+			image->capture_fbo = 0;
+			image->capture_texture = 0;
+			return -1;
+		}
+	}
+
+	x = go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y = go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+	width = output->current_mode->width;
+	height = output->current_mode->height;
+
+	/* The framebuffer is bottom up, the buffer top down unless the
+	 * client asked otherwise. */
+	if (dmabuf->attributes.flags &
+	    ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT) {
+		y1 = 0;
+		y2 = height;
+	} else {
+		y1 = height;
+		y2 = 0;
+	}
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER_NV, image->capture_fbo);
+	gr->blit_framebuffer(x, y, x + width, y + height,
+			     0, y1, width, y2,
+			     GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	/* Without a fence to wait on, the copy is done when this returns */
+	sync = EGL_NO_SYNC_KHR;
+	if (gr->has_native_fence_sync)
+		sync = gr->create_sync(gr->egl_display,
+				       EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+	if (sync == EGL_NO_SYNC_KHR) {
+		glFinish();
+		return 0;
+	}
+
+	/* The fence only gets a file descriptor once it is flushed */
+	glFlush();
+	*fence_fd = gr->dup_native_fence_fd(gr->egl_display, sync);
+	gr->destroy_sync(gr->egl_display, sync);
+
+	if (*fence_fd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+		*fence_fd = -1;
+		glFinish();
+	}
+
+	return 0;
+}
+
+/* Copy the damaged rows of a single plane wl_shm buffer into a pixel
+ * buffer object and upload the texture from there. The copy is all the
+ * compositor waits for; the transfer to the texture happens while the
+ * rest of the output is being repainted. Returns false if the buffer
+ * could not be mapped. */
+static bool
+flush_damage_pbo(struct weston_surface *surface, uint8_t *data)
+{
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct weston_buffer *buffer = gs->buffer_ref.buffer;
+	int32_t stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	pixman_box32_t boxes[UPLOAD_MAX_BOXES], r;
+	int32_t y1, y2;
+	GLsizeiptr size;
+	void *map;
+	int i, n;
+
+	if (gs->needs_full_upload) {
+		y1 = 0;
+		y2 = buffer->height;
+	} else {
+		r = weston_surface_to_buffer_rect(surface,
+				*pixman_region32_extents(&gs->texture_damage));
+		y1 = MAX(r.y1, 0);
+		y2 = MIN(r.y2, buffer->height);
+	}
+
+	if (y2 <= y1)
+		return true;
+
+	size = (GLsizeiptr) (y2 - y1) * stride;
+
+	if (!gr->upload_pbos[0])
+		glGenBuffers(UPLOAD_PBO_COUNT, gr->upload_pbos);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV,
+		     gr->upload_pbos[gr->upload_pbo_index]);
+	gr->upload_pbo_index = (gr->upload_pbo_index + 1) % UPLOAD_PBO_COUNT;
+
+	/* The GPU may still be reading the previous contents; let the
+	 * driver hand out new storage instead of waiting for it. */
+	glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, size, NULL, GL_STREAM_DRAW);
+	map = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER_NV, 0, size,
+				   GL_MAP_WRITE_BIT_EXT |
+				   GL_MAP_INVALIDATE_BUFFER_BIT_EXT);
+	if (!map) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return false;
+	}
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	memcpy(map, data + (size_t) y1 * stride, size);
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	if (!gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER_NV)) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return false;
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
+	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
+
+	if (gs->needs_full_upload) {
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format[0],
+			     gs->pitch, buffer->height, 0,
+			     gs->gl_format[0], gs->gl_pixel_type, NULL);
+	} else {
+		n = weston_region_coalesce(&gs->texture_damage, boxes,
+					   ARRAY_LENGTH(boxes));
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface, boxes[i]);
+			r.y1 = MAX(r.y1, y1);
+			r.y2 = MIN(r.y2, y2);
+			if (r.y2 <= r.y1 || r.x2 <= r.x1)
+				continue;
+
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1 - y1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
+					r.x2 - r.x1, r.y2 - r.y1,
+					gs->gl_format[0], gs->gl_pixel_type,
+					NULL);
+		}
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+
+	return true;
+}
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
@@ -1396,7 +1696,7 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	struct weston_buffer *buffer = gs->buffer_ref.buffer;
 	struct weston_view *view;
 	bool texture_used;
-	pixman_box32_t *rectangles;
+	pixman_box32_t boxes[UPLOAD_MAX_BOXES];
 	uint8_t *data;
 	int i, j, n;
 
@@ -1409,17 +1709,22 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	/* Avoid upload, if the texture won't be used this time.
 	 * We still accumulate the damage in texture_damage, and
 	 * hold the reference to the buffer, in case the surface
-	 * migrates back to the primary plane.
+	 * migrates back to the primary plane or gets uncovered.
 	 */
 	texture_used = false;
 	wl_list_for_each(view, &surface->views, surface_link) {
-		if (view->plane == &surface->compositor->primary_plane) {
+		if (view->plane == &surface->compositor->primary_plane &&
+		    !view->occluded) {
 			texture_used = true;
 			break;
 		}
 	}
-	if (!texture_used)
+	if (!texture_used) {
+		gs->upload_deferred = true;
 		return;
+	}
+
+	gs->upload_deferred = false;
 
 	if (!pixman_region32_not_empty(&gs->texture_damage) &&
 	    !gs->needs_full_upload)
@@ -1445,6 +1750,11 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		goto done;
 	}
 
+	/* Multi-planar formats are rare enough to take the direct path. */
+	if (gr->has_pbo_upload && gs->num_textures == 1 &&
+	    gs->offset[0] == 0 && flush_damage_pbo(surface, data))
+		goto done;
+
 	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
 
 	if (gs->needs_full_upload) {
@@ -1466,12 +1776,14 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		goto done;
 	}
 
-	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
+	/* Fewer, larger uploads are cheaper than many small ones. */
+	n = weston_region_coalesce(&gs->texture_damage, boxes,
+				   ARRAY_LENGTH(boxes));
 	wl_shm_buffer_begin_access(buffer->shm_buffer);
 	for (i = 0; i < n; i++) {
 		pixman_box32_t r;
 
-		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+		r = weston_surface_to_buffer_rect(surface, boxes[i]);
 
 		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1);
 		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1);
@@ -2511,6 +2823,75 @@ surface_state_handle_renderer_destroy(struct wl_listener *listener, void *data)
 	surface_state_destroy(gs, gr);
 }
 
+static void
+view_state_destroy(struct gl_view_state *vs)
+{
+	unsigned int i;
+
+	wl_list_remove(&vs->view_destroy_listener.link);
+	wl_list_remove(&vs->renderer_destroy_listener.link);
+
+	vs->view->renderer_state = NULL;
+
+	for (i = 0; i < ARRAY_LENGTH(vs->cache); i++)
+		vertex_cache_release(&vs->cache[i]);
+
+	free(vs);
+}
+
+static void
+view_state_handle_view_destroy(struct wl_listener *listener, void *data)
+{
+	struct gl_view_state *vs;
+
+	vs = container_of(listener, struct gl_view_state,
+			  view_destroy_listener);
+
+	view_state_destroy(vs);
+}
+
+static void
+view_state_handle_renderer_destroy(struct wl_listener *listener, void *data)
+{
+	struct gl_view_state *vs;
+
+	vs = container_of(listener, struct gl_view_state,
+			  renderer_destroy_listener);
+
+	view_state_destroy(vs);
+}
+
+static struct gl_view_state *
+get_view_state(struct weston_view *view)
+{
+	struct gl_renderer *gr = get_renderer(view->surface->compositor);
+	struct gl_view_state *vs = view->renderer_state;
+	unsigned int i;
+
+	if (vs)
+		return vs;
+
+	vs = zalloc(sizeof *vs);
+	if (vs == NULL)
+		return NULL;
+
+	vs->view = view;
+
+	for (i = 0; i < ARRAY_LENGTH(vs->cache); i++)
+		vertex_cache_init(&vs->cache[i]);
+
+	view->renderer_state = vs;
+
+	vs->view_destroy_listener.notify = view_state_handle_view_destroy;
+	wl_signal_add(&view->destroy_signal, &vs->view_destroy_listener);
+
+	vs->renderer_destroy_listener.notify =
+		view_state_handle_renderer_destroy;
+	wl_signal_add(&gr->destroy_signal, &vs->renderer_destroy_listener);
+
+	return vs;
+}
+
 static int
 gl_renderer_create_surface(struct weston_surface *surface)
 {
@@ -2978,6 +3359,7 @@ gl_renderer_output_create(struct weston_output *output,
 		pixman_region32_init(&go->buffer_damage[i]);
 
 	wl_list_init(&go->timeline_render_point_list);
+	wl_list_init(&go->read_back_list);
 
 	output->renderer_state = go;
 
@@ -3020,11 +3402,19 @@ gl_renderer_output_destroy(struct weston_output *output)
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
 	struct timeline_render_point *trp, *tmp;
+	struct gl_read_back *rb, *rb_tmp;
 	int i;
 
 	for (i = 0; i < 2; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
+	/* Reads still in flight fail, their callers may be waiting on
+	 * them to free the destination. */
+	if (!wl_list_empty(&go->read_back_list))
+		use_output(output);
+	wl_list_for_each_safe(rb, rb_tmp, &go->read_back_list, link)
+		gl_read_back_finish(rb, -1);
+
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
 		       EGL_NO_CONTEXT);
@@ -3058,6 +3448,11 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
+	if (gr->vertex_buffer)
+		glDeleteBuffers(1, &gr->vertex_buffer);
+	if (gr->upload_pbos[0])
+		glDeleteBuffers(UPLOAD_PBO_COUNT, gr->upload_pbos);
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -3078,6 +3473,8 @@ gl_renderer_destroy(struct weston_compositor *ec)
 
 	wl_array_release(&gr->vertices);
 	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->batch_vertices);
+	wl_array_release(&gr->batches);
 
 	if (gr->fragment_binding)
 		weston_binding_destroy(gr->fragment_binding);
@@ -3561,6 +3958,18 @@ fan_debug_repaint_binding(struct weston_keyboard *keyboard, uint32_t time,
 	weston_compositor_damage_all(compositor);
 }
 
+static int
+get_gl_major_version(void)
+{
+	const char *version = (const char *) glGetString(GL_VERSION);
+	int major;
+
+	if (!version || sscanf(version, "OpenGL ES %d.", &major) != 1)
+		return 2;
+
+	return major;
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
@@ -3625,9 +4034,51 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (weston_check_egl_extension(extensions, "GL_EXT_unpack_subimage"))
 		gr->has_unpack_subimage = 1;
 
+	/* Pixel buffer objects and the sub-image unpack parameters are
+	 * core in GLES 3, which drivers may give us for a GLES 2 context. */
+	if (get_gl_major_version() >= 3) {
+		gr->has_unpack_subimage = 1;
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRange");
+		gr->unmap_buffer = (void *) eglGetProcAddress("glUnmapBuffer");
+	} else if (weston_check_egl_extension(extensions,
+					      "GL_NV_pixel_buffer_object") &&
+		   weston_check_egl_extension(extensions,
+					      "GL_EXT_map_buffer_range") &&
+		   weston_check_egl_extension(extensions,
+					      "GL_OES_mapbuffer")) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRangeEXT");
+		gr->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBufferOES");
+	}
+
+	if (gr->has_unpack_subimage && gr->map_buffer_range &&
+	    gr->unmap_buffer)
+		gr->has_pbo_upload = 1;
+
 	if (weston_check_egl_extension(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	if (get_gl_major_version() >= 3)
+		gr->blit_framebuffer =
+			(void *) eglGetProcAddress("glBlitFramebuffer");
+	else if (weston_check_egl_extension(extensions,
+					    "GL_NV_framebuffer_blit"))
+		gr->blit_framebuffer =
+			(void *) eglGetProcAddress("glBlitFramebufferNV");
+
+	if (gr->blit_framebuffer && gr->has_dmabuf_import)
+		gr->base.capture_dmabuf = gl_renderer_capture_dmabuf;
+
+	/* The pack side of the pixel buffer objects used for uploads */
+	if (gr->map_buffer_range && gr->unmap_buffer &&
+	    gr->has_native_fence_sync) {
+		gr->read_back_usage = get_gl_major_version() >= 3 ?
+				      GL_STREAM_READ : GL_STREAM_DRAW;
+		gr->base.read_pixels_async = gl_renderer_read_pixels_async;
+	}
+
 	glActiveTexture(GL_TEXTURE0);
 
 	if (compile_shaders(ec))
@@ -3651,6 +4102,10 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm upload through PBO: %s\n",
+			    gr->has_pbo_upload ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "asynchronous read-back: %s\n",
+			    gr->base.read_pixels_async ? "yes" : "no");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
 
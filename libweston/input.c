@@ -39,6 +39,7 @@
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "compositor.h"
+#include "latency.h"
 #include "relative-pointer-unstable-v1-server-protocol.h"
 #include "pointer-constraints-unstable-v1-server-protocol.h"
 
@@ -227,12 +228,16 @@ weston_pointer_motion_to_rel(struct weston_pointer *pointer,
 WL_EXPORT void
 weston_seat_repick(struct weston_seat *seat)
 {
-	const struct weston_pointer *pointer = weston_seat_get_pointer(seat);
+	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
 	if (!pointer)
 		return;
 
 	pointer->grab->interface->focus(pointer->grab);
+
+	/* If the focus handler changed anything itself, the generation
+	 * has moved on and the next repick will not be skipped. */
+	pointer->pick_generation = seat->compositor->pick_generation;
 }
 
 static void
@@ -1225,6 +1230,9 @@ weston_pointer_set_focus(struct weston_pointer *pointer,
 	struct wl_list *focus_resource_list;
 	int refocus = 0;
 
+	/* The focus no longer necessarily matches the last repick. */
+	pointer->pick_generation = 0;
+
 	if ((!pointer->focus && view) ||
 	    (pointer->focus && !view) ||
 	    (pointer->focus && pointer->focus->surface != view->surface) ||
@@ -1558,6 +1566,7 @@ notify_motion(struct weston_seat *seat,
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
 	weston_compositor_wake(ec);
+	weston_latency_input(ec);
 	pointer->grab->interface->motion(pointer->grab, time, event);
 }
 
@@ -1606,6 +1615,7 @@ notify_motion_absolute(struct weston_seat *seat,
 	struct weston_pointer_motion_event event = { 0 };
 
 	weston_compositor_wake(ec);
+	weston_latency_input(ec);
 
 	event = (struct weston_pointer_motion_event) {
 		.mask = WESTON_POINTER_MOTION_ABS,
@@ -1652,6 +1662,8 @@ notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	weston_latency_input(compositor);
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		if (pointer->button_count == 0) {
@@ -1684,6 +1696,7 @@ notify_axis(struct weston_seat *seat, uint32_t time,
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
 	weston_compositor_wake(compositor);
+	weston_latency_input(compositor);
 
 	if (weston_compositor_run_axis_binding(compositor, pointer,
 					       time, event))
@@ -1943,6 +1956,8 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 	struct weston_keyboard_grab *grab = keyboard->grab;
 	uint32_t *k, *end;
 
+	weston_latency_input(compositor);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 	} else {
@@ -2138,6 +2153,8 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 	wl_fixed_t x = wl_fixed_from_double(double_x);
 	wl_fixed_t y = wl_fixed_from_double(double_y);
 
+	weston_latency_input(ec);
+
 	/* Update grab's global coordinates. */
 	if (touch_id == touch->grab_touch_id && touch_type != WL_TOUCH_UP) {
 		touch->grab_x = x;
@@ -0,0 +1,350 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "latency.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/zalloc.h"
+
+/*
+ * Latency histograms of the repaint pipeline.
+ *
+ * Every output keeps one histogram per stage. Samples are sorted into
+ * buckets on a logarithmic scale of microseconds, with a few linear
+ * sub-buckets per power of two, which keeps recording a sample down to
+ * a handful of instructions while still giving percentiles within 25%.
+ * The histograms are dumped into the log, and reset, periodically or
+ * with the debug key binding mod+shift+space l.
+ */
+
+#define LATENCY_SUB_BITS 2
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKET_COUNT (27 * LATENCY_SUB_BUCKETS)
+
+/* Input that no repaint picked up within this time is not counted. */
+#define LATENCY_INPUT_MAX_NSEC 1000000000LL
+
+struct latency_histogram {
+	uint32_t buckets[LATENCY_BUCKET_COUNT];
+	uint32_t count;
+	int64_t max_usec;
+};
+
+struct weston_output_latency {
+	struct latency_histogram histograms[WESTON_LATENCY_STAGE_COUNT];
+
+	/* Zero when not set. */
+	struct timespec repaint_begin;
+	struct timespec posted;
+	struct timespec input;		/* first input since repaint began */
+	struct timespec frame_input;	/* first input before the repaint */
+};
+
+static const char *const stage_names[] = {
+	[WESTON_LATENCY_COMMIT_TO_REPAINT] = "commit to repaint",
+	[WESTON_LATENCY_REPAINT_TO_POSTED] = "repaint to posted",
+	[WESTON_LATENCY_POSTED_TO_PRESENTED] = "posted to presented",
+	[WESTON_LATENCY_INPUT_TO_PRESENTED] = "input to presented",
+};
+
+static unsigned int
+latency_bucket(int64_t usec)
+{
+	unsigned int bit, index;
+
+	if (usec < LATENCY_SUB_BUCKETS)
+		return usec < 0 ? 0 : usec;
+
+	bit = 63 - __builtin_clzll(usec);
+	index = (bit - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS +
+		((usec >> (bit - LATENCY_SUB_BITS)) &
+		 (LATENCY_SUB_BUCKETS - 1));
+
+	return MIN(index, LATENCY_BUCKET_COUNT - 1);
+}
+
+/* The first value in microseconds above the bucket */
+static int64_t
+latency_bucket_limit(unsigned int index)
+{
+	unsigned int bit, sub;
+
+	if (index < LATENCY_SUB_BUCKETS)
+		return index + 1;
+
+	bit = index / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+	sub = index % LATENCY_SUB_BUCKETS;
+
+	return (int64_t)(LATENCY_SUB_BUCKETS + sub + 1) <<
+		(bit - LATENCY_SUB_BITS);
+}
+
+static int64_t
+latency_histogram_percentile(const struct latency_histogram *histogram,
+			     unsigned int percent)
+{
+	uint64_t rank, seen = 0;
+	unsigned int i;
+
+	if (histogram->count == 0)
+		return 0;
+
+	rank = ((uint64_t)histogram->count * percent + 99) / 100;
+	for (i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	return MIN(latency_bucket_limit(i), histogram->max_usec);
+}
+
+static struct weston_output_latency *
+output_latency(struct weston_output *output)
+{
+	if (!output->latency)
+		output->latency = zalloc(sizeof *output->latency);
+
+	return output->latency;
+}
+
+static void
+timespec_clear(struct timespec *a)
+{
+	a->tv_sec = 0;
+	a->tv_nsec = 0;
+}
+
+/** Add a sample to a latency histogram of an output
+ *
+ * \param output The output the sample belongs to.
+ * \param stage The stage of the repaint pipeline.
+ * \param begin Start of the stage; if zero, no sample is taken.
+ * \param end End of the stage, in the same clock as begin.
+ */
+void
+weston_latency_record(struct weston_output *output,
+		      enum weston_latency_stage stage,
+		      const struct timespec *begin,
+		      const struct timespec *end)
+{
+	struct weston_output_latency *latency = output_latency(output);
+	struct latency_histogram *histogram;
+	int64_t usec;
+
+	if (!latency || timespec_is_zero(begin))
+		return;
+
+	usec = timespec_sub_to_nsec(end, begin) / 1000;
+	if (usec < 0)
+		usec = 0;
+
+	histogram = &latency->histograms[stage];
+	histogram->buckets[latency_bucket(usec)]++;
+	histogram->count++;
+	histogram->max_usec = MAX(histogram->max_usec, usec);
+}
+
+void
+weston_latency_repaint_begin(struct weston_output *output,
+			     const struct timespec *now)
+{
+	struct weston_output_latency *latency = output_latency(output);
+
+	if (!latency)
+		return;
+
+	latency->repaint_begin = *now;
+
+	timespec_clear(&latency->frame_input);
+	if (!timespec_is_zero(&latency->input) &&
+	    timespec_sub_to_nsec(now, &latency->input) <=
+	    LATENCY_INPUT_MAX_NSEC)
+		latency->frame_input = latency->input;
+	timespec_clear(&latency->input);
+}
+
+void
+weston_latency_repaint_posted(struct weston_output *output,
+			      const struct timespec *now)
+{
+	struct weston_output_latency *latency = output_latency(output);
+
+	if (!latency)
+		return;
+
+	weston_latency_record(output, WESTON_LATENCY_REPAINT_TO_POSTED,
+			      &latency->repaint_begin, now);
+	timespec_clear(&latency->repaint_begin);
+	latency->posted = *now;
+}
+
+/** Account for a frame having reached the screen
+ *
+ * \param output The output that finished a frame.
+ * \param stamp The presentation time, or NULL if the frame was not
+ * actually presented, such as when the repaint loop restarts.
+ */
+void
+weston_latency_presented(struct weston_output *output,
+			 const struct timespec *stamp)
+{
+	struct weston_output_latency *latency = output_latency(output);
+
+	if (!latency)
+		return;
+
+	if (stamp) {
+		weston_latency_record(output,
+				      WESTON_LATENCY_POSTED_TO_PRESENTED,
+				      &latency->posted, stamp);
+		weston_latency_record(output,
+				      WESTON_LATENCY_INPUT_TO_PRESENTED,
+				      &latency->frame_input, stamp);
+	}
+
+	timespec_clear(&latency->posted);
+	timespec_clear(&latency->frame_input);
+}
+
+/** Note the arrival of an input event
+ *
+ * The event counts for the next frame presented on every output, if
+ * that frame is repainted within a second.
+ */
+void
+weston_latency_input(struct weston_compositor *compositor)
+{
+	struct weston_output_latency *latency;
+	struct weston_output *output;
+	struct timespec now = { 0, 0 };
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		latency = output_latency(output);
+		if (!latency || !timespec_is_zero(&latency->input))
+			continue;
+
+		if (timespec_is_zero(&now))
+			weston_compositor_read_presentation_clock(compositor,
+								  &now);
+		latency->input = now;
+	}
+}
+
+void
+weston_latency_output_destroy(struct weston_output *output)
+{
+	free(output->latency);
+	output->latency = NULL;
+}
+
+/** Write the latency histograms of all outputs into the log and reset
+ * them
+ */
+void
+weston_latency_log(struct weston_compositor *compositor)
+{
+	struct weston_output_latency *latency;
+	struct latency_histogram *histogram;
+	struct weston_output *output;
+	unsigned int i;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		latency = output->latency;
+		if (!latency)
+			continue;
+
+		weston_log("Latency on output %s, in us "
+			   "(count: p50 p90 p99 max):\n", output->name);
+
+		for (i = 0; i < WESTON_LATENCY_STAGE_COUNT; i++) {
+			histogram = &latency->histograms[i];
+			weston_log_continue(STAMP_SPACE "%-20s %u: "
+				"%lld %lld %lld %lld\n", stage_names[i],
+				histogram->count,
+				(long long)latency_histogram_percentile(histogram, 50),
+				(long long)latency_histogram_percentile(histogram, 90),
+				(long long)latency_histogram_percentile(histogram, 99),
+				(long long)histogram->max_usec);
+		}
+
+		memset(latency->histograms, 0, sizeof latency->histograms);
+	}
+}
+
+static int
+latency_log_timer_handler(void *data)
+{
+	struct weston_compositor *compositor = data;
+
+	weston_latency_log(compositor);
+	wl_event_source_timer_update(compositor->latency_log_timer,
+				     compositor->latency_log_msec);
+
+	return 0;
+}
+
+/** Dump the latency histograms into the log periodically
+ *
+ * \param compositor The compositor instance.
+ * \param msec The interval in milliseconds, or 0 to stop.
+ *
+ * The histograms are collected regardless, and can also be dumped with
+ * the debug key binding mod+shift+space l.
+ *
+ * \return 0 on success, -1 on failure.
+ */
+WL_EXPORT int
+weston_compositor_set_latency_log_interval(struct weston_compositor *compositor,
+					   uint32_t msec)
+{
+	struct wl_event_loop *loop;
+
+	/* wl_event_source_timer_update() takes an int */
+	if (msec > INT32_MAX)
+		return -1;
+
+	if (!compositor->latency_log_timer) {
+		if (msec == 0)
+			return 0;
+
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		compositor->latency_log_timer =
+			wl_event_loop_add_timer(loop, latency_log_timer_handler,
+						compositor);
+		if (!compositor->latency_log_timer)
+			return -1;
+	}
+
+	compositor->latency_log_msec = msec;
+	wl_event_source_timer_update(compositor->latency_log_timer, msec);
+
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_LATENCY_H
+#define WESTON_LATENCY_H
+
+#include <time.h>
+
+struct weston_compositor;
+struct weston_output;
+
+/* Stages of the repaint pipeline that get a latency histogram on every
+ * output. */
+enum weston_latency_stage {
+	WESTON_LATENCY_COMMIT_TO_REPAINT = 0,
+	WESTON_LATENCY_REPAINT_TO_POSTED,
+	WESTON_LATENCY_POSTED_TO_PRESENTED,
+	WESTON_LATENCY_INPUT_TO_PRESENTED,
+	WESTON_LATENCY_STAGE_COUNT
+};
+
+void
+weston_latency_record(struct weston_output *output,
+		      enum weston_latency_stage stage,
+		      const struct timespec *begin,
+		      const struct timespec *end);
+
+void
+weston_latency_repaint_begin(struct weston_output *output,
+			     const struct timespec *now);
+
+void
+weston_latency_repaint_posted(struct weston_output *output,
+			      const struct timespec *now);
+
+void
+weston_latency_presented(struct weston_output *output,
+			 const struct timespec *stamp);
+
+void
+weston_latency_input(struct weston_compositor *compositor);
+
+void
+weston_latency_output_destroy(struct weston_output *output);
+
+void
+weston_latency_log(struct weston_compositor *compositor);
+
+#endif /* WESTON_LATENCY_H */
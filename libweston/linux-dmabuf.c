@@ -27,8 +27,17 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_LINUX_DMA_BUF_H
+#include <linux/dma-buf.h>
+#else
+#include "weston-dma-buf.h"
+#endif
 
 #include "compositor.h"
 #include "linux-dmabuf.h"
@@ -39,6 +48,9 @@ linux_dmabuf_buffer_destroy(struct linux_dmabuf_buffer *buffer)
 {
 	int i;
 
+	if (buffer->map)
+		munmap(buffer->map, buffer->map_size);
+
 	for (i = 0; i < buffer->attributes.n_planes; i++) {
 		close(buffer->attributes.fd[i]);
 		buffer->attributes.fd[i] = -1;
@@ -456,6 +468,95 @@ linux_dmabuf_buffer_get_user_data(struct linux_dmabuf_buffer *buffer)
 	return buffer->user_data;
 }
 
+/** Map a dmabuf for CPU access
+ *
+ * Only single plane buffers with a linear layout can be mapped. The
+ * mapping is kept until the buffer is destroyed. Accesses through it
+ * are bracketed with linux_dmabuf_buffer_begin_access() and
+ * linux_dmabuf_buffer_end_access().
+ *
+ * \param buffer The linux_dmabuf_buffer to map.
+ * \param write Whether the mapping is going to be written to.
+ * \return The first pixel of the plane, or NULL if the buffer cannot be
+ * mapped.
+ */
+WL_EXPORT void *
+linux_dmabuf_buffer_map(struct linux_dmabuf_buffer *buffer, bool write)
+{
+	struct dmabuf_attributes *attributes = &buffer->attributes;
+	size_t size;
+	void *map;
+
+	if (attributes->n_planes != 1 || attributes->modifier[0] != DRM_FORMAT_MOD_LINEAR)
+		return NULL;
+
+	if (!buffer->map) {
+		size = attributes->offset[0] +
+		       (size_t) attributes->stride[0] * attributes->height;
+
+		buffer->map_writable = true;
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   attributes->fd[0], 0);
+		if (map == MAP_FAILED) {
+			buffer->map_writable = false;
+			map = mmap(NULL, size, PROT_READ, MAP_SHARED,
+				   attributes->fd[0], 0);
+		}
+		if (map == MAP_FAILED)
+			return NULL;
+
+		buffer->map = map;
+		buffer->map_size = size;
+	}
+
+	if (write && !buffer->map_writable)
+		return NULL;
+
+	return (char *) buffer->map + attributes->offset[0];
+}
+
+static void
+linux_dmabuf_buffer_sync(struct linux_dmabuf_buffer *buffer, uint64_t flags)
+{
+	struct dma_buf_sync sync = { .flags = flags };
+	int ret;
+
+	/* Buffers not exported by a dmabuf driver, such as memfds, need no
+	 * synchronization and fail with ENOTTY. */
+	do {
+		ret = ioctl(buffer->attributes.fd[0], DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+}
+
+/** Start CPU access to a mapped dmabuf
+ *
+ * \param buffer The linux_dmabuf_buffer, mapped with
+ * linux_dmabuf_buffer_map().
+ * \param write Whether the buffer is going to be written to.
+ *
+ * \sa linux_dmabuf_buffer_end_access
+ */
+WL_EXPORT void
+linux_dmabuf_buffer_begin_access(struct linux_dmabuf_buffer *buffer,
+				 bool write)
+{
+	linux_dmabuf_buffer_sync(buffer, DMA_BUF_SYNC_START |
+				 (write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ));
+}
+
+/** End CPU access to a mapped dmabuf
+ *
+ * \param buffer The linux_dmabuf_buffer.
+ * \param write As passed to linux_dmabuf_buffer_begin_access().
+ */
+WL_EXPORT void
+linux_dmabuf_buffer_end_access(struct linux_dmabuf_buffer *buffer,
+			       bool write)
+{
+	linux_dmabuf_buffer_sync(buffer, DMA_BUF_SYNC_END |
+				 (write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ));
+}
+
 static const struct zwp_linux_dmabuf_v1_interface linux_dmabuf_implementation = {
 	linux_dmabuf_destroy,
 	linux_dmabuf_create_params
@@ -26,12 +26,17 @@
 #ifndef WESTON_LINUX_DMABUF_H
 #define WESTON_LINUX_DMABUF_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAX_DMABUF_PLANES 4
 #ifndef DRM_FORMAT_MOD_INVALID
 #define DRM_FORMAT_MOD_INVALID ((1ULL<<56) - 1)
 #endif
+#ifndef DRM_FORMAT_MOD_LINEAR
+#define DRM_FORMAT_MOD_LINEAR 0
+#endif
 
 struct linux_dmabuf_buffer;
 typedef void (*dmabuf_user_data_destroy_func)(
@@ -58,6 +63,12 @@ struct linux_dmabuf_buffer {
 	void *user_data;
 	dmabuf_user_data_destroy_func user_data_destroy_func;
 
+	/* CPU mapping of a single plane linear buffer, see
+	 * linux_dmabuf_buffer_map() */
+	void *map;
+	size_t map_size;
+	bool map_writable;
+
 	/* XXX:
 	 *
 	 * Add backend private data. This would be for the backend
@@ -87,6 +98,17 @@ linux_dmabuf_buffer_set_user_data(struct linux_dmabuf_buffer *buffer,
 void *
 linux_dmabuf_buffer_get_user_data(struct linux_dmabuf_buffer *buffer);
 
+void *
+linux_dmabuf_buffer_map(struct linux_dmabuf_buffer *buffer, bool write);
+
+void
+linux_dmabuf_buffer_begin_access(struct linux_dmabuf_buffer *buffer,
+				 bool write);
+
+void
+linux_dmabuf_buffer_end_access(struct linux_dmabuf_buffer *buffer,
+			       bool write);
+
 void
 linux_dmabuf_buffer_send_server_error(struct linux_dmabuf_buffer *buffer,
 				      const char *msg);
@@ -30,9 +30,13 @@
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <drm_fourcc.h>
 
 #include "pixman-renderer.h"
+#include "linux-dmabuf.h"
 #include "shared/helpers.h"
 
 #include <linux/input.h>
@@ -41,12 +45,17 @@ struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+	uint32_t flags;			/* enum pixman_renderer_output_flags */
+	/* Painted into the hw buffer directly since the shadow image was
+	 * last painted there, in global coordinates */
+	pixman_region32_t shadow_stale;
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
 
 	pixman_image_t *image;
+	pixman_color_t color;	/* of a solid fill image */
 	struct weston_buffer_reference buffer_ref;
 
 	struct wl_listener buffer_destroy_listener;
@@ -62,6 +71,48 @@ struct pixman_renderer {
 	struct weston_binding *debug_binding;
 
 	struct wl_signal destroy_signal;
+
+	/* Worker threads of tiled repaints, see repaint_surfaces_tiled() */
+	pthread_mutex_t pool_mutex;
+	pthread_cond_t pool_start_cond;
+	pthread_cond_t pool_done_cond;
+	unsigned int thread_count;	/* as last requested */
+	pthread_t *workers;
+	unsigned int worker_count;
+	bool pool_stop;
+	struct pixman_tile_job *job;
+	uint32_t job_serial;
+	unsigned int busy_workers;
+
+	/* wl_shm_buffer_begin/end_access() are not thread safe */
+	pthread_mutex_t shm_access_mutex;
+};
+
+#define PIXMAN_MAX_THREADS 64
+#define PIXMAN_TILES_PER_THREAD 4
+#define PIXMAN_MIN_TILE_HEIGHT 16
+
+/** The part of an output one thread paints */
+struct pixman_tile {
+	pixman_image_t *dest;		/* the job's dest or a copy of it */
+	pixman_region32_t clip;		/* in output coordinates */
+	pixman_image_t *debug_color;
+};
+
+/** A tiled repaint of an output, split into bands of rows */
+struct pixman_tile_job {
+	struct weston_output *output;
+	pixman_region32_t *damage;	/* in global coordinates */
+	pixman_image_t *dest;		/* the shadow image or the hw buffer */
+	struct wl_array *paints;	/* of struct pixman_view_paint */
+	const pixman_box32_t *copy_boxes; /* disjoint, in output coordinates */
+	int copy_box_count;
+	void (*run_tile)(struct pixman_renderer *pr,
+			 struct pixman_tile_job *job,
+			 const pixman_box32_t *box);
+	pixman_box32_t tiles[PIXMAN_MAX_THREADS * PIXMAN_TILES_PER_THREAD];
+	int tile_count;
+	int next_tile;			/* protected by pool_mutex */
 };
 
 static inline struct pixman_output_state *
@@ -221,64 +272,99 @@ region_intersect_only_translation(pixman_region32_t *result_global,
 	pixman_region32_intersect(result_global, result_global, global);
 }
 
-static void
-composite_whole(pixman_op_t op,
-		pixman_image_t *src,
-		pixman_image_t *mask,
-		pixman_image_t *dest,
-		const pixman_transform_t *transform,
-		pixman_filter_t filter)
+/** How a view is painted, prepared once per repaint
+ *
+ * The transform and the filter are set on the source images, so every
+ * view gets its own images of the surface contents. The tiles only read
+ * them, which lets the threads share them.
+ */
+struct pixman_view_paint {
+	struct weston_view *view;
+	pixman_image_t **src;		/* whole source or source clip boxes */
+	int src_count;
+	pixman_image_t *mask;		/* view alpha, or NULL */
+};
+
+static pixman_image_t *
+surface_image_copy(struct pixman_surface_state *ps)
 {
-	int32_t dest_width;
-	int32_t dest_height;
+	pixman_image_t *image = ps->image;
 
-	dest_width = pixman_image_get_width(dest);
-	dest_height = pixman_image_get_height(dest);
+	/* Solid fills have no bits to share. */
+	if (!pixman_image_get_data(image))
+		return pixman_image_create_solid_fill(&ps->color);
 
-	pixman_image_set_transform(src, transform);
-	pixman_image_set_filter(src, filter, NULL, 0);
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+						 pixman_image_get_width(image),
+						 pixman_image_get_height(image),
+						 pixman_image_get_data(image),
+						 pixman_image_get_stride(image));
+}
 
-	pixman_image_composite32(op, src, mask, dest,
-				 0, 0, /* src_x, src_y */
-				 0, 0, /* mask_x, mask_y */
-				 0, 0, /* dest_x, dest_y */
-				 dest_width, dest_height);
+static bool
+view_paint_source_whole(struct pixman_view_paint *paint,
+			struct pixman_surface_state *ps,
+			const pixman_transform_t *transform,
+			pixman_filter_t filter)
+{
+	paint->src = zalloc(sizeof paint->src[0]);
+	if (!paint->src)
+		return false;
+
+	paint->src[0] = surface_image_copy(ps);
+	if (!paint->src[0])
+		return false;
+	paint->src_count = 1;
+
+	pixman_image_set_transform(paint->src[0], transform);
+	pixman_image_set_filter(paint->src[0], filter, NULL, 0);
+
+	return true;
 }
 
-static void
-composite_clipped(pixman_image_t *src,
-		  pixman_image_t *mask,
-		  pixman_image_t *dest,
-		  const pixman_transform_t *transform,
-		  pixman_filter_t filter,
-		  pixman_region32_t *src_clip)
+/* Source clipping is used with PIXMAN_OP_OVER only, because sampling
+ * outside of a Pixman image produces (0,0,0,0) instead of discarding the
+ * fragment. */
+static bool
+view_paint_source_clipped(struct pixman_view_paint *paint,
+			  struct pixman_surface_state *ps,
+			  const pixman_transform_t *transform,
+			  pixman_filter_t filter)
 {
-	int n_box;
+	struct weston_view *view = paint->view;
+	struct weston_surface *surface = view->surface;
+	pixman_region32_t surf_region;
+	pixman_region32_t buffer_region;
 	pixman_box32_t *boxes;
-	int32_t dest_width;
-	int32_t dest_height;
 	int src_stride;
 	int bitspp;
 	pixman_format_code_t src_format;
 	void *src_data;
-	int i;
+	int n_box, i;
+	bool ret = false;
 
-	/* Hardcoded to use PIXMAN_OP_OVER, because sampling outside of
-	 * a Pixman image produces (0,0,0,0) instead of discarding the
-	 * fragment.
-	 */
-
-	dest_width = pixman_image_get_width(dest);
-	dest_height = pixman_image_get_height(dest);
-	src_format = pixman_image_get_format(src);
-	src_stride = pixman_image_get_stride(src);
+	src_format = pixman_image_get_format(ps->image);
+	src_stride = pixman_image_get_stride(ps->image);
 	bitspp = PIXMAN_FORMAT_BPP(src_format);
-	src_data = pixman_image_get_data(src);
+	src_data = pixman_image_get_data(ps->image);
 
 	assert(src_format);
 
+	pixman_region32_init_rect(&surf_region, 0, 0,
+				  surface->width, surface->height);
+	if (view->geometry.scissor_enabled)
+		pixman_region32_intersect(&surf_region, &surf_region,
+					  &view->geometry.scissor);
+
+	pixman_region32_init(&buffer_region);
+	weston_surface_to_buffer_region(surface, &surf_region, &buffer_region);
+
 	/* This would be massive overdraw, except when n_box is 1. */
-	boxes = pixman_region32_rectangles(src_clip, &n_box);
+	boxes = pixman_region32_rectangles(&buffer_region, &n_box);
+	paint->src = zalloc(MAX(n_box, 1) * sizeof paint->src[0]);
+	if (!paint->src)
+		goto out;
+
 	for (i = 0; i < n_box; i++) {
 		uint8_t *ptr = src_data;
 		pixman_image_t *boximg;
@@ -290,6 +376,9 @@ composite_clipped(pixman_image_t *src,
 					boxes[i].x2 - boxes[i].x1,
 					boxes[i].y2 - boxes[i].y1,
 					(uint32_t *)ptr, src_stride);
+		if (!boximg)
+			goto out;
+		paint->src[paint->src_count++] = boximg;
 
 		pixman_transform_translate(&adj, NULL,
 					   pixman_int_to_fixed(-boxes[i].x1),
@@ -297,13 +386,6 @@ composite_clipped(pixman_image_t *src,
 		pixman_image_set_transform(boximg, &adj);
 
 		pixman_image_set_filter(boximg, filter, NULL, 0);
-		pixman_image_composite32(PIXMAN_OP_OVER, boximg, mask, dest,
-					 0, 0, /* src_x, src_y */
-					 0, 0, /* mask_x, mask_y */
-					 0, 0, /* dest_x, dest_y */
-					 dest_width, dest_height);
-
-		pixman_image_unref(boximg);
 	}
 
 	if (n_box > 1) {
@@ -314,35 +396,44 @@ composite_clipped(pixman_image_t *src,
 				   n_box);
 		warned = true;
 	}
+
+	ret = true;
+
+out:
+	pixman_region32_fini(&buffer_region);
+	pixman_region32_fini(&surf_region);
+
+	return ret;
 }
 
-/** Paint an intersected region
- *
- * \param ev The view to be painted.
- * \param output The output being painted.
- * \param repaint_output The region to be painted in output coordinates.
- * \param source_clip The region of the source image to use, in source image
- *                    coordinates. If NULL, use the whole source image.
- * \param pixman_op Compositing operator, either SRC or OVER.
- */
 static void
-repaint_region(struct weston_view *ev, struct weston_output *output,
-	       pixman_region32_t *repaint_output,
-	       pixman_region32_t *source_clip,
-	       pixman_op_t pixman_op)
+view_paint_fini(struct pixman_view_paint *paint)
+{
+	int i;
+
+	for (i = 0; i < paint->src_count; i++)
+		pixman_image_unref(paint->src[i]);
+	free(paint->src);
+
+	if (paint->mask)
+		pixman_image_unref(paint->mask);
+}
+
+static bool
+view_paint_init(struct pixman_view_paint *paint, struct weston_view *ev,
+		struct weston_output *output)
 {
-	struct pixman_renderer *pr =
-		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
 	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
 	pixman_transform_t transform;
 	pixman_filter_t filter;
-	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
+	bool ret;
 
-	/* Clip rendering to the damaged output region */
-	pixman_image_set_clip_region32(po->shadow_image, repaint_output);
+	paint->view = ev;
+	paint->src = NULL;
+	paint->src_count = 0;
+	paint->mask = NULL;
 
 	pixman_renderer_compute_transform(&transform, ev, output);
 
@@ -351,47 +442,178 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	else
 		filter = PIXMAN_FILTER_NEAREST;
 
-	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
-
 	if (ev->alpha < 1.0) {
 		mask.alpha = 0xffff * ev->alpha;
-		mask_image = pixman_image_create_solid_fill(&mask);
-	} else {
-		mask_image = NULL;
+		paint->mask = pixman_image_create_solid_fill(&mask);
 	}
 
-	if (source_clip)
-		composite_clipped(ps->image, mask_image, po->shadow_image,
-				  &transform, filter, source_clip);
+	if (view_transformation_is_translation(ev))
+		ret = view_paint_source_whole(paint, ps, &transform, filter);
 	else
-		composite_whole(pixman_op, ps->image, mask_image,
-				po->shadow_image, &transform, filter);
+		ret = view_paint_source_clipped(paint, ps, &transform, filter);
 
-	if (mask_image)
-		pixman_image_unref(mask_image);
+	if (!ret)
+		view_paint_fini(paint);
 
-	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+	return ret;
+}
+
+/** Prepare the views of an output for painting, in painting order
+ *
+ * Pixman updates the state it derives from an image the first time the
+ * image is composited after a change. Compositing nothing here does that
+ * on the compositor thread, so the threads only read the shared images.
+ */
+static void
+view_paints_init(struct wl_array *paints, struct weston_output *output,
+		 pixman_image_t *dest)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct pixman_renderer *pr = get_renderer(compositor);
+	struct pixman_view_paint *paint;
+	struct weston_view *view;
+	int i;
+
+	wl_array_init(paints);
+
+	wl_list_for_each_reverse(view, &compositor->view_list, link) {
+		if (view->plane != &compositor->primary_plane ||
+		    view->occluded ||
+		    !(view->output_mask & (1u << output->id)) ||
+		    !get_surface_state(view->surface)->image)
+			continue;
+
+		paint = wl_array_add(paints, sizeof *paint);
+		if (!paint)
+			break;
+
+		if (!view_paint_init(paint, view, output)) {
+			paints->size -= sizeof *paint;
+			continue;
+		}
+
+		for (i = 0; i < paint->src_count; i++)
+			pixman_image_composite32(PIXMAN_OP_OVER, paint->src[i],
+						 paint->mask, dest,
+						 0, 0, 0, 0, 0, 0, 0, 0);
+	}
 
 	if (pr->repaint_debug)
+		pixman_image_composite32(PIXMAN_OP_OVER, pr->debug_color,
+					 NULL, dest, 0, 0, 0, 0, 0, 0, 0, 0);
+}
+
+static void
+view_paints_fini(struct wl_array *paints)
+{
+	struct pixman_view_paint *paint;
+
+	wl_array_for_each(paint, paints)
+		view_paint_fini(paint);
+	wl_array_release(paints);
+}
+
+static void
+buffer_begin_access(struct pixman_renderer *pr, struct weston_buffer *buffer)
+{
+	struct linux_dmabuf_buffer *dmabuf;
+
+	if (buffer->shm_buffer) {
+		pthread_mutex_lock(&pr->shm_access_mutex);
+		wl_shm_buffer_begin_access(buffer->shm_buffer);
+		pthread_mutex_unlock(&pr->shm_access_mutex);
+	} else {
+		dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+		if (dmabuf)
+			linux_dmabuf_buffer_begin_access(dmabuf, false);
+	}
+}
+
+static void
+buffer_end_access(struct pixman_renderer *pr, struct weston_buffer *buffer)
+{
+	struct linux_dmabuf_buffer *dmabuf;
+
+	if (buffer->shm_buffer) {
+		pthread_mutex_lock(&pr->shm_access_mutex);
+		wl_shm_buffer_end_access(buffer->shm_buffer);
+		pthread_mutex_unlock(&pr->shm_access_mutex);
+	} else {
+		dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+		if (dmabuf)
+			linux_dmabuf_buffer_end_access(dmabuf, false);
+	}
+}
+
+/** Paint an intersected region
+ *
+ * \param paint The view to be painted.
+ * \param output The output being painted.
+ * \param tile The part of the output to paint, the region is clipped to it.
+ * \param repaint_output The region to be painted in output coordinates.
+ * \param pixman_op Compositing operator, either SRC or OVER.
+ */
+static void
+repaint_region(struct pixman_view_paint *paint, struct weston_output *output,
+	       struct pixman_tile *tile,
+	       pixman_region32_t *repaint_output,
+	       pixman_op_t pixman_op)
+{
+	struct pixman_renderer *pr =
+		(struct pixman_renderer *) output->compositor->renderer;
+	struct pixman_surface_state *ps = get_surface_state(paint->view->surface);
+	pixman_region32_t clip;
+	int i;
+
+	pixman_region32_init(&clip);
+	pixman_region32_intersect(&clip, repaint_output, &tile->clip);
+	if (!pixman_region32_not_empty(&clip))
+		goto out;
+
+	/* Clip rendering to the damaged output region */
+	pixman_image_set_clip_region32(tile->dest, &clip);
+
+	if (ps->buffer_ref.buffer)
+		buffer_begin_access(pr, ps->buffer_ref.buffer);
+
+	for (i = 0; i < paint->src_count; i++)
+		pixman_image_composite32(pixman_op,
+					 paint->src[i], /* src */
+					 paint->mask, /* mask */
+					 tile->dest, /* dest */
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 0, 0, /* dest_x, dest_y */
+					 pixman_image_get_width (tile->dest), /* width */
+					 pixman_image_get_height (tile->dest) /* height */);
+
+	if (ps->buffer_ref.buffer)
+		buffer_end_access(pr, ps->buffer_ref.buffer);
+
+	if (tile->debug_color)
 		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
+					 tile->debug_color, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 tile->dest, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 pixman_image_get_width (tile->dest), /* width */
+					 pixman_image_get_height (tile->dest) /* height */);
+
+	pixman_image_set_clip_region32 (tile->dest, NULL);
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+out:
+	pixman_region32_fini(&clip);
 }
 
 static void
-draw_view_translated(struct weston_view *view, struct weston_output *output,
+draw_view_translated(struct pixman_view_paint *paint,
+		     struct weston_output *output,
+		     struct pixman_tile *tile,
 		     pixman_region32_t *repaint_global)
 {
+	struct weston_view *view = paint->view;
 	struct weston_surface *surface = view->surface;
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
@@ -417,7 +639,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 							  view);
 			region_global_to_output(output, &repaint_output);
 
-			repaint_region(view, output, &repaint_output, NULL,
+			repaint_region(paint, output, tile, &repaint_output,
 				       PIXMAN_OP_SRC);
 		}
 	}
@@ -428,7 +650,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 						  &surface_blend, view);
 		region_global_to_output(output, &repaint_output);
 
-		repaint_region(view, output, &repaint_output, NULL,
+		repaint_region(paint, output, tile, &repaint_output,
 			       PIXMAN_OP_OVER);
 	}
 
@@ -437,13 +659,11 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 }
 
 static void
-draw_view_source_clipped(struct weston_view *view,
+draw_view_source_clipped(struct pixman_view_paint *paint,
 			 struct weston_output *output,
+			 struct pixman_tile *tile,
 			 pixman_region32_t *repaint_global)
 {
-	struct weston_surface *surface = view->surface;
-	pixman_region32_t surf_region;
-	pixman_region32_t buffer_region;
 	pixman_region32_t repaint_output;
 
 	/* Do not bother separating the opaque region from non-opaque.
@@ -451,39 +671,24 @@ draw_view_source_clipped(struct weston_view *view,
 	 * opaque separately has no benefit.
 	 */
 
-	pixman_region32_init_rect(&surf_region, 0, 0,
-				  surface->width, surface->height);
-	if (view->geometry.scissor_enabled)
-		pixman_region32_intersect(&surf_region, &surf_region,
-					  &view->geometry.scissor);
-
-	pixman_region32_init(&buffer_region);
-	weston_surface_to_buffer_region(surface, &surf_region, &buffer_region);
-
 	pixman_region32_init(&repaint_output);
 	pixman_region32_copy(&repaint_output, repaint_global);
 	region_global_to_output(output, &repaint_output);
 
-	repaint_region(view, output, &repaint_output, &buffer_region,
-		       PIXMAN_OP_OVER);
+	repaint_region(paint, output, tile, &repaint_output, PIXMAN_OP_OVER);
 
 	pixman_region32_fini(&repaint_output);
-	pixman_region32_fini(&buffer_region);
-	pixman_region32_fini(&surf_region);
 }
 
 static void
-draw_view(struct weston_view *ev, struct weston_output *output,
+draw_view(struct pixman_view_paint *paint, struct weston_output *output,
+	  struct pixman_tile *tile,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
-	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	struct weston_view *ev = paint->view;
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
 
-	/* No buffer attached */
-	if (!ps->image)
-		return;
-
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
 				  &ev->transform.boundingbox, damage);
@@ -500,7 +705,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_view_translated(ev, output, &repaint);
+		draw_view_translated(paint, output, tile, &repaint);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -509,48 +714,420 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_view_source_clipped(ev, output, &repaint);
+		draw_view_source_clipped(paint, output, tile, &repaint);
 	}
 
 out:
 	pixman_region32_fini(&repaint);
 }
+
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+repaint_surfaces(struct weston_output *output, struct pixman_tile *tile,
+		 struct wl_array *paints, pixman_region32_t *damage)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct pixman_view_paint *paint;
+
+	wl_array_for_each(paint, paints)
+		draw_view(paint, output, tile, damage);
+}
+
+/** Another image of the same pixels, for a thread to set its clip on */
+static pixman_image_t *
+image_alias(pixman_image_t *image)
+{
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+						 pixman_image_get_width(image),
+						 pixman_image_get_height(image),
+						 pixman_image_get_data(image),
+						 pixman_image_get_stride(image));
+}
+
+static void
+paint_tile(struct pixman_renderer *pr, struct pixman_tile_job *job,
+	   const pixman_box32_t *box)
+{
+	struct pixman_tile tile;
+
+	/* The clip region is set on the destination image, so every
+	 * thread paints through its own image of the destination. */
+	tile.dest = image_alias(job->dest);
+	if (!tile.dest)
+		return;
+
+	pixman_region32_init_rect(&tile.clip, box->x1, box->y1,
+				  box->x2 - box->x1, box->y2 - box->y1);
+	tile.debug_color = pr->repaint_debug ? pr->debug_color : NULL;
+
+	repaint_surfaces(job->output, &tile, job->paints, job->damage);
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	pixman_region32_fini(&tile.clip);
+	pixman_image_unref(tile.dest);
 }
 
+static void
+run_tile_job(struct pixman_renderer *pr, struct pixman_tile_job *job)
+{
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&pr->pool_mutex);
+		i = job->next_tile++;
+		pthread_mutex_unlock(&pr->pool_mutex);
+
+		if (i >= job->tile_count)
+			break;
+
+		job->run_tile(pr, job, &job->tiles[i]);
+	}
+}
+
+static void *
+pool_worker(void *data)
+{
+	struct pixman_renderer *pr = data;
+	uint32_t serial = 0;	/* pool_stop() reset job_serial */
+
+	pthread_mutex_lock(&pr->pool_mutex);
+
+	for (;;) {
+		while (!pr->pool_stop && pr->job_serial == serial)
+			pthread_cond_wait(&pr->pool_start_cond,
+					  &pr->pool_mutex);
+		if (pr->pool_stop)
+			break;
+
+		serial = pr->job_serial;
+		pthread_mutex_unlock(&pr->pool_mutex);
+
+		run_tile_job(pr, pr->job);
+
+		pthread_mutex_lock(&pr->pool_mutex);
+		if (--pr->busy_workers == 0)
+			pthread_cond_signal(&pr->pool_done_cond);
+	}
+
+	pthread_mutex_unlock(&pr->pool_mutex);
+
+	return NULL;
+}
+
+static void
+pool_stop(struct pixman_renderer *pr)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pr->pool_mutex);
+	pr->pool_stop = true;
+	pthread_cond_broadcast(&pr->pool_start_cond);
+	pthread_mutex_unlock(&pr->pool_mutex);
+
+	for (i = 0; i < pr->worker_count; i++)
+		pthread_join(pr->workers[i], NULL);
+
+	free(pr->workers);
+	pr->workers = NULL;
+	pr->worker_count = 0;
+	pr->pool_stop = false;
+	pr->job_serial = 0;
+}
+
+/** Start worker threads so that outputs are painted by thread_count threads
+ *
+ * The compositor thread paints tiles too, so thread_count - 1 workers are
+ * started.
+ */
+static void
+pool_resize(struct pixman_renderer *pr, unsigned int thread_count)
+{
+	unsigned int count = MIN(MAX(thread_count, 1), PIXMAN_MAX_THREADS) - 1;
+
+	if (thread_count == pr->thread_count)
+		return;
+
+	pr->thread_count = thread_count;
+	pool_stop(pr);
+
+	if (count == 0)
+		return;
+
+	pr->workers = zalloc(count * sizeof pr->workers[0]);
+	if (!pr->workers)
+		return;
+
+	while (pr->worker_count < count) {
+		if (pthread_create(&pr->workers[pr->worker_count], NULL,
+				   pool_worker, pr) != 0) {
+			weston_log("pixman renderer: failed to start worker "
+				   "thread: %m\n");
+			break;
+		}
+		pr->worker_count++;
+	}
+
+	weston_log("pixman renderer: painting with %u threads\n",
+		   pr->worker_count + 1);
+}
+
+/** Split the damage into bands of rows in output coordinates
+ *
+ * Bands spanning the whole width keep every tile in contiguous memory.
+ * There are a few more tiles than threads, so that threads finishing
+ * early pick up the rest.
+ */
+static int
+split_tiles(struct pixman_tile_job *job, int thread_count)
+{
+	pixman_region32_t output_damage;
+	pixman_box32_t extents;
+	int width, height;
+	int count, tile_height, y;
+
+	pixman_region32_init(&output_damage);
+	pixman_region32_copy(&output_damage, job->damage);
+	region_global_to_output(job->output, &output_damage);
+	extents = *pixman_region32_extents(&output_damage);
+	pixman_region32_fini(&output_damage);
+
+	width = pixman_image_get_width(job->dest);
+	height = pixman_image_get_height(job->dest);
+	extents.y1 = MAX(extents.y1, 0);
+	extents.y2 = MIN(extents.y2, height);
+	if (extents.y2 <= extents.y1)
+		return 0;
+
+	count = MIN(thread_count * PIXMAN_TILES_PER_THREAD,
+		    (extents.y2 - extents.y1) / PIXMAN_MIN_TILE_HEIGHT);
+	count = MAX(count, 1);
+	tile_height = (extents.y2 - extents.y1 + count - 1) / count;
+
+	job->tile_count = 0;
+	for (y = extents.y1; y < extents.y2; y += tile_height) {
+		pixman_box32_t *tile = &job->tiles[job->tile_count++];
+
+		tile->x1 = 0;
+		tile->y1 = y;
+		tile->x2 = width;
+		tile->y2 = MIN(y + tile_height, extents.y2);
+	}
+
+	return job->tile_count;
+}
+
+/** Run the tiles of a job on all threads of the pool, and wait for them */
+static void
+run_job(struct pixman_renderer *pr, struct pixman_tile_job *job)
+{
+	pthread_mutex_lock(&pr->pool_mutex);
+	pr->job = job;
+	pr->job_serial++;
+	pr->busy_workers = pr->worker_count;
+	pthread_cond_broadcast(&pr->pool_start_cond);
+	pthread_mutex_unlock(&pr->pool_mutex);
+
+	run_tile_job(pr, job);
+
+	pthread_mutex_lock(&pr->pool_mutex);
+	while (pr->busy_workers > 0)
+		pthread_cond_wait(&pr->pool_done_cond, &pr->pool_mutex);
+	pr->job = NULL;
+	pthread_mutex_unlock(&pr->pool_mutex);
+}
+
+/** Paint the damage with all threads of the pool
+ *
+ * Every tile paints the same prepared views as a single threaded repaint,
+ * clipped to its band of the output. The bands do not overlap, so the
+ * threads never write the same pixels.
+ */
+static void
+repaint_surfaces_tiled(struct weston_output *output, pixman_image_t *dest,
+		       struct wl_array *paints, pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_tile_job job;
+
+	job.output = output;
+	job.damage = damage;
+	job.dest = dest;
+	job.paints = paints;
+	job.copy_boxes = NULL;
+	job.copy_box_count = 0;
+	job.run_tile = paint_tile;
+	job.next_tile = 0;
+	if (split_tiles(&job, pr->worker_count + 1) == 0)
+		return;
+
+	run_job(pr, &job);
+}
+
+static void
+copy_box(pixman_image_t *src, pixman_image_t *dest, const pixman_box32_t *box)
+{
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 src, /* src */
+				 NULL /* mask */,
+				 dest, /* dest */
+				 box->x1, box->y1, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 box->x1, box->y1, /* dest_x, dest_y */
+				 box->x2 - box->x1, /* width */
+				 box->y2 - box->y1 /* height */);
+}
+
+static void
+copy_tile(struct pixman_renderer *pr, struct pixman_tile_job *job,
+	  const pixman_box32_t *box)
+{
+	struct pixman_output_state *po = get_output_state(job->output);
+	pixman_image_t *src, *dest;
+	pixman_box32_t b;
+	int i;
+
+	src = image_alias(po->shadow_image);
+	dest = image_alias(job->dest);
+
+	for (i = 0; src && dest && i < job->copy_box_count; i++) {
+		b.x1 = MAX(job->copy_boxes[i].x1, box->x1);
+		b.y1 = MAX(job->copy_boxes[i].y1, box->y1);
+		b.x2 = MIN(job->copy_boxes[i].x2, box->x2);
+		b.y2 = MIN(job->copy_boxes[i].y2, box->y2);
+
+		if (b.x1 < b.x2 && b.y1 < b.y2)
+			copy_box(src, dest, &b);
+	}
+
+	if (src)
+		pixman_image_unref(src);
+	if (dest)
+		pixman_image_unref(dest);
+}
+
+/** Copy the damage from the shadow image to the hw buffer
+ *
+ * The hw buffer is often write-combined memory, where the copy is the
+ * slowest part of a repaint. With a pool, the threads copy bands of rows
+ * like they paint them.
+ */
 static void
 copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_tile_job job;
 	pixman_region32_t output_region;
+	pixman_box32_t boxes[16];
+	int n, i;
 
 	pixman_region32_init(&output_region);
 	pixman_region32_copy(&output_region, region);
 
 	region_global_to_output(output, &output_region);
 
-	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
+	/* The shadow is up to date everywhere, copying a few more pixels
+	 * in fewer rectangles is faster. The boxes are disjoint, so they
+	 * are copied one by one rather than turned back into a region,
+	 * which would split them into bands again. */
+	n = weston_region_coalesce(&output_region, boxes, ARRAY_LENGTH(boxes));
 	pixman_region32_fini(&output_region);
 
-	pixman_image_composite32(PIXMAN_OP_SRC,
-				 po->shadow_image, /* src */
-				 NULL /* mask */,
-				 po->hw_buffer, /* dest */
-				 0, 0, /* src_x, src_y */
-				 0, 0, /* mask_x, mask_y */
-				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->hw_buffer), /* width */
-				 pixman_image_get_height (po->hw_buffer) /* height */);
+	job.output = output;
+	job.damage = region;
+	job.dest = po->hw_buffer;
+	job.paints = NULL;
+	job.copy_boxes = boxes;
+	job.copy_box_count = n;
+	job.run_tile = copy_tile;
+	job.next_tile = 0;
+
+	if (pr->worker_count == 0) {
+		for (i = 0; i < n; i++)
+			copy_box(po->shadow_image, po->hw_buffer, &boxes[i]);
+	} else if (split_tiles(&job, pr->worker_count + 1) > 0) {
+		run_job(pr, &job);
+	}
+}
+
+/** Whether painting the damage would only write to the destination
+ *
+ * True if every view painted there is translated only, fully opaque where
+ * it is painted, and the damage is covered by such views, so everything is
+ * painted with PIXMAN_OP_SRC.
+ */
+static bool
+repaint_only_writes(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_view *view;
+	pixman_region32_t repaint, uncovered;
+	bool only_writes = true;
+
+	pixman_region32_init(&repaint);
+	pixman_region32_init(&uncovered);
+	pixman_region32_copy(&uncovered, damage);
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (view->plane != &compositor->primary_plane ||
+		    view->occluded || !get_surface_state(view->surface)->image)
+			continue;
+
+		pixman_region32_intersect(&repaint,
+					  &view->transform.boundingbox,
+					  damage);
+		pixman_region32_subtract(&repaint, &repaint, &view->clip);
+		if (!pixman_region32_not_empty(&repaint))
+			continue;
+
+		/* transform.opaque is only set for such views */
+		if (view->alpha < 1.0 ||
+		    !view_transformation_is_translation(view)) {
+			only_writes = false;
+			break;
+		}
+
+		pixman_region32_subtract(&uncovered, &uncovered, &repaint);
+		pixman_region32_subtract(&repaint, &repaint,
+					 &view->transform.opaque);
+		if (pixman_region32_not_empty(&repaint)) {
+			only_writes = false;
+			break;
+		}
+	}
+
+	if (pixman_region32_not_empty(&uncovered))
+		only_writes = false;
 
-	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	pixman_region32_fini(&uncovered);
+	pixman_region32_fini(&repaint);
+
+	return only_writes;
+}
+
+static void
+repaint_surfaces_into(struct weston_output *output, pixman_image_t *dest,
+		      pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_tile tile;
+	struct wl_array paints;
+
+	view_paints_init(&paints, output, dest);
+
+	if (pr->worker_count > 0) {
+		repaint_surfaces_tiled(output, dest, &paints, damage);
+		view_paints_fini(&paints);
+		return;
+	}
+
+	tile.dest = dest;
+	pixman_region32_init_rect(&tile.clip, 0, 0,
+				  pixman_image_get_width(dest),
+				  pixman_image_get_height(dest));
+	tile.debug_color = pr->repaint_debug ? pr->debug_color : NULL;
+
+	repaint_surfaces(output, &tile, &paints, damage);
+
+	pixman_region32_fini(&tile.clip);
+	view_paints_fini(&paints);
 }
 
 static void
@@ -558,12 +1135,36 @@ pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	pixman_region32_t shadow_damage;
 
 	if (!po->hw_buffer)
 		return;
 
-	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	pool_resize(pr, output->compositor->renderer_threads);
+
+	if ((po->flags & PIXMAN_RENDERER_OUTPUT_DIRECT_OPAQUE) &&
+	    !pr->repaint_debug &&
+	    repaint_only_writes(output, output_damage)) {
+		repaint_surfaces_into(output, po->hw_buffer, output_damage);
+		pixman_region32_union(&po->shadow_stale, &po->shadow_stale,
+				      output_damage);
+	} else {
+		/* The damage is copied in a few rectangles that may reach
+		 * into what was painted directly; bring the shadow up to
+		 * date there first. */
+		pixman_region32_init(&shadow_damage);
+		pixman_region32_union(&shadow_damage, output_damage,
+				      &po->shadow_stale);
+		pixman_region32_fini(&po->shadow_stale);
+		pixman_region32_init(&po->shadow_stale);
+
+		repaint_surfaces_into(output, po->shadow_image,
+				      &shadow_damage);
+		copy_to_hw_buffer(output, output_damage);
+
+		pixman_region32_fini(&shadow_damage);
+	}
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -593,10 +1194,56 @@ buffer_state_handle_buffer_destroy(struct wl_listener *listener, void *data)
 	ps->buffer_destroy_listener.notify = NULL;
 }
 
+static pixman_format_code_t
+dmabuf_format_to_pixman(uint32_t format)
+{
+	switch (format) {
+	case DRM_FORMAT_ARGB8888:
+		return PIXMAN_a8r8g8b8;
+	case DRM_FORMAT_XRGB8888:
+		return PIXMAN_x8r8g8b8;
+	case DRM_FORMAT_ABGR8888:
+		return PIXMAN_a8b8g8r8;
+	case DRM_FORMAT_XBGR8888:
+		return PIXMAN_x8b8g8r8;
+	default:
+		return 0;
+	}
+}
+
+/* Linear dmabufs are read through a CPU mapping, checked to be possible
+ * by pixman_renderer_import_dmabuf(). */
+static void
+attach_dmabuf(struct pixman_surface_state *ps, struct weston_buffer *buffer,
+	      struct linux_dmabuf_buffer *dmabuf)
+{
+	void *data;
+
+	data = linux_dmabuf_buffer_map(dmabuf, false);
+	if (!data) {
+		weston_buffer_reference(&ps->buffer_ref, NULL);
+		return;
+	}
+
+	buffer->width = dmabuf->attributes.width;
+	buffer->height = dmabuf->attributes.height;
+
+	ps->image = pixman_image_create_bits(
+		dmabuf_format_to_pixman(dmabuf->attributes.format),
+		buffer->width, buffer->height,
+		data, dmabuf->attributes.stride[0]);
+
+	ps->buffer_destroy_listener.notify =
+		buffer_state_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal,
+		      &ps->buffer_destroy_listener);
+}
+
 static void
 pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 {
 	struct pixman_surface_state *ps = get_surface_state(es);
+	struct linux_dmabuf_buffer *dmabuf;
 	struct wl_shm_buffer *shm_buffer;
 	pixman_format_code_t pixman_format;
 
@@ -616,9 +1263,16 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		return;
 
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+
+	if (dmabuf) {
+		attach_dmabuf(ps, buffer, dmabuf);
+		return;
+	}
 
 	if (! shm_buffer) {
-		weston_log("Pixman renderer supports only SHM buffers\n");
+		weston_log("Pixman renderer supports only SHM and "
+			   "linear dmabuf buffers\n");
 		weston_buffer_reference(&ps->buffer_ref, NULL);
 		return;
 	}
@@ -741,6 +1395,7 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 		ps->image = NULL;
 	}
 
+	ps->color = color;
 	ps->image = pixman_image_create_solid_fill(&color);
 }
 
@@ -751,6 +1406,13 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+
+	pool_stop(pr);
+	pthread_cond_destroy(&pr->pool_done_cond);
+	pthread_cond_destroy(&pr->pool_start_cond);
+	pthread_mutex_destroy(&pr->pool_mutex);
+	pthread_mutex_destroy(&pr->shm_access_mutex);
+
 	free(pr);
 
 	ec->renderer = NULL;
@@ -803,6 +1465,55 @@ pixman_renderer_surface_copy_content(struct weston_surface *surface,
 	return 0;
 }
 
+static bool
+pixman_renderer_import_dmabuf(struct weston_compositor *ec,
+			      struct linux_dmabuf_buffer *dmabuf)
+{
+	if (dmabuf->attributes.flags ||
+	    !dmabuf_format_to_pixman(dmabuf->attributes.format))
+		return false;
+
+	return linux_dmabuf_buffer_map(dmabuf, false) != NULL;
+}
+
+static bool
+pixman_renderer_query_dmabuf_formats(struct weston_compositor *ec,
+				     int **formats, int *num_formats)
+{
+	static const int supported[] = {
+		DRM_FORMAT_ARGB8888,
+		DRM_FORMAT_XRGB8888,
+		DRM_FORMAT_ABGR8888,
+		DRM_FORMAT_XBGR8888,
+	};
+
+	*num_formats = 0;
+	*formats = malloc(sizeof supported);
+	if (*formats == NULL)
+		return false;
+
+	memcpy(*formats, supported, sizeof supported);
+	*num_formats = ARRAY_LENGTH(supported);
+
+	return true;
+}
+
+static bool
+pixman_renderer_query_dmabuf_modifiers(struct weston_compositor *ec,
+				       int format, uint64_t **modifiers,
+				       int *num_modifiers)
+{
+	*num_modifiers = 0;
+	*modifiers = malloc(sizeof **modifiers);
+	if (*modifiers == NULL)
+		return false;
+
+	(*modifiers)[0] = DRM_FORMAT_MOD_LINEAR;
+	*num_modifiers = 1;
+
+	return true;
+}
+
 static void
 debug_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 	      void *data)
@@ -825,7 +1536,7 @@ debug_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 }
 
 WL_EXPORT int
-pixman_renderer_init(struct weston_compositor *ec)
+pixman_renderer_init(struct weston_compositor *ec, uint32_t flags)
 {
 	struct pixman_renderer *renderer;
 
@@ -845,6 +1556,13 @@ pixman_renderer_init(struct weston_compositor *ec)
 		pixman_renderer_surface_get_content_size;
 	renderer->base.surface_copy_content =
 		pixman_renderer_surface_copy_content;
+	if (flags & PIXMAN_RENDERER_DMABUF_IMPORT) {
+		renderer->base.import_dmabuf = pixman_renderer_import_dmabuf;
+		renderer->base.query_dmabuf_formats =
+			pixman_renderer_query_dmabuf_formats;
+		renderer->base.query_dmabuf_modifiers =
+			pixman_renderer_query_dmabuf_modifiers;
+	}
 	ec->renderer = &renderer->base;
 	ec->capabilities |= WESTON_CAP_ROTATION_ANY;
 	ec->capabilities |= WESTON_CAP_CAPTURE_YFLIP;
@@ -858,6 +1576,11 @@ pixman_renderer_init(struct weston_compositor *ec)
 
 	wl_signal_init(&renderer->destroy_signal);
 
+	pthread_mutex_init(&renderer->pool_mutex, NULL);
+	pthread_cond_init(&renderer->pool_start_cond, NULL);
+	pthread_cond_init(&renderer->pool_done_cond, NULL);
+	pthread_mutex_init(&renderer->shm_access_mutex, NULL);
+
 	return 0;
 }
 
@@ -877,7 +1600,7 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 }
 
 WL_EXPORT int
-pixman_renderer_output_create(struct weston_output *output)
+pixman_renderer_output_create(struct weston_output *output, uint32_t flags)
 {
 	struct pixman_output_state *po;
 	int w, h;
@@ -907,6 +1630,9 @@ pixman_renderer_output_create(struct weston_output *output)
 		return -1;
 	}
 
+	po->flags = flags;
+	pixman_region32_init(&po->shadow_stale);
+
 	output->renderer_state = po;
 
 	return 0;
@@ -918,6 +1644,7 @@ pixman_renderer_output_destroy(struct weston_output *output)
 	struct pixman_output_state *po = get_output_state(output);
 
 	pixman_image_unref(po->shadow_image);
+	pixman_region32_fini(&po->shadow_stale);
 
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
@@ -27,11 +27,27 @@
 
 #include "compositor.h"
 
+enum pixman_renderer_flags {
+	/** Import linear dmabufs through a CPU mapping, which makes the
+	 * backend advertise zwp_linux_dmabuf_v1. Nothing is zero-copy
+	 * about it, so this is meant for backends without a device that
+	 * clients could allocate dmabufs for, like headless. */
+	PIXMAN_RENDERER_DMABUF_IMPORT = (1 << 0),
+};
+
 int
-pixman_renderer_init(struct weston_compositor *ec);
+pixman_renderer_init(struct weston_compositor *ec, uint32_t flags);
+
+enum pixman_renderer_output_flags {
+	/** Paint straight into the buffer given with
+	 * pixman_renderer_output_set_buffer() whenever the repaint only
+	 * writes to it, instead of going through the shadow image. For
+	 * buffers that are slow to read, like write-combined mappings. */
+	PIXMAN_RENDERER_OUTPUT_DIRECT_OPAQUE = (1 << 0),
+};
 
 int
-pixman_renderer_output_create(struct weston_output *output);
+pixman_renderer_output_create(struct weston_output *output, uint32_t flags);
 
 void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer);
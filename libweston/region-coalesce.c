@@ -0,0 +1,209 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+
+/* A merge is taken when at most half of the merged box is not damaged,
+ * or when the merged box is small enough for the per-box overhead of
+ * an upload or an encoder to outweigh the extra pixels. */
+#define COALESCE_MAX_WASTE_NUM	1
+#define COALESCE_MAX_WASTE_DEN	2
+#define COALESCE_SMALL_AREA	(64 * 64)
+
+struct coalesce_box {
+	pixman_box32_t box;
+	int64_t covered;	/* damaged area inside box */
+};
+
+static int64_t
+box_area(const pixman_box32_t *b)
+{
+	return (int64_t)(b->x2 - b->x1) * (b->y2 - b->y1);
+}
+
+static bool
+boxes_intersect(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static bool
+box_contains(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 <= b->x1 && a->y1 <= b->y1 &&
+	       a->x2 >= b->x2 && a->y2 >= b->y2;
+}
+
+static pixman_box32_t
+box_union(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	pixman_box32_t u;
+
+	u.x1 = MIN(a->x1, b->x1);
+	u.y1 = MIN(a->y1, b->y1);
+	u.x2 = MAX(a->x2, b->x2);
+	u.y2 = MAX(a->y2, b->y2);
+
+	return u;
+}
+
+static void
+merge_into(struct coalesce_box *dst, const struct coalesce_box *src)
+{
+	dst->box = box_union(&dst->box, &src->box);
+	dst->covered += src->covered;
+}
+
+/* Merge every box overlapping boxes[i] into it, so that the boxes stay
+ * disjoint. Returns the new number of boxes. */
+static int
+absorb_overlaps(struct coalesce_box *boxes, int n, int i)
+{
+	bool grown;
+	int j;
+
+	for (j = 0; j < n; j++) {
+		if (j == i || !boxes_intersect(&boxes[i].box, &boxes[j].box))
+			continue;
+
+		grown = !box_contains(&boxes[i].box, &boxes[j].box);
+		merge_into(&boxes[i], &boxes[j]);
+		boxes[j] = boxes[--n];
+		if (i == n)
+			i = j;
+
+		/* Only a grown box may overlap boxes already checked,
+		 * otherwise go on with the box moved to j. */
+		if (grown)
+			j = -1;
+		else
+			j--;
+	}
+
+	return n;
+}
+
+/** Reduce a region to a few boxes covering it
+ *
+ * \param region The region to cover.
+ * \param boxes Array receiving the boxes.
+ * \param max_boxes Size of the boxes array, at least 1.
+ * \return The number of boxes written.
+ *
+ * The boxes are disjoint and together cover at least the region. Close
+ * rectangles of the region are merged as long as the merged box does
+ * not consist mostly of undamaged area; if more than max_boxes are left
+ * after that, neighbouring boxes are merged regardless until they fit.
+ *
+ * This is meant for consumers of damage that pay a cost per rectangle,
+ * like texture uploads or remote display encoders, where painting or
+ * sending a few more pixels is cheaper than many small operations.
+ */
+WL_EXPORT int
+weston_region_coalesce(pixman_region32_t *region,
+		       pixman_box32_t *boxes, int max_boxes)
+{
+	struct coalesce_box *cb, r;
+	pixman_box32_t *rects, u;
+	int64_t waste, best_waste, area;
+	int nrects, n, m, i, j, best;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	if (nrects <= 1) {
+		for (i = 0; i < nrects; i++)
+			boxes[i] = rects[i];
+		return nrects;
+	}
+
+	cb = malloc(nrects * sizeof *cb);
+	if (!cb) {
+		boxes[0] = *pixman_region32_extents(region);
+		return 1;
+	}
+
+	n = 0;
+	for (i = 0; i < nrects; i++) {
+		r.box = rects[i];
+		r.covered = box_area(&rects[i]);
+
+		best = -1;
+		best_waste = INT64_MAX;
+		for (j = 0; j < n; j++) {
+			/* Overlapping boxes have to be merged anyway. */
+			if (boxes_intersect(&cb[j].box, &r.box)) {
+				best = j;
+				break;
+			}
+
+			u = box_union(&cb[j].box, &r.box);
+			area = box_area(&u);
+			waste = area - cb[j].covered - r.covered;
+			if (area > COALESCE_SMALL_AREA &&
+			    waste * COALESCE_MAX_WASTE_DEN >
+			    area * COALESCE_MAX_WASTE_NUM)
+				continue;
+
+			if (waste < best_waste) {
+				best_waste = waste;
+				best = j;
+			}
+		}
+
+		if (best < 0) {
+			cb[n++] = r;
+			continue;
+		}
+
+		merge_into(&cb[best], &r);
+		n = absorb_overlaps(cb, n, best);
+	}
+
+	/* Rectangles of a region are sorted by band, so neighbours in the
+	 * array are close to each other. */
+	while (n > max_boxes) {
+		for (i = 0, m = 0; i < n; i += 2, m++) {
+			cb[m] = cb[i];
+			if (i + 1 < n)
+				merge_into(&cb[m], &cb[i + 1]);
+		}
+		n = m;
+
+		for (i = 0; i < n; i++)
+			n = absorb_overlaps(cb, n, i);
+	}
+
+	for (i = 0; i < n; i++)
+		boxes[i] = cb[i].box;
+
+	free(cb);
+
+	return n;
+}
@@ -33,171 +33,307 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <pthread.h>
+
+#include <drm_fourcc.h>
 
 #include "compositor.h"
+#include "linux-dmabuf.h"
+#include "linux-dmabuf-unstable-v1-server-protocol.h"
 #include "shared/helpers.h"
+#include "shared/pixel-copy.h"
 
-#include "wcap/wcap-decode.h"
+#include "wcap/wcap-encode.h"
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
-	struct weston_buffer *buffer;
+	struct weston_buffer *buffer;	/* NULL once destroyed */
+	struct wl_listener buffer_destroy_listener;
+	struct linux_dmabuf_buffer *dmabuf;	/* or a wl_shm buffer */
+	struct wl_event_source *fence_source;
 	weston_screenshooter_done_func_t done;
 	void *data;
+
+	/* The output read back by the CPU paths, in read_format */
+	uint8_t *pixels;
+	int32_t width, height;
+	pixman_format_code_t read_format;
+	bool yflip;
 };
 
 static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+screenshooter_finish(struct screenshooter_frame_listener *l,
+		     enum weston_screenshooter_outcome outcome)
 {
-	uint8_t *end;
-
-	end = dst + height * stride;
-	while (dst < end) {
-		memcpy(dst, src, stride);
-		dst += stride;
-		src -= stride;
-	}
+	if (l->buffer)
+		wl_list_remove(&l->buffer_destroy_listener.link);
+	free(l->pixels);
+	l->done(l->data, outcome);
+	free(l);
 }
 
 static void
-copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
+screenshooter_buffer_destroyed(struct wl_listener *listener, void *data)
 {
-	/* TODO: optimize this out */
-	memcpy(dst, src, height * stride);
+	struct screenshooter_frame_listener *l =
+		container_of(listener, struct screenshooter_frame_listener,
+			     buffer_destroy_listener);
+
+	l->buffer = NULL;
+	l->dmabuf = NULL;
 }
 
+/* Copy the pixels read back into a buffer of 32 bit pixels, in the byte
+ * order of PIXMAN_a8r8g8b8, or of PIXMAN_a8b8g8r8 if abgr is set. */
 static void
-copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
+screenshooter_copy_pixels(struct screenshooter_frame_listener *l,
+			  void *dst, int32_t dst_stride,
+			  bool abgr, bool y_invert)
 {
-	uint32_t *dst = vdst;
-	uint32_t *src = vsrc;
-	uint32_t *end = dst + bytes / 4;
-
-	while (dst < end) {
-		uint32_t v = *src++;
-		/*                    A R G B */
-		uint32_t tmp = v & 0xff00ff00;
-		tmp |= (v >> 16) & 0x000000ff;
-		tmp |= (v << 16) & 0x00ff0000;
-		*dst++ = tmp;
+	int32_t stride;
+	uint32_t flags;
+
+	stride = l->width * (PIXMAN_FORMAT_BPP(l->read_format) / 8);
+
+	flags = 0;
+	if (l->yflip)
+		flags |= PIXEL_COPY_YFLIP;
+	if (y_invert)
+		flags ^= PIXEL_COPY_YFLIP;
+
+	switch (l->read_format) {
+	case PIXMAN_a8r8g8b8:
+	case PIXMAN_x8r8g8b8:
+		if (abgr)
+			flags |= PIXEL_COPY_SWAP_RB;
+		break;
+	case PIXMAN_x8b8g8r8:
+	case PIXMAN_a8b8g8r8:
+		if (!abgr)
+			flags |= PIXEL_COPY_SWAP_RB;
+		break;
+	default:
+		return;
 	}
+
+	pixel_copy_rect32(dst, dst_stride, l->pixels, stride,
+			  l->width, l->height, flags);
 }
 
 static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+screenshooter_read_done(int status, void *data)
 {
-	uint8_t *end;
+	struct screenshooter_frame_listener *l = data;
+	struct linux_dmabuf_buffer *dmabuf = l->dmabuf;
+	struct wl_shm_buffer *shm_buffer;
+	bool abgr, y_invert;
+	void *dst;
+
+	if (status < 0) {
+		screenshooter_finish(l, WESTON_SCREENSHOOTER_NO_MEMORY);
+		return;
+	}
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src -= stride;
+	if (l->buffer == NULL) {
+		screenshooter_finish(l, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		return;
 	}
-}
 
-static void
-copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
-{
-	uint8_t *end;
+	if (dmabuf == NULL) {
+		shm_buffer = l->buffer->shm_buffer;
+		wl_shm_buffer_begin_access(shm_buffer);
+		screenshooter_copy_pixels(l,
+					  wl_shm_buffer_get_data(shm_buffer),
+					  wl_shm_buffer_get_stride(shm_buffer),
+					  false, false);
+		wl_shm_buffer_end_access(shm_buffer);
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src += stride;
+		screenshooter_finish(l, WESTON_SCREENSHOOTER_SUCCESS);
+		return;
 	}
+
+	dst = linux_dmabuf_buffer_map(dmabuf, true);
+	if (dst == NULL) {
+		screenshooter_finish(l, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		return;
+	}
+
+	abgr = dmabuf->attributes.format == DRM_FORMAT_ABGR8888 ||
+	       dmabuf->attributes.format == DRM_FORMAT_XBGR8888;
+	y_invert = dmabuf->attributes.flags &
+		   ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT;
+
+	linux_dmabuf_buffer_begin_access(dmabuf, true);
+	screenshooter_copy_pixels(l, dst, dmabuf->attributes.stride[0],
+				  abgr, y_invert);
+	linux_dmabuf_buffer_end_access(dmabuf, true);
+
+	screenshooter_finish(l, WESTON_SCREENSHOOTER_SUCCESS);
 }
 
+/* Read the whole output back without waiting for the renderer, the
+ * pixels are copied into the buffer by screenshooter_read_done(). */
 static void
-screenshooter_frame_notify(struct wl_listener *listener, void *data)
+screenshooter_read_output(struct screenshooter_frame_listener *l,
+			  struct weston_output *output)
 {
-	struct screenshooter_frame_listener *l =
-		container_of(listener,
-			     struct screenshooter_frame_listener, listener);
-	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
-	int32_t stride;
-	uint8_t *pixels, *d, *s;
 
-	output->disable_planes--;
-	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
+	l->width = output->current_mode->width;
+	l->height = output->current_mode->height;
+	l->read_format = compositor->read_format;
+	l->yflip = compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP;
 
-	if (pixels == NULL) {
-		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
-		free(l);
+	l->pixels = malloc(l->width * l->height *
+			   (PIXMAN_FORMAT_BPP(l->read_format) / 8));
+	if (l->pixels == NULL) {
+		screenshooter_finish(l, WESTON_SCREENSHOOTER_NO_MEMORY);
 		return;
 	}
 
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
+	if (weston_output_read_pixels_async(output, l->read_format,
+					    l->pixels, 0, 0,
+					    l->width, l->height,
+					    screenshooter_read_done, l) < 0)
+		screenshooter_finish(l, WESTON_SCREENSHOOTER_NO_MEMORY);
+}
 
-	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
+static int
+screenshooter_fence_signalled(int fd, uint32_t mask, void *data)
+{
+	struct screenshooter_frame_listener *l = data;
 
-	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	wl_event_source_remove(l->fence_source);
+	close(fd);
+	screenshooter_finish(l, WESTON_SCREENSHOOTER_SUCCESS);
 
-	wl_shm_buffer_begin_access(l->buffer->shm_buffer);
+	return 0;
+}
 
-	switch (compositor->read_format) {
-	case PIXMAN_a8r8g8b8:
-	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
-		break;
-	case PIXMAN_x8b8g8r8:
-	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
+/* Let the renderer copy the output into the dmabuf, or read the output
+ * back and copy it into a mapping of the dmabuf if it cannot, as the
+ * headless backend does. */
+static void
+screenshooter_shoot_dmabuf(struct screenshooter_frame_listener *l,
+			   struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_renderer *renderer = compositor->renderer;
+	struct linux_dmabuf_buffer *dmabuf = l->dmabuf;
+	struct wl_event_loop *loop;
+	int fence_fd;
+
+	if (renderer->capture_dmabuf &&
+	    renderer->capture_dmabuf(output, dmabuf, &fence_fd) == 0) {
+		if (fence_fd < 0) {
+			screenshooter_finish(l, WESTON_SCREENSHOOTER_SUCCESS);
+			return;
+		}
+
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		l->fence_source = wl_event_loop_add_fd(loop, fence_fd,
+						       WL_EVENT_READABLE,
+						       screenshooter_fence_signalled,
+						       l);
+		if (l->fence_source == NULL) {
+			close(fence_fd);
+			screenshooter_finish(l, WESTON_SCREENSHOOTER_NO_MEMORY);
+		}
+		return;
+	}
+
+	switch (dmabuf->attributes.format) {
+	case DRM_FORMAT_ARGB8888:
+	case DRM_FORMAT_XRGB8888:
+	case DRM_FORMAT_ABGR8888:
+	case DRM_FORMAT_XBGR8888:
 		break;
 	default:
-		break;
+		screenshooter_finish(l, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		return;
+	}
+
+	if (linux_dmabuf_buffer_map(dmabuf, true) == NULL) {
+		screenshooter_finish(l, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		return;
 	}
 
-	wl_shm_buffer_end_access(l->buffer->shm_buffer);
+	screenshooter_read_output(l, output);
+}
 
-	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
-	free(pixels);
-	free(l);
+static void
+screenshooter_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener,
+			     struct screenshooter_frame_listener, listener);
+	struct weston_output *output = data;
+
+	output->disable_planes--;
+	wl_list_remove(&listener->link);
+
+	if (l->buffer == NULL)
+		screenshooter_finish(l, WESTON_SCREENSHOOTER_BAD_BUFFER);
+	else if (l->dmabuf)
+		screenshooter_shoot_dmabuf(l, output);
+	else
+		screenshooter_read_output(l, output);
 }
 
+/** Copy the contents of an output into a buffer
+ *
+ * \param output The output to capture, at its next repaint.
+ * \param buffer A wl_shm buffer, or a linux-dmabuf buffer. Either has to
+ * be at least as large as the current mode of the output.
+ * \param done Called with the outcome once the buffer holds the output.
+ * \param data Passed to done.
+ * \return 0 if the capture is underway, -1 if done was already called
+ * with an error.
+ *
+ * wl_shm buffers are filled by the CPU, with pixels read back through
+ * weston_output_read_pixels_async(). dmabufs are copied into by the
+ * renderer when it supports weston_renderer::capture_dmabuf, with done
+ * called once the GPU has finished the copy, and are mapped and filled
+ * like wl_shm buffers otherwise. dmabufs must then be single plane linear
+ * ARGB8888, XRGB8888, ABGR8888 or XBGR8888 buffers.
+ */
 WL_EXPORT int
 weston_screenshooter_shoot(struct weston_output *output,
 			   struct weston_buffer *buffer,
 			   weston_screenshooter_done_func_t done, void *data)
 {
 	struct screenshooter_frame_listener *l;
-
-	if (!wl_shm_buffer_get(buffer->resource)) {
+	struct linux_dmabuf_buffer *dmabuf;
+
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	if (dmabuf) {
+		buffer->width = dmabuf->attributes.width;
+		buffer->height = dmabuf->attributes.height;
+	} else if (wl_shm_buffer_get(buffer->resource)) {
+		buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
+		buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
+		buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
+	} else {
 		done(data, WESTON_SCREENSHOOTER_BAD_BUFFER);
 		return -1;
 	}
 
-	buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
-	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
-	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
-
 	if (buffer->width < output->current_mode->width ||
 	    buffer->height < output->current_mode->height) {
 		done(data, WESTON_SCREENSHOOTER_BAD_BUFFER);
 		return -1;
 	}
 
-	l = malloc(sizeof *l);
+	l = zalloc(sizeof *l);
 	if (l == NULL) {
 		done(data, WESTON_SCREENSHOOTER_NO_MEMORY);
 		return -1;
 	}
 
 	l->buffer = buffer;
+	l->buffer_destroy_listener.notify = screenshooter_buffer_destroyed;
+	wl_signal_add(&buffer->destroy_signal, &l->buffer_destroy_listener);
+	l->dmabuf = dmabuf;
 	l->done = done;
 	l->data = data;
 	l->listener.notify = screenshooter_frame_notify;
@@ -208,45 +344,168 @@ weston_screenshooter_shoot(struct weston_output *output,
 	return 0;
 }
 
+#define RECORDER_CAPTURES 2
+
+/* How often a whole frame is written against a blank one, so a player
+ * can seek without decoding from the start of the file. */
+#define RECORDER_KEYFRAME_INTERVAL 5000 /* ms */
+
+/** The damage of a frame and its pixels, waiting to be encoded */
+struct weston_recorder_capture {
+	uint32_t msecs;
+	uint32_t flags;		/* WCAP_FRAME_KEYFRAME */
+	pixman_box32_t *rects;
+	int nrects, rects_size;
+	uint32_t *pixels;	/* the rectangles one after the other */
+	int yflip;		/* rows are stored from the bottom up */
+	bool queued;		/* protected by the recorder mutex */
+};
+
+/* The compositor thread reads the damaged pixels of every frame into a
+ * free capture, the worker thread encodes the captures in order and
+ * writes them out. */
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
-	uint32_t total;
 	int fd;
 	struct wl_listener frame_listener;
 	int count, destroying;
+	uint32_t keyframe_msecs;
+
+	/* Damage of frames not captured because the worker was behind */
+	pixman_region32_t skipped_damage;
+
+	pthread_t worker;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct weston_recorder_capture captures[RECORDER_CAPTURES];
+	int head, tail;		/* next capture to fill, next to encode */
+	bool stop;
+	uint64_t total;		/* also the offset of the next frame */
+
+	/* Only used by the worker thread */
+	struct wcap_encoder encoder;
+	uint32_t *outbuf;
 };
 
-static uint32_t *
-output_run(uint32_t *p, uint32_t delta, int run)
+static ssize_t
+weston_recorder_encode(struct weston_recorder *recorder,
+		       struct weston_recorder_capture *capture)
 {
-	int i;
+	struct wcap_frame_header_v2 header;
+	struct wcap_rectangle *rect;
+	uint32_t *pixels = capture->pixels;
+	uint32_t *p = recorder->outbuf;
+	struct iovec v[3];
+	int i, width, height;
+	ssize_t ret;
+
+	if (capture->flags & WCAP_FRAME_KEYFRAME)
+		wcap_encoder_reset(&recorder->encoder);
+
+	for (i = 0; i < capture->nrects; i++) {
+		rect = (struct wcap_rectangle *) &capture->rects[i];
+		width = rect->x2 - rect->x1;
+		height = rect->y2 - rect->y1;
+
+		if (capture->yflip)
+			p = wcap_encoder_encode_rectangle(&recorder->encoder,
+							  p, rect, pixels,
+							  width);
+		else
+			p = wcap_encoder_encode_rectangle(&recorder->encoder,
+							  p, rect,
+							  pixels + (height - 1) * width,
+							  -width);
 
-	while (run > 0) {
-		if (run <= 0xe0) {
-			*p++ = delta | ((run - 1) << 24);
+		pixels += width * height;
+	}
+
+	v[1].iov_base = capture->rects;
+	v[1].iov_len = capture->nrects * sizeof capture->rects[0];
+	v[2].iov_base = recorder->outbuf;
+	v[2].iov_len = (p - recorder->outbuf) * 4;
+
+	header.msecs = capture->msecs;
+	header.nrects = capture->nrects;
+	header.flags = capture->flags;
+	header.size = v[1].iov_len + v[2].iov_len;
+	v[0].iov_base = &header;
+	v[0].iov_len = sizeof header;
+
+	ret = writev(recorder->fd, v, 3);
+	if (ret == (ssize_t) (sizeof header + header.size) &&
+	    wcap_encoder_add_frame(&recorder->encoder, recorder->total,
+				   header.msecs, header.flags) < 0)
+		weston_log("%s: out of memory, frame left out of the index\n",
+			   __func__);
+
+	return ret;
+}
+
+static void *
+weston_recorder_worker(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct weston_recorder_capture *capture;
+	ssize_t size;
+
+	pthread_mutex_lock(&recorder->mutex);
+	for (;;) {
+		capture = &recorder->captures[recorder->tail];
+		while (!capture->queued && !recorder->stop)
+			pthread_cond_wait(&recorder->cond, &recorder->mutex);
+
+		/* Stopping, and all captures are written */
+		if (!capture->queued)
 			break;
-		}
 
-		i = 24 - __builtin_clz(run);
-		*p++ = delta | ((i + 0xe0) << 24);
-		run -= 1 << (7 + i);
+		pthread_mutex_unlock(&recorder->mutex);
+		size = weston_recorder_encode(recorder, capture);
+		pthread_mutex_lock(&recorder->mutex);
+
+		if (size > 0)
+			recorder->total += size;
+		capture->queued = false;
+		recorder->tail = (recorder->tail + 1) % RECORDER_CAPTURES;
+		pthread_cond_broadcast(&recorder->cond);
 	}
+	pthread_mutex_unlock(&recorder->mutex);
+
+	size = wcap_encoder_write_index(&recorder->encoder, recorder->fd,
+					recorder->total);
+	if (size > 0)
+		recorder->total += size;
 
-	return p;
+	return NULL;
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+/** Get the next capture to fill, or NULL if the worker is still on it */
+static struct weston_recorder_capture *
+weston_recorder_get_capture(struct weston_recorder *recorder, bool wait)
 {
-	unsigned char dr, dg, db;
+	struct weston_recorder_capture *capture;
+
+	capture = &recorder->captures[recorder->head];
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+	pthread_mutex_lock(&recorder->mutex);
+	while (wait && capture->queued)
+		pthread_cond_wait(&recorder->cond, &recorder->mutex);
+	if (capture->queued)
+		capture = NULL;
+	pthread_mutex_unlock(&recorder->mutex);
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+	return capture;
+}
+
+static void
+weston_recorder_queue_capture(struct weston_recorder *recorder,
+			      struct weston_recorder_capture *capture)
+{
+	pthread_mutex_lock(&recorder->mutex);
+	capture->queued = true;
+	recorder->head = (recorder->head + 1) % RECORDER_CAPTURES;
+	pthread_cond_broadcast(&recorder->cond);
+	pthread_mutex_unlock(&recorder->mutex);
 }
 
 static void
@@ -259,25 +518,15 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 		container_of(listener, struct weston_recorder, frame_listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
-	pixman_box32_t *r;
+	struct weston_recorder_capture *capture;
+	pixman_box32_t *r, *rects, box;
 	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
+	int i, n, width, height;
+	uint32_t *pixels;
 	int do_yflip;
 	int y_orig;
-	uint32_t *outbuf;
 
 	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
 
 	pixman_region32_init(&damage);
 	pixman_region32_init(&transformed_damage);
@@ -289,21 +538,53 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 				 &damage, &transformed_damage);
 	pixman_region32_fini(&damage);
 
+	pixman_region32_union(&transformed_damage, &transformed_damage,
+			      &recorder->skipped_damage);
 	r = pixman_region32_rectangles(&transformed_damage, &n);
-	if (n == 0) {
-		pixman_region32_fini(&transformed_damage);
-		return;
+	if (n == 0)
+		goto out;
+
+	/* Rather than stalling the compositor while the worker catches
+	 * up, leave the frame out and record its damage with the next one.
+	 * The last frame is always written. */
+	capture = weston_recorder_get_capture(recorder, recorder->destroying);
+	if (!capture) {
+		pixman_region32_copy(&recorder->skipped_damage,
+				     &transformed_damage);
+		goto out;
 	}
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	capture->flags = 0;
+	if (recorder->count == 0 ||
+	    output->frame_time - recorder->keyframe_msecs >=
+	    RECORDER_KEYFRAME_INTERVAL) {
+		box.x1 = 0;
+		box.y1 = 0;
+		box.x2 = output->current_mode->width;
+		box.y2 = output->current_mode->height;
+		pixman_region32_reset(&transformed_damage, &box);
+		r = pixman_region32_rectangles(&transformed_damage, &n);
+		capture->flags = WCAP_FRAME_KEYFRAME;
+	}
+
+	if (n > capture->rects_size) {
+		rects = realloc(capture->rects, n * sizeof *rects);
+		if (!rects) {
+			weston_log("%s: out of memory\n", __func__);
+			pixman_region32_copy(&recorder->skipped_damage,
+					     &transformed_damage);
+			goto out;
+		}
+		capture->rects = rects;
+		capture->rects_size = n;
+	}
 
+	memcpy(capture->rects, r, n * sizeof *r);
+	capture->nrects = n;
+	capture->msecs = output->frame_time;
+	capture->yflip = do_yflip;
+
+	pixels = capture->pixels;
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
@@ -314,50 +595,20 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 			y_orig = r[i].y1;
 
 		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
+				compositor->read_format, pixels,
 				r[i].x1, y_orig, width, height);
+		pixels += width * height;
+	}
 
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				s = recorder->rect + width * j;
-			else
-				s = recorder->rect + width * (height - j - 1);
-			y_orig = r[i].y2 - j - 1;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
-		}
-
-		p = output_run(p, prev, run);
-
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+	if (capture->flags & WCAP_FRAME_KEYFRAME)
+		recorder->keyframe_msecs = output->frame_time;
 
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
-	}
+	weston_recorder_queue_capture(recorder, capture);
+	pixman_region32_clear(&recorder->skipped_damage);
+	recorder->count++;
 
+out:
 	pixman_region32_fini(&transformed_damage);
-	recorder->count++;
 
 	if (recorder->destroying)
 		weston_recorder_destroy(recorder);
@@ -366,12 +617,20 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 static void
 weston_recorder_free(struct weston_recorder *recorder)
 {
+	int i;
+
 	if (recorder == NULL)
 		return;
 
-	free(recorder->tmpbuf);
-	free(recorder->rect);
-	free(recorder->frame);
+	for (i = 0; i < RECORDER_CAPTURES; i++) {
+		free(recorder->captures[i].rects);
+		free(recorder->captures[i].pixels);
+	}
+	wcap_encoder_release(&recorder->encoder);
+	free(recorder->outbuf);
+	pixman_region32_fini(&recorder->skipped_damage);
+	pthread_cond_destroy(&recorder->cond);
+	pthread_mutex_destroy(&recorder->mutex);
 	free(recorder);
 }
 
@@ -380,11 +639,9 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
-	int stride, size;
-	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	int i, width, height;
+	size_t size;
+	struct wcap_header header;
 
 	recorder = zalloc(sizeof *recorder);
 	if (recorder == NULL) {
@@ -392,26 +649,34 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		return NULL;
 	}
 
-	stride = output->current_mode->width;
-	size = stride * 4 * output->current_mode->height;
-	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->cond, NULL);
+	pixman_region32_init(&recorder->skipped_damage);
 	recorder->output = output;
+	recorder->fd = -1;
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
-		weston_log("%s: out of memory\n", __func__);
-		goto err_recorder;
-	}
+	width = output->current_mode->width;
+	height = output->current_mode->height;
+	size = (size_t) width * height * 4;
 
-	if (!do_yflip) {
-		recorder->tmpbuf = malloc(size);
-		if (recorder->tmpbuf == NULL) {
+	/* Both the pixels of a capture and their encoding are at most
+	 * one word per pixel of the output. */
+	for (i = 0; i < RECORDER_CAPTURES; i++) {
+		recorder->captures[i].pixels = malloc(size);
+		if (!recorder->captures[i].pixels) {
 			weston_log("%s: out of memory\n", __func__);
 			goto err_recorder;
 		}
 	}
 
-	header.magic = WCAP_HEADER_MAGIC;
+	recorder->outbuf = malloc(size);
+	if (!recorder->outbuf ||
+	    wcap_encoder_init(&recorder->encoder, width, height) < 0) {
+		weston_log("%s: out of memory\n", __func__);
+		goto err_recorder;
+	}
+
+	header.magic = WCAP_HEADER_MAGIC_V2;
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -434,10 +699,16 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		goto err_recorder;
 	}
 
-	header.width = output->current_mode->width;
-	header.height = output->current_mode->height;
+	header.width = width;
+	header.height = height;
 	recorder->total += write(recorder->fd, &header, sizeof header);
 
+	if (pthread_create(&recorder->worker, NULL,
+			   weston_recorder_worker, recorder) != 0) {
+		weston_log("failed to start the recorder thread\n");
+		goto err_fd;
+	}
+
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
 	output->disable_planes++;
@@ -445,6 +716,8 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 
 	return recorder;
 
+err_fd:
+	close(recorder->fd);
 err_recorder:
 	weston_recorder_free(recorder);
 	return NULL;
@@ -454,6 +727,17 @@ static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
+
+	/* Let the worker write out what is queued */
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->stop = true;
+	pthread_cond_broadcast(&recorder->cond);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->worker, NULL);
+
+	weston_log("recorder stopped, total file size %dM, %d frames\n",
+		   (int) (recorder->total / (1024 * 1024)), recorder->count);
+
 	close(recorder->fd);
 	recorder->output->disable_planes--;
 	weston_recorder_free(recorder);
@@ -480,8 +764,7 @@ weston_recorder_start(struct weston_output *output, const char *filename)
 WL_EXPORT void
 weston_recorder_stop(struct weston_recorder *recorder)
 {
-	weston_log("stopping recorder, total file size %dM, %d frames\n",
-		   recorder->total / (1024 * 1024), recorder->count);
+	weston_log("stopping recorder\n");
 
 	recorder->destroying = 1;
 	weston_output_schedule_repaint(recorder->output);
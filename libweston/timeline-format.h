@@ -0,0 +1,111 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_TIMELINE_FORMAT_H
+#define WESTON_TIMELINE_FORMAT_H
+
+#include <stdint.h>
+
+/*
+ * Binary timeline log format
+ *
+ * The file starts with a struct timeline_file_header, followed by
+ * records. Every record starts with a struct timeline_record_header and
+ * is padded to a multiple of 8 bytes. Everything is in the byte order
+ * of the machine that wrote the log; the magic tells it apart.
+ *
+ * Strings (point names) and objects (outputs and surfaces) are
+ * described once by their own records, before the first point that
+ * refers to them, and then referred to by id. Objects are described
+ * again when their description changes.
+ */
+
+#define TIMELINE_FILE_MAGIC	0x4c54574e	/* "NWTL" */
+#define TIMELINE_FILE_VERSION	1
+
+struct timeline_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t clock_id;	/* clockid_t of all timestamps */
+	uint32_t padding;
+};
+
+enum timeline_record_type {
+	TIMELINE_RECORD_STRING = 1,
+	TIMELINE_RECORD_OUTPUT,
+	TIMELINE_RECORD_SURFACE,
+	TIMELINE_RECORD_POINT,
+	TIMELINE_RECORD_DROPPED,
+};
+
+struct timeline_record_header {
+	uint32_t type;		/* enum timeline_record_type */
+	uint32_t size;		/* including this header and padding */
+};
+
+/* Followed by length bytes of text, without terminating zero */
+struct timeline_record_string {
+	struct timeline_record_header header;
+	uint32_t id;
+	uint32_t length;
+};
+
+/* Followed by length bytes of the output name */
+struct timeline_record_output {
+	struct timeline_record_header header;
+	uint32_t id;
+	uint32_t length;
+};
+
+/* Followed by length bytes of the surface description; a length of 0
+ * means there is no description. */
+struct timeline_record_surface {
+	struct timeline_record_header header;
+	uint32_t id;
+	uint32_t main_surface;	/* id, 0 if this is a main surface */
+	uint32_t length;
+	uint32_t padding;
+};
+
+#define TIMELINE_POINT_VBLANK	(1 << 0)
+#define TIMELINE_POINT_GPU	(1 << 1)
+
+struct timeline_record_point {
+	struct timeline_record_header header;
+	uint32_t name;		/* string id */
+	uint32_t output;	/* object id, 0 if none */
+	uint32_t surface;	/* object id, 0 if none */
+	uint32_t flags;		/* TIMELINE_POINT_* */
+	int64_t sec, nsec;
+	int64_t vblank_sec, vblank_nsec;
+	int64_t gpu_sec, gpu_nsec;
+};
+
+/* Records were lost because the log could not be written fast enough */
+struct timeline_record_dropped {
+	struct timeline_record_header header;
+	uint32_t count;
+	uint32_t padding;
+};
+
+#endif /* WESTON_TIMELINE_FORMAT_H */
@@ -27,31 +27,129 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "timeline.h"
+#include "timeline-format.h"
 #include "compositor.h"
 #include "file-util.h"
+#include "shared/helpers.h"
+
+/*
+ * The timeline is written in the binary format of timeline-format.h.
+ * weston_timeline_point() only builds the records and copies them into
+ * a ring buffer; a thread writes the ring buffer into the file. If the
+ * thread cannot keep up, points are dropped rather than stalling the
+ * compositor, and the number of dropped points is recorded in the log.
+ *
+ * The weston-timeline-json tool converts the log into the JSON format
+ * that wesgr reads.
+ */
+
+#define TIMELINE_RING_SIZE	(4 * 1024 * 1024)	/* power of two */
+#define TIMELINE_STAGE_SIZE	4096
+#define TIMELINE_FLUSH_MSEC	100
+#define TIMELINE_MAX_TEXT	256
 
 struct timeline_log {
 	clock_t clk_id;
 	FILE *file;
 	unsigned series;
 	struct wl_listener compositor_destroy_listener;
+
+	/* Point names, by address; the index + 1 is the string id */
+	struct wl_array strings;
+
+	/* Records not written yet are in the ring between tail and head.
+	 * head is only changed by the compositor, tail only by the
+	 * flush thread, both under the mutex. */
+	char *ring;
+	uint64_t head;
+	uint64_t tail;
+	uint32_t dropped;
+	bool closing;
+	bool write_error;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
 };
 
 WL_EXPORT int weston_timeline_enabled_;
 static struct timeline_log timeline_ = { CLOCK_MONOTONIC, NULL, 0 };
 
+static void *
+timeline_flush_thread(void *data)
+{
+	struct timeline_log *tl = data;
+	struct timespec deadline;
+	uint64_t head, tail, pos, len;
+	bool closing, error = false;
+
+	pthread_mutex_lock(&tl->mutex);
+
+	while (1) {
+		head = tl->head;
+		tail = tl->tail;
+		closing = tl->closing;
+
+		if (head == tail) {
+			if (closing)
+				break;
+
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += TIMELINE_FLUSH_MSEC * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&tl->cond, &tl->mutex,
+					       &deadline);
+			continue;
+		}
+
+		pthread_mutex_unlock(&tl->mutex);
+
+		/* The compositor does not touch [tail, head) meanwhile. */
+		while (tail != head && !error) {
+			pos = tail & (TIMELINE_RING_SIZE - 1);
+			len = head - tail;
+			if (len > TIMELINE_RING_SIZE - pos)
+				len = TIMELINE_RING_SIZE - pos;
+
+			if (fwrite(tl->ring + pos, 1, len, tl->file) != len)
+				error = true;
+			tail += len;
+		}
+		if (fflush(tl->file) != 0)
+			error = true;
+
+		pthread_mutex_lock(&tl->mutex);
+		tl->tail = head;
+		tl->write_error = error;
+	}
+
+	pthread_mutex_unlock(&tl->mutex);
+
+	return NULL;
+}
+
 static int
 weston_timeline_do_open(void)
 {
 	const char *prefix = "weston-timeline-";
-	const char *suffix = ".log";
+	const char *suffix = ".wtl";
 	char fname[1000];
+	struct timeline_file_header header = {
+		.magic = TIMELINE_FILE_MAGIC,
+		.version = TIMELINE_FILE_VERSION,
+		.clock_id = timeline_.clk_id,
+	};
 
 	timeline_.file = file_create_dated(prefix, suffix,
 					   fname, sizeof(fname));
@@ -71,6 +169,39 @@ weston_timeline_do_open(void)
 		return -1;
 	}
 
+	timeline_.ring = malloc(TIMELINE_RING_SIZE);
+	if (!timeline_.ring ||
+	    fwrite(&header, sizeof header, 1, timeline_.file) != 1) {
+		weston_log("Cannot set up timeline file '%s'\n", fname);
+		free(timeline_.ring);
+		timeline_.ring = NULL;
+		fclose(timeline_.file);
+		timeline_.file = NULL;
+		return -1;
+	}
+
+	wl_array_init(&timeline_.strings);
+	timeline_.head = 0;
+	timeline_.tail = 0;
+	timeline_.dropped = 0;
+	timeline_.closing = false;
+	timeline_.write_error = false;
+
+	pthread_mutex_init(&timeline_.mutex, NULL);
+	pthread_cond_init(&timeline_.cond, NULL);
+	if (pthread_create(&timeline_.thread, NULL,
+			   timeline_flush_thread, &timeline_) != 0) {
+		weston_log("Cannot start timeline thread\n");
+		pthread_mutex_destroy(&timeline_.mutex);
+		pthread_cond_destroy(&timeline_.cond);
+		wl_array_release(&timeline_.strings);
+		free(timeline_.ring);
+		timeline_.ring = NULL;
+		fclose(timeline_.file);
+		timeline_.file = NULL;
+		return -1;
+	}
+
 	weston_log("Opened timeline file '%s'\n", fname);
 
 	return 0;
@@ -111,15 +242,40 @@ weston_timeline_close(void)
 
 	wl_list_remove(&timeline_.compositor_destroy_listener.link);
 
+	/* Let the thread write out what is left. */
+	pthread_mutex_lock(&timeline_.mutex);
+	timeline_.closing = true;
+	pthread_cond_signal(&timeline_.cond);
+	pthread_mutex_unlock(&timeline_.mutex);
+
+	pthread_join(timeline_.thread, NULL);
+	pthread_mutex_destroy(&timeline_.mutex);
+	pthread_cond_destroy(&timeline_.cond);
+
+	if (timeline_.dropped)
+		weston_log("Timeline dropped %u points at the end.\n",
+			   timeline_.dropped);
+
+	wl_array_release(&timeline_.strings);
+	free(timeline_.ring);
+	timeline_.ring = NULL;
+
 	fclose(timeline_.file);
 	timeline_.file = NULL;
 	weston_log("Timeline log file closed.\n");
 }
 
+/* Records of a single point, built on the stack before they are copied
+ * into the ring buffer in one go. */
 struct timeline_emit_context {
-	FILE *cur;
-	FILE *out;
+	char data[TIMELINE_STAGE_SIZE];
+	size_t size;
 	unsigned series;
+
+	/* Undone if the records do not make it into the ring buffer */
+	const char *new_string;
+	struct weston_timeline_object *described[4];
+	unsigned described_count;
 };
 
 static unsigned
@@ -151,131 +307,213 @@ check_series(struct timeline_emit_context *ctx,
 	return 0;
 }
 
+static void *
+emit_record(struct timeline_emit_context *ctx, uint32_t type,
+	    size_t size, const char *text, uint32_t length)
+{
+	struct timeline_record_header *header;
+	size_t total = (size + length + 7) & ~(size_t)7;
+
+	assert(size >= sizeof *header);
+
+	if (ctx->size + total > sizeof ctx->data)
+		return NULL;
+
+	header = (void *)(ctx->data + ctx->size);
+	memset(header, 0, total);
+	header->type = type;
+	header->size = total;
+	if (length)
+		memcpy((char *)header + size, text, length);
+
+	ctx->size += total;
+
+	return header;
+}
+
 static void
-fprint_quoted_string(FILE *fp, const char *str)
+mark_described(struct timeline_emit_context *ctx,
+	       struct weston_timeline_object *to)
 {
-	if (!str) {
-		fprintf(fp, "null");
-		return;
+	assert(ctx->described_count < ARRAY_LENGTH(ctx->described));
+	ctx->described[ctx->described_count++] = to;
+}
+
+static uint32_t
+text_length(const char *text)
+{
+	return text ? strnlen(text, TIMELINE_MAX_TEXT) : 0;
+}
+
+static uint32_t
+emit_string(struct timeline_emit_context *ctx, const char *str)
+{
+	struct timeline_record_string *rec;
+	const char **s;
+	uint32_t id = 0;
+
+	wl_array_for_each(s, &timeline_.strings) {
+		id++;
+		if (*s == str)
+			return id;
 	}
 
-	fprintf(fp, "\"%s\"", str);
+	rec = emit_record(ctx, TIMELINE_RECORD_STRING, sizeof *rec,
+			  str, text_length(str));
+	if (!rec)
+		return 0;
+
+	rec->id = id + 1;
+	rec->length = text_length(str);
+	ctx->new_string = str;
+
+	return rec->id;
 }
 
-static int
-emit_weston_output(struct timeline_emit_context *ctx, void *obj)
+static uint32_t
+emit_weston_output(struct timeline_emit_context *ctx,
+		   struct weston_output *o)
 {
-	struct weston_output *o = obj;
+	struct timeline_record_output *rec;
 
 	if (check_series(ctx, &o->timeline)) {
-		fprintf(ctx->out, "{ \"id\":%u, "
-			"\"type\":\"weston_output\", \"name\":",
-			o->timeline.id);
-		fprint_quoted_string(ctx->out, o->name);
-		fprintf(ctx->out, " }\n");
+		mark_described(ctx, &o->timeline);
+		rec = emit_record(ctx, TIMELINE_RECORD_OUTPUT, sizeof *rec,
+				  o->name, text_length(o->name));
+		if (rec) {
+			rec->id = o->timeline.id;
+			rec->length = text_length(o->name);
+		}
 	}
 
-	fprintf(ctx->cur, "\"wo\":%u", o->timeline.id);
-
-	return 1;
+	return o->timeline.id;
 }
 
 static void
 check_weston_surface_description(struct timeline_emit_context *ctx,
 				 struct weston_surface *s)
 {
+	struct timeline_record_surface *rec;
 	struct weston_surface *mains;
-	char d[512];
-	char mainstr[32];
+	uint32_t main_id = 0;
+	char d[TIMELINE_MAX_TEXT];
 
 	if (!check_series(ctx, &s->timeline))
 		return;
 
+	mark_described(ctx, &s->timeline);
+
 	mains = weston_surface_get_main_surface(s);
 	if (mains != s) {
 		check_weston_surface_description(ctx, mains);
-		if (snprintf(mainstr, sizeof(mainstr),
-			     ", \"main_surface\":%u", mains->timeline.id) < 0)
-			mainstr[0] = '\0';
-	} else {
-		mainstr[0] = '\0';
+		main_id = mains->timeline.id;
 	}
 
 	if (!s->get_label || s->get_label(s, d, sizeof(d)) < 0)
 		d[0] = '\0';
 
-	fprintf(ctx->out, "{ \"id\":%u, "
-		"\"type\":\"weston_surface\", \"desc\":", s->timeline.id);
-	fprint_quoted_string(ctx->out, d[0] ? d : NULL);
-	fprintf(ctx->out, "%s }\n", mainstr);
+	rec = emit_record(ctx, TIMELINE_RECORD_SURFACE, sizeof *rec,
+			  d, text_length(d));
+	if (rec) {
+		rec->id = s->timeline.id;
+		rec->main_surface = main_id;
+		rec->length = text_length(d);
+	}
 }
 
-static int
-emit_weston_surface(struct timeline_emit_context *ctx, void *obj)
+static uint32_t
+emit_weston_surface(struct timeline_emit_context *ctx,
+		    struct weston_surface *s)
 {
-	struct weston_surface *s = obj;
-
 	check_weston_surface_description(ctx, s);
-	fprintf(ctx->cur, "\"ws\":%u", s->timeline.id);
 
-	return 1;
+	return s->timeline.id;
 }
 
-static int
-emit_vblank_timestamp(struct timeline_emit_context *ctx, void *obj)
+/* Copy the records into the ring buffer, or undo them if they do not
+ * fit. Returns false if the flush thread has failed. */
+static bool
+timeline_commit(struct timeline_emit_context *ctx)
 {
-	struct timespec *ts = obj;
+	struct timeline_record_dropped dropped = { { 0 } };
+	uint64_t pos, len, space;
+	bool fits, ok;
+	const char **s;
+	unsigned i;
+
+	pthread_mutex_lock(&timeline_.mutex);
+
+	space = TIMELINE_RING_SIZE - (timeline_.head - timeline_.tail);
+	fits = ctx->size + (timeline_.dropped ? sizeof dropped : 0) <= space;
+
+	if (fits && timeline_.dropped) {
+		dropped.header.type = TIMELINE_RECORD_DROPPED;
+		dropped.header.size = sizeof dropped;
+		dropped.count = timeline_.dropped;
+		timeline_.dropped = 0;
+
+		memmove(ctx->data + sizeof dropped, ctx->data, ctx->size);
+		memcpy(ctx->data, &dropped, sizeof dropped);
+		ctx->size += sizeof dropped;
+	}
 
-	fprintf(ctx->cur, "\"vblank\":[%" PRId64 ", %ld]",
-		(int64_t)ts->tv_sec, ts->tv_nsec);
+	if (fits) {
+		pos = timeline_.head & (TIMELINE_RING_SIZE - 1);
+		len = TIMELINE_RING_SIZE - pos;
+		if (len > ctx->size)
+			len = ctx->size;
 
-	return 1;
-}
+		memcpy(timeline_.ring + pos, ctx->data, len);
+		memcpy(timeline_.ring, ctx->data + len, ctx->size - len);
+		timeline_.head += ctx->size;
 
-static int
-emit_gpu_timestamp(struct timeline_emit_context *ctx, void *obj)
-{
-	struct timespec *ts = obj;
+		/* Wake the thread early if the ring is filling up. */
+		if (timeline_.head - timeline_.tail > TIMELINE_RING_SIZE / 2)
+			pthread_cond_signal(&timeline_.cond);
+	} else {
+		timeline_.dropped++;
+	}
 
-	fprintf(ctx->cur, "\"gpu\":[%" PRId64 ", %ld]",
-		(int64_t)ts->tv_sec, ts->tv_nsec);
+	ok = !timeline_.write_error;
 
-	return 1;
-}
+	pthread_mutex_unlock(&timeline_.mutex);
 
-typedef int (*type_func)(struct timeline_emit_context *ctx, void *obj);
+	if (!fits) {
+		for (i = 0; i < ctx->described_count; i++)
+			ctx->described[i]->force_refresh = 1;
+	} else if (ctx->new_string) {
+		s = wl_array_add(&timeline_.strings, sizeof *s);
+		if (s)
+			*s = ctx->new_string;
+		else
+			ok = false;
+	}
 
-static const type_func type_dispatch[] = {
-	[TLT_OUTPUT] = emit_weston_output,
-	[TLT_SURFACE] = emit_weston_surface,
-	[TLT_VBLANK] = emit_vblank_timestamp,
-	[TLT_GPU] = emit_gpu_timestamp,
-};
+	return ok;
+}
 
 WL_EXPORT void
 weston_timeline_point(const char *name, ...)
 {
 	va_list argp;
-	struct timespec ts;
+	struct timespec ts, *stamp;
 	enum timeline_type otype;
 	void *obj;
-	char buf[512];
 	struct timeline_emit_context ctx;
+	struct timeline_record_point point = { { 0 } };
 
 	clock_gettime(timeline_.clk_id, &ts);
 
-	ctx.out = timeline_.file;
-	ctx.cur = fmemopen(buf, sizeof(buf), "w");
+	ctx.size = 0;
 	ctx.series = timeline_.series;
+	ctx.new_string = NULL;
+	ctx.described_count = 0;
 
-	if (!ctx.cur) {
-		weston_log("Timeline error in fmemopen, closing.\n");
-		weston_timeline_close();
-		return;
-	}
-
-	fprintf(ctx.cur, "{ \"T\":[%" PRId64 ", %ld], \"N\":\"%s\"",
-		(int64_t)ts.tv_sec, ts.tv_nsec, name);
+	point.header.type = TIMELINE_RECORD_POINT;
+	point.header.size = sizeof point;
+	point.sec = ts.tv_sec;
+	point.nsec = ts.tv_nsec;
+	point.name = emit_string(&ctx, name);
 
 	va_start(argp, name);
 	while (1) {
@@ -284,21 +522,43 @@ weston_timeline_point(const char *name, ...)
 			break;
 
 		obj = va_arg(argp, void *);
-		if (type_dispatch[otype]) {
-			fprintf(ctx.cur, ", ");
-			type_dispatch[otype](&ctx, obj);
+		switch (otype) {
+		case TLT_OUTPUT:
+			point.output = emit_weston_output(&ctx, obj);
+			break;
+		case TLT_SURFACE:
+			point.surface = emit_weston_surface(&ctx, obj);
+			break;
+		case TLT_VBLANK:
+			stamp = obj;
+			point.flags |= TIMELINE_POINT_VBLANK;
+			point.vblank_sec = stamp->tv_sec;
+			point.vblank_nsec = stamp->tv_nsec;
+			break;
+		case TLT_GPU:
+			stamp = obj;
+			point.flags |= TIMELINE_POINT_GPU;
+			point.gpu_sec = stamp->tv_sec;
+			point.gpu_nsec = stamp->tv_nsec;
+			break;
+		default:
+			break;
 		}
 	}
 	va_end(argp);
 
-	fprintf(ctx.cur, " }\n");
-	fflush(ctx.cur);
-	if (ferror(ctx.cur)) {
+	/* The stage is sized for the largest set of descriptions. */
+	if (ctx.size + sizeof point + sizeof(struct timeline_record_dropped) >
+	    sizeof ctx.data || point.name == 0) {
 		weston_log("Timeline error in constructing entry, closing.\n");
 		weston_timeline_close();
-	} else {
-		fprintf(ctx.out, "%s", buf);
+		return;
 	}
+	memcpy(ctx.data + ctx.size, &point, sizeof point);
+	ctx.size += sizeof point;
 
-	fclose(ctx.cur);
+	if (!timeline_commit(&ctx)) {
+		weston_log("Timeline error in writing the log, closing.\n");
+		weston_timeline_close();
+	}
 }
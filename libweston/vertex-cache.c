@@ -0,0 +1,408 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ * Copyright © 2015 Collabora, Ltd.
+ * Copyright © 2016 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vertex-cache.h"
+#include "vertex-clipping.h"
+
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define min(a, b) (((a) > (b)) ? (b) : (a))
+
+/*
+ * Compute the boundary vertices of the intersection of the global coordinate
+ * aligned rectangle 'rect', and an arbitrary quadrilateral produced from
+ * 'surf_rect' when transformed from surface coordinates into global coordinates.
+ * The vertices are written to 'ex' and 'ey', and the return value is the
+ * number of vertices. Vertices are produced in clockwise winding order.
+ * Guarantees to produce either zero vertices, or 3-8 vertices with non-zero
+ * polygon area.
+ */
+static int
+calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
+		pixman_box32_t *surf_rect, float *ex, float *ey)
+{
+
+	struct clip_context ctx;
+	int i, n;
+	float min_x, max_x, min_y, max_y;
+	struct polygon8 surf = {
+		{ surf_rect->x1, surf_rect->x2, surf_rect->x2, surf_rect->x1 },
+		{ surf_rect->y1, surf_rect->y1, surf_rect->y2, surf_rect->y2 },
+		4
+	};
+
+	ctx.clip.x1 = rect->x1;
+	ctx.clip.y1 = rect->y1;
+	ctx.clip.x2 = rect->x2;
+	ctx.clip.y2 = rect->y2;
+
+	/* transform surface to screen space: */
+	for (i = 0; i < surf.n; i++)
+		weston_view_to_global_float(ev, surf.x[i], surf.y[i],
+					    &surf.x[i], &surf.y[i]);
+
+	/* find bounding box: */
+	min_x = max_x = surf.x[0];
+	min_y = max_y = surf.y[0];
+
+	for (i = 1; i < surf.n; i++) {
+		min_x = min(min_x, surf.x[i]);
+		max_x = max(max_x, surf.x[i]);
+		min_y = min(min_y, surf.y[i]);
+		max_y = max(max_y, surf.y[i]);
+	}
+
+	/* First, simple bounding box check to discard early transformed
+	 * surface rects that do not intersect with the clip region:
+	 */
+	if ((min_x >= ctx.clip.x2) || (max_x <= ctx.clip.x1) ||
+	    (min_y >= ctx.clip.y2) || (max_y <= ctx.clip.y1))
+		return 0;
+
+	/* Simple case, bounding box edges are parallel to surface edges,
+	 * there will be only four edges.  We just need to clip the surface
+	 * vertices to the clip rect bounds:
+	 */
+	if (!ev->transform.enabled)
+		return clip_simple(&ctx, &surf, ex, ey);
+
+	/* Transformed case: use a general polygon clipping algorithm to
+	 * clip the surface rectangle with each side of 'rect'.
+	 * The algorithm is Sutherland-Hodgman, as explained in
+	 * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
+	 * but without looking at any of that code.
+	 */
+	n = clip_transformed(&ctx, &surf, ex, ey);
+
+	if (n < 3)
+		return 0;
+
+	return n;
+}
+
+static bool
+merge_down(pixman_box32_t *a, pixman_box32_t *b, pixman_box32_t *merge)
+{
+	if (a->x1 == b->x1 && a->x2 == b->x2 && a->y1 == b->y2) {
+		merge->x1 = a->x1;
+		merge->x2 = a->x2;
+		merge->y1 = b->y1;
+		merge->y2 = a->y2;
+		return true;
+	}
+	return false;
+}
+
+static int
+compress_bands(pixman_box32_t *inrects, int nrects,
+		   pixman_box32_t **outrects)
+{
+	bool merged = false;
+	pixman_box32_t *out, merge_rect;
+	int i, j, nout;
+
+	if (!nrects) {
+		*outrects = NULL;
+		return 0;
+	}
+
+	/* nrects is an upper bound - we're not too worried about
+	 * allocating a little extra
+	 */
+	out = malloc(sizeof(pixman_box32_t) * nrects);
+	out[0] = inrects[0];
+	nout = 1;
+	for (i = 1; i < nrects; i++) {
+		for (j = 0; j < nout; j++) {
+			merged = merge_down(&inrects[i], &out[j], &merge_rect);
+			if (merged) {
+				out[j] = merge_rect;
+				break;
+			}
+		}
+		if (!merged) {
+			out[nout] = inrects[i];
+			nout++;
+		}
+	}
+	*outrects = out;
+	return nout;
+}
+
+/* Appends to 'vertices' one fan per pair of rectangles of 'region', in
+ * global coordinates, and 'surf_region', in surface coordinates, that
+ * intersect, and returns the number of fans. */
+int
+texture_region(struct weston_view *ev, pixman_region32_t *region,
+	       pixman_region32_t *surf_region,
+	       const struct texture_geometry *tex,
+	       struct wl_array *vertices, struct wl_array *vtxcnt_array)
+{
+	float *v, inv_width, inv_height;
+	unsigned int *vtxcnt, nvtx = 0;
+	pixman_box32_t *rects, *surf_rects;
+	pixman_box32_t *raw_rects;
+	int i, j, k, nrects, nsurf, raw_nrects;
+	bool used_band_compression;
+	raw_rects = pixman_region32_rectangles(region, &raw_nrects);
+	surf_rects = pixman_region32_rectangles(surf_region, &nsurf);
+
+	if (raw_nrects < 4) {
+		used_band_compression = false;
+		nrects = raw_nrects;
+		rects = raw_rects;
+	} else {
+		nrects = compress_bands(raw_rects, raw_nrects, &rects);
+		used_band_compression = true;
+	}
+	/* worst case we can have 8 vertices per rect (ie. clipped into
+	 * an octagon):
+	 */
+	v = wl_array_add(vertices, nrects * nsurf * 8 * 4 * sizeof *v);
+	vtxcnt = wl_array_add(vtxcnt_array, nrects * nsurf * sizeof *vtxcnt);
+	if (!v || !vtxcnt)
+		goto out;
+
+	inv_width = 1.0 / tex->pitch;
+	inv_height = 1.0 / tex->height;
+
+	for (i = 0; i < nrects; i++) {
+		pixman_box32_t *rect = &rects[i];
+		for (j = 0; j < nsurf; j++) {
+			pixman_box32_t *surf_rect = &surf_rects[j];
+			float sx, sy, bx, by;
+			float ex[8], ey[8];          /* edge points in screen space */
+			int n;
+
+			/* The transformed surface, after clipping to the clip region,
+			 * can have as many as eight sides, emitted as a triangle-fan.
+			 * The first vertex in the triangle fan can be chosen arbitrarily,
+			 * since the area is guaranteed to be convex.
+			 *
+			 * If a corner of the transformed surface falls outside of the
+			 * clip region, instead of emitting one vertex for the corner
+			 * of the surface, up to two are emitted for two corresponding
+			 * intersection point(s) between the surface and the clip region.
+			 *
+			 * To do this, we first calculate the (up to eight) points that
+			 * form the intersection of the clip rect and the transformed
+			 * surface.
+			 */
+			n = calculate_edges(ev, rect, surf_rect, ex, ey);
+			if (n < 3)
+				continue;
+
+			/* emit edge points: */
+			for (k = 0; k < n; k++) {
+				weston_view_from_global_float(ev, ex[k], ey[k],
+							      &sx, &sy);
+				/* position: */
+				*(v++) = ex[k];
+				*(v++) = ey[k];
+				/* texcoord: */
+				weston_surface_to_buffer_float(ev->surface,
+							       sx, sy,
+							       &bx, &by);
+				*(v++) = bx * inv_width;
+				if (tex->y_inverted) {
+					*(v++) = by * inv_height;
+				} else {
+					*(v++) = (tex->height - by) * inv_height;
+				}
+			}
+
+			vtxcnt[nvtx++] = n;
+		}
+	}
+
+out:
+	if (used_band_compression)
+		free(rects);
+	return nvtx;
+}
+
+void
+vertex_cache_init(struct vertex_cache *cache)
+{
+	memset(cache, 0, sizeof *cache);
+	pixman_region32_init(&cache->surf_region);
+	wl_array_init(&cache->vertices);
+	wl_array_init(&cache->vtxcnt);
+}
+
+void
+vertex_cache_release(struct vertex_cache *cache)
+{
+	pixman_region32_fini(&cache->surf_region);
+	wl_array_release(&cache->vertices);
+	wl_array_release(&cache->vtxcnt);
+}
+
+bool
+vertex_cache_matches(struct vertex_cache *cache, struct weston_view *ev,
+		     pixman_region32_t *surf_region,
+		     const struct texture_geometry *tex)
+{
+	struct weston_surface *surface = ev->surface;
+
+	return cache->valid &&
+	       cache->generation == ev->transform.generation &&
+	       memcmp(&cache->buffer_viewport.buffer,
+		      &surface->buffer_viewport.buffer,
+		      sizeof cache->buffer_viewport.buffer) == 0 &&
+	       memcmp(&cache->buffer_viewport.surface,
+		      &surface->buffer_viewport.surface,
+		      sizeof cache->buffer_viewport.surface) == 0 &&
+	       cache->width == surface->width &&
+	       cache->height == surface->height &&
+	       cache->width_from_buffer == surface->width_from_buffer &&
+	       cache->height_from_buffer == surface->height_from_buffer &&
+	       memcmp(&cache->tex, tex, sizeof *tex) == 0 &&
+	       pixman_region32_equal(&cache->surf_region, surf_region);
+}
+
+/* Computes the fans of 'surf_region' against the whole bounding box of
+ * the view, so that only vertex_cache_clip() is left to do while the
+ * cache matches. */
+void
+vertex_cache_update(struct vertex_cache *cache, struct weston_view *ev,
+		    pixman_region32_t *surf_region,
+		    const struct texture_geometry *tex)
+{
+	struct weston_surface *surface = ev->surface;
+	pixman_region32_t bbox;
+
+	pixman_region32_init_with_extents(&bbox,
+		pixman_region32_extents(&ev->transform.boundingbox));
+	cache->vertices.size = 0;
+	cache->vtxcnt.size = 0;
+	texture_region(ev, &bbox, surf_region, tex,
+		       &cache->vertices, &cache->vtxcnt);
+	pixman_region32_fini(&bbox);
+
+	cache->valid = true;
+	cache->generation = ev->transform.generation;
+	cache->buffer_viewport = surface->buffer_viewport;
+	cache->width = surface->width;
+	cache->height = surface->height;
+	cache->width_from_buffer = surface->width_from_buffer;
+	cache->height_from_buffer = surface->height_from_buffer;
+	cache->tex = *tex;
+	pixman_region32_copy(&cache->surf_region, surf_region);
+}
+
+/* Clips the convex polygon 'in' of 'n' vertices against one edge of a
+ * rectangle, interpolating the texture coordinates linearly like the
+ * rasterizer does. 'coord' is 0 for x and 1 for y, 'sign' is 1 to keep
+ * what lies above 'bound' and -1 to keep what lies below. */
+static int
+clip_fan_edge(const float *in, int n, float *out,
+	      int coord, float sign, float bound)
+{
+	const float *a, *b;
+	float da, db, t;
+	int i, k, nout = 0;
+
+	for (i = 0; i < n; i++) {
+		a = &in[i * 4];
+		b = &in[((i + 1) % n) * 4];
+		da = sign * (a[coord] - bound);
+		db = sign * (b[coord] - bound);
+
+		if (da >= 0) {
+			memcpy(&out[nout * 4], a, 4 * sizeof *a);
+			nout++;
+		}
+
+		if ((da < 0 && db > 0) || (da > 0 && db < 0)) {
+			t = da / (da - db);
+			for (k = 0; k < 4; k++)
+				out[nout * 4 + k] = a[k] + t * (b[k] - a[k]);
+			out[nout * 4 + coord] = bound;
+			nout++;
+		}
+	}
+
+	return nout;
+}
+
+/* Appends to 'vertices' the fans of the cache clipped against every
+ * rectangle of 'region', and returns the number of fans produced. */
+int
+vertex_cache_clip(struct vertex_cache *cache, pixman_region32_t *region,
+		  struct wl_array *vertices, struct wl_array *vtxcnt_array)
+{
+	const unsigned int *counts = cache->vtxcnt.data;
+	int nfans = cache->vtxcnt.size / sizeof *counts;
+	pixman_box32_t *rects, *raw_rects;
+	int i, j, n, nrects, raw_nrects, nvtx = 0;
+	const float *fan;
+	/* A convex polygon of up to 8 vertices clipped by the four sides
+	 * of a rectangle has at most 12 vertices. */
+	float a[16 * 4], b[16 * 4];
+	unsigned int *vtxcnt;
+	float *v;
+
+	raw_rects = pixman_region32_rectangles(region, &raw_nrects);
+	if (raw_nrects < 4) {
+		nrects = raw_nrects;
+		rects = raw_rects;
+	} else {
+		nrects = compress_bands(raw_rects, raw_nrects, &rects);
+	}
+
+	for (i = 0; i < nrects; i++) {
+		fan = cache->vertices.data;
+		for (j = 0; j < nfans; fan += counts[j] * 4, j++) {
+			n = clip_fan_edge(fan, counts[j], a, 0, 1, rects[i].x1);
+			n = clip_fan_edge(a, n, b, 0, -1, rects[i].x2);
+			n = clip_fan_edge(b, n, a, 1, 1, rects[i].y1);
+			n = clip_fan_edge(a, n, b, 1, -1, rects[i].y2);
+			if (n < 3)
+				continue;
+
+			v = wl_array_add(vertices, n * 4 * sizeof *v);
+			vtxcnt = wl_array_add(vtxcnt_array, sizeof *vtxcnt);
+			if (!v || !vtxcnt)
+				goto out;
+
+			memcpy(v, b, n * 4 * sizeof *v);
+			*vtxcnt = n;
+			nvtx++;
+		}
+	}
+
+out:
+	if (rects != raw_rects)
+		free(rects);
+
+	return nvtx;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2012 Intel Corporation
+ * Copyright © 2015 Collabora, Ltd.
+ * Copyright © 2016 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WESTON_VERTEX_CACHE_H
+#define _WESTON_VERTEX_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "compositor.h"
+
+/* The part of the GL renderer turning view regions into textured
+ * polygons, kept free of GL so that it can be benchmarked with any
+ * renderer. Polygons are written as triangle fans of 4 floats per
+ * vertex: position x and y in global coordinates, then texture s and t,
+ * with the number of vertices of each fan in a separate array. */
+
+/* Maps buffer coordinates to texture coordinates */
+struct texture_geometry {
+	int pitch;
+	int height;
+	int y_inverted;
+};
+
+int
+texture_region(struct weston_view *ev, pixman_region32_t *region,
+	       pixman_region32_t *surf_region,
+	       const struct texture_geometry *tex,
+	       struct wl_array *vertices, struct wl_array *vtxcnt);
+
+/* Polygons of a transformed view, unclipped by the repaint region, reused
+ * as long as the view transformation, the buffer and the surface region
+ * painted stay the same */
+struct vertex_cache {
+	bool valid;
+	uint32_t generation;
+	struct weston_buffer_viewport buffer_viewport;
+	int32_t width, height;
+	int32_t width_from_buffer, height_from_buffer;
+	struct texture_geometry tex;
+	pixman_region32_t surf_region;
+	struct wl_array vertices;
+	struct wl_array vtxcnt;
+};
+
+void
+vertex_cache_init(struct vertex_cache *cache);
+
+void
+vertex_cache_release(struct vertex_cache *cache);
+
+bool
+vertex_cache_matches(struct vertex_cache *cache, struct weston_view *ev,
+		     pixman_region32_t *surf_region,
+		     const struct texture_geometry *tex);
+
+void
+vertex_cache_update(struct vertex_cache *cache, struct weston_view *ev,
+		    pixman_region32_t *surf_region,
+		    const struct texture_geometry *tex);
+
+int
+vertex_cache_clip(struct vertex_cache *cache, pixman_region32_t *region,
+		  struct wl_array *vertices, struct wl_array *vtxcnt);
+
+#endif
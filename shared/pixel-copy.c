@@ -0,0 +1,298 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include "pixel-copy.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Copies and converts 32 bits per pixel images, for the screenshooter,
+ * the screen recorder and the remote backends.
+ *
+ * Plain row copies are left to memcpy(), which is vectorized by the C
+ * library already. Swapping the red and blue channels has kernels for
+ * SSE2, AVX2 and NEON, picked at run time from what the CPU supports.
+ */
+
+typedef void (*swap_rb_row_func_t)(uint32_t *dst, const uint32_t *src,
+				   int width);
+
+static void
+swap_rb_row_c(uint32_t *dst, const uint32_t *src, int width)
+{
+	int i;
+
+	for (i = 0; i < width; i++) {
+		uint32_t v = src[i];
+
+		/*                  A R G B */
+		dst[i] = (v & 0xff00ff00) |
+			 ((v >> 16) & 0x000000ff) |
+			 ((v << 16) & 0x00ff0000);
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+static void
+swap_rb_row_sse2(uint32_t *dst, const uint32_t *src, int width)
+{
+	const __m128i ag = _mm_set1_epi32((int)0xff00ff00);
+	const __m128i b = _mm_set1_epi32(0x000000ff);
+	const __m128i r = _mm_set1_epi32(0x00ff0000);
+	__m128i v, t;
+	int i;
+
+	for (i = 0; i + 4 <= width; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		t = _mm_and_si128(v, ag);
+		t = _mm_or_si128(t, _mm_and_si128(_mm_srli_epi32(v, 16), b));
+		t = _mm_or_si128(t, _mm_and_si128(_mm_slli_epi32(v, 16), r));
+		_mm_storeu_si128((__m128i *)(dst + i), t);
+	}
+
+	swap_rb_row_c(dst + i, src + i, width - i);
+}
+
+__attribute__((target("avx2")))
+static void
+swap_rb_row_avx2(uint32_t *dst, const uint32_t *src, int width)
+{
+	const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+						 10, 9, 8, 11, 14, 13, 12, 15,
+						 2, 1, 0, 3, 6, 5, 4, 7,
+						 10, 9, 8, 11, 14, 13, 12, 15);
+	__m256i v0, v1;
+	int i;
+
+	for (i = 0; i + 16 <= width; i += 16) {
+		v0 = _mm256_loadu_si256((const __m256i *)(src + i));
+		v1 = _mm256_loadu_si256((const __m256i *)(src + i + 8));
+		v0 = _mm256_shuffle_epi8(v0, shuffle);
+		v1 = _mm256_shuffle_epi8(v1, shuffle);
+		_mm256_storeu_si256((__m256i *)(dst + i), v0);
+		_mm256_storeu_si256((__m256i *)(dst + i + 8), v1);
+	}
+
+	swap_rb_row_sse2(dst + i, src + i, width - i);
+}
+#endif
+
+#ifdef HAVE_NEON_KERNELS
+static void
+swap_rb_row_neon(uint32_t *dst, const uint32_t *src, int width)
+{
+	uint8x16x4_t v;
+	uint8x16_t t;
+	int i;
+
+	for (i = 0; i + 16 <= width; i += 16) {
+		v = vld4q_u8((const uint8_t *)(src + i));
+		t = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = t;
+		vst4q_u8((uint8_t *)(dst + i), v);
+	}
+
+	swap_rb_row_c(dst + i, src + i, width - i);
+}
+#endif
+
+static const struct {
+	enum pixel_copy_impl impl;
+	const char *name;
+	swap_rb_row_func_t swap_rb_row;
+} impls[] = {
+#ifdef HAVE_X86_KERNELS
+	{ PIXEL_COPY_IMPL_AVX2, "AVX2", swap_rb_row_avx2 },
+	{ PIXEL_COPY_IMPL_SSE2, "SSE2", swap_rb_row_sse2 },
+#endif
+#ifdef HAVE_NEON_KERNELS
+	{ PIXEL_COPY_IMPL_NEON, "NEON", swap_rb_row_neon },
+#endif
+	{ PIXEL_COPY_IMPL_C, "C", swap_rb_row_c },
+};
+
+static int
+impl_supported(enum pixel_copy_impl impl)
+{
+	switch (impl) {
+#ifdef HAVE_X86_KERNELS
+	case PIXEL_COPY_IMPL_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	case PIXEL_COPY_IMPL_SSE2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+#endif
+#ifdef HAVE_NEON_KERNELS
+	case PIXEL_COPY_IMPL_NEON:
+		/* Built with NEON enabled, so it is there. */
+		return 1;
+#endif
+	case PIXEL_COPY_IMPL_C:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static unsigned int current_impl;
+static int current_impl_valid;
+
+static void
+choose_impl(void)
+{
+	unsigned int i;
+
+	/* The C version is last and always supported. */
+	for (i = 0; !impl_supported(impls[i].impl); i++)
+		;
+
+	current_impl = i;
+	current_impl_valid = 1;
+}
+
+static swap_rb_row_func_t
+get_swap_rb_row(void)
+{
+	/* Racing threads would all pick the same one. */
+	if (!current_impl_valid)
+		choose_impl();
+
+	return impls[current_impl].swap_rb_row;
+}
+
+/** Override the kernels picked for the CPU, for tests and benchmarks
+ *
+ * \param impl The kernels to use, or PIXEL_COPY_IMPL_AUTO for the best
+ * ones the CPU supports.
+ * \return 0 on success, -1 if the kernels are not built in or the CPU
+ * does not support them.
+ */
+int
+pixel_copy_set_impl(enum pixel_copy_impl impl)
+{
+	unsigned int i;
+
+	if (impl == PIXEL_COPY_IMPL_AUTO) {
+		choose_impl();
+		return 0;
+	}
+
+	for (i = 0; i < sizeof impls / sizeof impls[0]; i++) {
+		if (impls[i].impl != impl)
+			continue;
+
+		if (!impl_supported(impl))
+			return -1;
+
+		current_impl = i;
+		current_impl_valid = 1;
+		return 0;
+	}
+
+	return -1;
+}
+
+const char *
+pixel_copy_impl_name(void)
+{
+	if (!current_impl_valid)
+		choose_impl();
+
+	return impls[current_impl].name;
+}
+
+/** Swap the red and blue channels of a row of 32 bits per pixel
+ *
+ * \param dst The destination row, may be the same as src.
+ * \param src The source row.
+ * \param width The number of pixels.
+ */
+void
+pixel_copy_row_swap_rb(void *dst, const void *src, int width)
+{
+	get_swap_rb_row()(dst, src, width);
+}
+
+/** Copy a rectangle of 32 bits per pixel
+ *
+ * \param dst The first row of the destination.
+ * \param dst_stride The destination stride in bytes.
+ * \param src The first row of the source.
+ * \param src_stride The source stride in bytes.
+ * \param width The width of the rectangle in pixels.
+ * \param height The height of the rectangle in rows.
+ * \param flags A combination of enum pixel_copy_flags.
+ *
+ * The source and destination must not overlap.
+ */
+void
+pixel_copy_rect32(void *dst, int dst_stride,
+		  const void *src, int src_stride,
+		  int width, int height, uint32_t flags)
+{
+	swap_rb_row_func_t swap_rb_row = NULL;
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	int y;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	if (flags & PIXEL_COPY_YFLIP) {
+		s += (height - 1) * src_stride;
+		src_stride = -src_stride;
+	}
+
+	if (flags & PIXEL_COPY_SWAP_RB)
+		swap_rb_row = get_swap_rb_row();
+	else if (src_stride == width * 4 && dst_stride == width * 4) {
+		memcpy(d, s, (size_t)height * width * 4);
+		return;
+	}
+
+	for (y = 0; y < height; y++) {
+		if (swap_rb_row)
+			swap_rb_row((uint32_t *)d, (const uint32_t *)s, width);
+		else
+			memcpy(d, s, width * 4);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
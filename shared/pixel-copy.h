@@ -0,0 +1,67 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_PIXEL_COPY_H
+#define WESTON_PIXEL_COPY_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+enum pixel_copy_flags {
+	/* Swap the red and blue channels, converting between
+	 * a8r8g8b8 and a8b8g8r8 (or the x8 variants) */
+	PIXEL_COPY_SWAP_RB = 1 << 0,
+	/* Copy the last source row to the first destination row */
+	PIXEL_COPY_YFLIP = 1 << 1,
+};
+
+enum pixel_copy_impl {
+	PIXEL_COPY_IMPL_AUTO = 0,
+	PIXEL_COPY_IMPL_C,
+	PIXEL_COPY_IMPL_SSE2,
+	PIXEL_COPY_IMPL_AVX2,
+	PIXEL_COPY_IMPL_NEON,
+};
+
+void
+pixel_copy_rect32(void *dst, int dst_stride,
+		  const void *src, int src_stride,
+		  int width, int height, uint32_t flags);
+
+void
+pixel_copy_row_swap_rb(void *dst, const void *src, int width);
+
+int
+pixel_copy_set_impl(enum pixel_copy_impl impl);
+
+const char *
+pixel_copy_impl_name(void);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* WESTON_PIXEL_COPY_H */
@@ -109,6 +109,30 @@ typedef struct wl_buffer * (EGLAPIENTRYP PFNEGLCREATEWAYLANDBUFFERFROMIMAGEWL) (
 #define GL_UNPACK_SKIP_PIXELS_EXT                               0x0CF4
 #endif
 
+#ifndef GL_MAP_WRITE_BIT_EXT
+#define GL_MAP_WRITE_BIT_EXT              0x0002
+#define GL_MAP_INVALIDATE_BUFFER_BIT_EXT  0x0008
+#endif
+
+/* Same value as GL_PIXEL_UNPACK_BUFFER of GLES 3 */
+#ifndef GL_PIXEL_UNPACK_BUFFER_NV
+#define GL_PIXEL_UNPACK_BUFFER_NV         0x88EC
+#endif
+
+#ifndef GL_MAP_READ_BIT_EXT
+#define GL_MAP_READ_BIT_EXT               0x0001
+#endif
+
+/* Same value as GL_PIXEL_PACK_BUFFER of GLES 3 */
+#ifndef GL_PIXEL_PACK_BUFFER_NV
+#define GL_PIXEL_PACK_BUFFER_NV           0x88EB
+#endif
+
+/* Buffer usage hint of GLES 3 */
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ                    0x88E1
+#endif
+
 /* Define needed tokens from EGL_EXT_image_dma_buf_import extension
  * here to avoid having to add ifdefs everywhere.*/
 #ifndef EGL_EXT_image_dma_buf_import
@@ -0,0 +1,202 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "compositor/weston.h"
+#include "windowed-output-api.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "module-test-helper.h"
+
+/*
+ * Damages every surface on every frame and reports the CPU time the
+ * compositor spends per frame for different numbers of outputs and
+ * surfaces. Outputs are added on the fly through the windowed output
+ * API of the headless backend, side by side, and the surfaces are
+ * spread over all of them.
+ */
+
+#define FRAME_COUNT 60
+
+static const int output_counts[] = { 1, 2, 4 };
+static const int surface_counts[] = { 10, 100, 1000 };
+
+struct bench {
+	struct module_test base;
+	const struct weston_windowed_output_api *api;
+	unsigned int output_round;
+	unsigned int surface_round;
+	int output_count;
+	int frame;
+	struct timespec begin;
+};
+
+static void
+populate(struct bench *bench, int count)
+{
+	struct weston_output *output;
+	int width = 0, height = 0;
+	int i, x, y, w, h;
+
+	wl_list_for_each(output, &bench->base.compositor->output_list, link) {
+		width = MAX(width, output->x + output->width);
+		height = MAX(height, output->y + output->height);
+	}
+	assert(width > 0 && height > 0);
+
+	for (i = 0; i < count; i++) {
+		w = 32 + rand() % 256;
+		h = 32 + rand() % 256;
+		x = rand() % width - 16;
+		y = rand() % height - 16;
+		module_test_add_view(&bench->base, x, y, w, h);
+	}
+}
+
+static void
+damage_all(struct bench *bench)
+{
+	struct weston_surface **surface;
+
+	wl_array_for_each(surface, &bench->base.surfaces)
+		pixman_region32_union_rect(&(*surface)->damage,
+					   &(*surface)->damage, 0, 0,
+					   (*surface)->width,
+					   (*surface)->height);
+
+	weston_compositor_schedule_repaint(bench->base.compositor);
+}
+
+static void
+add_outputs(struct bench *bench, int count)
+{
+	char name[32];
+	int ret;
+
+	while (bench->output_count < count) {
+		snprintf(name, sizeof name, "bench-%d", bench->output_count);
+		ret = bench->api->output_create(bench->base.compositor, name);
+		assert(ret == 0);
+		bench->output_count++;
+	}
+}
+
+static void
+report(struct bench *bench)
+{
+	struct timespec end;
+	int64_t nsec;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	nsec = timespec_sub_to_nsec(&end, &bench->begin);
+
+	fprintf(stderr, "%d outputs, %5d surfaces: %8.1f us/frame\n",
+		bench->output_count, surface_counts[bench->surface_round],
+		(double)nsec / FRAME_COUNT / 1000.0);
+}
+
+static bool
+next_round(struct bench *bench)
+{
+	if (++bench->surface_round == ARRAY_LENGTH(surface_counts)) {
+		bench->surface_round = 0;
+		if (++bench->output_round == ARRAY_LENGTH(output_counts))
+			return false;
+
+		add_outputs(bench, output_counts[bench->output_round]);
+	}
+
+	populate(bench, surface_counts[bench->surface_round]);
+
+	return true;
+}
+
+static void
+bench_frame(struct module_test *base, uint32_t msecs)
+{
+	struct bench *bench = container_of(base, struct bench, base);
+
+	/* The first frame after populating maps the views; start counting
+	 * from there. */
+	if (bench->frame++ == 0)
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &bench->begin);
+
+	if (bench->frame <= FRAME_COUNT) {
+		damage_all(bench);
+		return;
+	}
+
+	report(bench);
+	module_test_clear_views(base);
+	bench->frame = 0;
+
+	if (!next_round(bench)) {
+		module_test_finish(base);
+		free(bench);
+		return;
+	}
+
+	weston_compositor_schedule_repaint(base->compositor);
+}
+
+static void
+bench_start(struct module_test *base)
+{
+	struct bench *bench = container_of(base, struct bench, base);
+
+	bench->output_count = wl_list_length(&base->compositor->output_list);
+	add_outputs(bench, output_counts[0]);
+
+	srand(1);
+	populate(bench, surface_counts[0]);
+	weston_compositor_schedule_repaint(base->compositor);
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct bench *bench;
+
+	bench = zalloc(sizeof *bench);
+	if (!bench)
+		return -1;
+
+	bench->api = weston_windowed_output_get_api(compositor);
+	if (!bench->api) {
+		weston_log("damage-benchmark: needs the headless backend\n");
+		free(bench);
+		return -1;
+	}
+
+	module_test_init(&bench->base, compositor, bench_start, bench_frame);
+
+	return 0;
+}
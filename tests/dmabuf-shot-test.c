@@ -0,0 +1,223 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <drm_fourcc.h>
+
+#include "weston-test-client-helper.h"
+#include "shared/os-compatibility.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+
+#ifndef DRM_FORMAT_MOD_LINEAR
+#define DRM_FORMAT_MOD_LINEAR 0
+#endif
+
+char *server_parameters = "--use-pixman --width=320 --height=240"
+	" --shell=weston-test-desktop-shell.so";
+
+/*
+ * The pixman renderer cannot copy into a dmabuf itself, so the
+ * screenshooter reads the output back and writes it through a CPU mapping
+ * of the dmabuf. A memfd stands in for the dmabuf, the compositor maps it
+ * the same way.
+ */
+
+struct memfd_dmabuf {
+	struct wl_buffer *proxy;
+	int fd;
+	int width, height, stride;
+	uint32_t *map;
+};
+
+static struct zwp_linux_dmabuf_v1 *
+get_linux_dmabuf(struct client *client)
+{
+	struct global *g;
+	struct global *global_dmabuf = NULL;
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, "zwp_linux_dmabuf_v1"))
+			continue;
+
+		if (global_dmabuf)
+			assert(0 && "multiple zwp_linux_dmabuf_v1 objects");
+
+		global_dmabuf = g;
+	}
+
+	assert(global_dmabuf && "no zwp_linux_dmabuf_v1 found");
+	assert(global_dmabuf->version >= 2);
+
+	dmabuf = wl_registry_bind(client->wl_registry, global_dmabuf->name,
+				  &zwp_linux_dmabuf_v1_interface, 2);
+	assert(dmabuf);
+
+	return dmabuf;
+}
+
+static void
+memfd_dmabuf_create(struct memfd_dmabuf *buf,
+		    struct zwp_linux_dmabuf_v1 *dmabuf,
+		    int width, int height)
+{
+	struct zwp_linux_buffer_params_v1 *params;
+	uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+	size_t size;
+
+	buf->width = width;
+	buf->height = height;
+	buf->stride = width * 4;
+	size = (size_t) buf->stride * height;
+
+	buf->fd = os_create_anonymous_file(size);
+	assert(buf->fd >= 0);
+
+	buf->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			buf->fd, 0);
+	assert(buf->map != MAP_FAILED);
+	memset(buf->map, 0, size);
+
+	params = zwp_linux_dmabuf_v1_create_params(dmabuf);
+	zwp_linux_buffer_params_v1_add(params, buf->fd, 0, 0, buf->stride,
+				       modifier >> 32, modifier & 0xffffffff);
+	buf->proxy = zwp_linux_buffer_params_v1_create_immed(params,
+							      width, height,
+							      DRM_FORMAT_XRGB8888,
+							      0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	assert(buf->proxy);
+}
+
+static void
+memfd_dmabuf_destroy(struct memfd_dmabuf *buf)
+{
+	wl_buffer_destroy(buf->proxy);
+	munmap(buf->map, (size_t) buf->stride * buf->height);
+	close(buf->fd);
+}
+
+static void
+capture_into(struct client *client, struct wl_buffer *buffer)
+{
+	client->test->buffer_copy_done = 0;
+	weston_test_capture_screenshot(client->test->weston_test,
+				       client->output->wl_output,
+				       buffer);
+	while (client->test->buffer_copy_done == 0)
+		if (wl_display_dispatch(client->wl_display) < 0)
+			break;
+
+	assert(client->test->buffer_copy_done);
+}
+
+static void
+surface_fill(struct client *client, uint32_t color)
+{
+	struct surface *surface = client->surface;
+	uint32_t *pixels;
+	int i;
+
+	pixels = pixman_image_get_data(surface->buffer->image);
+	for (i = 0; i < surface->width * surface->height; i++)
+		pixels[i] = color;
+
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0,
+			  surface->width, surface->height);
+	wl_surface_commit(surface->wl_surface);
+}
+
+TEST(dmabuf_capture_matches_shm_capture)
+{
+	struct client *client;
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	struct memfd_dmabuf buf;
+	struct buffer *shot;
+	uint32_t *shm_pixels;
+	int shm_stride;
+	int x, y;
+
+	client = create_client_and_test_surface(100, 50, 100, 100);
+	assert(client);
+	dmabuf = get_linux_dmabuf(client);
+
+	/* move the pointer clearly away from our screenshooting area */
+	weston_test_move_pointer(client->test->weston_test, 2, 30);
+
+	surface_fill(client, 0xffff0000);
+
+	memfd_dmabuf_create(&buf, dmabuf,
+			    client->output->width, client->output->height);
+	capture_into(client, buf.proxy);
+
+	assert((buf.map[100 * buf.width + 150] & 0xffffff) == 0xff0000);
+	assert((buf.map[10 * buf.width + 10] & 0xffffff) != 0xff0000);
+
+	/* The dmabuf and the wl_shm capture go through different paths,
+	 * but have to agree on every pixel, including the orientation. */
+	shot = capture_screenshot_of_output(client);
+	shm_pixels = pixman_image_get_data(shot->image);
+	shm_stride = pixman_image_get_stride(shot->image) / 4;
+
+	for (y = 0; y < buf.height; y++)
+		for (x = 0; x < buf.width; x++)
+			assert((buf.map[y * buf.width + x] & 0xffffff) ==
+			       (shm_pixels[y * shm_stride + x] & 0xffffff));
+
+	buffer_destroy(shot);
+	memfd_dmabuf_destroy(&buf);
+	zwp_linux_dmabuf_v1_destroy(dmabuf);
+}
+
+TEST(dmabuf_capture_rejects_small_buffer)
+{
+	struct client *client;
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	struct memfd_dmabuf buf;
+
+	client = create_client_and_test_surface(100, 50, 100, 100);
+	assert(client);
+	dmabuf = get_linux_dmabuf(client);
+
+	memfd_dmabuf_create(&buf, dmabuf,
+			    client->output->width / 2, client->output->height);
+
+	/* The buffer is refused without a done event, the roundtrip
+	 * must come back with the buffer left untouched. */
+	client->test->buffer_copy_done = 0;
+	weston_test_capture_screenshot(client->test->weston_test,
+				       client->output->wl_output,
+				       buf.proxy);
+	client_roundtrip(client);
+	assert(client->test->buffer_copy_done == 0);
+	assert(buf.map[0] == 0);
+
+	memfd_dmabuf_destroy(&buf);
+	zwp_linux_dmabuf_v1_destroy(dmabuf);
+}
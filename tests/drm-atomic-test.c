@@ -0,0 +1,197 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "compositor.h"
+#include "compositor/weston.h"
+#include "shared/helpers.h"
+
+/*
+ * Runs the DRM backend for a number of frames under drm-commit-recorder,
+ * on the fake KMS device so that neither root nor a display is needed,
+ * then checks from its log that every repaint went to the kernel as one
+ * non-blocking atomic commit, the first of them carrying the modeset, that
+ * the primary plane was flipped between buffers, and that no legacy KMS
+ * call was made meanwhile.
+ */
+
+#define FRAME_COUNT 30
+
+#define FLAG_PAGE_FLIP_EVENT	0x0001
+#define FLAG_TEST_ONLY		0x0100
+#define FLAG_NONBLOCK		0x0200
+#define FLAG_ALLOW_MODESET	0x0400
+
+struct atomic_test {
+	struct weston_compositor *compositor;
+	struct weston_animation animation;
+	const char *log_path;
+	int start_commits;
+	int frames;
+};
+
+/* Checks the log so far, returns the number of commits made */
+static int
+check_commit_log(const char *path)
+{
+	FILE *fp;
+	char line[256];
+	unsigned int flags;
+	unsigned long long value, fbs[2] = { 0, 0 };
+	int ret, commits = 0, fb_props = 0, modeset_props = 0;
+	bool in_commit = false;
+
+	/* Nothing has been logged yet. */
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+
+	while (fgets(line, sizeof line, fp)) {
+		if (strncmp(line, "legacy ", 7) == 0) {
+			fprintf(stderr, "unexpected legacy call: %s", line);
+			assert(0);
+		}
+
+		if (sscanf(line, "atomic flags=0x%x ret=%d", &flags, &ret) == 2) {
+			in_commit = false;
+			if (flags & FLAG_TEST_ONLY)
+				continue;
+
+			assert(ret == 0);
+			assert(flags & FLAG_NONBLOCK);
+			assert(flags & FLAG_PAGE_FLIP_EVENT);
+			if (commits == 0)
+				assert(flags & FLAG_ALLOW_MODESET);
+
+			in_commit = true;
+			commits++;
+			continue;
+		}
+
+		if (!in_commit)
+			continue;
+
+		if (commits == 1 && (strstr(line, " MODE_ID=") ||
+				     strstr(line, " ACTIVE=1")))
+			modeset_props++;
+
+		if (sscanf(line, " %*u FB_ID=%llu", &value) == 1 &&
+		    value != 0) {
+			fb_props++;
+			if (value != fbs[0] && fbs[1] == 0 && fbs[0] != 0)
+				fbs[1] = value;
+			if (fbs[0] == 0)
+				fbs[0] = value;
+		}
+	}
+
+	fclose(fp);
+
+	if (commits == 0)
+		return 0;
+
+	/* The modeset sets the mode and lights up the CRTC */
+	assert(modeset_props == 2);
+
+	/* Every commit at least flips the primary plane */
+	assert(fb_props >= commits);
+
+	/* and with more than one of them, between two buffers */
+	if (commits > 2)
+		assert(fbs[1] != 0);
+
+	return commits;
+}
+
+static void
+atomic_test_frame(struct weston_animation *animation,
+		  struct weston_output *output, uint32_t msecs)
+{
+	struct atomic_test *test =
+		container_of(animation, struct atomic_test, animation);
+	int commits;
+
+	if (++test->frames < FRAME_COUNT) {
+		weston_output_schedule_repaint(output);
+		return;
+	}
+
+	wl_list_remove(&animation->link);
+	wl_list_init(&animation->link);
+
+	/* This frame is being repainted, its commit is yet to come.
+	 * Restarting the repaint loop may cost one more commit, but there
+	 * is never more than one per repaint. */
+	commits = check_commit_log(test->log_path) - test->start_commits;
+	fprintf(stderr, "%d atomic commits for %d repaints\n",
+		commits, test->frames - 1);
+	assert(commits >= test->frames - 1);
+	assert(commits <= test->frames);
+
+	wl_display_terminate(test->compositor->wl_display);
+	free(test);
+}
+
+static void
+atomic_test_start(void *data)
+{
+	struct atomic_test *test = data;
+	struct weston_output *output;
+
+	assert(!wl_list_empty(&test->compositor->output_list));
+	output = container_of(test->compositor->output_list.next,
+			      struct weston_output, link);
+
+	test->log_path = getenv("WESTON_DRM_COMMIT_LOG");
+	assert(test->log_path);
+	test->start_commits = check_commit_log(test->log_path);
+
+	test->animation.frame = atomic_test_frame;
+	wl_list_insert(&output->animation_list, &test->animation.link);
+	weston_output_schedule_repaint(output);
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct atomic_test *test;
+
+	test = zalloc(sizeof *test);
+	if (!test)
+		return -1;
+
+	test->compositor = compositor;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	wl_event_loop_add_idle(loop, atomic_test_start, test);
+
+	return 0;
+}
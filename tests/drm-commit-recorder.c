@@ -0,0 +1,302 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <wayland-util.h>
+
+#include "shared/helpers.h"
+#include "shared/zalloc.h"
+#include "drm-fake-device.h"
+
+/*
+ * LD_PRELOAD library logging the KMS updates done through libdrm to the
+ * file named by WESTON_DRM_COMMIT_LOG, one line per call:
+ *
+ *	atomic flags=0x<flags> ret=<ret>
+ *	 <object id> <property name>=<value>
+ *	legacy <function> crtc=<crtc id> ...
+ *
+ * with the properties of an atomic commit on the lines following it.
+ * The calls go to the fake KMS device of drm-fake-device.c when the
+ * compositor runs on it, and to the real libdrm otherwise.
+ */
+
+struct recorded_req {
+	drmModeAtomicReqPtr req;
+	struct drm_prop_value *props;
+	int count, alloc;
+	struct recorded_req *next;
+};
+
+static struct recorded_req *recorded_reqs;
+static FILE *commit_log;
+
+static FILE *
+get_log(void)
+{
+	const char *path;
+
+	if (commit_log)
+		return commit_log;
+
+	path = getenv("WESTON_DRM_COMMIT_LOG");
+	if (!path)
+		return NULL;
+
+	commit_log = fopen(path, "w");
+
+	return commit_log;
+}
+
+static struct recorded_req *
+find_req(drmModeAtomicReqPtr req, struct recorded_req ***prev_next)
+{
+	struct recorded_req **next, *r;
+
+	for (next = &recorded_reqs; (r = *next); next = &r->next) {
+		if (r->req != req)
+			continue;
+
+		if (prev_next)
+			*prev_next = next;
+		return r;
+	}
+
+	return NULL;
+}
+
+WL_EXPORT int
+drmModeAtomicAddProperty(drmModeAtomicReqPtr req, uint32_t object_id,
+			 uint32_t property_id, uint64_t value)
+{
+	static int (*real)(drmModeAtomicReqPtr, uint32_t, uint32_t, uint64_t);
+	struct recorded_req *r;
+	struct drm_prop_value *props;
+	int ret;
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	ret = real(req, object_id, property_id, value);
+	if (ret <= 0)
+		return ret;
+
+	r = find_req(req, NULL);
+	if (!r) {
+		r = zalloc(sizeof *r);
+		if (!r)
+			return ret;
+		r->req = req;
+		r->next = recorded_reqs;
+		recorded_reqs = r;
+	}
+
+	if (r->count == r->alloc) {
+		props = realloc(r->props,
+				(r->alloc * 2 + 16) * sizeof r->props[0]);
+		if (!props)
+			return ret;
+		r->props = props;
+		r->alloc = r->alloc * 2 + 16;
+	}
+
+	r->props[r->count].object_id = object_id;
+	r->props[r->count].prop_id = property_id;
+	r->props[r->count].value = value;
+	r->count++;
+
+	return ret;
+}
+
+WL_EXPORT void
+drmModeAtomicFree(drmModeAtomicReqPtr req)
+{
+	static void (*real)(drmModeAtomicReqPtr);
+	struct recorded_req **prev_next, *r;
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	r = find_req(req, &prev_next);
+	if (r) {
+		*prev_next = r->next;
+		free(r->props);
+		free(r);
+	}
+
+	real(req);
+}
+
+WL_EXPORT int
+drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req, uint32_t flags,
+		    void *user_data)
+{
+	static int (*real)(int, drmModeAtomicReqPtr, uint32_t, void *);
+	struct recorded_req *r;
+	drmModePropertyPtr prop;
+	FILE *fp = get_log();
+	int ret, i;
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	r = find_req(req, NULL);
+	if (drm_fake_device_is(fd))
+		ret = drm_fake_atomic_commit(r ? r->props : NULL,
+					     r ? r->count : 0,
+					     flags, user_data);
+	else
+		ret = real(fd, req, flags, user_data);
+	if (!fp)
+		return ret;
+
+	fprintf(fp, "atomic flags=0x%x ret=%d\n", flags, ret);
+
+	for (i = 0; r && i < r->count; i++) {
+		prop = drmModeGetProperty(fd, r->props[i].prop_id);
+		fprintf(fp, " %u %s=%llu\n", r->props[i].object_id,
+			prop ? prop->name : "?",
+			(unsigned long long) r->props[i].value);
+		drmModeFreeProperty(prop);
+	}
+	fflush(fp);
+
+	return ret;
+}
+
+static void
+log_legacy(const char *func, uint32_t crtc_id, uint32_t fb_id)
+{
+	FILE *fp = get_log();
+
+	if (!fp)
+		return;
+
+	fprintf(fp, "legacy %s crtc=%u fb=%u\n", func, crtc_id, fb_id);
+	fflush(fp);
+}
+
+WL_EXPORT int
+drmModeSetCrtc(int fd, uint32_t crtc_id, uint32_t buffer_id,
+	       uint32_t x, uint32_t y, uint32_t *connectors, int count,
+	       drmModeModeInfoPtr mode)
+{
+	static int (*real)(int, uint32_t, uint32_t, uint32_t, uint32_t,
+			   uint32_t *, int, drmModeModeInfoPtr);
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	log_legacy(__func__, crtc_id, buffer_id);
+
+	if (drm_fake_device_is(fd))
+		return drm_fake_set_crtc(crtc_id, buffer_id,
+					 connectors, count, mode);
+
+	return real(fd, crtc_id, buffer_id, x, y, connectors, count, mode);
+}
+
+WL_EXPORT int
+drmModePageFlip(int fd, uint32_t crtc_id, uint32_t fb_id,
+		uint32_t flags, void *user_data)
+{
+	static int (*real)(int, uint32_t, uint32_t, uint32_t, void *);
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	log_legacy(__func__, crtc_id, fb_id);
+
+	if (drm_fake_device_is(fd))
+		return drm_fake_page_flip(crtc_id, fb_id, flags, user_data);
+
+	return real(fd, crtc_id, fb_id, flags, user_data);
+}
+
+WL_EXPORT int
+drmModeSetPlane(int fd, uint32_t plane_id, uint32_t crtc_id,
+		uint32_t fb_id, uint32_t flags,
+		int32_t crtc_x, int32_t crtc_y,
+		uint32_t crtc_w, uint32_t crtc_h,
+		uint32_t src_x, uint32_t src_y,
+		uint32_t src_w, uint32_t src_h)
+{
+	static int (*real)(int, uint32_t, uint32_t, uint32_t, uint32_t,
+			   int32_t, int32_t, uint32_t, uint32_t,
+			   uint32_t, uint32_t, uint32_t, uint32_t);
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	log_legacy(__func__, crtc_id, fb_id);
+
+	if (drm_fake_device_is(fd))
+		return drm_fake_set_plane(plane_id, crtc_id, fb_id,
+					  crtc_x, crtc_y, crtc_w, crtc_h,
+					  src_x, src_y, src_w, src_h);
+
+	return real(fd, plane_id, crtc_id, fb_id, flags,
+		    crtc_x, crtc_y, crtc_w, crtc_h,
+		    src_x, src_y, src_w, src_h);
+}
+
+WL_EXPORT int
+drmModeSetCursor(int fd, uint32_t crtc_id, uint32_t bo_handle,
+		 uint32_t width, uint32_t height)
+{
+	static int (*real)(int, uint32_t, uint32_t, uint32_t, uint32_t);
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	log_legacy(__func__, crtc_id, bo_handle);
+
+	/* The cursor is never read back from the fake device */
+	if (drm_fake_device_is(fd))
+		return 0;
+
+	return real(fd, crtc_id, bo_handle, width, height);
+}
+
+WL_EXPORT int
+drmModeMoveCursor(int fd, uint32_t crtc_id, int x, int y)
+{
+	static int (*real)(int, uint32_t, int, int);
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	log_legacy(__func__, crtc_id, 0);
+
+	if (drm_fake_device_is(fd))
+		return 0;
+
+	return real(fd, crtc_id, x, y);
+}
@@ -0,0 +1,2442 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <libudev.h>
+#include <wayland-util.h>
+
+#include "launcher-util.h"
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "shared/timespec-util.h"
+#include "shared/zalloc.h"
+#include "drm-fake-device.h"
+
+/*
+ * A KMS device faked in drm-commit-recorder, so that the DRM backend can
+ * be tested without root, a free VT or a display. It is enabled in
+ * the compositor by setting WESTON_DRM_FAKE_DEVICE.
+ *
+ * The device has one CRTC driving one connector through one encoder,
+ * with a primary, a cursor and an overlay plane, and a single
+ * 1024x768@60 mode. udev reports it as the only DRM card and no input
+ * devices; the compositor gets it through the weston-launch protocol
+ * without anybody on the other end, and through weston_launcher_open()
+ * which is overridden for the card.
+ *
+ * Dumb buffers are anonymous files, page flip and vblank events are
+ * delivered on the next 60 Hz boundary of CLOCK_MONOTONIC through a
+ * timerfd standing in for the card. Atomic commits are checked the way
+ * the kernel does: properties have to belong to their objects, modesets
+ * need DRM_MODE_ATOMIC_ALLOW_MODESET, framebuffers have to exist and
+ * fit their planes, the primary plane has to cover the CRTC, and a
+ * non-blocking commit fails with EBUSY while a page flip is pending.
+ *
+ * Anything which is not the fake card is passed on to the real libdrm
+ * and libudev.
+ */
+
+#define FAKE_CARD_SYSPATH	"/sys/devices/platform/weston-fake-kms/drm/card0"
+#define FAKE_CARD_DEVNODE	"/dev/dri/weston-fake-card0"
+
+#define FAKE_REFRESH_NSEC	16666667
+#define FAKE_CURSOR_SIZE	64
+#define FAKE_ENCODER_ID		40
+
+#define FAKE_ATOMIC_FLAGS	(DRM_MODE_PAGE_FLIP_EVENT | \
+				 DRM_MODE_ATOMIC_TEST_ONLY | \
+				 DRM_MODE_ATOMIC_NONBLOCK | \
+				 DRM_MODE_ATOMIC_ALLOW_MODESET)
+
+enum fake_object {
+	OBJ_CRTC,
+	OBJ_CONNECTOR,
+	OBJ_PRIMARY,
+	OBJ_CURSOR,
+	OBJ_OVERLAY,
+	OBJ__COUNT
+};
+
+/* The values double as property ids */
+enum fake_prop {
+	PROP_NONE,
+	PROP_TYPE,
+	PROP_FB_ID,
+	PROP_CRTC_ID,
+	PROP_SRC_X,
+	PROP_SRC_Y,
+	PROP_SRC_W,
+	PROP_SRC_H,
+	PROP_CRTC_X,
+	PROP_CRTC_Y,
+	PROP_CRTC_W,
+	PROP_CRTC_H,
+	PROP_EDID,
+	PROP_DPMS,
+	PROP_ACTIVE,
+	PROP_MODE_ID,
+	PROP__COUNT
+};
+
+enum fake_plane_type {
+	PLANE_TYPE_OVERLAY,
+	PLANE_TYPE_PRIMARY,
+	PLANE_TYPE_CURSOR,
+};
+
+static const char * const plane_type_enums[] = {
+	[PLANE_TYPE_OVERLAY] = "Overlay",
+	[PLANE_TYPE_PRIMARY] = "Primary",
+	[PLANE_TYPE_CURSOR] = "Cursor",
+};
+
+static const char * const dpms_enums[] = {
+	"On", "Standby", "Suspend", "Off",
+};
+
+static const struct fake_prop_info {
+	const char *name;
+	uint32_t flags;
+	uint64_t values[2];
+	int count_values;
+	const char * const *enums;
+	int count_enums;
+} fake_props[PROP__COUNT] = {
+	[PROP_TYPE] = {
+		.name = "type",
+		.flags = DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE,
+		.enums = plane_type_enums,
+		.count_enums = ARRAY_LENGTH(plane_type_enums),
+	},
+	[PROP_FB_ID] = {
+		.name = "FB_ID",
+		.flags = DRM_MODE_PROP_OBJECT,
+		.values = { DRM_MODE_OBJECT_FB }, .count_values = 1,
+	},
+	[PROP_CRTC_ID] = {
+		.name = "CRTC_ID",
+		.flags = DRM_MODE_PROP_OBJECT,
+		.values = { DRM_MODE_OBJECT_CRTC }, .count_values = 1,
+	},
+	[PROP_SRC_X] = {
+		.name = "SRC_X",
+		.flags = DRM_MODE_PROP_RANGE,
+		.values = { 0, UINT32_MAX }, .count_values = 2,
+	},
+	[PROP_SRC_Y] = {
+		.name = "SRC_Y",
+		.flags = DRM_MODE_PROP_RANGE,
+		.values = { 0, UINT32_MAX }, .count_values = 2,
+	},
+	[PROP_SRC_W] = {
+		.name = "SRC_W",
+		.flags = DRM_MODE_PROP_RANGE,
+		.values = { 0, UINT32_MAX }, .count_values = 2,
+	},
+	[PROP_SRC_H] = {
+		.name = "SRC_H",
+		.flags = DRM_MODE_PROP_RANGE,
+		.values = { 0, UINT32_MAX }, .count_values = 2,
+	},
+	[PROP_CRTC_X] = {
+		.name = "CRTC_X",
+		.flags = DRM_MODE_PROP_SIGNED_RANGE,
+		.values = { (uint64_t) INT32_MIN, INT32_MAX }, .count_values = 2,
+	},
+	[PROP_CRTC_Y] = {
+		.name = "CRTC_Y",
+		.flags = DRM_MODE_PROP_SIGNED_RANGE,
+		.values = { (uint64_t) INT32_MIN, INT32_MAX }, .count_values = 2,
+	},
+	[PROP_CRTC_W] = {
+		.name = "CRTC_W",
+		.flags = DRM_MODE_PROP_RANGE,
+		.values = { 0, INT32_MAX }, .count_values = 2,
+	},
+	[PROP_CRTC_H] = {
+		.name = "CRTC_H",
+		.flags = DRM_MODE_PROP_RANGE,
+		.values = { 0, INT32_MAX }, .count_values = 2,
+	},
+	[PROP_EDID] = {
+		.name = "EDID",
+		.flags = DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE,
+	},
+	[PROP_DPMS] = {
+		.name = "DPMS",
+		.flags = DRM_MODE_PROP_ENUM,
+		.enums = dpms_enums,
+		.count_enums = ARRAY_LENGTH(dpms_enums),
+	},
+	[PROP_ACTIVE] = {
+		.name = "ACTIVE",
+		.flags = DRM_MODE_PROP_RANGE,
+		.values = { 0, 1 }, .count_values = 2,
+	},
+	[PROP_MODE_ID] = {
+		.name = "MODE_ID",
+		.flags = DRM_MODE_PROP_BLOB,
+	},
+};
+
+static const enum fake_prop crtc_props[] = {
+	PROP_ACTIVE, PROP_MODE_ID,
+};
+
+static const enum fake_prop connector_props[] = {
+	PROP_EDID, PROP_DPMS, PROP_CRTC_ID,
+};
+
+static const enum fake_prop plane_props[] = {
+	PROP_TYPE, PROP_FB_ID, PROP_CRTC_ID,
+	PROP_SRC_X, PROP_SRC_Y, PROP_SRC_W, PROP_SRC_H,
+	PROP_CRTC_X, PROP_CRTC_Y, PROP_CRTC_W, PROP_CRTC_H,
+};
+
+static const uint32_t primary_formats[] = {
+	DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888, DRM_FORMAT_RGB565,
+};
+
+static const uint32_t cursor_formats[] = {
+	DRM_FORMAT_ARGB8888,
+};
+
+static const uint32_t overlay_formats[] = {
+	DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888,
+};
+
+static const struct fake_object_info {
+	uint32_t id;
+	uint32_t type;
+	const enum fake_prop *props;
+	int count_props;
+	enum fake_plane_type plane_type;
+	const uint32_t *formats;
+	int count_formats;
+} fake_objects[OBJ__COUNT] = {
+	[OBJ_CRTC] = {
+		.id = 31,
+		.type = DRM_MODE_OBJECT_CRTC,
+		.props = crtc_props,
+		.count_props = ARRAY_LENGTH(crtc_props),
+	},
+	[OBJ_CONNECTOR] = {
+		.id = 32,
+		.type = DRM_MODE_OBJECT_CONNECTOR,
+		.props = connector_props,
+		.count_props = ARRAY_LENGTH(connector_props),
+	},
+	[OBJ_PRIMARY] = {
+		.id = 33,
+		.type = DRM_MODE_OBJECT_PLANE,
+		.props = plane_props,
+		.count_props = ARRAY_LENGTH(plane_props),
+		.plane_type = PLANE_TYPE_PRIMARY,
+		.formats = primary_formats,
+		.count_formats = ARRAY_LENGTH(primary_formats),
+	},
+	[OBJ_CURSOR] = {
+		.id = 34,
+		.type = DRM_MODE_OBJECT_PLANE,
+		.props = plane_props,
+		.count_props = ARRAY_LENGTH(plane_props),
+		.plane_type = PLANE_TYPE_CURSOR,
+		.formats = cursor_formats,
+		.count_formats = ARRAY_LENGTH(cursor_formats),
+	},
+	[OBJ_OVERLAY] = {
+		.id = 35,
+		.type = DRM_MODE_OBJECT_PLANE,
+		.props = plane_props,
+		.count_props = ARRAY_LENGTH(plane_props),
+		.plane_type = PLANE_TYPE_OVERLAY,
+		.formats = overlay_formats,
+		.count_formats = ARRAY_LENGTH(overlay_formats),
+	},
+};
+
+/* VESA 1024x768@60 */
+static const drmModeModeInfo fake_mode = {
+	.clock = 65000,
+	.hdisplay = 1024,
+	.hsync_start = 1048,
+	.hsync_end = 1184,
+	.htotal = 1344,
+	.vdisplay = 768,
+	.vsync_start = 771,
+	.vsync_end = 777,
+	.vtotal = 806,
+	.vrefresh = 60,
+	.flags = DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_NVSYNC,
+	.type = DRM_MODE_TYPE_PREFERRED | DRM_MODE_TYPE_DRIVER,
+	.name = "1024x768",
+};
+
+struct fake_state {
+	uint64_t values[OBJ__COUNT][PROP__COUNT];
+};
+
+struct fake_dumb {
+	uint32_t handle;
+	int fd;
+	uint64_t size;
+	struct fake_dumb *next;
+};
+
+struct fake_fb {
+	uint32_t id;
+	uint32_t width, height;
+	uint32_t format;
+	struct fake_fb *next;
+};
+
+struct fake_blob {
+	uint32_t id;
+	/* Kept for the state still using it after userspace let go */
+	bool destroyed;
+	size_t size;
+	void *data;
+	struct fake_blob *next;
+};
+
+enum fake_event_type {
+	FAKE_EVENT_VBLANK,
+	FAKE_EVENT_FLIP,
+	FAKE_EVENT_ATOMIC_FLIP,
+};
+
+struct fake_event {
+	enum fake_event_type type;
+	void *user_data;
+	struct fake_event *next;
+};
+
+static struct {
+	bool active;
+	/* Our end of the weston-launch socket, never written to */
+	int launcher_sock;
+	/* The timerfd handed out as the card */
+	int fd;
+
+	bool universal_planes;
+	bool atomic;
+
+	struct fake_state state;
+	uint32_t next_id;
+	uint32_t next_handle;
+	struct fake_dumb *dumbs;
+	struct fake_fb *fbs;
+	struct fake_blob *blobs;
+
+	struct fake_event *events;
+	bool flip_pending;
+	bool timer_armed;
+	int64_t vblank_nsec;
+} fake = {
+	.launcher_sock = -1,
+	.fd = -1,
+};
+
+void *
+drm_real_func(const char *name)
+{
+	void *func = dlsym(RTLD_NEXT, name);
+
+	if (!func) {
+		fprintf(stderr, "drm-commit-recorder: no %s\n", name);
+		abort();
+	}
+
+	return func;
+}
+
+bool
+drm_fake_device_is(int fd)
+{
+	return fake.active && fd >= 0 && fd == fake.fd;
+}
+
+static int
+fake_error(int err)
+{
+	errno = err;
+	return -err;
+}
+
+static int64_t
+fake_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return timespec_to_nsec(&ts);
+}
+
+static int
+fake_object_find(uint32_t id)
+{
+	int i;
+
+	for (i = 0; i < OBJ__COUNT; i++) {
+		if (fake_objects[i].id == id)
+			return i;
+	}
+
+	return -1;
+}
+
+static bool
+fake_object_has_prop(int index, uint32_t prop_id)
+{
+	int i;
+
+	for (i = 0; i < fake_objects[index].count_props; i++) {
+		if (fake_objects[index].props[i] == prop_id)
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+fake_object_is_plane(int index)
+{
+	return index >= 0 &&
+	       fake_objects[index].type == DRM_MODE_OBJECT_PLANE;
+}
+
+static struct fake_dumb *
+fake_dumb_find(uint32_t handle)
+{
+	struct fake_dumb *dumb;
+
+	for (dumb = fake.dumbs; dumb; dumb = dumb->next) {
+		if (dumb->handle == handle)
+			return dumb;
+	}
+
+	return NULL;
+}
+
+static uint64_t
+fake_dumb_offset(const struct fake_dumb *dumb)
+{
+	return (uint64_t) dumb->handle << 20;
+}
+
+static struct fake_fb *
+fake_fb_find(uint32_t id)
+{
+	struct fake_fb *fb;
+
+	for (fb = fake.fbs; fb; fb = fb->next) {
+		if (fb->id == id)
+			return fb;
+	}
+
+	return NULL;
+}
+
+static struct fake_blob *
+fake_blob_find(uint32_t id, bool include_destroyed)
+{
+	struct fake_blob *blob;
+
+	for (blob = fake.blobs; blob; blob = blob->next) {
+		if (blob->id == id && (include_destroyed || !blob->destroyed))
+			return blob;
+	}
+
+	return NULL;
+}
+
+static struct fake_blob *
+fake_blob_add(const void *data, size_t size)
+{
+	struct fake_blob *blob;
+
+	blob = zalloc(sizeof *blob);
+	if (!blob)
+		return NULL;
+
+	blob->data = malloc(size);
+	if (!blob->data) {
+		free(blob);
+		return NULL;
+	}
+
+	memcpy(blob->data, data, size);
+	blob->size = size;
+	blob->id = fake.next_id++;
+	blob->next = fake.blobs;
+	fake.blobs = blob;
+
+	return blob;
+}
+
+static const drmModeModeInfo *
+fake_state_mode(const struct fake_state *state)
+{
+	struct fake_blob *blob;
+
+	blob = fake_blob_find(state->values[OBJ_CRTC][PROP_MODE_ID], true);
+	if (!blob || blob->size != sizeof(drmModeModeInfo))
+		return NULL;
+
+	return blob->data;
+}
+
+static uint32_t *
+fake_id_array(uint32_t id)
+{
+	uint32_t *ids = malloc(sizeof *ids);
+
+	if (ids)
+		ids[0] = id;
+
+	return ids;
+}
+
+static int
+fake_object_get_props(int index, uint32_t **props, uint64_t **values)
+{
+	const struct fake_object_info *obj = &fake_objects[index];
+	int i;
+
+	*props = calloc(obj->count_props, sizeof **props);
+	*values = calloc(obj->count_props, sizeof **values);
+	if (!*props || !*values) {
+		free(*props);
+		free(*values);
+		*props = NULL;
+		*values = NULL;
+		return -1;
+	}
+
+	for (i = 0; i < obj->count_props; i++) {
+		(*props)[i] = obj->props[i];
+		(*values)[i] = fake.state.values[index][obj->props[i]];
+	}
+
+	return obj->count_props;
+}
+
+/* Starts the timer for the next vblank, when the queued events go out */
+static void
+fake_queue_event(enum fake_event_type type, void *user_data)
+{
+	struct fake_event *event, **tail;
+	struct itimerspec its;
+
+	event = zalloc(sizeof *event);
+	if (!event)
+		abort();
+
+	event->type = type;
+	event->user_data = user_data;
+	for (tail = &fake.events; *tail; tail = &(*tail)->next)
+		;
+	*tail = event;
+
+	if (fake.timer_armed)
+		return;
+
+	fake.vblank_nsec = (fake_now() / FAKE_REFRESH_NSEC + 1) *
+			   FAKE_REFRESH_NSEC;
+	memset(&its, 0, sizeof its);
+	timespec_from_nsec(&its.it_value, fake.vblank_nsec);
+	if (timerfd_settime(fake.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		abort();
+	fake.timer_armed = true;
+}
+
+/*
+ * Checks a new state against the current one, returns 0 or a negative
+ * errno like the kernel does, and whether the new state needs a modeset.
+ */
+static int
+fake_state_check(const struct fake_state *state, bool *modeset)
+{
+	const struct fake_state *old = &fake.state;
+	const uint64_t *crtc = state->values[OBJ_CRTC];
+	const drmModeModeInfo *mode = NULL, *old_mode;
+	uint64_t conn_crtc;
+	struct fake_fb *fb;
+	bool enabled;
+	int i, j;
+
+	if (crtc[PROP_MODE_ID] != old->values[OBJ_CRTC][PROP_MODE_ID] &&
+	    crtc[PROP_MODE_ID] != 0 &&
+	    !fake_blob_find(crtc[PROP_MODE_ID], false))
+		return -ENOENT;
+
+	if (crtc[PROP_MODE_ID] != 0) {
+		mode = fake_state_mode(state);
+		if (!mode)
+			return -EINVAL;
+	}
+
+	enabled = mode != NULL;
+	if (crtc[PROP_ACTIVE] > 1 || (crtc[PROP_ACTIVE] && !enabled))
+		return -EINVAL;
+
+	conn_crtc = state->values[OBJ_CONNECTOR][PROP_CRTC_ID];
+	if (conn_crtc != 0 && conn_crtc != fake_objects[OBJ_CRTC].id)
+		return -EINVAL;
+	if (enabled != (conn_crtc != 0))
+		return -EINVAL;
+
+	for (i = OBJ_PRIMARY; i < OBJ__COUNT; i++) {
+		const uint64_t *plane = state->values[i];
+
+		if (!plane[PROP_FB_ID] != !plane[PROP_CRTC_ID])
+			return -EINVAL;
+		if (!plane[PROP_FB_ID])
+			continue;
+
+		if (plane[PROP_CRTC_ID] != fake_objects[OBJ_CRTC].id ||
+		    !enabled)
+			return -EINVAL;
+
+		fb = fake_fb_find(plane[PROP_FB_ID]);
+		if (!fb)
+			return -ENOENT;
+
+		for (j = 0; j < fake_objects[i].count_formats; j++) {
+			if (fake_objects[i].formats[j] == fb->format)
+				break;
+		}
+		if (j == fake_objects[i].count_formats)
+			return -EINVAL;
+
+		if (!plane[PROP_SRC_W] || !plane[PROP_SRC_H] ||
+		    !plane[PROP_CRTC_W] || !plane[PROP_CRTC_H])
+			return -EINVAL;
+
+		if (plane[PROP_SRC_X] + plane[PROP_SRC_W] >
+		    (uint64_t) fb->width << 16 ||
+		    plane[PROP_SRC_Y] + plane[PROP_SRC_H] >
+		    (uint64_t) fb->height << 16)
+			return -ENOSPC;
+
+		/* The primary plane can neither be moved nor scaled */
+		if (i == OBJ_PRIMARY &&
+		    ((int32_t) plane[PROP_CRTC_X] != 0 ||
+		     (int32_t) plane[PROP_CRTC_Y] != 0 ||
+		     plane[PROP_CRTC_W] != mode->hdisplay ||
+		     plane[PROP_CRTC_H] != mode->vdisplay ||
+		     plane[PROP_SRC_W] != plane[PROP_CRTC_W] << 16 ||
+		     plane[PROP_SRC_H] != plane[PROP_CRTC_H] << 16))
+			return -EINVAL;
+
+		if (i == OBJ_CURSOR &&
+		    (plane[PROP_CRTC_W] > FAKE_CURSOR_SIZE ||
+		     plane[PROP_CRTC_H] > FAKE_CURSOR_SIZE))
+			return -EINVAL;
+	}
+
+	old_mode = fake_state_mode(old);
+	*modeset = crtc[PROP_ACTIVE] != old->values[OBJ_CRTC][PROP_ACTIVE] ||
+		   conn_crtc != old->values[OBJ_CONNECTOR][PROP_CRTC_ID] ||
+		   !mode != !old_mode ||
+		   (mode && memcmp(mode, old_mode, sizeof *mode) != 0);
+
+	return 0;
+}
+
+int
+drm_fake_atomic_commit(const struct drm_prop_value *props, int count,
+		       uint32_t flags, void *user_data)
+{
+	struct fake_state state = fake.state;
+	bool modeset, crtc_in_commit = false;
+	int i, index, ret;
+
+	if ((flags & ~FAKE_ATOMIC_FLAGS) ||
+	    ((flags & DRM_MODE_ATOMIC_TEST_ONLY) &&
+	     (flags & DRM_MODE_PAGE_FLIP_EVENT)))
+		return fake_error(EINVAL);
+
+	for (i = 0; i < count; i++) {
+		index = fake_object_find(props[i].object_id);
+		if (index < 0)
+			return fake_error(ENOENT);
+
+		if (!fake_object_has_prop(index, props[i].prop_id) ||
+		    (fake_props[props[i].prop_id].flags &
+		     DRM_MODE_PROP_IMMUTABLE))
+			return fake_error(EINVAL);
+
+		state.values[index][props[i].prop_id] = props[i].value;
+
+		/* Everything on this device goes with its only CRTC */
+		crtc_in_commit = true;
+	}
+
+	ret = fake_state_check(&state, &modeset);
+	if (ret < 0)
+		return fake_error(-ret);
+
+	if (modeset && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET))
+		return fake_error(EINVAL);
+
+	if ((flags & DRM_MODE_PAGE_FLIP_EVENT) &&
+	    !state.values[OBJ_CRTC][PROP_ACTIVE])
+		return fake_error(EINVAL);
+
+	if (flags & DRM_MODE_ATOMIC_TEST_ONLY)
+		return 0;
+
+	if ((flags & DRM_MODE_ATOMIC_NONBLOCK) && crtc_in_commit &&
+	    fake.flip_pending)
+		return fake_error(EBUSY);
+
+	fake.state = state;
+
+	if ((flags & DRM_MODE_PAGE_FLIP_EVENT) && crtc_in_commit) {
+		fake.flip_pending = true;
+		fake_queue_event(FAKE_EVENT_ATOMIC_FLIP, user_data);
+	}
+
+	return 0;
+}
+
+int
+drm_fake_set_crtc(uint32_t crtc_id, uint32_t fb_id,
+		  const uint32_t *connectors, int count,
+		  const drmModeModeInfo *mode)
+{
+	struct fake_state state = fake.state;
+	uint64_t *plane = state.values[OBJ_PRIMARY];
+	struct fake_blob *blob;
+	bool modeset;
+	int ret;
+
+	if (crtc_id != fake_objects[OBJ_CRTC].id)
+		return fake_error(ENOENT);
+
+	if (fb_id == 0) {
+		state.values[OBJ_CRTC][PROP_ACTIVE] = 0;
+		state.values[OBJ_CRTC][PROP_MODE_ID] = 0;
+		state.values[OBJ_CONNECTOR][PROP_CRTC_ID] = 0;
+		plane[PROP_FB_ID] = 0;
+		plane[PROP_CRTC_ID] = 0;
+	} else {
+		if (!mode || count != 1 ||
+		    connectors[0] != fake_objects[OBJ_CONNECTOR].id)
+			return fake_error(EINVAL);
+
+		/* The kernel's own blob, nobody can destroy it */
+		blob = fake_blob_add(mode, sizeof *mode);
+		if (!blob)
+			return fake_error(ENOMEM);
+		blob->destroyed = true;
+
+		state.values[OBJ_CRTC][PROP_ACTIVE] = 1;
+		state.values[OBJ_CRTC][PROP_MODE_ID] = blob->id;
+		state.values[OBJ_CONNECTOR][PROP_CRTC_ID] = crtc_id;
+		plane[PROP_FB_ID] = fb_id;
+		plane[PROP_CRTC_ID] = crtc_id;
+		plane[PROP_SRC_X] = 0;
+		plane[PROP_SRC_Y] = 0;
+		plane[PROP_SRC_W] = (uint64_t) mode->hdisplay << 16;
+		plane[PROP_SRC_H] = (uint64_t) mode->vdisplay << 16;
+		plane[PROP_CRTC_X] = 0;
+		plane[PROP_CRTC_Y] = 0;
+		plane[PROP_CRTC_W] = mode->hdisplay;
+		plane[PROP_CRTC_H] = mode->vdisplay;
+	}
+
+	ret = fake_state_check(&state, &modeset);
+	if (ret < 0)
+		return fake_error(-ret);
+
+	fake.state = state;
+
+	return 0;
+}
+
+int
+drm_fake_page_flip(uint32_t crtc_id, uint32_t fb_id, uint32_t flags,
+		   void *user_data)
+{
+	struct fake_state state = fake.state;
+	bool modeset;
+	int ret;
+
+	if (crtc_id != fake_objects[OBJ_CRTC].id)
+		return fake_error(ENOENT);
+
+	if (!state.values[OBJ_CRTC][PROP_ACTIVE])
+		return fake_error(EINVAL);
+
+	if (fake.flip_pending)
+		return fake_error(EBUSY);
+
+	state.values[OBJ_PRIMARY][PROP_FB_ID] = fb_id;
+	ret = fake_state_check(&state, &modeset);
+	if (ret < 0)
+		return fake_error(-ret);
+
+	fake.state = state;
+
+	if (flags & DRM_MODE_PAGE_FLIP_EVENT) {
+		fake.flip_pending = true;
+		fake_queue_event(FAKE_EVENT_FLIP, user_data);
+	}
+
+	return 0;
+}
+
+int
+drm_fake_set_plane(uint32_t plane_id, uint32_t crtc_id, uint32_t fb_id,
+		   int32_t crtc_x, int32_t crtc_y,
+		   uint32_t crtc_w, uint32_t crtc_h,
+		   uint32_t src_x, uint32_t src_y,
+		   uint32_t src_w, uint32_t src_h)
+{
+	struct fake_state state = fake.state;
+	int index = fake_object_find(plane_id);
+	uint64_t *plane;
+	bool modeset;
+	int ret;
+
+	if (!fake_object_is_plane(index))
+		return fake_error(ENOENT);
+
+	plane = state.values[index];
+	if (fb_id == 0) {
+		plane[PROP_FB_ID] = 0;
+		plane[PROP_CRTC_ID] = 0;
+	} else {
+		plane[PROP_FB_ID] = fb_id;
+		plane[PROP_CRTC_ID] = crtc_id;
+		plane[PROP_SRC_X] = src_x;
+		plane[PROP_SRC_Y] = src_y;
+		plane[PROP_SRC_W] = src_w;
+		plane[PROP_SRC_H] = src_h;
+		plane[PROP_CRTC_X] = (uint64_t) crtc_x;
+		plane[PROP_CRTC_Y] = (uint64_t) crtc_y;
+		plane[PROP_CRTC_W] = crtc_w;
+		plane[PROP_CRTC_H] = crtc_h;
+	}
+
+	ret = fake_state_check(&state, &modeset);
+	if (ret < 0)
+		return fake_error(-ret);
+
+	fake.state = state;
+
+	return 0;
+}
+
+static int
+fake_device_open(void)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	fake.fd = fd;
+	fake.timer_armed = false;
+
+	return fd;
+}
+
+static void __attribute__ ((constructor))
+fake_device_init(void)
+{
+	char sock_env[16];
+	int sock[2];
+	int i;
+
+	/* Only the compositor gets the fake device: neither the shell
+	 * running it through libtool, nor the clients it starts. */
+	if (!getenv("WESTON_DRM_FAKE_DEVICE") ||
+	    !dlsym(RTLD_DEFAULT, "weston_compositor_create"))
+		return;
+
+	unsetenv("WESTON_DRM_FAKE_DEVICE");
+
+	if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sock) < 0) {
+		fprintf(stderr, "drm-commit-recorder: socketpair: %m\n");
+		abort();
+	}
+
+	fake.launcher_sock = sock[0];
+	snprintf(sock_env, sizeof sock_env, "%d", sock[1]);
+	setenv("WESTON_LAUNCHER_SOCK", sock_env, 1);
+
+	for (i = OBJ_PRIMARY; i < OBJ__COUNT; i++)
+		fake.state.values[i][PROP_TYPE] = fake_objects[i].plane_type;
+
+	fake.next_id = 64;
+	fake.active = true;
+}
+
+WL_EXPORT int
+weston_launcher_open(struct weston_launcher *launcher,
+		     const char *path, int flags)
+{
+	static int (*real)(struct weston_launcher *, const char *, int);
+
+	if (fake.active && strcmp(path, FAKE_CARD_DEVNODE) == 0)
+		return fake_device_open();
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	return real(launcher, path, flags);
+}
+
+/* Keeps logind from handing the session, and its VT, to the compositor */
+WL_EXPORT int
+sd_pid_get_session(pid_t pid, char **session)
+{
+	static int (*real)(pid_t, char **);
+
+	if (fake.active)
+		return -ENODATA;
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	return real(pid, session);
+}
+
+/*
+ * Dumb buffers are mapped through the card at the offset given by
+ * DRM_IOCTL_MODE_MAP_DUMB. Both mmap() and mmap64() are overridden,
+ * the compositor gets either depending on _FILE_OFFSET_BITS; the
+ * offsets are spelled out so as to match either ABI.
+ */
+static struct fake_dumb *
+fake_dumb_find_mapping(int fd, uint64_t offset, size_t length)
+{
+	struct fake_dumb *dumb;
+
+	for (dumb = fake.dumbs; dumb; dumb = dumb->next) {
+		if (fake_dumb_offset(dumb) == offset && length <= dumb->size)
+			return dumb;
+	}
+
+	return NULL;
+}
+
+WL_EXPORT void *
+mmap(void *addr, size_t length, int prot, int flags, int fd, long offset)
+{
+	static void *(*real)(void *, size_t, int, int, int, long);
+	struct fake_dumb *dumb;
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	if (!drm_fake_device_is(fd))
+		return real(addr, length, prot, flags, fd, offset);
+
+	dumb = fake_dumb_find_mapping(fd, offset, length);
+	if (!dumb) {
+		errno = EINVAL;
+		return (void *) -1;
+	}
+
+	return real(addr, length, prot, flags, dumb->fd, 0);
+}
+
+WL_EXPORT void *
+mmap64(void *addr, size_t length, int prot, int flags, int fd,
+       int64_t offset)
+{
+	static void *(*real)(void *, size_t, int, int, int, int64_t);
+	struct fake_dumb *dumb;
+
+	if (!real)
+		real = drm_real_func(__func__);
+
+	if (!drm_fake_device_is(fd))
+		return real(addr, length, prot, flags, fd, offset);
+
+	dumb = fake_dumb_find_mapping(fd, offset, length);
+	if (!dumb) {
+		errno = EINVAL;
+		return (void *) -1;
+	}
+
+	return real(addr, length, prot, flags, dumb->fd, 0);
+}
+
+static int
+fake_create_dumb(struct drm_mode_create_dumb *create)
+{
+	struct fake_dumb *dumb;
+	uint32_t pitch;
+
+	if (!create->width || !create->height || !create->bpp) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pitch = (create->width * ((create->bpp + 7) / 8) + 63) & ~63u;
+
+	dumb = zalloc(sizeof *dumb);
+	if (!dumb) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	dumb->size = (uint64_t) pitch * create->height;
+	dumb->fd = os_create_anonymous_file(dumb->size);
+	if (dumb->fd < 0) {
+		free(dumb);
+		return -1;
+	}
+
+	dumb->handle = ++fake.next_handle;
+	dumb->next = fake.dumbs;
+	fake.dumbs = dumb;
+
+	create->handle = dumb->handle;
+	create->pitch = pitch;
+	create->size = dumb->size;
+
+	return 0;
+}
+
+static int
+fake_map_dumb(struct drm_mode_map_dumb *map)
+{
+	struct fake_dumb *dumb = fake_dumb_find(map->handle);
+
+	if (!dumb) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	map->offset = fake_dumb_offset(dumb);
+
+	return 0;
+}
+
+static int
+fake_destroy_dumb(struct drm_mode_destroy_dumb *destroy)
+{
+	struct fake_dumb **prev, *dumb;
+
+	for (prev = &fake.dumbs; (dumb = *prev); prev = &dumb->next) {
+		if (dumb->handle != destroy->handle)
+			continue;
+
+		*prev = dumb->next;
+		close(dumb->fd);
+		free(dumb);
+		return 0;
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+WL_EXPORT int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	static int (*real)(int, unsigned long, void *);
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, request, arg);
+	}
+
+	switch (request) {
+	case DRM_IOCTL_MODE_CREATE_DUMB:
+		return fake_create_dumb(arg);
+	case DRM_IOCTL_MODE_MAP_DUMB:
+		return fake_map_dumb(arg);
+	case DRM_IOCTL_MODE_DESTROY_DUMB:
+		return fake_destroy_dumb(arg);
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+WL_EXPORT int
+drmGetCap(int fd, uint64_t capability, uint64_t *value)
+{
+	static int (*real)(int, uint64_t, uint64_t *);
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, capability, value);
+	}
+
+	switch (capability) {
+	case DRM_CAP_DUMB_BUFFER:
+	case DRM_CAP_TIMESTAMP_MONOTONIC:
+		*value = 1;
+		return 0;
+	case DRM_CAP_CURSOR_WIDTH:
+	case DRM_CAP_CURSOR_HEIGHT:
+		*value = FAKE_CURSOR_SIZE;
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+WL_EXPORT int
+drmSetClientCap(int fd, uint64_t capability, uint64_t value)
+{
+	static int (*real)(int, uint64_t, uint64_t);
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, capability, value);
+	}
+
+	switch (capability) {
+	case DRM_CLIENT_CAP_UNIVERSAL_PLANES:
+		fake.universal_planes = value;
+		return 0;
+	case DRM_CLIENT_CAP_ATOMIC:
+		/* Atomic implies universal planes */
+		fake.atomic = value;
+		if (value)
+			fake.universal_planes = true;
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+WL_EXPORT int
+drmWaitVBlank(int fd, drmVBlankPtr vbl)
+{
+	static int (*real)(int, drmVBlankPtr);
+	unsigned int type, sequence;
+	unsigned long signal;
+	struct timespec ts;
+	int64_t now, target;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, vbl);
+	}
+
+	/* The reply overwrites the request */
+	type = vbl->request.type;
+	sequence = vbl->request.sequence;
+	signal = vbl->request.signal;
+
+	if (!fake.state.values[OBJ_CRTC][PROP_ACTIVE]) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	now = fake_now();
+	target = now / FAKE_REFRESH_NSEC * FAKE_REFRESH_NSEC;
+
+	if (type & DRM_VBLANK_EVENT) {
+		fake_queue_event(FAKE_EVENT_VBLANK, (void *) signal);
+		target = fake.vblank_nsec;
+	} else if (type & DRM_VBLANK_RELATIVE) {
+		target += (int64_t) sequence * FAKE_REFRESH_NSEC;
+	} else if ((int64_t) sequence * FAKE_REFRESH_NSEC > target) {
+		target = (int64_t) sequence * FAKE_REFRESH_NSEC;
+	}
+
+	if (!(type & DRM_VBLANK_EVENT) && target > now) {
+		timespec_from_nsec(&ts, target);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &ts, NULL) == EINTR)
+			;
+	}
+
+	timespec_from_nsec(&ts, target);
+	vbl->reply.sequence = target / FAKE_REFRESH_NSEC;
+	vbl->reply.tval_sec = ts.tv_sec;
+	vbl->reply.tval_usec = ts.tv_nsec / 1000;
+
+	return 0;
+}
+
+WL_EXPORT int
+drmHandleEvent(int fd, drmEventContextPtr evctx)
+{
+	static int (*real)(int, drmEventContextPtr);
+	struct fake_event *event, *next;
+	struct timespec ts;
+	unsigned int sequence, sec, usec;
+	uint64_t expirations;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, evctx);
+	}
+
+	/* Nothing to deliver until the timer has fired */
+	if (read(fd, &expirations, sizeof expirations) !=
+	    sizeof expirations)
+		return 0;
+
+	/* The handlers may well commit again */
+	event = fake.events;
+	fake.events = NULL;
+	fake.timer_armed = false;
+	fake.flip_pending = false;
+
+	timespec_from_nsec(&ts, fake.vblank_nsec);
+	sequence = fake.vblank_nsec / FAKE_REFRESH_NSEC;
+	sec = ts.tv_sec;
+	usec = ts.tv_nsec / 1000;
+
+	for (; event; event = next) {
+		next = event->next;
+
+		switch (event->type) {
+		case FAKE_EVENT_VBLANK:
+			if (evctx->vblank_handler)
+				evctx->vblank_handler(fd, sequence, sec, usec,
+						      event->user_data);
+			break;
+		case FAKE_EVENT_ATOMIC_FLIP:
+			if (evctx->version >= 3 && evctx->page_flip_handler2) {
+				evctx->page_flip_handler2(fd, sequence,
+							  sec, usec,
+							  fake_objects[OBJ_CRTC].id,
+							  event->user_data);
+				break;
+			}
+			/* fall through */
+		case FAKE_EVENT_FLIP:
+			if (evctx->page_flip_handler)
+				evctx->page_flip_handler(fd, sequence,
+							 sec, usec,
+							 event->user_data);
+			break;
+		}
+
+		free(event);
+	}
+
+	return 0;
+}
+
+WL_EXPORT drmModeResPtr
+drmModeGetResources(int fd)
+{
+	static drmModeResPtr (*real)(int);
+	drmModeResPtr res;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd);
+	}
+
+	res = zalloc(sizeof *res);
+	if (!res)
+		return NULL;
+
+	res->crtcs = fake_id_array(fake_objects[OBJ_CRTC].id);
+	res->connectors = fake_id_array(fake_objects[OBJ_CONNECTOR].id);
+	res->encoders = fake_id_array(FAKE_ENCODER_ID);
+	if (!res->crtcs || !res->connectors || !res->encoders) {
+		drmModeFreeResources(res);
+		return NULL;
+	}
+
+	res->count_crtcs = 1;
+	res->count_connectors = 1;
+	res->count_encoders = 1;
+	res->min_width = 1;
+	res->max_width = 8192;
+	res->min_height = 1;
+	res->max_height = 8192;
+
+	return res;
+}
+
+WL_EXPORT drmModeConnectorPtr
+drmModeGetConnector(int fd, uint32_t connector_id)
+{
+	static drmModeConnectorPtr (*real)(int, uint32_t);
+	drmModeConnectorPtr conn;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, connector_id);
+	}
+
+	if (connector_id != fake_objects[OBJ_CONNECTOR].id) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	conn = zalloc(sizeof *conn);
+	if (!conn)
+		return NULL;
+
+	conn->connector_id = connector_id;
+	if (fake.state.values[OBJ_CONNECTOR][PROP_CRTC_ID])
+		conn->encoder_id = FAKE_ENCODER_ID;
+	conn->connector_type = DRM_MODE_CONNECTOR_VIRTUAL;
+	conn->connector_type_id = 1;
+	conn->connection = DRM_MODE_CONNECTED;
+	conn->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+
+	conn->modes = malloc(sizeof fake_mode);
+	conn->encoders = fake_id_array(FAKE_ENCODER_ID);
+	conn->count_props = fake_object_get_props(OBJ_CONNECTOR, &conn->props,
+						  &conn->prop_values);
+	if (!conn->modes || !conn->encoders || conn->count_props < 0) {
+		drmModeFreeConnector(conn);
+		return NULL;
+	}
+
+	conn->modes[0] = fake_mode;
+	conn->count_modes = 1;
+	conn->count_encoders = 1;
+
+	return conn;
+}
+
+WL_EXPORT drmModeEncoderPtr
+drmModeGetEncoder(int fd, uint32_t encoder_id)
+{
+	static drmModeEncoderPtr (*real)(int, uint32_t);
+	drmModeEncoderPtr encoder;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, encoder_id);
+	}
+
+	if (encoder_id != FAKE_ENCODER_ID) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	encoder = zalloc(sizeof *encoder);
+	if (!encoder)
+		return NULL;
+
+	encoder->encoder_id = encoder_id;
+	encoder->encoder_type = DRM_MODE_ENCODER_VIRTUAL;
+	if (fake.state.values[OBJ_CONNECTOR][PROP_CRTC_ID])
+		encoder->crtc_id = fake_objects[OBJ_CRTC].id;
+	encoder->possible_crtcs = 1 << 0;
+
+	return encoder;
+}
+
+WL_EXPORT drmModeCrtcPtr
+drmModeGetCrtc(int fd, uint32_t crtc_id)
+{
+	static drmModeCrtcPtr (*real)(int, uint32_t);
+	const drmModeModeInfo *mode;
+	drmModeCrtcPtr crtc;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, crtc_id);
+	}
+
+	if (crtc_id != fake_objects[OBJ_CRTC].id) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	crtc = zalloc(sizeof *crtc);
+	if (!crtc)
+		return NULL;
+
+	crtc->crtc_id = crtc_id;
+	crtc->buffer_id = fake.state.values[OBJ_PRIMARY][PROP_FB_ID];
+
+	mode = fake_state_mode(&fake.state);
+	if (mode) {
+		crtc->mode_valid = 1;
+		crtc->mode = *mode;
+		crtc->width = mode->hdisplay;
+		crtc->height = mode->vdisplay;
+	}
+
+	return crtc;
+}
+
+WL_EXPORT drmModePlaneResPtr
+drmModeGetPlaneResources(int fd)
+{
+	static drmModePlaneResPtr (*real)(int);
+	drmModePlaneResPtr res;
+	int i;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd);
+	}
+
+	res = zalloc(sizeof *res);
+	if (!res)
+		return NULL;
+
+	res->planes = calloc(OBJ__COUNT, sizeof res->planes[0]);
+	if (!res->planes) {
+		free(res);
+		return NULL;
+	}
+
+	/* Only overlays are planes unless told otherwise */
+	for (i = OBJ_PRIMARY; i < OBJ__COUNT; i++) {
+		if (fake_objects[i].plane_type != PLANE_TYPE_OVERLAY &&
+		    !fake.universal_planes)
+			continue;
+
+		res->planes[res->count_planes++] = fake_objects[i].id;
+	}
+
+	return res;
+}
+
+WL_EXPORT drmModePlanePtr
+drmModeGetPlane(int fd, uint32_t plane_id)
+{
+	static drmModePlanePtr (*real)(int, uint32_t);
+	const struct fake_object_info *obj;
+	const uint64_t *values;
+	drmModePlanePtr plane;
+	int index;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, plane_id);
+	}
+
+	index = fake_object_find(plane_id);
+	if (!fake_object_is_plane(index)) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	obj = &fake_objects[index];
+	values = fake.state.values[index];
+
+	plane = zalloc(sizeof *plane);
+	if (!plane)
+		return NULL;
+
+	plane->formats = calloc(obj->count_formats, sizeof plane->formats[0]);
+	if (!plane->formats) {
+		free(plane);
+		return NULL;
+	}
+
+	memcpy(plane->formats, obj->formats,
+	       obj->count_formats * sizeof plane->formats[0]);
+	plane->count_formats = obj->count_formats;
+	plane->plane_id = plane_id;
+	plane->crtc_id = values[PROP_CRTC_ID];
+	plane->fb_id = values[PROP_FB_ID];
+	plane->crtc_x = values[PROP_CRTC_X];
+	plane->crtc_y = values[PROP_CRTC_Y];
+	plane->x = values[PROP_SRC_X] >> 16;
+	plane->y = values[PROP_SRC_Y] >> 16;
+	plane->possible_crtcs = 1 << 0;
+
+	return plane;
+}
+
+WL_EXPORT drmModeObjectPropertiesPtr
+drmModeObjectGetProperties(int fd, uint32_t object_id, uint32_t object_type)
+{
+	static drmModeObjectPropertiesPtr (*real)(int, uint32_t, uint32_t);
+	drmModeObjectPropertiesPtr props;
+	int index, count;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, object_id, object_type);
+	}
+
+	index = fake_object_find(object_id);
+	if (index < 0 || fake_objects[index].type != object_type) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	props = zalloc(sizeof *props);
+	if (!props)
+		return NULL;
+
+	count = fake_object_get_props(index, &props->props,
+				      &props->prop_values);
+	if (count < 0) {
+		free(props);
+		return NULL;
+	}
+	props->count_props = count;
+
+	return props;
+}
+
+WL_EXPORT drmModePropertyPtr
+drmModeGetProperty(int fd, uint32_t property_id)
+{
+	static drmModePropertyPtr (*real)(int, uint32_t);
+	const struct fake_prop_info *info;
+	drmModePropertyPtr prop;
+	int i;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, property_id);
+	}
+
+	if (property_id <= PROP_NONE || property_id >= PROP__COUNT) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	info = &fake_props[property_id];
+
+	prop = zalloc(sizeof *prop);
+	if (!prop)
+		return NULL;
+
+	prop->prop_id = property_id;
+	prop->flags = info->flags;
+	snprintf(prop->name, sizeof prop->name, "%s", info->name);
+
+	if (info->count_enums > 0) {
+		prop->values = calloc(info->count_enums,
+				      sizeof prop->values[0]);
+		prop->enums = calloc(info->count_enums,
+				     sizeof prop->enums[0]);
+		if (!prop->values || !prop->enums) {
+			drmModeFreeProperty(prop);
+			return NULL;
+		}
+
+		for (i = 0; i < info->count_enums; i++) {
+			prop->values[i] = i;
+			prop->enums[i].value = i;
+			snprintf(prop->enums[i].name,
+				 sizeof prop->enums[i].name,
+				 "%s", info->enums[i]);
+		}
+		prop->count_values = info->count_enums;
+		prop->count_enums = info->count_enums;
+	} else if (info->count_values > 0) {
+		prop->values = calloc(info->count_values,
+				      sizeof prop->values[0]);
+		if (!prop->values) {
+			drmModeFreeProperty(prop);
+			return NULL;
+		}
+
+		memcpy(prop->values, info->values,
+		       info->count_values * sizeof prop->values[0]);
+		prop->count_values = info->count_values;
+	}
+
+	return prop;
+}
+
+WL_EXPORT drmModePropertyBlobPtr
+drmModeGetPropertyBlob(int fd, uint32_t blob_id)
+{
+	static drmModePropertyBlobPtr (*real)(int, uint32_t);
+	drmModePropertyBlobPtr res;
+	struct fake_blob *blob;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, blob_id);
+	}
+
+	blob = fake_blob_find(blob_id, false);
+	if (!blob) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	res = zalloc(sizeof *res);
+	if (!res)
+		return NULL;
+
+	res->data = malloc(blob->size);
+	if (!res->data) {
+		free(res);
+		return NULL;
+	}
+
+	memcpy(res->data, blob->data, blob->size);
+	res->id = blob->id;
+	res->length = blob->size;
+
+	return res;
+}
+
+WL_EXPORT int
+drmModeCreatePropertyBlob(int fd, const void *data, size_t size,
+			  uint32_t *id)
+{
+	static int (*real)(int, const void *, size_t, uint32_t *);
+	struct fake_blob *blob;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, data, size, id);
+	}
+
+	if (size == 0)
+		return fake_error(EINVAL);
+
+	blob = fake_blob_add(data, size);
+	if (!blob)
+		return fake_error(ENOMEM);
+
+	*id = blob->id;
+
+	return 0;
+}
+
+WL_EXPORT int
+drmModeDestroyPropertyBlob(int fd, uint32_t id)
+{
+	static int (*real)(int, uint32_t);
+	struct fake_blob *blob;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, id);
+	}
+
+	blob = fake_blob_find(id, false);
+	if (!blob)
+		return fake_error(ENOENT);
+
+	blob->destroyed = true;
+
+	return 0;
+}
+
+static int
+fake_add_fb(uint32_t width, uint32_t height, uint32_t format,
+	    uint32_t handle, uint32_t pitch, uint32_t offset, uint32_t *fb_id)
+{
+	struct fake_dumb *dumb = fake_dumb_find(handle);
+	struct fake_fb *fb;
+
+	if (!dumb)
+		return fake_error(ENOENT);
+
+	if (!width || !height ||
+	    offset + (uint64_t) pitch * height > dumb->size)
+		return fake_error(EINVAL);
+
+	fb = zalloc(sizeof *fb);
+	if (!fb)
+		return fake_error(ENOMEM);
+
+	fb->id = fake.next_id++;
+	fb->width = width;
+	fb->height = height;
+	fb->format = format;
+	fb->next = fake.fbs;
+	fake.fbs = fb;
+
+	*fb_id = fb->id;
+
+	return 0;
+}
+
+WL_EXPORT int
+drmModeAddFB(int fd, uint32_t width, uint32_t height, uint8_t depth,
+	     uint8_t bpp, uint32_t pitch, uint32_t bo_handle,
+	     uint32_t *buf_id)
+{
+	static int (*real)(int, uint32_t, uint32_t, uint8_t, uint8_t,
+			   uint32_t, uint32_t, uint32_t *);
+	uint32_t format;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, width, height, depth, bpp, pitch, bo_handle,
+			    buf_id);
+	}
+
+	if (depth == 24 && bpp == 32)
+		format = DRM_FORMAT_XRGB8888;
+	else if (depth == 32 && bpp == 32)
+		format = DRM_FORMAT_ARGB8888;
+	else if (depth == 16 && bpp == 16)
+		format = DRM_FORMAT_RGB565;
+	else
+		return fake_error(EINVAL);
+
+	return fake_add_fb(width, height, format, bo_handle, pitch, 0, buf_id);
+}
+
+WL_EXPORT int
+drmModeAddFB2(int fd, uint32_t width, uint32_t height,
+	      uint32_t pixel_format, const uint32_t bo_handles[4],
+	      const uint32_t pitches[4], const uint32_t offsets[4],
+	      uint32_t *buf_id, uint32_t flags)
+{
+	static int (*real)(int, uint32_t, uint32_t, uint32_t,
+			   const uint32_t *, const uint32_t *,
+			   const uint32_t *, uint32_t *, uint32_t);
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, width, height, pixel_format, bo_handles,
+			    pitches, offsets, buf_id, flags);
+	}
+
+	if (flags != 0)
+		return fake_error(EINVAL);
+
+	switch (pixel_format) {
+	case DRM_FORMAT_XRGB8888:
+	case DRM_FORMAT_ARGB8888:
+	case DRM_FORMAT_RGB565:
+		break;
+	default:
+		return fake_error(EINVAL);
+	}
+
+	return fake_add_fb(width, height, pixel_format, bo_handles[0],
+			   pitches[0], offsets[0], buf_id);
+}
+
+WL_EXPORT int
+drmModeRmFB(int fd, uint32_t buffer_id)
+{
+	static int (*real)(int, uint32_t);
+	struct fake_fb **prev, *fb;
+	int i;
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, buffer_id);
+	}
+
+	for (prev = &fake.fbs; (fb = *prev); prev = &fb->next) {
+		if (fb->id == buffer_id)
+			break;
+	}
+
+	if (!fb)
+		return fake_error(ENOENT);
+
+	*prev = fb->next;
+	free(fb);
+
+	/* Like the kernel, take it off the planes still showing it */
+	for (i = OBJ_PRIMARY; i < OBJ__COUNT; i++) {
+		if (fake.state.values[i][PROP_FB_ID] != buffer_id)
+			continue;
+
+		fake.state.values[i][PROP_FB_ID] = 0;
+		fake.state.values[i][PROP_CRTC_ID] = 0;
+	}
+
+	return 0;
+}
+
+WL_EXPORT int
+drmModeConnectorSetProperty(int fd, uint32_t connector_id,
+			    uint32_t property_id, uint64_t value)
+{
+	static int (*real)(int, uint32_t, uint32_t, uint64_t);
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, connector_id, property_id, value);
+	}
+
+	if (connector_id != fake_objects[OBJ_CONNECTOR].id)
+		return fake_error(ENOENT);
+
+	if (property_id != PROP_DPMS || value >= ARRAY_LENGTH(dpms_enums))
+		return fake_error(EINVAL);
+
+	fake.state.values[OBJ_CONNECTOR][PROP_DPMS] = value;
+
+	return 0;
+}
+
+WL_EXPORT int
+drmModeCrtcSetGamma(int fd, uint32_t crtc_id, uint32_t size,
+		    uint16_t *red, uint16_t *green, uint16_t *blue)
+{
+	static int (*real)(int, uint32_t, uint32_t,
+			   uint16_t *, uint16_t *, uint16_t *);
+
+	if (!drm_fake_device_is(fd)) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(fd, crtc_id, size, red, green, blue);
+	}
+
+	/* The CRTC reports no gamma ramp */
+	return fake_error(EINVAL);
+}
+
+/*
+ * libudev, with the fake card as the only DRM device and no input
+ * devices at all. Once udev_new() has handed out the fake context,
+ * every udev object the compositor and libinput see is fake.
+ */
+
+struct udev {
+	int refcount;
+};
+
+struct udev_list_entry {
+	const char *name;
+	struct udev_list_entry *next;
+};
+
+struct udev_enumerate {
+	int refcount;
+	struct udev *udev;
+	bool match_drm;
+	struct udev_list_entry *list;
+	struct udev_list_entry card;
+};
+
+struct udev_device {
+	int refcount;
+	struct udev *udev;
+};
+
+struct udev_monitor {
+	int refcount;
+	struct udev *udev;
+	/* Never readable, there is no hotplug */
+	int fd;
+};
+
+WL_EXPORT struct udev *
+udev_new(void)
+{
+	static struct udev *(*real)(void);
+	struct udev *udev;
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real();
+	}
+
+	udev = zalloc(sizeof *udev);
+	if (udev)
+		udev->refcount = 1;
+
+	return udev;
+}
+
+WL_EXPORT struct udev *
+udev_ref(struct udev *udev)
+{
+	static struct udev *(*real)(struct udev *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(udev);
+	}
+
+	if (udev)
+		udev->refcount++;
+
+	return udev;
+}
+
+WL_EXPORT struct udev *
+udev_unref(struct udev *udev)
+{
+	static struct udev *(*real)(struct udev *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(udev);
+	}
+
+	if (!udev || --udev->refcount > 0)
+		return udev;
+
+	free(udev);
+
+	return NULL;
+}
+
+WL_EXPORT struct udev_enumerate *
+udev_enumerate_new(struct udev *udev)
+{
+	static struct udev_enumerate *(*real)(struct udev *);
+	struct udev_enumerate *e;
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(udev);
+	}
+
+	e = zalloc(sizeof *e);
+	if (!e)
+		return NULL;
+
+	e->refcount = 1;
+	e->udev = udev_ref(udev);
+	e->card.name = FAKE_CARD_SYSPATH;
+
+	return e;
+}
+
+WL_EXPORT struct udev_enumerate *
+udev_enumerate_unref(struct udev_enumerate *e)
+{
+	static struct udev_enumerate *(*real)(struct udev_enumerate *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(e);
+	}
+
+	if (!e || --e->refcount > 0)
+		return e;
+
+	udev_unref(e->udev);
+	free(e);
+
+	return NULL;
+}
+
+WL_EXPORT int
+udev_enumerate_add_match_subsystem(struct udev_enumerate *e,
+				   const char *subsystem)
+{
+	static int (*real)(struct udev_enumerate *, const char *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(e, subsystem);
+	}
+
+	if (strcmp(subsystem, "drm") == 0)
+		e->match_drm = true;
+
+	return 0;
+}
+
+WL_EXPORT int
+udev_enumerate_add_match_sysname(struct udev_enumerate *e,
+				 const char *sysname)
+{
+	static int (*real)(struct udev_enumerate *, const char *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(e, sysname);
+	}
+
+	/* The only DRM device is a card */
+	return 0;
+}
+
+WL_EXPORT int
+udev_enumerate_scan_devices(struct udev_enumerate *e)
+{
+	static int (*real)(struct udev_enumerate *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(e);
+	}
+
+	e->list = e->match_drm ? &e->card : NULL;
+
+	return 0;
+}
+
+WL_EXPORT struct udev_list_entry *
+udev_enumerate_get_list_entry(struct udev_enumerate *e)
+{
+	static struct udev_list_entry *(*real)(struct udev_enumerate *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(e);
+	}
+
+	return e->list;
+}
+
+WL_EXPORT struct udev_list_entry *
+udev_list_entry_get_next(struct udev_list_entry *entry)
+{
+	static struct udev_list_entry *(*real)(struct udev_list_entry *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(entry);
+	}
+
+	return entry ? entry->next : NULL;
+}
+
+WL_EXPORT const char *
+udev_list_entry_get_name(struct udev_list_entry *entry)
+{
+	static const char *(*real)(struct udev_list_entry *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(entry);
+	}
+
+	return entry ? entry->name : NULL;
+}
+
+WL_EXPORT struct udev_device *
+udev_device_new_from_syspath(struct udev *udev, const char *syspath)
+{
+	static struct udev_device *(*real)(struct udev *, const char *);
+	struct udev_device *device;
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(udev, syspath);
+	}
+
+	if (strcmp(syspath, FAKE_CARD_SYSPATH) != 0) {
+		errno = ENODEV;
+		return NULL;
+	}
+
+	device = zalloc(sizeof *device);
+	if (!device)
+		return NULL;
+
+	device->refcount = 1;
+	device->udev = udev_ref(udev);
+
+	return device;
+}
+
+WL_EXPORT struct udev_device *
+udev_device_new_from_subsystem_sysname(struct udev *udev,
+				       const char *subsystem,
+				       const char *sysname)
+{
+	static struct udev_device *(*real)(struct udev *, const char *,
+					   const char *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(udev, subsystem, sysname);
+	}
+
+	if (strcmp(subsystem, "drm") != 0 || strcmp(sysname, "card0") != 0) {
+		errno = ENODEV;
+		return NULL;
+	}
+
+	return udev_device_new_from_syspath(udev, FAKE_CARD_SYSPATH);
+}
+
+WL_EXPORT struct udev_device *
+udev_device_ref(struct udev_device *device)
+{
+	static struct udev_device *(*real)(struct udev_device *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device);
+	}
+
+	if (device)
+		device->refcount++;
+
+	return device;
+}
+
+WL_EXPORT struct udev_device *
+udev_device_unref(struct udev_device *device)
+{
+	static struct udev_device *(*real)(struct udev_device *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device);
+	}
+
+	if (!device || --device->refcount > 0)
+		return device;
+
+	udev_unref(device->udev);
+	free(device);
+
+	return NULL;
+}
+
+WL_EXPORT struct udev *
+udev_device_get_udev(struct udev_device *device)
+{
+	static struct udev *(*real)(struct udev_device *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device);
+	}
+
+	return device->udev;
+}
+
+WL_EXPORT const char *
+udev_device_get_syspath(struct udev_device *device)
+{
+	static const char *(*real)(struct udev_device *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device);
+	}
+
+	return FAKE_CARD_SYSPATH;
+}
+
+WL_EXPORT const char *
+udev_device_get_sysname(struct udev_device *device)
+{
+	static const char *(*real)(struct udev_device *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device);
+	}
+
+	return "card0";
+}
+
+WL_EXPORT const char *
+udev_device_get_sysnum(struct udev_device *device)
+{
+	static const char *(*real)(struct udev_device *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device);
+	}
+
+	return "0";
+}
+
+WL_EXPORT const char *
+udev_device_get_devnode(struct udev_device *device)
+{
+	static const char *(*real)(struct udev_device *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device);
+	}
+
+	return FAKE_CARD_DEVNODE;
+}
+
+WL_EXPORT const char *
+udev_device_get_subsystem(struct udev_device *device)
+{
+	static const char *(*real)(struct udev_device *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device);
+	}
+
+	return "drm";
+}
+
+WL_EXPORT const char *
+udev_device_get_property_value(struct udev_device *device, const char *key)
+{
+	static const char *(*real)(struct udev_device *, const char *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device, key);
+	}
+
+	/* No ID_SEAT puts the card on the default seat */
+	return NULL;
+}
+
+WL_EXPORT const char *
+udev_device_get_sysattr_value(struct udev_device *device,
+			      const char *sysattr)
+{
+	static const char *(*real)(struct udev_device *, const char *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device, sysattr);
+	}
+
+	return NULL;
+}
+
+WL_EXPORT struct udev_device *
+udev_device_get_parent_with_subsystem_devtype(struct udev_device *device,
+					      const char *subsystem,
+					      const char *devtype)
+{
+	static struct udev_device *(*real)(struct udev_device *,
+					   const char *, const char *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(device, subsystem, devtype);
+	}
+
+	/* Not on any bus, so never the boot VGA device */
+	return NULL;
+}
+
+WL_EXPORT struct udev_monitor *
+udev_monitor_new_from_netlink(struct udev *udev, const char *name)
+{
+	static struct udev_monitor *(*real)(struct udev *, const char *);
+	struct udev_monitor *monitor;
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(udev, name);
+	}
+
+	monitor = zalloc(sizeof *monitor);
+	if (!monitor)
+		return NULL;
+
+	monitor->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (monitor->fd < 0) {
+		free(monitor);
+		return NULL;
+	}
+
+	monitor->refcount = 1;
+	monitor->udev = udev_ref(udev);
+
+	return monitor;
+}
+
+WL_EXPORT struct udev_monitor *
+udev_monitor_ref(struct udev_monitor *monitor)
+{
+	static struct udev_monitor *(*real)(struct udev_monitor *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(monitor);
+	}
+
+	if (monitor)
+		monitor->refcount++;
+
+	return monitor;
+}
+
+WL_EXPORT struct udev_monitor *
+udev_monitor_unref(struct udev_monitor *monitor)
+{
+	static struct udev_monitor *(*real)(struct udev_monitor *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(monitor);
+	}
+
+	if (!monitor || --monitor->refcount > 0)
+		return monitor;
+
+	close(monitor->fd);
+	udev_unref(monitor->udev);
+	free(monitor);
+
+	return NULL;
+}
+
+WL_EXPORT struct udev *
+udev_monitor_get_udev(struct udev_monitor *monitor)
+{
+	static struct udev *(*real)(struct udev_monitor *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(monitor);
+	}
+
+	return monitor->udev;
+}
+
+WL_EXPORT int
+udev_monitor_filter_add_match_subsystem_devtype(struct udev_monitor *monitor,
+						const char *subsystem,
+						const char *devtype)
+{
+	static int (*real)(struct udev_monitor *, const char *, const char *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(monitor, subsystem, devtype);
+	}
+
+	return 0;
+}
+
+WL_EXPORT int
+udev_monitor_enable_receiving(struct udev_monitor *monitor)
+{
+	static int (*real)(struct udev_monitor *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(monitor);
+	}
+
+	return 0;
+}
+
+WL_EXPORT int
+udev_monitor_set_receive_buffer_size(struct udev_monitor *monitor, int size)
+{
+	static int (*real)(struct udev_monitor *, int);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(monitor, size);
+	}
+
+	return 0;
+}
+
+WL_EXPORT int
+udev_monitor_get_fd(struct udev_monitor *monitor)
+{
+	static int (*real)(struct udev_monitor *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(monitor);
+	}
+
+	return monitor->fd;
+}
+
+WL_EXPORT struct udev_device *
+udev_monitor_receive_device(struct udev_monitor *monitor)
+{
+	static struct udev_device *(*real)(struct udev_monitor *);
+
+	if (!fake.active) {
+		if (!real)
+			real = drm_real_func(__func__);
+		return real(monitor);
+	}
+
+	errno = EAGAIN;
+	return NULL;
+}
@@ -0,0 +1,65 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DRM_FAKE_DEVICE_H
+#define DRM_FAKE_DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <xf86drmMode.h>
+
+/* One property set in an atomic request */
+struct drm_prop_value {
+	uint32_t object_id;
+	uint32_t prop_id;
+	uint64_t value;
+};
+
+void *
+drm_real_func(const char *name);
+
+bool
+drm_fake_device_is(int fd);
+
+int
+drm_fake_atomic_commit(const struct drm_prop_value *props, int count,
+		       uint32_t flags, void *user_data);
+
+int
+drm_fake_set_crtc(uint32_t crtc_id, uint32_t fb_id,
+		  const uint32_t *connectors, int count,
+		  const drmModeModeInfo *mode);
+
+int
+drm_fake_page_flip(uint32_t crtc_id, uint32_t fb_id, uint32_t flags,
+		   void *user_data);
+
+int
+drm_fake_set_plane(uint32_t plane_id, uint32_t crtc_id, uint32_t fb_id,
+		   int32_t crtc_x, int32_t crtc_y,
+		   uint32_t crtc_w, uint32_t crtc_h,
+		   uint32_t src_x, uint32_t src_y,
+		   uint32_t src_w, uint32_t src_h);
+
+#endif
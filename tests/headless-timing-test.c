@@ -0,0 +1,238 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "compositor.h"
+#include "compositor/weston.h"
+#include "shared/helpers.h"
+#include "module-test-helper.h"
+
+/*
+ * Runs the headless output with the display timing configured in the
+ * [output] section of the test's .ini, and checks that frames are
+ * presented accordingly:
+ *
+ * - at a fixed refresh rate, with or without frame-jitter, the frame
+ *   times advance by a refresh cycle per frame counter step, and every
+ *   repaint takes at least one cycle: jitter delays the completion of a
+ *   frame but never its timestamp;
+ * - with min-refresh-rate, frames come no faster than the refresh rate,
+ *   and after a pause of a few cycles of the lowest refresh rate the
+ *   frame counter accounts for the self-refreshes meanwhile;
+ * - unthrottled, the mode has a refresh of 0, so weston_output_finish_frame
+ *   repaints again right away: each frame is one counter step, and they
+ *   come faster than a 60 Hz display would show them.
+ */
+
+#define FRAME_COUNT 60
+/* The frame after which a VRR output is left idle */
+#define PAUSE_FRAME (FRAME_COUNT / 2)
+/* in cycles of the lowest refresh rate */
+#define PAUSE_CYCLES 3
+
+struct timing_test {
+	struct module_test base;
+	int32_t refresh, min_refresh;	/* mHz */
+	bool unthrottled;
+	struct wl_event_source *pause_timer;
+	uint64_t last_msc;	/* of the frame the next call sees presented */
+	uint64_t start_msc;
+	uint32_t start_msecs;
+	uint32_t last_msecs;
+	int frames;
+	bool paused;
+};
+
+static int
+refresh_period_msec(int32_t refresh)
+{
+	return (1000000 + refresh - 1) / refresh;
+}
+
+static void
+timing_test_read_config(struct timing_test *test)
+{
+	struct weston_config *wc = wet_get_config(test->base.compositor);
+	struct weston_config_section *section;
+	double refresh, min_refresh;
+	int unthrottled;
+
+	section = weston_config_get_section(wc, "output", "name",
+					    test->base.output->name);
+	weston_config_section_get_double(section, "refresh-rate",
+					 &refresh, 60.0);
+	weston_config_section_get_double(section, "min-refresh-rate",
+					 &min_refresh, 0.0);
+	weston_config_section_get_bool(section, "unthrottled",
+				       &unthrottled, 0);
+
+	test->refresh = refresh * 1000.0 + 0.5;
+	test->min_refresh = min_refresh * 1000.0 + 0.5;
+	test->unthrottled = unthrottled;
+}
+
+static int
+pause_timer_handler(void *data)
+{
+	struct timing_test *test = data;
+
+	wl_event_source_remove(test->pause_timer);
+	test->pause_timer = NULL;
+	weston_output_schedule_repaint(test->base.output);
+
+	return 0;
+}
+
+/* Leaves the output idle, so that a VRR display refreshes on its own */
+static void
+timing_test_pause(struct timing_test *test)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(test->base.compositor->wl_display);
+
+	test->pause_timer = wl_event_loop_add_timer(loop, pause_timer_handler,
+						    test);
+	assert(test->pause_timer);
+	wl_event_source_timer_update(test->pause_timer, PAUSE_CYCLES *
+				     refresh_period_msec(test->min_refresh));
+	test->paused = true;
+}
+
+static void
+timing_test_check_fixed(struct timing_test *test, uint64_t presented_msc,
+			uint32_t msecs)
+{
+	double cycles, expected_msecs;
+
+	cycles = presented_msc - test->start_msc;
+	expected_msecs = cycles * 1000000.0 / test->refresh;
+	fprintf(stderr, "%d repaints over %.0f refresh cycles in %u ms, "
+		"%.1f ms expected\n", test->frames - 2, cycles,
+		msecs - test->start_msecs, expected_msecs);
+
+	assert(cycles >= test->frames - 2);
+	/* Frame times are in whole milliseconds. */
+	assert(msecs - test->start_msecs >= expected_msecs - 1.0);
+	assert(msecs - test->start_msecs <= expected_msecs + 1.0);
+}
+
+static void
+timing_test_check_unthrottled(struct timing_test *test,
+			      uint64_t presented_msc, uint32_t msecs)
+{
+	uint32_t elapsed = msecs - test->start_msecs;
+
+	fprintf(stderr, "%d unthrottled repaints in %u ms\n",
+		test->frames - 2, elapsed);
+
+	assert(presented_msc - test->start_msc ==
+	       (uint64_t) (test->frames - 2));
+	/* Faster than a 60 Hz display, with plenty of slack */
+	assert(elapsed * 60 < (uint32_t) (test->frames - 2) * 1000);
+}
+
+static void
+timing_test_frame(struct module_test *base, uint32_t msecs)
+{
+	struct timing_test *test =
+		container_of(base, struct timing_test, base);
+	struct weston_output *output = base->output;
+	uint64_t presented_msc = test->last_msc;
+
+	/* Animations run after the output was repainted: msecs is the
+	 * presentation time of the previous frame, output->msc is the
+	 * counter of the vblank this one is to be shown at. The first
+	 * call follows the start of the repaint loop. */
+	test->frames++;
+
+	if (test->frames == 1) {
+		timing_test_read_config(test);
+		assert(output->current_mode->refresh ==
+		       (test->unthrottled ? 0 : test->refresh));
+	}
+
+	if (test->frames == 2) {
+		test->start_msc = presented_msc;
+		test->start_msecs = msecs;
+	}
+
+	if (test->min_refresh && test->paused) {
+		/* The frame after the pause counts the self-refreshes */
+		assert(output->msc - test->last_msc > PAUSE_CYCLES);
+		test->paused = false;
+	} else if (test->min_refresh && test->frames > 2) {
+		assert(output->msc > test->last_msc);
+
+		/* No faster than the refresh rate, in whole milliseconds.
+		 * Restarting the repaint loop after the pause reports the
+		 * time it restarted at, which is no vblank. */
+		if (test->frames != PAUSE_FRAME + 2)
+			assert((uint64_t) (msecs - test->last_msecs + 1) *
+			       test->refresh >= 1000000);
+	}
+
+	test->last_msc = output->msc;
+	test->last_msecs = msecs;
+
+	if (test->frames < FRAME_COUNT) {
+		if (test->min_refresh && test->frames == PAUSE_FRAME)
+			timing_test_pause(test);
+		else
+			weston_output_schedule_repaint(output);
+		return;
+	}
+
+	if (test->unthrottled)
+		timing_test_check_unthrottled(test, presented_msc, msecs);
+	else if (!test->min_refresh)
+		timing_test_check_fixed(test, presented_msc, msecs);
+
+	module_test_finish(base);
+	free(test);
+}
+static void
+timing_test_start(struct module_test *base)
+{
+	weston_output_schedule_repaint(base->output);
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct timing_test *test;
+
+	test = zalloc(sizeof *test);
+	if (!test)
+		return -1;
+
+	module_test_init(&test->base, compositor, timing_test_start,
+			 timing_test_frame);
+
+	return 0;
+}
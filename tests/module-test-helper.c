@@ -0,0 +1,186 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+
+#include "module-test-helper.h"
+#include "shared/helpers.h"
+
+static void
+module_test_frame(struct weston_animation *animation,
+		  struct weston_output *output, uint32_t msecs)
+{
+	struct module_test *test =
+		container_of(animation, struct module_test, animation);
+
+	test->frame(test, msecs);
+}
+
+static void
+module_test_start(void *data)
+{
+	struct module_test *test = data;
+	struct weston_compositor *compositor = test->compositor;
+
+	assert(!wl_list_empty(&compositor->output_list));
+	test->output = container_of(compositor->output_list.next,
+				    struct weston_output, link);
+
+	weston_layer_init(&test->layer, compositor);
+	weston_layer_set_position(&test->layer,
+				  WESTON_LAYER_POSITION_NORMAL + 1);
+
+	test->animation.frame = module_test_frame;
+	wl_list_insert(&test->output->animation_list,
+		       &test->animation.link);
+
+	test->start(test);
+}
+
+/** Runs the test from an idle callback
+ *
+ * \param test The test state, zero-initialized by the caller.
+ * \param compositor The compositor the test module is loaded into.
+ * \param start Called once the outputs exist.
+ * \param frame Called after every repaint of the first output.
+ */
+void
+module_test_init(struct module_test *test,
+		 struct weston_compositor *compositor,
+		 void (*start)(struct module_test *test),
+		 void (*frame)(struct module_test *test, uint32_t msecs))
+{
+	struct wl_event_loop *loop;
+
+	test->compositor = compositor;
+	test->start = start;
+	test->frame = frame;
+	wl_list_init(&test->animation.link);
+	wl_array_init(&test->surfaces);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	wl_event_loop_add_idle(loop, module_test_start, test);
+}
+
+/** Creates a mapped surface and view in the test layer
+ *
+ * The surface has no buffer; give it a color or an opaque region as
+ * needed. It is destroyed by module_test_clear_views().
+ */
+struct weston_view *
+module_test_add_view(struct module_test *test,
+		     int x, int y, int width, int height)
+{
+	struct weston_surface *surface, **slot;
+	struct weston_view *view;
+
+	surface = weston_surface_create(test->compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+	slot = wl_array_add(&test->surfaces, sizeof *slot);
+	assert(slot);
+	*slot = surface;
+
+	surface->width = width;
+	surface->height = height;
+	surface->is_mapped = true;
+	view->is_mapped = true;
+	weston_view_set_position(view, x, y);
+	weston_layer_entry_insert(&test->layer.view_list, &view->layer_link);
+
+	return view;
+}
+
+void
+module_test_clear_views(struct module_test *test)
+{
+	struct weston_surface **surface;
+
+	wl_array_for_each(surface, &test->surfaces)
+		weston_surface_destroy(*surface);
+
+	test->surfaces.size = 0;
+}
+
+/** Tears the harness down and terminates the compositor
+ *
+ * The caller frees its test state afterwards.
+ */
+void
+module_test_finish(struct module_test *test)
+{
+	wl_list_remove(&test->animation.link);
+	wl_list_init(&test->animation.link);
+
+	module_test_clear_views(test);
+	wl_array_release(&test->surfaces);
+
+	if (test->output)
+		weston_layer_unset_position(&test->layer);
+
+	wl_display_terminate(test->compositor->wl_display);
+}
+
+/** Picks the top view at a point by scanning the whole view list
+ *
+ * Reference for weston_compositor_pick_view(), which uses an index.
+ */
+struct weston_view *
+module_test_linear_pick_view(struct weston_compositor *compositor,
+			     wl_fixed_t x, wl_fixed_t y,
+			     wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	struct weston_view *view;
+	wl_fixed_t view_x, view_y;
+	int view_ix, view_iy;
+	int ix = wl_fixed_to_int(x);
+	int iy = wl_fixed_to_int(y);
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (!pixman_region32_contains_point(
+				&view->transform.boundingbox, ix, iy, NULL))
+			continue;
+
+		weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
+		view_ix = wl_fixed_to_int(view_x);
+		view_iy = wl_fixed_to_int(view_y);
+
+		if (!pixman_region32_contains_point(&view->surface->input,
+						    view_ix, view_iy, NULL))
+			continue;
+
+		if (view->geometry.scissor_enabled &&
+		    !pixman_region32_contains_point(&view->geometry.scissor,
+						    view_ix, view_iy, NULL))
+			continue;
+
+		*vx = view_x;
+		*vy = view_y;
+		return view;
+	}
+
+	return NULL;
+}
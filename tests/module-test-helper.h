@@ -0,0 +1,75 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WESTON_MODULE_TEST_HELPER_H_
+#define _WESTON_MODULE_TEST_HELPER_H_
+
+#include <stdint.h>
+
+#include "compositor.h"
+
+/*
+ * Harness for module tests and benchmarks that drive the repaint loop of
+ * the first output from inside the compositor. Embed struct module_test
+ * in the test state, call module_test_init() from wet_module_init(), and
+ * end the test with module_test_finish().
+ */
+
+struct module_test {
+	struct weston_compositor *compositor;
+	/* The first output, whose repaints call frame */
+	struct weston_output *output;
+	/* Views added with module_test_add_view(), above the shell's */
+	struct weston_layer layer;
+	struct weston_animation animation;
+	struct wl_array surfaces;
+
+	/* Called once the outputs exist. */
+	void (*start)(struct module_test *test);
+	/* Called after every repaint of the output, with the
+	 * presentation time of the previous frame. */
+	void (*frame)(struct module_test *test, uint32_t msecs);
+};
+
+void
+module_test_init(struct module_test *test,
+		 struct weston_compositor *compositor,
+		 void (*start)(struct module_test *test),
+		 void (*frame)(struct module_test *test, uint32_t msecs));
+
+struct weston_view *
+module_test_add_view(struct module_test *test,
+		     int x, int y, int width, int height);
+
+void
+module_test_clear_views(struct module_test *test);
+
+void
+module_test_finish(struct module_test *test);
+
+struct weston_view *
+module_test_linear_pick_view(struct weston_compositor *compositor,
+			     wl_fixed_t x, wl_fixed_t y,
+			     wl_fixed_t *vx, wl_fixed_t *vy);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "compositor/weston.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "module-test-helper.h"
+
+/*
+ * Compares weston_compositor_pick_view() against a plain scan of the
+ * view list, checking that both pick the same view and reporting the
+ * time spent per pick for different numbers of views.
+ */
+
+#define PICK_COUNT 100000
+
+static const int view_counts[] = { 10, 100, 1000 };
+
+struct bench {
+	struct module_test base;
+	unsigned int round;
+};
+
+static void
+populate(struct bench *bench, int count)
+{
+	int i, x, y, width, height;
+
+	for (i = 0; i < count; i++) {
+		width = 32 + rand() % 480;
+		height = 32 + rand() % 480;
+		x = rand() % 1920 - 200;
+		y = rand() % 1080 - 200;
+		module_test_add_view(&bench->base, x, y, width, height);
+	}
+}
+
+static void
+run_picks(struct bench *bench)
+{
+	struct weston_compositor *compositor = bench->base.compositor;
+	struct weston_view *grid_view, *linear_view;
+	wl_fixed_t *points, vx, vy;
+	struct timespec begin, end;
+	int64_t grid_nsec, linear_nsec;
+	int i;
+
+	points = zalloc(2 * PICK_COUNT * sizeof points[0]);
+	assert(points);
+	for (i = 0; i < 2 * PICK_COUNT; i += 2) {
+		points[i] = wl_fixed_from_double(rand() % 2400 - 199.5);
+		points[i + 1] = wl_fixed_from_double(rand() % 1400 - 199.5);
+	}
+
+	for (i = 0; i < 2 * PICK_COUNT; i += 2) {
+		grid_view = weston_compositor_pick_view(compositor,
+							points[i], points[i + 1],
+							&vx, &vy);
+		linear_view = module_test_linear_pick_view(compositor,
+							   points[i],
+							   points[i + 1],
+							   &vx, &vy);
+		assert(grid_view == linear_view);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < 2 * PICK_COUNT; i += 2)
+		weston_compositor_pick_view(compositor,
+					    points[i], points[i + 1], &vx, &vy);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	grid_nsec = timespec_sub_to_nsec(&end, &begin);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < 2 * PICK_COUNT; i += 2)
+		module_test_linear_pick_view(compositor,
+					     points[i], points[i + 1],
+					     &vx, &vy);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	linear_nsec = timespec_sub_to_nsec(&end, &begin);
+
+	fprintf(stderr, "%5d views: grid %8.1f ns/pick, "
+		"linear %8.1f ns/pick\n", view_counts[bench->round],
+		(double)grid_nsec / PICK_COUNT,
+		(double)linear_nsec / PICK_COUNT);
+
+	free(points);
+}
+
+static void
+bench_frame(struct module_test *base, uint32_t msecs)
+{
+	struct bench *bench = container_of(base, struct bench, base);
+
+	/* The view list and the pick grid are up to date after a repaint. */
+	run_picks(bench);
+	module_test_clear_views(base);
+
+	if (++bench->round == ARRAY_LENGTH(view_counts)) {
+		module_test_finish(base);
+		free(bench);
+		return;
+	}
+
+	populate(bench, view_counts[bench->round]);
+	weston_output_schedule_repaint(base->output);
+}
+
+static void
+bench_start(struct module_test *base)
+{
+	struct bench *bench = container_of(base, struct bench, base);
+
+	srand(1);
+	populate(bench, view_counts[0]);
+	weston_output_schedule_repaint(base->output);
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct bench *bench;
+
+	bench = zalloc(sizeof *bench);
+	if (!bench)
+		return -1;
+
+	module_test_init(&bench->base, compositor, bench_start, bench_frame);
+
+	return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "compositor.h"
+#include "compositor/weston.h"
+#include "shared/helpers.h"
+#include "module-test-helper.h"
+
+/*
+ * Moves, restacks, hides and shows views between picks, and checks that
+ * weston_compositor_pick_view() always agrees with a plain scan of the
+ * view list. Moves are picked both right after updating the transform,
+ * which updates the pick grid in place, and after the next repaint, which
+ * rebuilds it if the stacking changed.
+ *
+ * The views are spread far enough for the grid cells to wrap around onto
+ * the same buckets, and one view spans more cells than there are buckets.
+ */
+
+#define VIEW_COUNT 200
+#define ROUND_COUNT 30
+#define PICK_COUNT 2000
+#define AREA 20000
+
+struct pick_test {
+	struct module_test base;
+	struct weston_view *views[VIEW_COUNT];
+	int round;
+};
+
+static void
+random_point(struct pick_test *test, wl_fixed_t *x, wl_fixed_t *y)
+{
+	struct weston_view *view;
+	pixman_box32_t *box;
+
+	/* Half of the points land in a view's bounding box, so that
+	 * there is something to pick in a sparse scene. */
+	if (rand() % 2) {
+		*x = wl_fixed_from_int(rand() % (2 * AREA) - AREA);
+		*y = wl_fixed_from_int(rand() % (2 * AREA) - AREA);
+		return;
+	}
+
+	view = test->views[rand() % VIEW_COUNT];
+	box = pixman_region32_extents(&view->transform.boundingbox);
+	if (box->x2 <= box->x1 || box->y2 <= box->y1) {
+		*x = *y = 0;
+		return;
+	}
+
+	*x = wl_fixed_from_int(box->x1 + rand() % (box->x2 - box->x1));
+	*y = wl_fixed_from_int(box->y1 + rand() % (box->y2 - box->y1));
+}
+
+static void
+check_picks(struct pick_test *test)
+{
+	struct weston_compositor *compositor = test->base.compositor;
+	struct weston_view *grid_view, *linear_view;
+	wl_fixed_t x, y, vx, vy, linear_vx, linear_vy;
+	int i, hits = 0;
+
+	for (i = 0; i < PICK_COUNT; i++) {
+		random_point(test, &x, &y);
+		grid_view = weston_compositor_pick_view(compositor, x, y,
+							&vx, &vy);
+		linear_view = module_test_linear_pick_view(compositor, x, y,
+							   &linear_vx,
+							   &linear_vy);
+		assert(grid_view == linear_view);
+		if (grid_view) {
+			assert(vx == linear_vx && vy == linear_vy);
+			hits++;
+		}
+	}
+
+	/* Make sure the test is not vacuous. */
+	assert(hits > 0);
+}
+
+static void
+move_views(struct pick_test *test)
+{
+	struct weston_view *view;
+	int i, x, y;
+
+	for (i = 0; i < VIEW_COUNT / 10; i++) {
+		view = test->views[rand() % VIEW_COUNT];
+
+		/* Mostly small steps, sometimes across the whole area */
+		if (rand() % 4) {
+			x = view->geometry.x + rand() % 512 - 256;
+			y = view->geometry.y + rand() % 512 - 256;
+		} else {
+			x = rand() % (2 * AREA) - AREA;
+			y = rand() % (2 * AREA) - AREA;
+		}
+
+		weston_view_set_position(view, x, y);
+		weston_view_update_transform(view);
+	}
+}
+
+static void
+restack_views(struct pick_test *test)
+{
+	struct weston_view *view, *below;
+	int i;
+
+	for (i = 0; i < VIEW_COUNT / 20; i++) {
+		view = test->views[rand() % VIEW_COUNT];
+		below = test->views[rand() % VIEW_COUNT];
+
+		if (view == below)
+			continue;
+
+		/* Hidden views are not in the layer; showing one again
+		 * puts it at the top. */
+		weston_layer_entry_remove(&view->layer_link);
+		if (below->layer_link.layer)
+			weston_layer_entry_insert(&below->layer_link,
+						  &view->layer_link);
+		else
+			weston_layer_entry_insert(&test->base.layer.view_list,
+						  &view->layer_link);
+	}
+
+	/* Hide a few */
+	for (i = 0; i < VIEW_COUNT / 50; i++) {
+		view = test->views[rand() % VIEW_COUNT];
+		weston_layer_entry_remove(&view->layer_link);
+	}
+}
+
+static void
+pick_test_frame(struct module_test *base, uint32_t msecs)
+{
+	struct pick_test *test = container_of(base, struct pick_test, base);
+
+	/* The view list was rebuilt by the repaint. */
+	check_picks(test);
+
+	if (++test->round == ROUND_COUNT) {
+		fprintf(stderr, "%d rounds of %d picks match\n",
+			ROUND_COUNT, 2 * PICK_COUNT);
+		module_test_finish(base);
+		free(test);
+		return;
+	}
+
+	move_views(test);
+	check_picks(test);
+
+	restack_views(test);
+	weston_output_schedule_repaint(base->output);
+}
+
+static void
+pick_test_start(struct module_test *base)
+{
+	struct pick_test *test = container_of(base, struct pick_test, base);
+	int i, x, y, width, height;
+
+	srand(1);
+
+	for (i = 0; i < VIEW_COUNT; i++) {
+		if (i == 0) {
+			/* Wider than all buckets along x together */
+			width = 2 * AREA;
+			height = 300;
+			x = -AREA;
+			y = 0;
+		} else {
+			width = 32 + rand() % 800;
+			height = 32 + rand() % 800;
+			x = rand() % (2 * AREA) - AREA;
+			y = rand() % (2 * AREA) - AREA;
+		}
+
+		test->views[i] = module_test_add_view(base, x, y,
+						      width, height);
+	}
+
+	weston_output_schedule_repaint(base->output);
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct pick_test *test;
+
+	test = zalloc(sizeof *test);
+	if (!test)
+		return -1;
+
+	module_test_init(&test->base, compositor, pick_test_start,
+			 pick_test_frame);
+
+	return 0;
+}
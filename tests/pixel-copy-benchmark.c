@@ -0,0 +1,79 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "shared/pixel-copy.h"
+#include "shared/timespec-util.h"
+
+static const enum pixel_copy_impl impls[] = {
+	PIXEL_COPY_IMPL_C,
+	PIXEL_COPY_IMPL_SSE2,
+	PIXEL_COPY_IMPL_AVX2,
+	PIXEL_COPY_IMPL_NEON,
+};
+
+/* A full 4K screenshot: swap R and B and flip vertically. */
+TEST(pixel_copy_4k_screenshot)
+{
+	const int width = 3840, height = 2160, rounds = 10;
+	struct timespec begin, end;
+	uint32_t *src, *dst;
+	unsigned int i;
+	int64_t nsec;
+	int r;
+
+	src = calloc(width * height, sizeof *src);
+	dst = malloc(width * height * sizeof *dst);
+	assert(src && dst);
+
+	for (i = 0; i < ARRAY_LENGTH(impls); i++) {
+		if (pixel_copy_set_impl(impls[i]) < 0)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		for (r = 0; r < rounds; r++)
+			pixel_copy_rect32(dst, width * 4, src, width * 4,
+					  width, height,
+					  PIXEL_COPY_SWAP_RB | PIXEL_COPY_YFLIP);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		nsec = timespec_sub_to_nsec(&end, &begin) / rounds;
+
+		fprintf(stderr, "%dx%d swap and flip, %s: %6.2f ms, "
+			"%6.0f MB/s\n", width, height, pixel_copy_impl_name(),
+			nsec / 1e6, width * height * 4.0 / 1e6 / (nsec / 1e9));
+	}
+
+	assert(pixel_copy_set_impl(PIXEL_COPY_IMPL_AUTO) == 0);
+	free(src);
+	free(dst);
+}
@@ -0,0 +1,127 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "shared/pixel-copy.h"
+
+static const enum pixel_copy_impl impls[] = {
+	PIXEL_COPY_IMPL_C,
+	PIXEL_COPY_IMPL_SSE2,
+	PIXEL_COPY_IMPL_AVX2,
+	PIXEL_COPY_IMPL_NEON,
+};
+
+static uint32_t
+swap_rb(uint32_t v)
+{
+	return (v & 0xff00ff00) | ((v >> 16) & 0xff) | ((v & 0xff) << 16);
+}
+
+/* Copies a width x height rectangle at an odd offset into a buffer
+ * filled with a marker, and checks every pixel with a plain loop. */
+static void
+check_copy(int width, int height, uint32_t flags)
+{
+	int src_stride = width + 5;
+	int dst_stride = width + 3;
+	uint32_t *src, *dst;
+	uint32_t expected;
+	int x, y, sy;
+
+	src = malloc((height * src_stride + 1) * sizeof *src);
+	dst = malloc((height * dst_stride + 1) * sizeof *dst);
+	assert(src && dst);
+
+	for (x = 0; x < height * src_stride + 1; x++)
+		src[x] = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+	for (x = 0; x < height * dst_stride + 1; x++)
+		dst[x] = 0xdeadbeef;
+
+	/* Off by one pixel, so that no row is 16 byte aligned. */
+	pixel_copy_rect32(dst + 1, dst_stride * 4, src + 1, src_stride * 4,
+			  width, height, flags);
+
+	assert(dst[0] == 0xdeadbeef);
+	for (y = 0; y < height; y++) {
+		sy = (flags & PIXEL_COPY_YFLIP) ? height - 1 - y : y;
+
+		for (x = 0; x < dst_stride; x++) {
+			if (x >= width)
+				expected = 0xdeadbeef;
+			else if (flags & PIXEL_COPY_SWAP_RB)
+				expected = swap_rb(src[1 + sy * src_stride + x]);
+			else
+				expected = src[1 + sy * src_stride + x];
+
+			assert(dst[1 + y * dst_stride + x] == expected);
+		}
+	}
+
+	free(src);
+	free(dst);
+}
+
+TEST(pixel_copy_all_impls)
+{
+	static const int widths[] = { 1, 3, 4, 7, 8, 15, 16, 17, 31, 33, 100 };
+	unsigned int i, j;
+	uint32_t flags;
+
+	srand(1);
+
+	for (i = 0; i < ARRAY_LENGTH(impls); i++) {
+		if (pixel_copy_set_impl(impls[i]) < 0)
+			continue;
+
+		fprintf(stderr, "checking %s\n", pixel_copy_impl_name());
+
+		for (j = 0; j < ARRAY_LENGTH(widths); j++)
+			for (flags = 0; flags < 4; flags++)
+				check_copy(widths[j], 5, flags);
+	}
+
+	assert(pixel_copy_set_impl(PIXEL_COPY_IMPL_AUTO) == 0);
+}
+
+TEST(pixel_copy_swap_rb_in_place)
+{
+	uint32_t row[37];
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(row); i++)
+		row[i] = 0x11223344 + i;
+
+	pixel_copy_row_swap_rb(row, row, ARRAY_LENGTH(row));
+
+	for (i = 0; i < ARRAY_LENGTH(row); i++)
+		assert(row[i] == swap_rb(0x11223344 + i));
+}
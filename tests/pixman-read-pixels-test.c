@@ -0,0 +1,377 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "compositor.h"
+#include "compositor/weston.h"
+#include "windowed-output-api.h"
+#include "shared/helpers.h"
+#include "module-test-helper.h"
+
+/*
+ * Reads the output back with weston_output_read_pixels_async() the way
+ * the screenshooter and screen sharing do. Overlapping reads started
+ * over two frames have to complete in the order they were started, each
+ * with the pixels of its own frame, so that a consumer applying them in
+ * completion order never lets an older frame overwrite a newer one.
+ * Reads still in flight when their output is destroyed have to complete
+ * exactly once all the same.
+ *
+ * Runs on the pixman renderer, weston-tests-env passes --use-pixman for
+ * tests named pixman-*.
+ */
+
+#define VIEW_X 100
+#define VIEW_Y 80
+#define VIEW_WIDTH 200
+#define VIEW_HEIGHT 150
+
+#define BACKGROUND_COLOR 0xff0000
+#define DOOMED_NAME "read-pixels-doomed"
+
+static const uint32_t frame_colors[] = { 0x00ff00, 0x0000ff };
+
+/* In output coordinates, y down */
+static const pixman_box32_t read_boxes[] = {
+	{ 0, 0, 400, 300 },
+	{ 150, 100, 350, 250 },
+	{ 50, 50, 1000, 600 },
+};
+
+#define READS_PER_FRAME ARRAY_LENGTH(read_boxes)
+
+struct read_test;
+
+struct read {
+	struct read_test *test;
+	int index;
+	pixman_box32_t box;
+	uint32_t color;		/* of the view in the frame read */
+	int yflip;
+	uint32_t *pixels;
+	int done;
+	int status;
+};
+
+struct read_test {
+	struct module_test base;
+	struct weston_view *view;
+	struct wl_listener frame_listener;
+	int frames;
+
+	struct read reads[ARRAY_LENGTH(frame_colors) * READS_PER_FRAME];
+	int started;
+	int completed;
+
+	struct wl_listener output_created_listener;
+	struct wl_listener doomed_frame_listener;
+	struct weston_output *doomed;
+	struct read doomed_reads[2];
+	int doomed_completed;
+};
+
+static void
+set_view_color(struct read_test *test, uint32_t color)
+{
+	weston_surface_set_color(test->view->surface,
+				 ((color >> 16) & 0xff) / 255.0f,
+				 ((color >> 8) & 0xff) / 255.0f,
+				 (color & 0xff) / 255.0f, 1.0);
+	weston_surface_damage(test->view->surface);
+}
+
+static uint32_t
+expected_color(struct read *read, int x, int y)
+{
+	if (x >= VIEW_X && x < VIEW_X + VIEW_WIDTH &&
+	    y >= VIEW_Y && y < VIEW_Y + VIEW_HEIGHT)
+		return read->color;
+
+	return BACKGROUND_COLOR;
+}
+
+static void
+check_pixels(struct read *read)
+{
+	int width = read->box.x2 - read->box.x1;
+	int height = read->box.y2 - read->box.y1;
+	uint32_t pixel, expected;
+	int row, x, y;
+
+	for (row = 0; row < height; row++) {
+		/* Rows come bottom-up from renderers capturing y-flipped */
+		y = read->yflip ? read->box.y2 - 1 - row : read->box.y1 + row;
+
+		for (x = read->box.x1; x < read->box.x2; x++) {
+			pixel = read->pixels[row * width + x - read->box.x1];
+			expected = expected_color(read, x, y);
+			if ((pixel & 0xffffff) == expected)
+				continue;
+
+			fprintf(stderr, "read %d: pixel %d,%d is 0x%06x, "
+				"expected 0x%06x\n", read->index, x, y,
+				pixel & 0xffffff, expected);
+			assert(0);
+		}
+	}
+}
+
+static void
+read_test_finish(struct read_test *test)
+{
+	unsigned int i;
+
+	wl_list_remove(&test->frame_listener.link);
+	wl_list_remove(&test->output_created_listener.link);
+
+	for (i = 0; i < ARRAY_LENGTH(test->reads); i++)
+		free(test->reads[i].pixels);
+	for (i = 0; i < ARRAY_LENGTH(test->doomed_reads); i++)
+		free(test->doomed_reads[i].pixels);
+
+	module_test_finish(&test->base);
+	free(test);
+}
+
+/* Another output, destroyed while reads from it are in flight */
+static void
+create_doomed(struct read_test *test)
+{
+	struct weston_compositor *compositor = test->base.compositor;
+	const struct weston_windowed_output_api *api;
+	int ret;
+
+	api = weston_windowed_output_get_api(compositor);
+	assert(api);
+	ret = api->output_create(compositor, DOOMED_NAME);
+	assert(ret == 0);
+	assert(test->doomed);
+}
+
+static void
+read_done(int status, void *data)
+{
+	struct read *read = data;
+	struct read_test *test = read->test;
+
+	read->done++;
+	read->status = status;
+	assert(read->done == 1);
+
+	if (read >= test->doomed_reads &&
+	    read < test->doomed_reads + ARRAY_LENGTH(test->doomed_reads)) {
+		/* The output is gone, the read may have failed. */
+		assert(test->doomed == NULL);
+		assert(status == 0 || status == -1);
+
+		if (++test->doomed_completed ==
+		    (int) ARRAY_LENGTH(test->doomed_reads))
+			read_test_finish(test);
+		return;
+	}
+
+	assert(status == 0);
+	assert(read->index == test->completed);
+	test->completed++;
+	check_pixels(read);
+
+	if (test->completed == (int) ARRAY_LENGTH(test->reads))
+		create_doomed(test);
+}
+
+static void
+start_read(struct read_test *test, struct read *read,
+	   struct weston_output *output, const pixman_box32_t *box,
+	   uint32_t color)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int width = box->x2 - box->x1;
+	int height = box->y2 - box->y1;
+	int y;
+	int ret;
+
+	read->test = test;
+	read->box = *box;
+	read->color = color;
+	read->yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	read->pixels = malloc(width * height * 4);
+	assert(read->pixels);
+
+	y = read->yflip ? output->current_mode->height - box->y2 : box->y1;
+	ret = weston_output_read_pixels_async(output,
+					      compositor->read_format,
+					      read->pixels, box->x1, y,
+					      width, height, read_done, read);
+	assert(ret == 0);
+}
+
+static void
+destroy_doomed(void *data)
+{
+	struct read_test *test = data;
+	struct weston_output *output = test->doomed;
+
+	test->doomed = NULL;
+	output->destroy(output);
+}
+
+static void
+doomed_frame(struct wl_listener *listener, void *data)
+{
+	struct read_test *test =
+		container_of(listener, struct read_test,
+			     doomed_frame_listener);
+	struct weston_output *output = data;
+	struct wl_event_loop *loop;
+	struct wl_event_source *idle;
+	pixman_box32_t box = { 0, 0, 64, 64 };
+	unsigned int i;
+
+	wl_list_remove(&listener->link);
+
+	/* Idle callbacks run in order, destroy the output before any
+	 * read could have completed. */
+	loop = wl_display_get_event_loop(test->base.compositor->wl_display);
+	idle = wl_event_loop_add_idle(loop, destroy_doomed, test);
+	assert(idle);
+
+	for (i = 0; i < ARRAY_LENGTH(test->doomed_reads); i++) {
+		test->doomed_reads[i].index = i;
+		start_read(test, &test->doomed_reads[i], output, &box, 0);
+		box.x1 += 32;
+		box.x2 += 32;
+	}
+}
+
+static void
+output_created(struct wl_listener *listener, void *data)
+{
+	struct read_test *test =
+		container_of(listener, struct read_test,
+			     output_created_listener);
+	struct weston_output *output = data;
+
+	if (strcmp(output->name, DOOMED_NAME) != 0)
+		return;
+
+	test->doomed = output;
+	test->doomed_frame_listener.notify = doomed_frame;
+	wl_signal_add(&output->frame_signal, &test->doomed_frame_listener);
+	weston_output_schedule_repaint(output);
+}
+
+static void
+output_frame(struct wl_listener *listener, void *data)
+{
+	struct read_test *test =
+		container_of(listener, struct read_test, frame_listener);
+	struct weston_output *output = data;
+	unsigned int i;
+	int frame;
+
+	/* The first repaint shows the first color */
+	frame = test->frames++;
+	if (frame >= (int) ARRAY_LENGTH(frame_colors))
+		return;
+
+	for (i = 0; i < READS_PER_FRAME; i++) {
+		struct read *read = &test->reads[test->started];
+
+		read->index = test->started++;
+		start_read(test, read, output, &read_boxes[i],
+			   frame_colors[frame]);
+	}
+}
+
+static void
+read_test_frame(struct module_test *base, uint32_t msecs)
+{
+	struct read_test *test = container_of(base, struct read_test, base);
+
+	/* The reads of the frame just painted have been started, change
+	 * the view for the next one before any of them completes. */
+	if (test->frames > 0 &&
+	    test->frames < (int) ARRAY_LENGTH(frame_colors)) {
+		set_view_color(test, frame_colors[test->frames]);
+		weston_output_schedule_repaint(base->output);
+	}
+}
+
+static void
+read_test_start(struct module_test *base)
+{
+	struct read_test *test = container_of(base, struct read_test, base);
+	struct weston_output *output = base->output;
+	struct weston_view *background;
+
+	if (base->compositor->read_format == 0) {
+		fprintf(stderr, "not using the pixman renderer, skipping\n");
+		module_test_finish(base);
+		free(test);
+		return;
+	}
+
+	background = module_test_add_view(base, output->x, output->y,
+					  output->width, output->height);
+	weston_surface_set_color(background->surface, 1.0, 0.0, 0.0, 1.0);
+	pixman_region32_init_rect(&background->surface->opaque, 0, 0,
+				  output->width, output->height);
+
+	test->view = module_test_add_view(base, output->x + VIEW_X,
+					  output->y + VIEW_Y,
+					  VIEW_WIDTH, VIEW_HEIGHT);
+	pixman_region32_init_rect(&test->view->surface->opaque, 0, 0,
+				  VIEW_WIDTH, VIEW_HEIGHT);
+	set_view_color(test, frame_colors[0]);
+
+	test->frame_listener.notify = output_frame;
+	wl_signal_add(&output->frame_signal, &test->frame_listener);
+
+	test->output_created_listener.notify = output_created;
+	wl_signal_add(&base->compositor->output_created_signal,
+		      &test->output_created_listener);
+
+	weston_output_damage(output);
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct read_test *test;
+
+	test = zalloc(sizeof *test);
+	if (!test)
+		return -1;
+
+	module_test_init(&test->base, compositor,
+			 read_test_start, read_test_frame);
+
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "compositor/weston.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "module-test-helper.h"
+
+/*
+ * Repaints the whole output every frame with the pixman renderer using
+ * 1, 2, 4 and 8 threads and reports the time spent in repaint_output per
+ * frame, checking that every thread count paints the same image.
+ *
+ * Needs the headless backend with --use-pixman, weston-tests-env passes
+ * it for tests named pixman-*. make check builds it with a few frames
+ * per round as pixman-threads-test, for the image comparison.
+ */
+
+#define VIEW_COUNT 40
+#ifndef FRAME_COUNT
+#define FRAME_COUNT 60
+#endif
+
+static const unsigned int thread_counts[] = { 1, 2, 4, 8 };
+
+struct bench {
+	struct module_test base;
+	void (*repaint_output)(struct weston_output *output,
+			       pixman_region32_t *output_damage);
+	unsigned int round;
+	int frames;
+	int64_t nsec;
+	uint32_t *reference;
+	uint32_t *pixels;
+};
+
+/* repaint_output has no user data pointer */
+static struct bench *bench_;
+
+static void
+timed_repaint_output(struct weston_output *output,
+		     pixman_region32_t *output_damage)
+{
+	struct timespec begin, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	bench_->repaint_output(output, output_damage);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (output == bench_->base.output) {
+		bench_->nsec += timespec_sub_to_nsec(&end, &begin);
+		bench_->frames++;
+	}
+}
+
+static void
+populate(struct bench *bench)
+{
+	struct weston_output *output = bench->base.output;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	int i, x, y, width, height;
+
+	for (i = 0; i < VIEW_COUNT; i++) {
+		if (i == 0) {
+			/* Background, so that every pixel is painted */
+			width = output->width;
+			height = output->height;
+			x = output->x;
+			y = output->y;
+		} else {
+			width = 64 + rand() % 800;
+			height = 64 + rand() % 600;
+			x = output->x + rand() % output->width;
+			y = output->y + rand() % output->height;
+		}
+
+		view = module_test_add_view(&bench->base, x, y, width, height);
+		surface = view->surface;
+		weston_surface_set_color(surface, (i % 3) / 2.0f,
+					 (i % 5) / 4.0f, (i % 7) / 6.0f, 1.0);
+
+		/* Half of the views are opaque and painted with
+		 * PIXMAN_OP_SRC, the rest are blended. */
+		if (i % 2 == 0)
+			pixman_region32_init_rect(&surface->opaque, 0, 0,
+						  surface->width,
+						  surface->height);
+		else
+			view->alpha = 0.5;
+	}
+}
+
+static void
+finish_round(struct bench *bench)
+{
+	struct weston_compositor *compositor = bench->base.compositor;
+	struct weston_output *output = bench->base.output;
+	int width = output->current_mode->width;
+	int height = output->current_mode->height;
+	uint32_t *pixels;
+	int ret;
+
+	pixels = bench->round == 0 ? bench->reference : bench->pixels;
+	ret = compositor->renderer->read_pixels(output,
+						compositor->read_format,
+						pixels, 0, 0, width, height);
+	assert(ret == 0);
+
+	if (pixels != bench->reference)
+		assert(memcmp(pixels, bench->reference,
+			      width * height * 4) == 0);
+
+	fprintf(stderr, "%d views, %dx%d, %u threads: %8.1f us/frame\n",
+		VIEW_COUNT, width, height, thread_counts[bench->round],
+		(double)bench->nsec / bench->frames / 1000.0);
+}
+
+static void
+bench_frame(struct module_test *base, uint32_t msecs)
+{
+	struct bench *bench = container_of(base, struct bench, base);
+	struct weston_compositor *compositor = base->compositor;
+
+	if (bench->frames >= FRAME_COUNT) {
+		finish_round(bench);
+
+		if (++bench->round == ARRAY_LENGTH(thread_counts)) {
+			compositor->renderer->repaint_output =
+				bench->repaint_output;
+			compositor->renderer_threads = 1;
+			module_test_finish(base);
+			free(bench->reference);
+			free(bench->pixels);
+			free(bench);
+			bench_ = NULL;
+			return;
+		}
+
+		compositor->renderer_threads = thread_counts[bench->round];
+		bench->frames = 0;
+		bench->nsec = 0;
+	}
+
+	weston_output_damage(base->output);
+}
+
+static void
+bench_start(struct module_test *base)
+{
+	struct bench *bench = container_of(base, struct bench, base);
+	struct weston_compositor *compositor = base->compositor;
+	struct weston_output *output = base->output;
+	size_t size;
+
+	/* Only the pixman renderer sets a read format on the headless
+	 * backend, the noop renderer leaves it at 0. */
+	if (compositor->read_format == 0) {
+		fprintf(stderr, "not using the pixman renderer, skipping\n");
+		module_test_finish(base);
+		free(bench);
+		bench_ = NULL;
+		return;
+	}
+
+	size = output->current_mode->width * output->current_mode->height * 4;
+	bench->reference = malloc(size);
+	bench->pixels = malloc(size);
+	assert(bench->reference && bench->pixels);
+
+	bench->repaint_output = compositor->renderer->repaint_output;
+	compositor->renderer->repaint_output = timed_repaint_output;
+	compositor->renderer_threads = thread_counts[0];
+
+	srand(1);
+	populate(bench);
+	weston_output_damage(output);
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct bench *bench;
+
+	bench = zalloc(sizeof *bench);
+	if (!bench)
+		return -1;
+
+	bench_ = bench;
+	module_test_init(&bench->base, compositor, bench_start, bench_frame);
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "weston-test-runner.h"
+
+#include "compositor.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+
+#define MAX_BOXES 16
+#define FRAME_COUNT 1000
+#define RANDOM_FRAME_COUNT 100
+
+static void
+random_region(pixman_region32_t *region, int count)
+{
+	int i;
+
+	pixman_region32_init(region);
+	for (i = 0; i < count; i++)
+		pixman_region32_union_rect(region, region,
+					   rand() % 1920, rand() % 1080,
+					   1 + rand() % 64, 1 + rand() % 64);
+}
+
+/* Damage of an 80x24 terminal with 8x16 pixel cells, where a few runs
+ * of characters change on some lines every frame, the way text output
+ * and cursor movement damage a terminal window. Reports the upload
+ * calls saved, the extra pixels uploaded and the time spent per call. */
+TEST(coalesce_terminal_damage)
+{
+	pixman_region32_t region;
+	pixman_box32_t boxes[MAX_BOXES], *rects;
+	struct timespec begin, end;
+	int64_t damaged = 0, uploaded = 0, nsec = 0;
+	int rects_before = 0, rects_after = 0;
+	int frame, line, runs, run, col, len, n, nrects, i;
+
+	srand(3);
+	for (frame = 0; frame < FRAME_COUNT; frame++) {
+		pixman_region32_init(&region);
+
+		for (line = 0; line < 24; line++) {
+			if (rand() % 3)
+				continue;
+
+			runs = 1 + rand() % 6;
+			for (run = 0; run < runs; run++) {
+				col = rand() % 80;
+				len = 1 + rand() % MIN(12, 80 - col);
+				pixman_region32_union_rect(&region, &region,
+							   col * 8, line * 16,
+							   len * 8, 16);
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		n = weston_region_coalesce(&region, boxes, MAX_BOXES);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		nsec += timespec_sub_to_nsec(&end, &begin);
+		rects_after += n;
+
+		rects = pixman_region32_rectangles(&region, &nrects);
+		for (i = 0; i < nrects; i++)
+			damaged += (int64_t)(rects[i].x2 - rects[i].x1) *
+				   (rects[i].y2 - rects[i].y1);
+		rects_before += nrects;
+		for (i = 0; i < n; i++)
+			uploaded += (int64_t)(boxes[i].x2 - boxes[i].x1) *
+				    (boxes[i].y2 - boxes[i].y1);
+
+		pixman_region32_fini(&region);
+	}
+
+	fprintf(stderr, "terminal damage, %d frames: %d upload calls "
+		"before, %d after (%.1f%% saved), %.1f%% more pixels, "
+		"%.1f ns/call\n", FRAME_COUNT,
+		rects_before, rects_after,
+		100.0 * (rects_before - rects_after) / rects_before,
+		100.0 * (uploaded - damaged) / damaged,
+		(double)nsec / FRAME_COUNT);
+}
+
+/* Scattered damage of many rectangles, the expensive case. */
+TEST(coalesce_random_damage)
+{
+	static const int rect_counts[] = { 10, 100, 1000 };
+	pixman_region32_t region;
+	pixman_box32_t boxes[MAX_BOXES];
+	struct timespec begin, end;
+	int64_t nsec;
+	int nrects, frame;
+	unsigned int i;
+
+	srand(4);
+	for (i = 0; i < ARRAY_LENGTH(rect_counts); i++) {
+		nsec = 0;
+		nrects = 0;
+
+		for (frame = 0; frame < RANDOM_FRAME_COUNT; frame++) {
+			random_region(&region, rect_counts[i]);
+			nrects += pixman_region32_n_rects(&region);
+
+			clock_gettime(CLOCK_MONOTONIC, &begin);
+			weston_region_coalesce(&region, boxes, MAX_BOXES);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			nsec += timespec_sub_to_nsec(&end, &begin);
+
+			pixman_region32_fini(&region);
+		}
+
+		fprintf(stderr, "%4d random rectangles, %6.1f region "
+			"rectangles: %10.1f ns/call\n", rect_counts[i],
+			(double)nrects / RANDOM_FRAME_COUNT,
+			(double)nsec / RANDOM_FRAME_COUNT);
+	}
+}
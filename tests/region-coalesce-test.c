@@ -0,0 +1,161 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "weston-test-runner.h"
+
+#include "compositor.h"
+#include "shared/helpers.h"
+
+#define MAX_BOXES 16
+
+/* The boxes must be disjoint, within the extents of the region and
+ * cover all of it. */
+static void
+check_coalesced(pixman_region32_t *region, pixman_box32_t *boxes, int n,
+		int max_boxes)
+{
+	pixman_box32_t *extents = pixman_region32_extents(region);
+	pixman_region32_t covered, missing;
+	int i, j;
+
+	assert(n <= max_boxes);
+	assert(n > 0 || !pixman_region32_not_empty(region));
+
+	pixman_region32_init(&covered);
+	for (i = 0; i < n; i++) {
+		assert(boxes[i].x1 < boxes[i].x2);
+		assert(boxes[i].y1 < boxes[i].y2);
+		assert(boxes[i].x1 >= extents->x1);
+		assert(boxes[i].y1 >= extents->y1);
+		assert(boxes[i].x2 <= extents->x2);
+		assert(boxes[i].y2 <= extents->y2);
+
+		for (j = i + 1; j < n; j++)
+			assert(boxes[i].x2 <= boxes[j].x1 ||
+			       boxes[j].x2 <= boxes[i].x1 ||
+			       boxes[i].y2 <= boxes[j].y1 ||
+			       boxes[j].y2 <= boxes[i].y1);
+
+		pixman_region32_union_rect(&covered, &covered,
+					   boxes[i].x1, boxes[i].y1,
+					   boxes[i].x2 - boxes[i].x1,
+					   boxes[i].y2 - boxes[i].y1);
+	}
+
+	pixman_region32_init(&missing);
+	pixman_region32_subtract(&missing, region, &covered);
+	assert(!pixman_region32_not_empty(&missing));
+
+	pixman_region32_fini(&missing);
+	pixman_region32_fini(&covered);
+}
+
+static void
+random_region(pixman_region32_t *region, int count, int size)
+{
+	int i;
+
+	pixman_region32_init(region);
+	for (i = 0; i < count; i++)
+		pixman_region32_union_rect(region, region,
+					   rand() % 1920, rand() % 1080,
+					   1 + rand() % size,
+					   1 + rand() % size);
+}
+
+TEST(coalesce_empty)
+{
+	pixman_region32_t region;
+	pixman_box32_t boxes[MAX_BOXES];
+
+	pixman_region32_init(&region);
+	assert(weston_region_coalesce(&region, boxes, MAX_BOXES) == 0);
+	pixman_region32_fini(&region);
+}
+
+TEST(coalesce_few_rects_kept)
+{
+	pixman_region32_t region;
+	pixman_box32_t boxes[MAX_BOXES];
+	pixman_box32_t *rects;
+	int i, n, nrects;
+
+	pixman_region32_init_rect(&region, 0, 0, 10, 10);
+	pixman_region32_union_rect(&region, &region, 500, 500, 10, 10);
+	pixman_region32_union_rect(&region, &region, 1000, 0, 10, 10);
+
+	n = weston_region_coalesce(&region, boxes, MAX_BOXES);
+	rects = pixman_region32_rectangles(&region, &nrects);
+	assert(n == nrects);
+	for (i = 0; i < n; i++) {
+		assert(boxes[i].x1 == rects[i].x1);
+		assert(boxes[i].y1 == rects[i].y1);
+		assert(boxes[i].x2 == rects[i].x2);
+		assert(boxes[i].y2 == rects[i].y2);
+	}
+
+	pixman_region32_fini(&region);
+}
+
+TEST(coalesce_single_box_is_extents)
+{
+	pixman_region32_t region;
+	pixman_box32_t box, *extents;
+
+	srand(1);
+	random_region(&region, 100, 50);
+
+	assert(weston_region_coalesce(&region, &box, 1) == 1);
+	extents = pixman_region32_extents(&region);
+	assert(box.x1 == extents->x1 && box.y1 == extents->y1);
+	assert(box.x2 == extents->x2 && box.y2 == extents->y2);
+
+	pixman_region32_fini(&region);
+}
+
+TEST(coalesce_random_regions)
+{
+	static const int max_boxes[] = { 1, 2, 7, MAX_BOXES };
+	pixman_region32_t region;
+	pixman_box32_t boxes[MAX_BOXES];
+	unsigned int i, round;
+	int n;
+
+	srand(2);
+	for (round = 0; round < 200; round++) {
+		random_region(&region, 1 + rand() % 300, 1 + rand() % 200);
+
+		for (i = 0; i < ARRAY_LENGTH(max_boxes); i++) {
+			n = weston_region_coalesce(&region, boxes,
+						   max_boxes[i]);
+			check_coalesced(&region, boxes, n, max_boxes[i]);
+		}
+
+		pixman_region32_fini(&region);
+	}
+}
@@ -0,0 +1,270 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "compositor/weston.h"
+#include "vertex-cache.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "module-test-helper.h"
+
+/*
+ * Reports the CPU time the GL renderer spends per frame turning 50
+ * rotated views into textured polygons, with and without its vertex
+ * cache, first with the rotations left alone, then with every view
+ * turned a bit on each frame. The headless backend cannot run the GL
+ * renderer, so this runs the GL-free code of vertex-cache.c on the
+ * regions the compositor computed for the repaint, the same way
+ * batch_region() in gl-renderer.c does.
+ */
+
+#define VIEW_COUNT 50
+#define FRAME_COUNT 120
+
+struct bench_view {
+	struct weston_view *view;
+	struct weston_transform rotation;
+	float angle;
+	struct vertex_cache cache;
+	/* in global coordinates */
+	pixman_region32_t repaint;
+	/* in surface coordinates */
+	pixman_region32_t surf_region;
+	struct texture_geometry tex;
+};
+
+struct bench {
+	struct module_test base;
+	struct bench_view views[VIEW_COUNT];
+	struct wl_array vertices;
+	struct wl_array vtxcnt;
+	bool rotating;
+	int frame;
+	int64_t cached_nsec;
+	int64_t uncached_nsec;
+};
+
+static void
+rotate(struct bench_view *bv, float angle)
+{
+	struct weston_matrix *matrix = &bv->rotation.matrix;
+	float cx = bv->view->surface->width / 2.0f;
+	float cy = bv->view->surface->height / 2.0f;
+
+	bv->angle = angle;
+
+	weston_matrix_init(matrix);
+	weston_matrix_translate(matrix, -cx, -cy, 0);
+	weston_matrix_rotate_xy(matrix, cosf(angle), sinf(angle));
+	weston_matrix_translate(matrix, cx, cy, 0);
+
+	weston_view_geometry_dirty(bv->view);
+}
+
+static void
+populate(struct bench *bench)
+{
+	struct weston_output *output = bench->base.output;
+	struct bench_view *bv;
+	int i, width, height;
+
+	for (i = 0; i < VIEW_COUNT; i++) {
+		bv = &bench->views[i];
+
+		width = 64 + rand() % 256;
+		height = 64 + rand() % 256;
+		bv->view = module_test_add_view(&bench->base,
+						output->x + rand() % output->width,
+						output->y + rand() % output->height,
+						width, height);
+		weston_surface_set_color(bv->view->surface, (i % 3) / 2.0f,
+					 (i % 5) / 4.0f, (i % 7) / 6.0f, 1.0);
+
+		wl_list_insert(&bv->view->geometry.transformation_list,
+			       &bv->rotation.link);
+		rotate(bv, (rand() % 360) * M_PI / 180.0);
+
+		vertex_cache_init(&bv->cache);
+		pixman_region32_init(&bv->repaint);
+		pixman_region32_init_rect(&bv->surf_region, 0, 0,
+					  width, height);
+		bv->tex.pitch = width;
+		bv->tex.height = height;
+		bv->tex.y_inverted = 1;
+	}
+}
+
+static void
+depopulate(struct bench *bench)
+{
+	struct bench_view *bv;
+	int i;
+
+	for (i = 0; i < VIEW_COUNT; i++) {
+		bv = &bench->views[i];
+		wl_list_remove(&bv->rotation.link);
+		vertex_cache_release(&bv->cache);
+		pixman_region32_fini(&bv->repaint);
+		pixman_region32_fini(&bv->surf_region);
+	}
+
+	module_test_clear_views(&bench->base);
+}
+
+/* What draw_view() paints of each view when the whole output is
+ * repainted */
+static void
+compute_repaint(struct bench *bench)
+{
+	struct bench_view *bv;
+	int i;
+
+	for (i = 0; i < VIEW_COUNT; i++) {
+		bv = &bench->views[i];
+		pixman_region32_intersect(&bv->repaint,
+					  &bv->view->transform.boundingbox,
+					  &bench->base.output->region);
+		pixman_region32_subtract(&bv->repaint, &bv->repaint,
+					 &bv->view->clip);
+	}
+}
+
+static int64_t
+run_views(struct bench *bench, bool cached)
+{
+	struct bench_view *bv;
+	struct timespec begin, end;
+	int i;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+	for (i = 0; i < VIEW_COUNT; i++) {
+		bv = &bench->views[i];
+		if (!pixman_region32_not_empty(&bv->repaint))
+			continue;
+
+		if (cached) {
+			if (!vertex_cache_matches(&bv->cache, bv->view,
+						  &bv->surf_region, &bv->tex))
+				vertex_cache_update(&bv->cache, bv->view,
+						    &bv->surf_region,
+						    &bv->tex);
+			vertex_cache_clip(&bv->cache, &bv->repaint,
+					  &bench->vertices, &bench->vtxcnt);
+		} else {
+			texture_region(bv->view, &bv->repaint,
+				       &bv->surf_region, &bv->tex,
+				       &bench->vertices, &bench->vtxcnt);
+		}
+
+		bench->vertices.size = 0;
+		bench->vtxcnt.size = 0;
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	return timespec_sub_to_nsec(&end, &begin);
+}
+
+static void
+report(struct bench *bench)
+{
+	fprintf(stderr, "%d %s views: cache on %9.1f ns/frame, "
+		"cache off %9.1f ns/frame\n", VIEW_COUNT,
+		bench->rotating ? "rotating" : "static rotated",
+		(double)bench->cached_nsec / FRAME_COUNT,
+		(double)bench->uncached_nsec / FRAME_COUNT);
+}
+
+static void
+bench_frame(struct module_test *base, uint32_t msecs)
+{
+	struct bench *bench = container_of(base, struct bench, base);
+	int i;
+
+	/* The transformations and the clip of the views are up to date
+	 * after a repaint. */
+	compute_repaint(bench);
+	bench->cached_nsec += run_views(bench, true);
+	bench->uncached_nsec += run_views(bench, false);
+
+	if (++bench->frame == FRAME_COUNT) {
+		report(bench);
+		bench->frame = 0;
+		bench->cached_nsec = 0;
+		bench->uncached_nsec = 0;
+
+		if (bench->rotating) {
+			depopulate(bench);
+			wl_array_release(&bench->vertices);
+			wl_array_release(&bench->vtxcnt);
+			module_test_finish(base);
+			free(bench);
+			return;
+		}
+
+		bench->rotating = true;
+	}
+
+	if (bench->rotating)
+		for (i = 0; i < VIEW_COUNT; i++)
+			rotate(&bench->views[i],
+			       bench->views[i].angle + 0.01f);
+
+	weston_output_schedule_repaint(base->output);
+}
+
+static void
+bench_start(struct module_test *base)
+{
+	struct bench *bench = container_of(base, struct bench, base);
+
+	srand(1);
+	populate(bench);
+	weston_output_schedule_repaint(base->output);
+}
+
+WL_EXPORT int
+wet_module_init(struct weston_compositor *compositor,
+		int *argc, char *argv[])
+{
+	struct bench *bench;
+
+	bench = zalloc(sizeof *bench);
+	if (!bench)
+		return -1;
+
+	wl_array_init(&bench->vertices);
+	wl_array_init(&bench->vtxcnt);
+	module_test_init(&bench->base, compositor, bench_start, bench_frame);
+
+	return 0;
+}
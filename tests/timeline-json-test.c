@@ -0,0 +1,248 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "libweston/timeline-format.h"
+
+int
+timeline_convert(FILE *in, FILE *out);
+
+static void
+write_record(FILE *fp, uint32_t type, void *record, size_t size,
+	     const char *text)
+{
+	static const char zeros[8];
+	struct timeline_record_header *header = record;
+	size_t length = text ? strlen(text) : 0;
+	size_t padded = (size + length + 7) & ~(size_t)7;
+
+	header->type = type;
+	header->size = padded;
+
+	assert(fwrite(record, size, 1, fp) == 1);
+	if (length)
+		assert(fwrite(text, length, 1, fp) == 1);
+	if (padded > size + length)
+		assert(fwrite(zeros, padded - size - length, 1, fp) == 1);
+}
+
+static void
+write_file_header(FILE *fp)
+{
+	struct timeline_file_header header = {
+		.magic = TIMELINE_FILE_MAGIC,
+		.version = TIMELINE_FILE_VERSION,
+		.clock_id = 1,
+	};
+
+	assert(fwrite(&header, sizeof header, 1, fp) == 1);
+}
+
+/* A log as libweston writes it: names and objects are described before
+ * the points that refer to them. */
+static void
+write_log(FILE *fp)
+{
+	struct timeline_record_string str = { .id = 1 };
+	struct timeline_record_output output = { .id = 2 };
+	struct timeline_record_surface surface = { .id = 3 };
+	struct timeline_record_point point = { .name = 1, .output = 2 };
+	struct timeline_record_dropped dropped = { .count = 7 };
+	struct timeline_record_header unknown = { 0 };
+
+	write_file_header(fp);
+
+	str.length = strlen("core_repaint_begin");
+	write_record(fp, TIMELINE_RECORD_STRING, &str, sizeof str,
+		     "core_repaint_begin");
+
+	output.length = strlen("HDMI-A-1");
+	write_record(fp, TIMELINE_RECORD_OUTPUT, &output, sizeof output,
+		     "HDMI-A-1");
+
+	surface.length = strlen("top-level \"term\"");
+	write_record(fp, TIMELINE_RECORD_SURFACE, &surface, sizeof surface,
+		     "top-level \"term\"");
+
+	point.sec = 10;
+	point.nsec = 500;
+	point.flags = TIMELINE_POINT_VBLANK;
+	point.vblank_sec = 9;
+	point.vblank_nsec = 999;
+	write_record(fp, TIMELINE_RECORD_POINT, &point, sizeof point, NULL);
+
+	/* Unknown records are skipped */
+	write_record(fp, 99, &unknown, sizeof unknown, "future");
+
+	write_record(fp, TIMELINE_RECORD_DROPPED, &dropped, sizeof dropped,
+		     NULL);
+
+	surface.id = 4;
+	surface.main_surface = 3;
+	surface.length = 0;
+	write_record(fp, TIMELINE_RECORD_SURFACE, &surface, sizeof surface,
+		     NULL);
+
+	str.id = 5;
+	str.length = strlen("core_flush_damage");
+	write_record(fp, TIMELINE_RECORD_STRING, &str, sizeof str,
+		     "core_flush_damage");
+
+	memset(&point, 0, sizeof point);
+	point.name = 5;
+	point.surface = 4;
+	point.sec = 11;
+	point.nsec = 0;
+	point.flags = TIMELINE_POINT_GPU;
+	point.gpu_sec = 11;
+	point.gpu_nsec = 42;
+	write_record(fp, TIMELINE_RECORD_POINT, &point, sizeof point, NULL);
+}
+
+static char *
+convert(FILE *in, int *ret)
+{
+	FILE *out;
+	char *json = NULL;
+	size_t size = 0;
+
+	rewind(in);
+	out = open_memstream(&json, &size);
+	assert(out);
+	*ret = timeline_convert(in, out);
+	fclose(out);
+
+	return json;
+}
+
+static const char expected_json[] =
+	"{ \"id\":2, \"type\":\"weston_output\", \"name\":\"HDMI-A-1\" }\n"
+	"{ \"id\":3, \"type\":\"weston_surface\", "
+		"\"desc\":\"top-level \\\"term\\\"\" }\n"
+	"{ \"T\":[10, 500], \"N\":\"core_repaint_begin\", \"wo\":2, "
+		"\"vblank\":[9, 999] }\n"
+	"{ \"id\":4, \"type\":\"weston_surface\", \"desc\":null, "
+		"\"main_surface\":3 }\n"
+	"{ \"T\":[11, 0], \"N\":\"core_flush_damage\", \"ws\":4, "
+		"\"gpu\":[11, 42] }\n";
+
+TEST(timeline_json_converts_log)
+{
+	FILE *log;
+	char *json;
+	int ret;
+
+	log = tmpfile();
+	assert(log);
+	write_log(log);
+
+	json = convert(log, &ret);
+	assert(ret == 0);
+	if (strcmp(json, expected_json) != 0) {
+		fprintf(stderr, "got:\n%s\nexpected:\n%s\n",
+			json, expected_json);
+		assert(0);
+	}
+
+	free(json);
+	fclose(log);
+}
+
+TEST(timeline_json_truncated_log)
+{
+	FILE *log, *cut;
+	char buf[4096];
+	char *json;
+	long size;
+	int ret;
+
+	log = tmpfile();
+	assert(log);
+	write_log(log);
+
+	/* Cut the last point in half, as when the compositor died while
+	 * writing it: everything before it is still converted. */
+	size = ftell(log);
+	rewind(log);
+	assert(fread(buf, size, 1, log) == 1);
+	cut = tmpfile();
+	assert(cut);
+	assert(fwrite(buf, size - 20, 1, cut) == 1);
+
+	json = convert(cut, &ret);
+	assert(ret == 0);
+	assert(strstr(json, "core_repaint_begin"));
+	assert(!strstr(json, "core_flush_damage\", \"ws\""));
+
+	free(json);
+	fclose(cut);
+	fclose(log);
+}
+
+TEST(timeline_json_rejects_garbage)
+{
+	struct timeline_record_header header = { TIMELINE_RECORD_POINT, 12 };
+	FILE *log;
+	char *json;
+	int ret;
+
+	/* Not a timeline log */
+	log = tmpfile();
+	assert(log);
+	assert(fwrite("{ \"id\":1 }\n", 11, 1, log) == 1);
+	json = convert(log, &ret);
+	assert(ret < 0);
+	free(json);
+	fclose(log);
+
+	/* A record size that is not a multiple of 8 */
+	log = tmpfile();
+	assert(log);
+	write_file_header(log);
+	assert(fwrite(&header, sizeof header, 1, log) == 1);
+	assert(fwrite("abcd", 4, 1, log) == 1);
+	json = convert(log, &ret);
+	assert(ret < 0);
+	free(json);
+	fclose(log);
+
+	/* A point record too short for a point */
+	log = tmpfile();
+	assert(log);
+	write_file_header(log);
+	header.size = 16;
+	assert(fwrite(&header, sizeof header, 1, log) == 1);
+	assert(fwrite("abcdefgh", 8, 1, log) == 1);
+	json = convert(log, &ret);
+	assert(ret < 0);
+	free(json);
+	fclose(log);
+}
@@ -60,6 +60,30 @@ ZUC_TEST(timespec_test, timespec_to_nsec)
 	ZUC_ASSERT_EQ(timespec_to_nsec(&a), (NSEC_PER_SEC * 4ULL) + 4);
 }
 
+ZUC_TEST(timespec_test, timespec_is_zero)
+{
+	struct timespec zero = { 0 };
+	struct timespec non_zero_sec = { .tv_sec = 1, .tv_nsec = 0 };
+	struct timespec non_zero_nsec = { .tv_sec = 0, .tv_nsec = 1 };
+
+	ZUC_ASSERT_TRUE(timespec_is_zero(&zero));
+	ZUC_ASSERT_FALSE(timespec_is_zero(&non_zero_nsec));
+	ZUC_ASSERT_FALSE(timespec_is_zero(&non_zero_sec));
+}
+
+ZUC_TEST(timespec_test, timespec_from_nsec)
+{
+	struct timespec a;
+
+	timespec_from_nsec(&a, 0);
+	ZUC_ASSERT_EQ(0, a.tv_sec);
+	ZUC_ASSERT_EQ(0, a.tv_nsec);
+
+	timespec_from_nsec(&a, (NSEC_PER_SEC * 4LL) + 4);
+	ZUC_ASSERT_EQ(4, a.tv_sec);
+	ZUC_ASSERT_EQ(4, a.tv_nsec);
+}
+
 ZUC_TEST(timespec_test, timespec_to_msec)
 {
 	struct timespec a;
@@ -0,0 +1,97 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "wcap/wcap-encode.h"
+#include "wcap-encode-helper.h"
+
+#define RECT_COUNT 300
+
+/* Encodes a stream of damage rectangles with the scalar encoder the
+ * recorder used before and with wcap_encoder, and reports the
+ * throughput of both. */
+TEST(wcap_encode_throughput)
+{
+	struct wcap_encoder encoder;
+	struct wcap_rectangle *rects;
+	uint32_t **pixels, *frame, *out;
+	struct timespec begin, end;
+	int64_t nsec, ref_nsec;
+	double bytes = 0;
+	int i, width, height;
+
+	assert(wcap_encoder_init(&encoder, WIDTH, HEIGHT) == 0);
+	frame = calloc(WIDTH * HEIGHT, sizeof *frame);
+	out = malloc(WIDTH * HEIGHT * sizeof *out);
+	rects = malloc(RECT_COUNT * sizeof *rects);
+	pixels = malloc(RECT_COUNT * sizeof *pixels);
+	assert(frame && out && rects && pixels);
+
+	srand(2);
+	for (i = 0; i < RECT_COUNT; i++) {
+		make_rect(&rects[i], i % 60);
+		width = rects[i].x2 - rects[i].x1;
+		height = rects[i].y2 - rects[i].y1;
+
+		pixels[i] = malloc(width * height * sizeof *pixels[i]);
+		assert(pixels[i]);
+		fill_rect(&rects[i], pixels[i], i % 60);
+		bytes += width * height * 4.0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < RECT_COUNT; i++)
+		reference_encode(frame, out, &rects[i], pixels[i]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ref_nsec = timespec_sub_to_nsec(&end, &begin);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < RECT_COUNT; i++)
+		wcap_encoder_encode_rectangle(&encoder, out, &rects[i],
+					      pixels[i],
+					      rects[i].x2 - rects[i].x1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	nsec = timespec_sub_to_nsec(&end, &begin);
+
+	fprintf(stderr, "%d rectangles, %.0f MB: scalar %.0f MB/s, "
+		"wcap_encoder %.0f MB/s\n", RECT_COUNT, bytes / 1e6,
+		bytes / 1e6 / (ref_nsec / 1e9), bytes / 1e6 / (nsec / 1e9));
+
+	for (i = 0; i < RECT_COUNT; i++)
+		free(pixels[i]);
+	free(pixels);
+	free(rects);
+	free(out);
+	free(frame);
+	wcap_encoder_release(&encoder);
+}
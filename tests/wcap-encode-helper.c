@@ -0,0 +1,129 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "wcap-encode-helper.h"
+
+/* The encoder of the recorder before it was vectorized. */
+static uint32_t *
+reference_output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((uint32_t)(run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((uint32_t)(i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static uint32_t
+reference_component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+uint32_t *
+reference_encode(uint32_t *frame, uint32_t *p, const struct wcap_rectangle *r,
+		 const uint32_t *pixels)
+{
+	int width = r->x2 - r->x1, height = r->y2 - r->y1;
+	uint32_t delta, prev, next, *d;
+	const uint32_t *s;
+	int j, k, run;
+
+	run = prev = 0;
+	for (j = 0; j < height; j++) {
+		s = pixels + width * j;
+		d = frame + WIDTH * (r->y2 - j - 1) + r->x1;
+
+		for (k = 0; k < width; k++) {
+			next = *s++;
+			delta = reference_component_delta(next, *d);
+			*d++ = next;
+			if (run == 0 || delta == prev) {
+				run++;
+			} else {
+				p = reference_output_run(p, prev, run);
+				run = 1;
+			}
+			prev = delta;
+		}
+	}
+
+	return reference_output_run(p, prev, run);
+}
+
+/* A terminal-like damage stream: a full first frame, then lines of
+ * glyphs changing on a flat background, with the odd gradient. */
+void
+make_rect(struct wcap_rectangle *r, int frame)
+{
+	if (frame == 0) {
+		r->x1 = 0;
+		r->y1 = 0;
+		r->x2 = WIDTH;
+		r->y2 = HEIGHT;
+	} else {
+		r->x1 = rand() % (WIDTH / 2);
+		r->y1 = rand() % (HEIGHT - 20);
+		r->x2 = r->x1 + 1 + rand() % (WIDTH / 2);
+		r->y2 = r->y1 + 1 + rand() % 20;
+	}
+}
+
+/* Fills the pixels of a rectangle made by make_rect(). */
+void
+fill_rect(const struct wcap_rectangle *r, uint32_t *pixels, int frame)
+{
+	int width, height, i, x, y;
+
+	width = r->x2 - r->x1;
+	height = r->y2 - r->y1;
+	for (i = 0; i < width * height; i++) {
+		x = i % width;
+		y = i / width;
+		if (frame % 7 == 3)
+			pixels[i] = 0xff000000 | (x << 8) | y;
+		else if ((x / 3 + y / 5 + frame) % 4 == 0)
+			pixels[i] = 0xffc0c0c0;
+		else
+			pixels[i] = 0xff202020;
+	}
+}
@@ -0,0 +1,45 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WESTON_WCAP_ENCODE_HELPER_H_
+#define _WESTON_WCAP_ENCODE_HELPER_H_
+
+#include <stdint.h>
+
+#include "wcap/wcap-decode.h"
+
+/* Frames of the recorder streams made by make_rect() */
+#define WIDTH 1920
+#define HEIGHT 1080
+
+uint32_t *
+reference_encode(uint32_t *frame, uint32_t *p, const struct wcap_rectangle *r,
+		 const uint32_t *pixels);
+
+void
+make_rect(struct wcap_rectangle *r, int frame);
+
+void
+fill_rect(const struct wcap_rectangle *r, uint32_t *pixels, int frame);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "wcap/wcap-decode.h"
+#include "wcap/wcap-encode.h"
+#include "wcap-encode-helper.h"
+
+TEST(wcap_encode_matches_reference)
+{
+	struct wcap_encoder encoder;
+	struct wcap_rectangle r;
+	uint32_t *frame, *pixels, *flipped, *out, *ref, *end, *ref_end;
+	int i, y, width, height;
+
+	assert(wcap_encoder_init(&encoder, WIDTH, HEIGHT) == 0);
+	frame = calloc(WIDTH * HEIGHT, sizeof *frame);
+	pixels = malloc(WIDTH * HEIGHT * sizeof *pixels);
+	flipped = malloc(WIDTH * HEIGHT * sizeof *flipped);
+	out = malloc(WIDTH * HEIGHT * sizeof *out);
+	ref = malloc(WIDTH * HEIGHT * sizeof *ref);
+	assert(frame && pixels && flipped && out && ref);
+
+	srand(1);
+	for (i = 0; i < 200; i++) {
+		make_rect(&r, i);
+		fill_rect(&r, pixels, i);
+		width = r.x2 - r.x1;
+		height = r.y2 - r.y1;
+
+		ref_end = reference_encode(frame, ref, &r, pixels);
+
+		/* Every other rectangle stored top to bottom */
+		if (i % 2) {
+			for (y = 0; y < height; y++)
+				memcpy(flipped + (height - 1 - y) * width,
+				       pixels + y * width, width * 4);
+			end = wcap_encoder_encode_rectangle(&encoder, out, &r,
+					flipped + (height - 1) * width,
+					-width);
+		} else {
+			end = wcap_encoder_encode_rectangle(&encoder, out, &r,
+							    pixels, width);
+		}
+
+		assert(end - out == ref_end - ref);
+		assert(memcmp(out, ref, (end - out) * 4) == 0);
+	}
+
+	assert(memcmp(frame, encoder.frame, WIDTH * HEIGHT * 4) == 0);
+
+	wcap_encoder_release(&encoder);
+	free(frame);
+	free(pixels);
+	free(flipped);
+	free(out);
+	free(ref);
+}
+
+#define SEEK_WIDTH 64
+#define SEEK_HEIGHT 48
+#define SEEK_FRAMES 100
+
+struct stream {
+	char filename[64];
+	uint32_t msecs[SEEK_FRAMES];
+	uint32_t *frames[SEEK_FRAMES];	/* the expected frame after each */
+	off_t frames_end;
+};
+
+/* Write a recording the way the recorder does, or as a version 1 file
+ * with no keyframes or index. */
+static void
+write_stream(struct stream *stream, int version)
+{
+	struct wcap_encoder encoder;
+	struct wcap_header header;
+	struct wcap_frame_header frame_header;
+	struct wcap_frame_header_v2 frame_header_v2;
+	struct wcap_rectangle r;
+	uint32_t pixels[SEEK_WIDTH * SEEK_HEIGHT], out[SEEK_WIDTH * SEEK_HEIGHT];
+	uint32_t *end, flags;
+	off_t offset;
+	int fd, i, x, y, width;
+
+	snprintf(stream->filename, sizeof stream->filename,
+		 "/tmp/weston-wcap-test-XXXXXX");
+	fd = mkstemp(stream->filename);
+	assert(fd >= 0);
+	assert(wcap_encoder_init(&encoder, SEEK_WIDTH, SEEK_HEIGHT) == 0);
+
+	header.magic = version == 2 ? WCAP_HEADER_MAGIC_V2 : WCAP_HEADER_MAGIC;
+	header.format = WCAP_FORMAT_XRGB8888;
+	header.width = SEEK_WIDTH;
+	header.height = SEEK_HEIGHT;
+	offset = write(fd, &header, sizeof header);
+	assert(offset == sizeof header);
+
+	srand(3);
+	for (i = 0; i < SEEK_FRAMES; i++) {
+		/* Irregular timestamps, with the odd pause or repeat */
+		if (i == 0)
+			stream->msecs[i] = 1000;
+		else
+			stream->msecs[i] = stream->msecs[i - 1] +
+				(i % 13 == 0 ? 0 : i % 9 == 0 ? 300 : 16);
+
+		flags = 0;
+		if (i == 0 || (version == 2 && i % 10 == 0)) {
+			flags = WCAP_FRAME_KEYFRAME;
+			wcap_encoder_reset(&encoder);
+			r.x1 = 0;
+			r.y1 = 0;
+			r.x2 = SEEK_WIDTH;
+			r.y2 = SEEK_HEIGHT;
+		} else {
+			r.x1 = rand() % SEEK_WIDTH;
+			r.y1 = rand() % SEEK_HEIGHT;
+			r.x2 = r.x1 + 1 + rand() % (SEEK_WIDTH - r.x1);
+			r.y2 = r.y1 + 1 + rand() % (SEEK_HEIGHT - r.y1);
+		}
+
+		/* Keyframes repeat the frame before them, except the first */
+		width = r.x2 - r.x1;
+		for (y = r.y1; y < r.y2; y++) {
+			for (x = r.x1; x < r.x2; x++) {
+				if (flags && i > 0)
+					pixels[(y - r.y1) * width + x - r.x1] =
+						stream->frames[i - 1][y * SEEK_WIDTH + x];
+				else
+					pixels[(y - r.y1) * width + x - r.x1] =
+						0xff000000 | (rand() & 0xffffff);
+			}
+		}
+
+		/* The encoder takes the bottom row first */
+		end = wcap_encoder_encode_rectangle(&encoder, out, &r,
+				pixels + (r.y2 - r.y1 - 1) * width, -width);
+
+		stream->frames[i] = malloc(sizeof pixels);
+		assert(stream->frames[i]);
+		for (y = 0; y < SEEK_WIDTH * SEEK_HEIGHT; y++)
+			stream->frames[i][y] = 0xff000000 | encoder.frame[y];
+
+		if (version == 2) {
+			frame_header_v2.msecs = stream->msecs[i];
+			frame_header_v2.nrects = 1;
+			frame_header_v2.flags = flags;
+			frame_header_v2.size = sizeof r + (end - out) * 4;
+			assert(wcap_encoder_add_frame(&encoder, offset,
+						      stream->msecs[i],
+						      flags) == 0);
+			offset += write(fd, &frame_header_v2,
+					sizeof frame_header_v2);
+		} else {
+			frame_header.msecs = stream->msecs[i];
+			frame_header.nrects = 1;
+			offset += write(fd, &frame_header, sizeof frame_header);
+		}
+		offset += write(fd, &r, sizeof r);
+		offset += write(fd, out, (end - out) * 4);
+	}
+
+	stream->frames_end = offset;
+	if (version == 2)
+		assert(wcap_encoder_write_index(&encoder, fd, offset) > 0);
+
+	close(fd);
+	wcap_encoder_release(&encoder);
+}
+
+static void
+release_stream(struct stream *stream)
+{
+	int i;
+
+	unlink(stream->filename);
+	for (i = 0; i < SEEK_FRAMES; i++)
+		free(stream->frames[i]);
+}
+
+/* Seek back and forth, and compare with the frames as they were
+ * encoded. */
+static void
+check_seeking(struct stream *stream)
+{
+	struct wcap_decoder *decoder;
+	uint32_t target;
+	int i, j;
+
+	decoder = wcap_decoder_create(stream->filename);
+	assert(decoder);
+	assert(decoder->width == SEEK_WIDTH);
+	assert(decoder->height == SEEK_HEIGHT);
+	assert(decoder->index_count == SEEK_FRAMES);
+
+	for (i = 0; i < SEEK_FRAMES; i++) {
+		assert(wcap_decoder_get_frame(decoder) == 1);
+		assert(decoder->msecs == stream->msecs[i]);
+		assert(memcmp(decoder->frame, stream->frames[i],
+			      SEEK_WIDTH * SEEK_HEIGHT * 4) == 0);
+	}
+	assert(wcap_decoder_get_frame(decoder) == 0);
+
+	for (i = 0; i < 500; i++) {
+		target = 900 + rand() % (stream->msecs[SEEK_FRAMES - 1] - 800);
+		for (j = 0; j < SEEK_FRAMES; j++)
+			if (stream->msecs[j] >= target)
+				break;
+
+		if (j == SEEK_FRAMES) {
+			assert(wcap_decoder_seek(decoder, target) == 0);
+			continue;
+		}
+
+		assert(wcap_decoder_seek(decoder, target) == 1);
+		assert(decoder->msecs == stream->msecs[j]);
+		assert(memcmp(decoder->frame, stream->frames[j],
+			      SEEK_WIDTH * SEEK_HEIGHT * 4) == 0);
+	}
+
+	wcap_decoder_destroy(decoder);
+}
+
+TEST(wcap_decode_seek)
+{
+	struct stream stream;
+
+	write_stream(&stream, 2);
+	check_seeking(&stream);
+
+	/* A recording that did not get to write its index */
+	assert(truncate(stream.filename, stream.frames_end + 10) == 0);
+	check_seeking(&stream);
+
+	release_stream(&stream);
+}
+
+TEST(wcap_decode_seek_version_1)
+{
+	struct stream stream;
+
+	write_stream(&stream, 1);
+	check_seeking(&stream);
+	release_stream(&stream);
+}
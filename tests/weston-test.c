@@ -34,6 +34,7 @@
 
 #include "compositor.h"
 #include "compositor/weston.h"
+#include "linux-dmabuf.h"
 #include "weston-test-server-protocol.h"
 
 #ifdef ENABLE_EGL
@@ -43,6 +44,7 @@
 #endif /* ENABLE_EGL */
 
 #include "shared/helpers.h"
+#include "shared/pixel-copy.h"
 
 struct weston_test {
 	struct weston_compositor *compositor;
@@ -268,70 +270,6 @@ struct test_screenshot_frame_listener {
 	void *data;
 };
 
-static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
-{
-	uint8_t *end;
-
-	end = dst + height * stride;
-	while (dst < end) {
-		memcpy(dst, src, stride);
-		dst += stride;
-		src -= stride;
-	}
-}
-
-
-static void
-copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
-{
-	/* TODO: optimize this out */
-	memcpy(dst, src, height * stride);
-}
-
-static void
-copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
-{
-	uint32_t *dst = vdst;
-	uint32_t *src = vsrc;
-	uint32_t *end = dst + bytes / 4;
-
-	while (dst < end) {
-		uint32_t v = *src++;
-		/*                    A R G B */
-		uint32_t tmp = v & 0xff00ff00;
-		tmp |= (v >> 16) & 0x000000ff;
-		tmp |= (v << 16) & 0x00ff0000;
-		*dst++ = tmp;
-	}
-}
-
-static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
-{
-	uint8_t *end;
-
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src -= stride;
-	}
-}
-
-static void
-copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
-{
-	uint8_t *end;
-
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src += stride;
-	}
-}
-
 static void
 test_screenshot_frame_notify(struct wl_listener *listener, void *data)
 {
@@ -341,12 +279,15 @@ test_screenshot_frame_notify(struct wl_listener *listener, void *data)
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
 	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	uint32_t flags;
+	bool supported;
+	uint8_t *pixels;
 
 	output->disable_planes--;
 	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
+	stride = output->current_mode->width *
+		 (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
+	pixels = malloc(stride * output->current_mode->height);
 
 	if (pixels == NULL) {
 		l->done(l->data, WESTON_TEST_SCREENSHOT_NO_MEMORY);
@@ -363,36 +304,34 @@ test_screenshot_frame_notify(struct wl_listener *listener, void *data)
 					  output->current_mode->width,
 					  output->current_mode->height);
 
-	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
-
-	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
-
-	wl_shm_buffer_begin_access(l->buffer->shm_buffer);
+	flags = 0;
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
+		flags |= PIXEL_COPY_YFLIP;
 
-	/* XXX: It would be nice if we used Pixman to do all this rather
-	 *  than our own implementation
-	 */
 	switch (compositor->read_format) {
 	case PIXMAN_a8r8g8b8:
 	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
+		supported = true;
 		break;
 	case PIXMAN_x8b8g8r8:
 	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
-		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
+		flags |= PIXEL_COPY_SWAP_RB;
+		supported = true;
 		break;
 	default:
+		supported = false;
 		break;
 	}
 
-	wl_shm_buffer_end_access(l->buffer->shm_buffer);
+	if (supported) {
+		wl_shm_buffer_begin_access(l->buffer->shm_buffer);
+		pixel_copy_rect32(wl_shm_buffer_get_data(l->buffer->shm_buffer),
+				  wl_shm_buffer_get_stride(l->buffer->shm_buffer),
+				  pixels, stride,
+				  output->current_mode->width,
+				  output->current_mode->height, flags);
+		wl_shm_buffer_end_access(l->buffer->shm_buffer);
+	}
 
 	l->done(l->data, WESTON_TEST_SCREENSHOT_SUCCESS);
 	free(pixels);
@@ -462,6 +401,22 @@ capture_screenshot_done(void *data, enum weston_test_screenshot_outcome outcome)
 	}
 }
 
+static void
+screenshooter_done(void *data, enum weston_screenshooter_outcome outcome)
+{
+	struct wl_resource *resource = data;
+
+	switch (outcome) {
+	case WESTON_SCREENSHOOTER_SUCCESS:
+		weston_test_send_capture_screenshot_done(resource);
+		break;
+	case WESTON_SCREENSHOOTER_NO_MEMORY:
+		wl_resource_post_no_memory(resource);
+		break;
+	default:
+		break;
+	}
+}
 
 /**
  * Grabs a snapshot of the screen.
@@ -482,6 +437,13 @@ capture_screenshot(struct wl_client *client,
 		return;
 	}
 
+	/* dmabufs go through the screenshooter, to test its capture path */
+	if (linux_dmabuf_buffer_get(buffer_resource)) {
+		weston_screenshooter_shoot(output, buffer,
+					   screenshooter_done, resource);
+		return;
+	}
+
 	weston_test_screenshot_shoot(output, buffer,
 				     capture_screenshot_done, resource);
 }
@@ -0,0 +1,277 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Converts a binary timeline log written by libweston (see
+ * libweston/timeline-format.h) into the JSON format read by wesgr.
+ *
+ * Usage: weston-timeline-json weston-timeline-*.wtl > timeline.json
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "timeline-format.h"
+
+/* tests/timeline-json-test.c builds this file with UNIT_TEST and calls
+ * timeline_convert() directly. */
+#ifdef UNIT_TEST
+#  define TIMELINE_JSON_TEST_EXPORT
+int
+timeline_convert(FILE *in, FILE *out);
+#else
+#  define TIMELINE_JSON_TEST_EXPORT static
+#endif
+
+struct string_table {
+	char **strings;
+	uint32_t count;
+};
+
+static void
+print_quoted(FILE *fp, const char *text, uint32_t length)
+{
+	uint32_t i;
+
+	fputc('"', fp);
+	for (i = 0; i < length; i++) {
+		if (text[i] == '"' || text[i] == '\\')
+			fputc('\\', fp);
+		fputc(text[i], fp);
+	}
+	fputc('"', fp);
+}
+
+static int
+add_string(struct string_table *table, uint32_t id,
+	   const char *text, uint32_t length)
+{
+	char **strings;
+	char *str;
+
+	if (id >= table->count) {
+		strings = realloc(table->strings,
+				  (id + 1) * sizeof table->strings[0]);
+		if (!strings)
+			return -1;
+		memset(strings + table->count, 0,
+		       (id + 1 - table->count) * sizeof strings[0]);
+		table->strings = strings;
+		table->count = id + 1;
+	}
+
+	str = strndup(text, length);
+	if (!str)
+		return -1;
+
+	free(table->strings[id]);
+	table->strings[id] = str;
+
+	return 0;
+}
+
+static void
+print_point(FILE *out, struct string_table *table,
+	    const struct timeline_record_point *p)
+{
+	const char *name = NULL;
+
+	if (p->name < table->count)
+		name = table->strings[p->name];
+
+	fprintf(out, "{ \"T\":[%" PRId64 ", %" PRId64 "], \"N\":",
+		p->sec, p->nsec);
+	print_quoted(out, name ? name : "", name ? strlen(name) : 0);
+
+	if (p->output)
+		fprintf(out, ", \"wo\":%u", p->output);
+	if (p->surface)
+		fprintf(out, ", \"ws\":%u", p->surface);
+	if (p->flags & TIMELINE_POINT_VBLANK)
+		fprintf(out, ", \"vblank\":[%" PRId64 ", %" PRId64 "]",
+			p->vblank_sec, p->vblank_nsec);
+	if (p->flags & TIMELINE_POINT_GPU)
+		fprintf(out, ", \"gpu\":[%" PRId64 ", %" PRId64 "]",
+			p->gpu_sec, p->gpu_nsec);
+
+	fprintf(out, " }\n");
+}
+
+/* Returns -1 if the record is malformed. */
+static int
+convert_record(FILE *out, struct string_table *table,
+	       const struct timeline_record_header *header)
+{
+	const struct timeline_record_string *str;
+	const struct timeline_record_output *output;
+	const struct timeline_record_surface *surface;
+	const struct timeline_record_dropped *dropped;
+
+	switch (header->type) {
+	case TIMELINE_RECORD_STRING:
+		str = (const void *)header;
+		if (header->size < sizeof *str + str->length)
+			return -1;
+		return add_string(table, str->id,
+				  (const char *)(str + 1), str->length);
+
+	case TIMELINE_RECORD_OUTPUT:
+		output = (const void *)header;
+		if (header->size < sizeof *output + output->length)
+			return -1;
+		fprintf(out, "{ \"id\":%u, \"type\":\"weston_output\", "
+			"\"name\":", output->id);
+		print_quoted(out, (const char *)(output + 1), output->length);
+		fprintf(out, " }\n");
+		return 0;
+
+	case TIMELINE_RECORD_SURFACE:
+		surface = (const void *)header;
+		if (header->size < sizeof *surface + surface->length)
+			return -1;
+		fprintf(out, "{ \"id\":%u, \"type\":\"weston_surface\", "
+			"\"desc\":", surface->id);
+		if (surface->length)
+			print_quoted(out, (const char *)(surface + 1),
+				     surface->length);
+		else
+			fprintf(out, "null");
+		if (surface->main_surface)
+			fprintf(out, ", \"main_surface\":%u",
+				surface->main_surface);
+		fprintf(out, " }\n");
+		return 0;
+
+	case TIMELINE_RECORD_POINT:
+		if (header->size < sizeof(struct timeline_record_point))
+			return -1;
+		print_point(out, table, (const void *)header);
+		return 0;
+
+	case TIMELINE_RECORD_DROPPED:
+		if (header->size < sizeof *dropped)
+			return -1;
+		dropped = (const void *)header;
+		fprintf(stderr, "warning: %u timeline points were dropped "
+			"while logging\n", dropped->count);
+		return 0;
+
+	default:
+		/* Unknown records are skipped, the size tells how far. */
+		return 0;
+	}
+}
+
+TIMELINE_JSON_TEST_EXPORT int
+timeline_convert(FILE *in, FILE *out)
+{
+	struct timeline_file_header file_header;
+	struct timeline_record_header header;
+	struct string_table table = { NULL, 0 };
+	uint64_t *record = NULL;
+	uint32_t capacity = 0;
+	uint32_t i;
+	int ret = -1;
+
+	if (fread(&file_header, sizeof file_header, 1, in) != 1 ||
+	    file_header.magic != TIMELINE_FILE_MAGIC) {
+		fprintf(stderr, "not a weston timeline log\n");
+		return -1;
+	}
+
+	if (file_header.version != TIMELINE_FILE_VERSION) {
+		fprintf(stderr, "unsupported timeline log version %u\n",
+			file_header.version);
+		return -1;
+	}
+
+	while (fread(&header, sizeof header, 1, in) == 1) {
+		if (header.size < sizeof header || header.size % 8 != 0) {
+			fprintf(stderr, "corrupt record in timeline log\n");
+			goto out;
+		}
+
+		if (header.size > capacity) {
+			free(record);
+			capacity = header.size;
+			record = malloc(capacity);
+			if (!record) {
+				fprintf(stderr, "out of memory\n");
+				goto out;
+			}
+		}
+
+		memcpy(record, &header, sizeof header);
+		if (fread((char *)record + sizeof header,
+			  header.size - sizeof header, 1, in) != 1) {
+			/* A log cut short when the compositor died. */
+			fprintf(stderr, "warning: truncated timeline log\n");
+			break;
+		}
+
+		if (convert_record(out, &table, (const void *)record) < 0) {
+			fprintf(stderr, "corrupt record in timeline log\n");
+			goto out;
+		}
+	}
+
+	ret = 0;
+
+out:
+	free(record);
+	for (i = 0; i < table.count; i++)
+		free(table.strings[i]);
+	free(table.strings);
+
+	return ret;
+}
+
+#ifndef UNIT_TEST
+int
+main(int argc, char *argv[])
+{
+	FILE *in;
+	int ret;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s weston-timeline-*.wtl\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	in = fopen(argv[1], "rb");
+	if (!in) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	ret = timeline_convert(in, stdout);
+	fclose(in);
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
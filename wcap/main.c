@@ -36,17 +36,20 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
 
+#define MAX_THREADS 64
+
 static void
-write_png(struct wcap_decoder *decoder, const char *filename)
+write_png(struct wcap_decoder *decoder, uint32_t *frame, const char *filename)
 {
 	cairo_surface_t *surface;
 
-	surface = cairo_image_surface_create_for_data((unsigned char *) decoder->frame,
+	surface = cairo_image_surface_create_for_data((unsigned char *) frame,
 						      CAIRO_FORMAT_ARGB32,
 						      decoder->width,
 						      decoder->height,
@@ -99,10 +102,11 @@ int clamp_uv(int u)
 }
 
 static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yv12(struct wcap_decoder *decoder, const uint32_t *frame,
+		unsigned char *out)
 {
 	unsigned char *y1, *y2, *u, *v;
-	uint32_t *p1, *p2, *end;
+	const uint32_t *p1, *p2, *end;
 	int i, u_accum, v_accum, stride0, stride1;
 	uint32_t format = decoder->format;
 
@@ -113,7 +117,7 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 		y2 = y1 + stride0;
 		v = out + stride0 * decoder->height + stride1 * i / 2;
 		u = v + stride1 * decoder->height / 2;
-		p1 = decoder->frame + decoder->width * i;
+		p1 = frame + decoder->width * i;
 		p2 = p1 + decoder->width;
 		end = p1 + decoder->width;
 
@@ -138,11 +142,12 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 }
 
 static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yuv444(struct wcap_decoder *decoder, const uint32_t *frame,
+		  unsigned char *out)
 {
 
 	unsigned char *yp, *up, *vp;
-	uint32_t *rp, *end;
+	const uint32_t *rp, *end;
 	int u, v;
 	int i, stride, psize;
 	uint32_t format = decoder->format;
@@ -153,7 +158,7 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 		yp = out + stride * i;
 		up = yp + (psize * 2);
 		vp = yp + (psize * 1);
-		rp = decoder->frame + decoder->width * i;
+		rp = frame + decoder->width * i;
 		end = rp + decoder->width;
 		while (rp < end) {
 			u = 0;
@@ -169,28 +174,221 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 	}
 }
 
+/* Frames are converted to yuv and png on a pool of threads while the
+ * main thread decodes the next ones. Each decoded frame is copied into a
+ * ring of jobs, which are written out in order as they complete. */
+struct job {
+	int frame;
+	int png;
+	int repeat;		/* the same picture as the job before */
+	int done;		/* protected by the pipeline mutex */
+	uint32_t *pixels;
+	unsigned char *yuv;
+};
+
+struct pipeline {
+	struct wcap_decoder *decoder;
+	int depth;		/* 420 or 444, 0 for no yuv4mpeg2 output */
+	size_t yuv_size;
+	unsigned char *last_yuv;	/* the last frame written */
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t threads[MAX_THREADS];
+	int thread_count;
+	struct job *jobs;
+	int job_count;
+	int head, next, tail;	/* next job to fill, to convert, to write */
+	int stop;
+};
+
 static void
-output_yuv_frame(struct wcap_decoder *decoder, int depth)
+process_job(struct pipeline *pipeline, struct job *job)
 {
-	static unsigned char *out;
-	int size;
+	struct wcap_decoder *decoder = pipeline->decoder;
+	char filename[200];
 
-	if (depth == 444) {
-		size = decoder->width * decoder->height * 3;
-	} else {
-		size = decoder->width * decoder->height * 3 / 2;
+	if (job->png) {
+		snprintf(filename, sizeof filename,
+			 "wcap-frame-%d.png", job->frame);
+		write_png(decoder, job->pixels, filename);
 	}
-	if (out == NULL)
-		out = malloc(size);
 
-	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
-	} else {
-		convert_to_yv12(decoder, out);
+	if (pipeline->depth == 444 && !job->repeat)
+		convert_to_yuv444(decoder, job->pixels, job->yuv);
+	else if (pipeline->depth && !job->repeat)
+		convert_to_yv12(decoder, job->pixels, job->yuv);
+}
+
+static void *
+pipeline_worker(void *data)
+{
+	struct pipeline *pipeline = data;
+	struct job *job;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	for (;;) {
+		while (pipeline->next == pipeline->head && !pipeline->stop)
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+		if (pipeline->next == pipeline->head)
+			break;
+
+		job = &pipeline->jobs[pipeline->next % pipeline->job_count];
+		pipeline->next++;
+
+		pthread_mutex_unlock(&pipeline->mutex);
+		process_job(pipeline, job);
+		pthread_mutex_lock(&pipeline->mutex);
+
+		job->done = 1;
+		pthread_cond_broadcast(&pipeline->cond);
 	}
+	pthread_mutex_unlock(&pipeline->mutex);
 
-	printf("FRAME\n");
-	fwrite(out, 1, size, stdout);
+	return NULL;
+}
+
+static int
+pipeline_init(struct pipeline *pipeline, struct wcap_decoder *decoder,
+	      int depth, int threads)
+{
+	size_t size = (size_t) decoder->width * decoder->height;
+	int i;
+
+	memset(pipeline, 0, sizeof *pipeline);
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+	pipeline->decoder = decoder;
+	pipeline->depth = depth;
+	if (depth == 444)
+		pipeline->yuv_size = size * 3;
+	else if (depth)
+		pipeline->yuv_size = size * 3 / 2;
+
+	/* With one thread, frames are converted as they are decoded */
+	pipeline->job_count = threads > 1 ? threads + 1 : 1;
+	pipeline->jobs = calloc(pipeline->job_count, sizeof pipeline->jobs[0]);
+	if (pipeline->jobs == NULL)
+		return -1;
+
+	for (i = 0; i < pipeline->job_count; i++) {
+		pipeline->jobs[i].pixels = malloc(size * 4);
+		if (pipeline->jobs[i].pixels == NULL)
+			return -1;
+		if (!depth)
+			continue;
+		pipeline->jobs[i].yuv = malloc(pipeline->yuv_size);
+		if (pipeline->jobs[i].yuv == NULL)
+			return -1;
+	}
+	if (depth) {
+		pipeline->last_yuv = malloc(pipeline->yuv_size);
+		if (pipeline->last_yuv == NULL)
+			return -1;
+	}
+
+	if (threads == 1)
+		return 0;
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&pipeline->threads[i], NULL,
+				   pipeline_worker, pipeline) != 0)
+			break;
+		pipeline->thread_count++;
+	}
+
+	return pipeline->thread_count > 0 ? 0 : -1;
+}
+
+static void
+pipeline_write_job(struct pipeline *pipeline)
+{
+	struct job *job = &pipeline->jobs[pipeline->tail % pipeline->job_count];
+	unsigned char *yuv;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	while (!job->done)
+		pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+	job->done = 0;
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	if (job->png)
+		fprintf(stderr, "wrote wcap-frame-%d.png\n", job->frame);
+
+	if (pipeline->depth) {
+		/* Keep the picture around for the jobs repeating it */
+		if (!job->repeat) {
+			yuv = pipeline->last_yuv;
+			pipeline->last_yuv = job->yuv;
+			job->yuv = yuv;
+		}
+		printf("FRAME\n");
+		fwrite(pipeline->last_yuv, 1, pipeline->yuv_size, stdout);
+	}
+
+	pipeline->tail++;
+}
+
+static void
+pipeline_queue(struct pipeline *pipeline, int frame, int png, int repeat)
+{
+	struct wcap_decoder *decoder = pipeline->decoder;
+	struct job *job;
+
+	if (pipeline->head - pipeline->tail == pipeline->job_count)
+		pipeline_write_job(pipeline);
+
+	job = &pipeline->jobs[pipeline->head % pipeline->job_count];
+	job->frame = frame;
+	job->png = png;
+	job->repeat = repeat;
+	if (png || (pipeline->depth && !repeat))
+		memcpy(job->pixels, decoder->frame,
+		       (size_t) decoder->width * decoder->height * 4);
+
+	if (pipeline->thread_count == 0) {
+		process_job(pipeline, job);
+		job->done = 1;
+		pipeline->head++;
+		return;
+	}
+
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->head++;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+}
+
+static void
+pipeline_finish(struct pipeline *pipeline)
+{
+	int i;
+
+	while (pipeline->tail != pipeline->head)
+		pipeline_write_job(pipeline);
+
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->stop = 1;
+	pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	for (i = 0; i < pipeline->thread_count; i++)
+		pthread_join(pipeline->threads[i], NULL);
+}
+
+static void
+pipeline_release(struct pipeline *pipeline)
+{
+	int i;
+
+	for (i = 0; pipeline->jobs && i < pipeline->job_count; i++) {
+		free(pipeline->jobs[i].pixels);
+		free(pipeline->jobs[i].yuv);
+	}
+	free(pipeline->jobs);
+	free(pipeline->last_yuv);
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->mutex);
 }
 
 static void
@@ -198,14 +396,19 @@ usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
 		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"\t[--frames=<first>-<last>] [--rate=<num:denom>] [--threads=<n>]\n"
+		"\t<wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
+		"\t--frames=<first>-<last>\twrite out a range of frames as pngs,\n"
+		"\t\t\t\tor limit the yuv4mpeg2 stream to them\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--threads=<n>\t\tnumber of threads converting frames,\n"
+		"\t\t\t\tone per cpu by default\n\n");
 
 	exit(exit_code);
 }
@@ -213,11 +416,12 @@ usage(int exit_code)
 int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
-	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
-	int num = 30, denom = 1;
-	char filename[200];
+	struct pipeline pipeline;
+	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0;
+	int range = 0, first = 0, last = -1, count;
+	int num = 30, denom = 1, threads = 0;
+	uint32_t start, frame_time, decoded;
 	char *mode;
-	uint32_t msecs, frame_time;
 
 	for (i = 1, j = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--yuv4mpeg2-444") == 0) {
@@ -230,6 +434,11 @@ int main(int argc, char *argv[])
 			all = 1;
 		} else if (sscanf(argv[i], "--frame=%d", &output_frame) == 1) {
 			;
+		} else if (sscanf(argv[i], "--frames=%d-%d",
+				  &first, &last) == 2) {
+			range = 1;
+		} else if (sscanf(argv[i], "--threads=%d", &threads) == 1) {
+			;
 		} else if (sscanf(argv[i], "--rate=%d", &num) == 1) {
 			;
 		} else if (sscanf(argv[i], "--rate=%d:%d", &num, &denom) == 2) {
@@ -252,6 +461,13 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "invalid rate, denom can not be 0\n");
 		exit(EXIT_FAILURE);
 	}
+	if (range && (first < 0 || first > last)) {
+		fprintf(stderr, "invalid frame range\n");
+		exit(EXIT_FAILURE);
+	}
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
 
 	decoder = wcap_decoder_create(argv[1]);
 	if (decoder == NULL) {
@@ -279,27 +495,45 @@ int main(int argc, char *argv[])
 		fflush(stdout);
 	}
 
-	i = 0;
-	has_frame = wcap_decoder_get_frame(decoder);
-	msecs = decoder->msecs;
+	/* A frame is written for every frame_time of the recording, showing
+	 * the first frame recorded at or after it. */
 	frame_time = 1000 * denom / num;
-	while (has_frame) {
-		if (all || i == output_frame) {
-			snprintf(filename, sizeof filename,
-				 "wcap-frame-%d.png", i);
-			write_png(decoder, filename);
-			fprintf(stderr, "wrote %s\n", filename);
-		}
-		if (yuv4mpeg2)
-			output_yuv_frame(decoder, yuv4mpeg2);
-		i++;
-		msecs += frame_time;
-		while (decoder->msecs < msecs && has_frame)
-			has_frame = wcap_decoder_get_frame(decoder);
+	if (frame_time == 0)
+		frame_time = 1;
+	start = 0;
+	count = 0;
+	if (decoder->index_count > 0) {
+		start = decoder->index[0].msecs;
+		count = (decoder->index[decoder->index_count - 1].msecs -
+			 start) / frame_time + 1;
 	}
 
+	if (range) {
+		all = 1;
+	} else if (all || yuv4mpeg2) {
+		last = count - 1;
+	} else if (output_frame >= 0) {
+		first = output_frame;
+		last = output_frame;
+	}
+
+	if (pipeline_init(&pipeline, decoder, yuv4mpeg2, threads) < 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = first; i <= last && i < count; i++) {
+		decoded = decoder->count;
+		wcap_decoder_seek(decoder, start + i * frame_time);
+		pipeline_queue(&pipeline, i, all || i == output_frame,
+			       i > first && decoder->count == decoded);
+	}
+
+	pipeline_finish(&pipeline);
+	pipeline_release(&pipeline);
+
 	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
-		decoder->width, decoder->height, i);
+		decoder->width, decoder->height, count);
 
 	wcap_decoder_destroy(decoder);
 
@@ -29,15 +29,12 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <sys/mman.h>
-#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
 
-#include <cairo.h>
-
 #include "wcap-decode.h"
 
 static void
@@ -85,37 +82,243 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 	decoder->p = p;
 }
 
+static int
+wcap_decoder_add_frame(struct wcap_decoder *decoder, uint32_t *size,
+		       const void *header, uint32_t msecs, uint32_t flags)
+{
+	struct wcap_index_entry *index, *entry;
+
+	if (decoder->index_count == *size) {
+		*size = *size ? *size * 2 : 256;
+		index = realloc(decoder->index, *size * sizeof *index);
+		if (index == NULL)
+			return -1;
+		decoder->index = index;
+	}
+
+	entry = &decoder->index[decoder->index_count++];
+	entry->offset = (const char *) header - (const char *) decoder->map;
+	entry->msecs = msecs;
+	entry->flags = flags;
+
+	return 0;
+}
+
+/* Check that the rectangles fit the frame and skip over their pixels
+ * without decoding them. Returns the end of the frame or NULL. */
+static uint32_t *
+wcap_decoder_skip_rectangles(struct wcap_decoder *decoder, uint32_t *p,
+			     uint32_t nrects)
+{
+	struct wcap_rectangle *rects = (void *) p;
+	uint32_t *end = decoder->end;
+	uint32_t i, v, l;
+	int64_t count, j;
+
+	if ((size_t) (end - p) / 4 < nrects)
+		return NULL;
+	p = (uint32_t *) (rects + nrects);
+
+	for (i = 0; i < nrects; i++) {
+		if (rects[i].x1 < 0 || rects[i].x1 > rects[i].x2 ||
+		    rects[i].x2 > decoder->width ||
+		    rects[i].y1 < 0 || rects[i].y1 > rects[i].y2 ||
+		    rects[i].y2 > decoder->height)
+			return NULL;
+
+		count = (int64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+		for (j = 0; j < count; j += l) {
+			if (p == end)
+				return NULL;
+			v = *p++;
+			l = v >> 24;
+			l = l < 0xe0 ? l + 1 : 1u << (l - 0xe0 + 7);
+		}
+	}
+
+	return p;
+}
+
+/* Version 1 files have no index, and frames can only be found by
+ * walking the run length encoding of all of them. */
+static int
+wcap_decoder_scan_v1(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header *header;
+	uint32_t *p = decoder->p, *end = decoder->end, size = 0;
+
+	while ((size_t) (end - p) >= sizeof *header / 4) {
+		header = (void *) p;
+		p = wcap_decoder_skip_rectangles(decoder, (uint32_t *) (header + 1),
+						 header->nrects);
+		if (p == NULL)
+			break;
+		if (wcap_decoder_add_frame(decoder, &size, header,
+					   header->msecs, 0) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* A version 2 file without an index, cut short by a crash or a full
+ * disk. The frame headers give the size of each frame, a partly written
+ * frame at the end is dropped. */
+static int
+wcap_decoder_scan_v2(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header_v2 *header;
+	uint32_t *p = decoder->p, *end = decoder->end, size = 0;
+
+	while ((size_t) (end - p) >= sizeof *header / 4) {
+		header = (void *) p;
+		if ((size_t) (end - p) - sizeof *header / 4 < header->size / 4 ||
+		    header->size % 4 != 0)
+			break;
+		p += sizeof *header / 4 + header->size / 4;
+		if (wcap_decoder_add_frame(decoder, &size, header,
+					   header->msecs, header->flags) < 0)
+			return -1;
+	}
+	decoder->end = p;
+
+	return 0;
+}
+
+static int
+wcap_decoder_read_index(struct wcap_decoder *decoder)
+{
+	struct wcap_index_trailer trailer;
+	struct wcap_frame_header_v2 *header;
+	uint64_t frames_end, index_end, index_size;
+	uint32_t i;
+
+	if (decoder->size < sizeof (struct wcap_header) + sizeof trailer)
+		return -1;
+
+	/* The file may have been cut anywhere, copy rather than risk an
+	 * unaligned read. */
+	index_end = decoder->size - sizeof trailer;
+	memcpy(&trailer, (char *) decoder->map + index_end, sizeof trailer);
+	index_size = (uint64_t) trailer.count * sizeof decoder->index[0];
+	if (trailer.magic != WCAP_INDEX_MAGIC || trailer.count == 0 ||
+	    index_size > index_end - sizeof (struct wcap_header))
+		return -1;
+
+	frames_end = index_end - index_size;
+	if (trailer.offset != frames_end || frames_end % 4 != 0)
+		return -1;
+
+	decoder->index = malloc(index_size);
+	if (decoder->index == NULL)
+		return -1;
+	memcpy(decoder->index, (char *) decoder->map + frames_end, index_size);
+	decoder->index_count = trailer.count;
+
+	for (i = 0; i < decoder->index_count; i++) {
+		header = (void *) ((char *) decoder->map +
+				   decoder->index[i].offset);
+		if (decoder->index[i].offset < sizeof (struct wcap_header) ||
+		    decoder->index[i].offset % 4 != 0 ||
+		    decoder->index[i].offset + sizeof *header > frames_end ||
+		    decoder->index[i].offset + sizeof *header +
+		    header->size > frames_end) {
+			free(decoder->index);
+			decoder->index = NULL;
+			decoder->index_count = 0;
+			return -1;
+		}
+	}
+
+	decoder->end = (char *) decoder->map + frames_end;
+
+	return 0;
+}
+
 int
 wcap_decoder_get_frame(struct wcap_decoder *decoder)
 {
-	struct wcap_rectangle *rects;
+	struct wcap_index_entry *entry;
 	struct wcap_frame_header *header;
-	uint32_t i;
+	struct wcap_frame_header_v2 *header_v2;
+	struct wcap_rectangle *rects;
+	uint32_t i, nrects;
+	void *p;
 
-	if (decoder->p == decoder->end)
+	if (decoder->count == decoder->index_count)
 		return 0;
 
-	header = decoder->p;
-	decoder->msecs = header->msecs;
-	decoder->count++;
+	entry = &decoder->index[decoder->count++];
+	p = (char *) decoder->map + entry->offset;
+	if (decoder->version == 2) {
+		header_v2 = p;
+		nrects = header_v2->nrects;
+		rects = (void *) (header_v2 + 1);
+	} else {
+		header = p;
+		nrects = header->nrects;
+		rects = (void *) (header + 1);
+	}
+
+	if (entry->flags & WCAP_FRAME_KEYFRAME)
+		memset(decoder->frame, 0,
+		       (size_t) decoder->width * decoder->height * 4);
 
-	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++)
+	decoder->msecs = entry->msecs;
+	decoder->p = (uint32_t *) (rects + nrects);
+	for (i = 0; i < nrects; i++)
 		wcap_decoder_decode_rectangle(decoder, &rects[i]);
 
 	return 1;
 }
 
+/** Decode the first frame at or after a time
+ *
+ * \param decoder The decoder.
+ * \param msecs The time, in the timestamps of the file.
+ * \return 1 if there is such a frame, 0 if the file ends before.
+ *
+ * Decoding starts over from the last keyframe before the frame, unless
+ * the decoder is already between the two.
+ */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	struct wcap_index_entry *index = decoder->index;
+	uint32_t first = 0, last = decoder->index_count, mid, key;
+
+	while (first < last) {
+		mid = first + (last - first) / 2;
+		if (index[mid].msecs < msecs)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	if (first == decoder->index_count)
+		return 0;
+
+	for (key = first; !(index[key].flags & WCAP_FRAME_KEYFRAME); key--)
+		;
+
+	if (decoder->count <= key || decoder->count > first + 1)
+		decoder->count = key;
+	while (decoder->count <= first)
+		wcap_decoder_get_frame(decoder);
+
+	return 1;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
 	struct wcap_decoder *decoder;
 	struct wcap_header *header;
-	int frame_size;
+	int frame_size, ret;
 	struct stat buf;
 
-	decoder = malloc(sizeof *decoder);
+	decoder = calloc(1, sizeof *decoder);
 	if (decoder == NULL)
 		return NULL;
 
@@ -127,6 +330,13 @@ wcap_decoder_create(const char *filename)
 
 	fstat(decoder->fd, &buf);
 	decoder->size = buf.st_size;
+	if (decoder->size < sizeof *header) {
+		fprintf(stderr, "not a wcap file\n");
+		close(decoder->fd);
+		free(decoder);
+		return NULL;
+	}
+
 	decoder->map = mmap(NULL, decoder->size,
 			    PROT_READ, MAP_PRIVATE, decoder->fd, 0);
 	if (decoder->map == MAP_FAILED) {
@@ -137,23 +347,51 @@ wcap_decoder_create(const char *filename)
 	}
 
 	header = decoder->map;
+	switch (header->magic) {
+	case WCAP_HEADER_MAGIC:
+		decoder->version = 1;
+		break;
+	case WCAP_HEADER_MAGIC_V2:
+		decoder->version = 2;
+		break;
+	default:
+		fprintf(stderr, "not a wcap file\n");
+		goto err;
+	}
+
 	decoder->format = header->format;
 	decoder->count = 0;
 	decoder->width = header->width;
 	decoder->height = header->height;
 	decoder->p = header + 1;
-	decoder->end = decoder->map + decoder->size;
+	decoder->end = (char *) decoder->map + decoder->size;
+
+	if (decoder->version == 1)
+		ret = wcap_decoder_scan_v1(decoder);
+	else if (wcap_decoder_read_index(decoder) < 0)
+		ret = wcap_decoder_scan_v2(decoder);
+	else
+		ret = 0;
+	if (ret < 0)
+		goto err;
+
+	/* The first frame is always decoded against a blank frame */
+	if (decoder->index_count > 0)
+		decoder->index[0].flags |= WCAP_FRAME_KEYFRAME;
 
 	frame_size = header->width * header->height * 4;
-	decoder->frame = malloc(frame_size);
-	if (decoder->frame == NULL) {
-		close(decoder->fd);
-		free(decoder);
-		return NULL;
-	}
-	memset(decoder->frame, 0, frame_size);
+	decoder->frame = calloc(1, frame_size);
+	if (decoder->frame == NULL)
+		goto err;
 
 	return decoder;
+
+err:
+	free(decoder->index);
+	munmap(decoder->map, decoder->size);
+	close(decoder->fd);
+	free(decoder);
+	return NULL;
 }
 
 void
@@ -161,6 +399,7 @@ wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
 	munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	free(decoder->index);
 	free(decoder->frame);
 	free(decoder);
 }
@@ -29,6 +29,8 @@
 #include <stdint.h>
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
+#define WCAP_INDEX_MAGIC	0x57434958
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -46,10 +48,32 @@ struct wcap_frame_header {
 	uint32_t nrects;
 };
 
+/* The frame is encoded against all 0x00000000 pixels */
+#define WCAP_FRAME_KEYFRAME	(1 << 0)
+
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+	uint32_t size;
+};
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+struct wcap_index_entry {
+	uint64_t offset;
+	uint32_t msecs;
+	uint32_t flags;
+};
+
+struct wcap_index_trailer {
+	uint64_t offset;
+	uint32_t count;
+	uint32_t magic;
+};
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
@@ -59,9 +83,16 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+	int version;
+
+	/* Every frame of the file, read from the index of a version 2 file
+	 * or gathered when opening it otherwise. */
+	struct wcap_index_entry *index;
+	uint32_t index_count;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
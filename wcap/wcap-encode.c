@@ -0,0 +1,287 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "wcap-encode.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define WCAP_ENCODE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Only the color channels are encoded, the deltas have no alpha. */
+#define DELTA_MASK 0x00ffffff
+
+struct run_state {
+	uint32_t *p;
+	uint32_t prev;
+	int run;
+};
+
+static uint32_t *
+output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((uint32_t)(run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((uint32_t)(i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static uint32_t
+component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+static inline void
+add_delta(struct run_state *rs, uint32_t delta)
+{
+	if (rs->run == 0 || delta == rs->prev) {
+		rs->run++;
+	} else {
+		rs->p = output_run(rs->p, rs->prev, rs->run);
+		rs->run = 1;
+	}
+	rs->prev = delta;
+}
+
+/* Encode one row, updating the saved frame. Groups of four pixels are
+ * handled with vector instructions: the deltas of all channels are one
+ * byte-wise subtraction, and groups continuing the current run, the
+ * common case of unchanged or flat areas, only extend the run. */
+static void
+encode_row(struct run_state *rs, uint32_t *d, const uint32_t *s, int width)
+{
+	int k = 0;
+
+#if defined(__SSE2__)
+	const __m128i mask = _mm_set1_epi32(DELTA_MASK);
+	uint32_t deltas[4];
+	__m128i next, delta;
+	int i;
+
+	for (; k + 4 <= width; k += 4) {
+		next = _mm_loadu_si128((const __m128i *)(s + k));
+		delta = _mm_sub_epi8(next,
+				     _mm_loadu_si128((const __m128i *)(d + k)));
+		delta = _mm_and_si128(delta, mask);
+		_mm_storeu_si128((__m128i *)(d + k), next);
+
+		if (rs->run > 0 &&
+		    _mm_movemask_epi8(_mm_cmpeq_epi32(delta,
+				_mm_set1_epi32(rs->prev))) == 0xffff) {
+			rs->run += 4;
+			continue;
+		}
+
+		_mm_storeu_si128((__m128i *)deltas, delta);
+		for (i = 0; i < 4; i++)
+			add_delta(rs, deltas[i]);
+	}
+#elif defined(WCAP_ENCODE_NEON)
+	const uint32x4_t mask = vdupq_n_u32(DELTA_MASK);
+	uint32_t deltas[4];
+	uint32x4_t next, delta, same;
+	uint32x2_t all;
+	int i;
+
+	for (; k + 4 <= width; k += 4) {
+		next = vld1q_u32(s + k);
+		delta = vreinterpretq_u32_u8(
+				vsubq_u8(vreinterpretq_u8_u32(next),
+					 vreinterpretq_u8_u32(vld1q_u32(d + k))));
+		delta = vandq_u32(delta, mask);
+		vst1q_u32(d + k, next);
+
+		if (rs->run > 0) {
+			same = vceqq_u32(delta, vdupq_n_u32(rs->prev));
+			all = vand_u32(vget_low_u32(same), vget_high_u32(same));
+			if (vget_lane_u32(vpmin_u32(all, all), 0)) {
+				rs->run += 4;
+				continue;
+			}
+		}
+
+		vst1q_u32(deltas, delta);
+		for (i = 0; i < 4; i++)
+			add_delta(rs, deltas[i]);
+	}
+#endif
+
+	for (; k < width; k++) {
+		add_delta(rs, component_delta(s[k], d[k]));
+		d[k] = s[k];
+	}
+}
+
+int
+wcap_encoder_init(struct wcap_encoder *encoder, int width, int height)
+{
+	encoder->frame = calloc((size_t)width * height, sizeof *encoder->frame);
+	if (!encoder->frame)
+		return -1;
+
+	encoder->index = NULL;
+	encoder->index_count = 0;
+	encoder->index_size = 0;
+
+	encoder->width = width;
+	encoder->height = height;
+
+	return 0;
+}
+
+void
+wcap_encoder_release(struct wcap_encoder *encoder)
+{
+	free(encoder->frame);
+	encoder->frame = NULL;
+	free(encoder->index);
+	encoder->index = NULL;
+	encoder->index_count = 0;
+	encoder->index_size = 0;
+}
+
+/** Encode the next frame against a blank one, making it a keyframe */
+void
+wcap_encoder_reset(struct wcap_encoder *encoder)
+{
+	memset(encoder->frame, 0,
+	       (size_t) encoder->width * encoder->height * sizeof *encoder->frame);
+}
+
+/** Record a frame written to the file in the index
+ *
+ * \param encoder The encoder.
+ * \param offset The offset of the frame header in the file.
+ * \param msecs The timestamp of the frame.
+ * \param flags WCAP_FRAME_KEYFRAME if the frame was encoded right after
+ * wcap_encoder_reset().
+ * \return 0 on success, -1 if out of memory.
+ */
+int
+wcap_encoder_add_frame(struct wcap_encoder *encoder, uint64_t offset,
+		       uint32_t msecs, uint32_t flags)
+{
+	struct wcap_index_entry *index;
+	uint32_t size;
+
+	if (encoder->index_count == encoder->index_size) {
+		size = encoder->index_size ? encoder->index_size * 2 : 256;
+		index = realloc(encoder->index, size * sizeof *index);
+		if (!index)
+			return -1;
+		encoder->index = index;
+		encoder->index_size = size;
+	}
+
+	index = &encoder->index[encoder->index_count++];
+	index->offset = offset;
+	index->msecs = msecs;
+	index->flags = flags;
+
+	return 0;
+}
+
+/** Write the index and its trailer at the end of a version 2 file
+ *
+ * \param encoder The encoder.
+ * \param fd The file, positioned after the last frame.
+ * \param offset The current size of the file.
+ * \return The number of bytes written, or -1 on error.
+ */
+ssize_t
+wcap_encoder_write_index(struct wcap_encoder *encoder, int fd,
+			 uint64_t offset)
+{
+	struct wcap_index_trailer trailer;
+	struct iovec v[2];
+
+	trailer.offset = offset;
+	trailer.count = encoder->index_count;
+	trailer.magic = WCAP_INDEX_MAGIC;
+
+	v[0].iov_base = encoder->index;
+	v[0].iov_len = encoder->index_count * sizeof encoder->index[0];
+	v[1].iov_base = &trailer;
+	v[1].iov_len = sizeof trailer;
+
+	return writev(fd, v, 2);
+}
+
+/** Encode a rectangle of a new frame
+ *
+ * \param encoder The encoder, its saved frame is updated.
+ * \param out Where to write the encoded rectangle. The encoding is at
+ * most one word per pixel.
+ * \param rect The rectangle, in frame coordinates.
+ * \param pixels The bottom row of the rectangle.
+ * \param stride The distance from a row to the one above it, in pixels.
+ * Negative if the rows are stored top to bottom.
+ * \return The end of the encoded data.
+ *
+ * The rows are encoded from the bottom up, and runs continue from one row
+ * to the next, as wcap_decoder_get_frame() expects.
+ */
+uint32_t *
+wcap_encoder_encode_rectangle(struct wcap_encoder *encoder, uint32_t *out,
+			      const struct wcap_rectangle *rect,
+			      const uint32_t *pixels, int stride)
+{
+	struct run_state rs = { out, 0, 0 };
+	int width = rect->x2 - rect->x1;
+	int y;
+
+	for (y = rect->y2 - 1; y >= rect->y1; y--) {
+		encode_row(&rs, encoder->frame + y * encoder->width + rect->x1,
+			   pixels, width);
+		pixels += stride;
+	}
+
+	return output_run(rs.p, rs.prev, rs.run);
+}
@@ -0,0 +1,67 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_ENCODE_
+#define _WCAP_ENCODE_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "wcap-decode.h"
+
+/** Delta and run length encoder of wcap rectangles
+ *
+ * Keeps the last frame written, which every rectangle is encoded as the
+ * difference against, and the index of the frames written so far.
+ */
+struct wcap_encoder {
+	uint32_t *frame;
+	int width, height;
+
+	struct wcap_index_entry *index;
+	uint32_t index_count, index_size;
+};
+
+int
+wcap_encoder_init(struct wcap_encoder *encoder, int width, int height);
+
+void
+wcap_encoder_release(struct wcap_encoder *encoder);
+
+uint32_t *
+wcap_encoder_encode_rectangle(struct wcap_encoder *encoder, uint32_t *out,
+			      const struct wcap_rectangle *rect,
+			      const uint32_t *pixels, int stride);
+
+void
+wcap_encoder_reset(struct wcap_encoder *encoder);
+
+int
+wcap_encoder_add_frame(struct wcap_encoder *encoder, uint64_t offset,
+		       uint32_t msecs, uint32_t flags);
+
+ssize_t
+wcap_encoder_write_index(struct wcap_encoder *encoder, int fd,
+			 uint64_t offset);
+
+#endif